@@ -0,0 +1,271 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    bvconvert.cxx
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+// Converts .raw and .vti volumes to the bricked, memory mappable .bvol
+// format (see Common/BrickedVolume.h).
+//
+//   bvconvert input.raw output.bvol -dims X Y Z [-type uint8|uint16|int16|float32]
+//             [-components N] [-spacing X Y Z] [-origin X Y Z] [-brick B]
+//             [-codec none|bc4]
+//   bvconvert input.vti output.bvol [-brick B] [-codec none|bc4]
+//
+// Raw input is read one slice at a time, so volumes larger than memory can
+// be converted. -codec bc4 stores single component bricks compressed (see
+// Common/BrickCodec.h); the compression ratio, the PSNR of the decoded
+// voxels and the decode throughput are reported.
+
+#include <vtkDataArray.h>
+#include <vtkImageData.h>
+#include <vtkPointData.h>
+#include <vtkSmartPointer.h>
+#include <vtkXMLImageDataReader.h>
+#include <vtksys/SystemTools.hxx>
+
+#include "BrickedVolume.h"
+#include "FrameProfiler.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+//----------------------------------------------------------------------------
+int ScalarTypeFromName(const std::string& name)
+{
+  if (name == "uint8")
+    {
+    return SCALAR_UINT8;
+    }
+  if (name == "uint16")
+    {
+    return SCALAR_UINT16;
+    }
+  if (name == "int16")
+    {
+    return SCALAR_INT16;
+    }
+  if (name == "float32")
+    {
+    return SCALAR_FLOAT32;
+    }
+  return -1;
+}
+
+//----------------------------------------------------------------------------
+int ScalarTypeFromVTK(int vtkType)
+{
+  switch (vtkType)
+    {
+    case VTK_UNSIGNED_CHAR:
+      return SCALAR_UINT8;
+    case VTK_UNSIGNED_SHORT:
+      return SCALAR_UINT16;
+    case VTK_SHORT:
+      return SCALAR_INT16;
+    case VTK_FLOAT:
+      return SCALAR_FLOAT32;
+    default:
+      return -1;
+    }
+}
+
+//----------------------------------------------------------------------------
+void Usage()
+{
+  std::cerr << "Usage: bvconvert input.raw output.bvol -dims X Y Z "
+            << "[-type uint8|uint16|int16|float32] [-components N] "
+            << "[-spacing X Y Z] [-origin X Y Z] [-brick B] "
+            << "[-codec none|bc4]" << std::endl
+            << "       bvconvert input.vti output.bvol [-brick B] "
+            << "[-codec none|bc4]" << std::endl;
+}
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 3)
+    {
+    Usage();
+    return EXIT_FAILURE;
+    }
+
+  std::string input = argv[1];
+  std::string output = argv[2];
+
+  BrickedVolumeInfo info;
+  memset(&info, 0, sizeof(info));
+  info.spacing[0] = info.spacing[1] = info.spacing[2] = 1.0;
+  info.scalarType = SCALAR_UINT8;
+  info.components = 1;
+  info.brickSize = 64;
+
+  for (int i = 3; i < argc; ++i)
+    {
+    std::string arg = argv[i];
+    if (arg == "-dims" && i + 3 < argc)
+      {
+      for (int j = 0; j < 3; ++j)
+        {
+        info.dims[j] = atoi(argv[++i]);
+        }
+      }
+    else if (arg == "-spacing" && i + 3 < argc)
+      {
+      for (int j = 0; j < 3; ++j)
+        {
+        info.spacing[j] = atof(argv[++i]);
+        }
+      }
+    else if (arg == "-origin" && i + 3 < argc)
+      {
+      for (int j = 0; j < 3; ++j)
+        {
+        info.origin[j] = atof(argv[++i]);
+        }
+      }
+    else if (arg == "-type" && i + 1 < argc)
+      {
+      info.scalarType = ScalarTypeFromName(argv[++i]);
+      }
+    else if (arg == "-components" && i + 1 < argc)
+      {
+      info.components = atoi(argv[++i]);
+      }
+    else if (arg == "-brick" && i + 1 < argc)
+      {
+      info.brickSize = atoi(argv[++i]);
+      }
+    else if (arg == "-codec" && i + 1 < argc)
+      {
+      std::string codec = argv[++i];
+      if (codec != "none" && codec != "bc4")
+        {
+        Usage();
+        return EXIT_FAILURE;
+        }
+      info.codec = codec == "bc4" ? BRICK_CODEC_BC4 : BRICK_CODEC_NONE;
+      }
+    else
+      {
+      Usage();
+      return EXIT_FAILURE;
+      }
+    }
+
+  std::string ext = vtksys::SystemTools::GetFilenameLastExtension(input);
+  BrickedVolume::WriteStatistics statistics;
+  bool ok = false;
+  if (ext == ".vti")
+    {
+    vtkSmartPointer<vtkXMLImageDataReader> reader =
+      vtkSmartPointer<vtkXMLImageDataReader>::New();
+    reader->SetFileName(input.c_str());
+    reader->Update();
+
+    vtkImageData *image = reader->GetOutput();
+    vtkDataArray *scalars = image->GetPointData()->GetScalars();
+    if (!scalars || ScalarTypeFromVTK(scalars->GetDataType()) < 0)
+      {
+      std::cerr << "Unsupported or missing point scalars in " << input
+                << std::endl;
+      return EXIT_FAILURE;
+      }
+
+    image->GetDimensions(info.dims);
+    image->GetSpacing(info.spacing);
+    image->GetOrigin(info.origin);
+    info.scalarType = ScalarTypeFromVTK(scalars->GetDataType());
+    info.components = scalars->GetNumberOfComponents();
+
+    const unsigned char *data =
+      static_cast<const unsigned char *>(scalars->GetVoidPointer(0));
+    size_t sliceBytes = size_t(info.dims[0]) * info.dims[1] *
+      ScalarTypeSize(info.scalarType) * info.components;
+    ok = BrickedVolume::Write(output, info,
+      [&](int z, void *slice)
+        {
+        memcpy(slice, data + size_t(z) * sliceBytes, sliceBytes);
+        return true;
+        }, &statistics);
+    }
+  else
+    {
+    if (info.scalarType < 0 || info.dims[0] < 1 || info.dims[1] < 1 ||
+        info.dims[2] < 1)
+      {
+      Usage();
+      return EXIT_FAILURE;
+      }
+
+    std::ifstream in(input.c_str(), std::ios_base::binary);
+    if (!in.good())
+      {
+      std::cerr << "Cannot open " << input << std::endl;
+      return EXIT_FAILURE;
+      }
+
+    size_t sliceBytes = size_t(info.dims[0]) * info.dims[1] *
+      ScalarTypeSize(info.scalarType) * info.components;
+    ok = BrickedVolume::Write(output, info,
+      [&](int z, void *slice)
+        {
+        in.seekg(static_cast<std::streamoff>(z) * sliceBytes);
+        in.read(static_cast<char *>(slice), sliceBytes);
+        return in.good();
+        }, &statistics);
+    }
+
+  if (!ok)
+    {
+    return EXIT_FAILURE;
+    }
+
+  BrickedVolume volume;
+  if (volume.Open(output))
+    {
+    double range[2];
+    volume.GetScalarRange(range);
+    const int *grid = volume.GetBrickGridDimensions();
+    std::cout << output << ": " << info.dims[0] << "x" << info.dims[1] << "x"
+              << info.dims[2] << ", " << grid[0] << "x" << grid[1] << "x"
+              << grid[2] << " bricks of " << info.brickSize
+              << ", range [" << range[0] << ", " << range[1] << "]"
+              << std::endl;
+
+    if (volume.IsCompressed())
+      {
+      // Decode every brick once for the throughput
+      std::vector<unsigned char> decoded(volume.GetDecodedBrickBytes());
+      double start = FrameProfiler::Now();
+      for (int i = 0; i < volume.GetNumberOfBricks(); ++i)
+        {
+        volume.DecodeBrick(i, &decoded[0]);
+        }
+      double seconds = FrameProfiler::Now() - start;
+      double decodedMB = volume.GetNumberOfBricks() *
+        double(volume.GetDecodedBrickBytes()) / (1024.0 * 1024.0);
+      std::cout << "bc4: " << statistics.storedBytes / (1024.0 * 1024.0)
+                << " MB of " << statistics.rawBytes / (1024.0 * 1024.0)
+                << " MB bricks (" << statistics.GetCompressionRatio()
+                << ":1), PSNR " << statistics.GetPSNR() << " dB, decoded at "
+                << (seconds > 0.0 ? decodedMB / seconds : 0.0) << " MB/s"
+                << std::endl;
+      }
+    }
+  return EXIT_SUCCESS;
+}
@@ -29,7 +29,6 @@
 #include "vtkVolumeProperty.h"
 #include "vtkCamera.h"
 #include "vtkRegressionTestImage.h"
-#include "vtkImageShiftScale.h"
 #include "vtkImageData.h"
 #include "vtkPointData.h"
 #include "vtkDataArray.h"
@@ -46,7 +45,7 @@ int main(int argc, char *argv[])
   vtkSampleFunction *source=vtkSampleFunction::New();
   source->SetImplicitFunction(shape);
   shape->Delete();
-  source->SetOutputScalarTypeToDouble();
+  source->SetOutputScalarTypeToFloat(); // rendered as is, no 8-bit copy
   source->SetSampleDimensions(127,127,127); // intentional NPOT dimensions.
   source->SetModelBounds(-1.0,1.0,-1.0,1.0,-1.0,1.0);
   source->SetCapping(false);
@@ -55,23 +54,17 @@ int main(int argc, char *argv[])
 
   source->Update();
 
+  // the transfer functions below are laid out over 0..255, map them onto
+  // the scalar range instead of converting the scalars
   vtkDataArray *a=source->GetOutput()->GetPointData()->GetScalars("values");
   double range[2];
   a->GetRange(range);
-
-  vtkImageShiftScale *t=vtkImageShiftScale::New();
-  t->SetInputConnection(source->GetOutputPort());
-  source->Delete();
-  t->SetShift(-range[0]);
   double magnitude=range[1]-range[0];
   if(magnitude==0.0)
     {
     magnitude=1.0;
     }
-  t->SetScale(255.0/magnitude);
-  t->SetOutputScalarTypeToUnsignedChar();
-
-  t->Update();
+  const double s=magnitude/255.0;
 
   vtkRenderWindow *renWin=vtkRenderWindow::New();
   vtkRenderer *ren1=vtkRenderer::New();
@@ -94,29 +87,30 @@ int main(int argc, char *argv[])
   volumeMapper=vtkGPUVolumeRayCastMapper::New();
   volumeMapper->SetBlendModeToComposite(); // composite first
   volumeMapper->SetInputConnection(
-    t->GetOutputPort());
+    source->GetOutputPort());
+  source->Delete();
 
   volumeProperty=vtkVolumeProperty::New();
   volumeProperty->ShadeOff();
   volumeProperty->SetInterpolationType(VTK_LINEAR_INTERPOLATION);
 
   vtkPiecewiseFunction *additiveOpacity = vtkPiecewiseFunction::New();
-  additiveOpacity->AddPoint(0.0,0.0);
-  additiveOpacity->AddPoint(200.0,0.5);
-  additiveOpacity->AddPoint(200.1,1.0);
-  additiveOpacity->AddPoint(255.0,1.0);
+  additiveOpacity->AddPoint(range[0]+0.0*s,0.0);
+  additiveOpacity->AddPoint(range[0]+200.0*s,0.5);
+  additiveOpacity->AddPoint(range[0]+200.1*s,1.0);
+  additiveOpacity->AddPoint(range[0]+255.0*s,1.0);
 
   vtkPiecewiseFunction *compositeOpacity = vtkPiecewiseFunction::New();
-  compositeOpacity->AddPoint(0.0,0.0);
-  compositeOpacity->AddPoint(80.0,1.0);
-  compositeOpacity->AddPoint(80.1,0.0);
-  compositeOpacity->AddPoint(255.0,0.0);
+  compositeOpacity->AddPoint(range[0]+0.0*s,0.0);
+  compositeOpacity->AddPoint(range[0]+80.0*s,1.0);
+  compositeOpacity->AddPoint(range[0]+80.1*s,0.0);
+  compositeOpacity->AddPoint(range[0]+255.0*s,0.0);
   volumeProperty->SetScalarOpacity(compositeOpacity); // composite first.
 
   vtkColorTransferFunction *color=vtkColorTransferFunction::New();
-  color->AddRGBPoint(0.0  ,0.0,0.0,1.0);
-  color->AddRGBPoint(40.0  ,1.0,0.0,0.0);
-  color->AddRGBPoint(255.0,1.0,1.0,1.0);
+  color->AddRGBPoint(range[0]+0.0*s  ,0.0,0.0,1.0);
+  color->AddRGBPoint(range[0]+40.0*s  ,1.0,0.0,0.0);
+  color->AddRGBPoint(range[0]+255.0*s,1.0,1.0,1.0);
   volumeProperty->SetColor(color);
   color->Delete();
 
@@ -146,7 +140,6 @@ int main(int argc, char *argv[])
   volumeProperty->Delete();
   volume->Delete();
   iren->Delete();
-  t->Delete();
   additiveOpacity->Delete();
   compositeOpacity->Delete();
 
@@ -0,0 +1,987 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    volbatch.cxx
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+// Headless batch renderer for offline jobs: turntables, keyframed camera
+// paths and sweeps over transfer functions or time steps of datasets that
+// are loaded once. No window or OpenGL context is created; the images are
+// ray cast by the CPU ray caster and written by a background thread while
+// the next ones render.
+//
+//   volbatch -data head.vti[,step2.vti,...] [-jobs jobs.txt] [-turntable N]
+//            [-output frame%04d.png] [-size WxH] [-blend composite]
+//            [-sample D] [-shade] [-background r,g,b] [-engines N]
+//            [-threads N] [-json results.json] [-csv results.csv]
+//
+// A job file holds one job per line of key=value pairs, # starts a comment:
+//
+//   output=side.png size=1024x768 azimuth=90 elevation=20 roll=0 zoom=1.5
+//   blend=composite sample=0.5 shade=1 step=0
+//   opacity=0:0,80:0,120:0.6,255:1 color=0:0:0:0,255:1:0.9:0.8
+//
+// Angles are in degrees and applied to the camera vtkRenderer::ResetCamera
+// puts in front of the dataset, in the order azimuth, elevation, roll. step
+// picks one of the -data datasets. Transfer function points are given in
+// scalar values, opacities per unit distance; without them the opacity and
+// grey ramps of volvis over the scalar range are used. Keys a job leaves out
+// take the command line defaults, a missing output name follows -output
+// with the job number. Without -jobs, -turntable N orbits the camera once
+// in N jobs.
+//
+// Jobs are scheduled over a pool of -engines ray casters, each of them with
+// -threads threads (by default the cores are shared out evenly). Several
+// engines keep the cores busy during the serial parts of a frame, which
+// pays off for small images; every engine keeps its own acceleration
+// structures of the datasets. Throughput is reported in images per second
+// from the first job to the last image on disk.
+
+#include <vtkCamera.h>
+#include <vtkDataArray.h>
+#include <vtkImageData.h>
+#include <vtkImageWriter.h>
+#include <vtkJPEGWriter.h>
+#include <vtkMatrix4x4.h>
+#include <vtkNew.h>
+#include <vtkPNGWriter.h>
+#include <vtkPNMWriter.h>
+#include <vtkPointData.h>
+#include <vtkRenderer.h>
+#include <vtkRTAnalyticSource.h>
+#include <vtkSmartPointer.h>
+#include <vtkStructuredPointsReader.h>
+#include <vtkVersion.h>
+#include <vtkXMLImageDataReader.h>
+#include <vtksys/SystemTools.hxx>
+
+#include "BenchmarkReport.h"
+#include "BrickedVolume.h"
+#include "CPURaycaster.h"
+#include "FrameProfiler.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+const int TransferFunctionSize = 256;
+
+struct Options
+{
+  std::vector<std::string> Datasets;
+  std::string JobFile;
+  int Turntable;
+  std::string Output;
+  int Size[2];
+  std::string BlendMode;
+  float SampleDistance;
+  bool Shade;
+  double Background[3];
+  int Engines;
+  int Threads;
+  std::string JSONFile;
+  std::string CSVFile;
+};
+
+// One dataset, loaded once and shared read-only by all engines
+struct Dataset
+{
+  std::string Name;
+  vtkSmartPointer<vtkImageData> Image;
+  BrickedVolume Bricks;
+  const void *Scalars;
+  int ScalarType;
+  int Components;
+  int Dims[3];
+  double Spacing[3];
+  double Bounds[6];
+  double ScalarRange[2];  // of the scalar the transfer function classifies
+  double TableRange[2];   // the values the table entries span
+  vtkNew<vtkMatrix4x4> TextureToWorld;
+};
+
+struct Job
+{
+  std::string Output;
+  int Size[2];
+  int Step;
+  int BlendMode;
+  float SampleDistance;
+  bool Shade;
+  Mat4 TextureToClip;
+  std::vector<float> TransferFunction;
+};
+
+//----------------------------------------------------------------------------
+std::vector<std::string> Split(const std::string& list, char separator)
+{
+  std::vector<std::string> items;
+  vtksys::SystemTools::Split(list, items, separator);
+  return items;
+}
+
+//----------------------------------------------------------------------------
+void Usage()
+{
+  std::cerr << "Usage: volbatch -data wavelet:N|file.vti|file.vtk|file.bvol,..."
+            << " [-jobs file] [-turntable N] [-output pattern] [-size WxH]"
+            << " [-blend composite|mip|minip|average|additive] [-sample D]"
+            << " [-shade]"
+            << " [-background r,g,b] [-engines N] [-threads N]"
+            << " [-json file] [-csv file]" << std::endl;
+}
+
+//----------------------------------------------------------------------------
+int ParseBlendMode(const std::string& mode)
+{
+  if (mode == "composite")
+    {
+    return BLEND_COMPOSITE;
+    }
+  if (mode == "mip")
+    {
+    return BLEND_MAXIMUM;
+    }
+  if (mode == "minip")
+    {
+    return BLEND_MINIMUM;
+    }
+  if (mode == "average")
+    {
+    return BLEND_AVERAGE;
+    }
+  if (mode == "additive")
+    {
+    return BLEND_ADDITIVE;
+    }
+  return -1;
+}
+
+//----------------------------------------------------------------------------
+bool ParseSize(const std::string& text, int size[2])
+{
+  std::vector<std::string> items = Split(text, 'x');
+  if (items.size() == 1)
+    {
+    items.push_back(items[0]);
+    }
+  if (items.size() != 2)
+    {
+    return false;
+    }
+  size[0] = atoi(items[0].c_str());
+  size[1] = atoi(items[1].c_str());
+  return size[0] > 0 && size[1] > 0;
+}
+
+//----------------------------------------------------------------------------
+// Loads the dataset the way volbench does; bricked volumes stay memory
+// mapped. Only scalars the ray caster samples in place, or the bricks of
+// compressed volumes it decodes, are accepted.
+bool LoadDataset(Dataset& dataset)
+{
+  const std::string& name = dataset.Name;
+  std::string ext = vtksys::SystemTools::GetFilenameLastExtension(name);
+  int extent[6] = { 0, 0, 0, 0, 0, 0 };
+  double origin[3];
+  if (ext == ".bvol")
+    {
+    if (!dataset.Bricks.Open(name))
+      {
+      return false;
+      }
+    const BrickedVolumeInfo& info = dataset.Bricks.GetInfo();
+    if (info.components != 1 ||
+        (info.scalarType != SCALAR_UINT8 && !dataset.Bricks.IsCompressed()))
+      {
+      return false;
+      }
+    dataset.Scalars = NULL;
+    dataset.ScalarType = info.scalarType;
+    dataset.Components = 1;
+    for (int i = 0; i < 3; ++i)
+      {
+      dataset.Dims[i] = info.dims[i];
+      dataset.Spacing[i] = info.spacing[i];
+      origin[i] = info.origin[i];
+      extent[2 * i + 1] = info.dims[i] - 1;
+      }
+    dataset.Bricks.GetScalarRange(dataset.ScalarRange);
+    }
+  else
+    {
+    if (name.compare(0, 8, "wavelet:") == 0)
+      {
+      int half = atoi(name.c_str() + 8) / 2;
+      vtkNew<vtkRTAnalyticSource> source;
+      source->SetWholeExtent(-half, half - 1, -half, half - 1, -half, half - 1);
+      source->Update();
+      dataset.Image = source->GetOutput();
+      }
+    else if (ext == ".vti")
+      {
+      vtkNew<vtkXMLImageDataReader> reader;
+      reader->SetFileName(name.c_str());
+      reader->Update();
+      dataset.Image = reader->GetOutput();
+      }
+    else if (ext == ".vtk")
+      {
+      vtkNew<vtkStructuredPointsReader> reader;
+      reader->SetFileName(name.c_str());
+      reader->Update();
+      dataset.Image = reader->GetOutput();
+      }
+    vtkImageData *image = dataset.Image;
+    vtkDataArray *scalars =
+      image ? image->GetPointData()->GetScalars() : NULL;
+    if (!scalars)
+      {
+      return false;
+      }
+    switch (scalars->GetDataType())
+      {
+      case VTK_UNSIGNED_CHAR: dataset.ScalarType = SCALAR_UINT8; break;
+      case VTK_UNSIGNED_SHORT: dataset.ScalarType = SCALAR_UINT16; break;
+      case VTK_SHORT: dataset.ScalarType = SCALAR_INT16; break;
+      case VTK_FLOAT: dataset.ScalarType = SCALAR_FLOAT32; break;
+      default: return false;
+      }
+    dataset.Components = scalars->GetNumberOfComponents();
+    if (dataset.Components < 1 || dataset.Components > 4)
+      {
+      return false;
+      }
+    dataset.Scalars = scalars->GetVoidPointer(0);
+    image->GetDimensions(dataset.Dims);
+    image->GetSpacing(dataset.Spacing);
+    image->GetOrigin(origin);
+    image->GetExtent(extent);
+    scalars->GetRange(dataset.ScalarRange, dataset.Components - 1);
+    }
+  if (dataset.Dims[0] < 2 || dataset.Dims[1] < 2 || dataset.Dims[2] < 2)
+    {
+    return false;
+    }
+
+  // Like the mapper's, the table of 8-bit scalars spans 0..255
+  dataset.TableRange[0] = 0.0;
+  dataset.TableRange[1] = 255.0;
+  if (dataset.ScalarType != SCALAR_UINT8)
+    {
+    dataset.TableRange[0] = dataset.ScalarRange[0];
+    dataset.TableRange[1] = dataset.ScalarRange[1];
+    }
+
+  // Texture space covers the voxels plus half a voxel of border
+  for (int i = 0; i < 3; ++i)
+    {
+    dataset.Bounds[2 * i] = origin[i] + dataset.Spacing[i] * extent[2 * i];
+    dataset.Bounds[2 * i + 1] =
+      origin[i] + dataset.Spacing[i] * extent[2 * i + 1];
+    dataset.TextureToWorld->SetElement(i, i,
+      dataset.Spacing[i] * dataset.Dims[i]);
+    dataset.TextureToWorld->SetElement(i, 3,
+      origin[i] + dataset.Spacing[i] * (extent[2 * i] - 0.5));
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Piecewise linear function through "value:y0[:y1...]" points, given as a
+// comma separated list; 'values' outputs per point. Returns false on
+// malformed points.
+bool ParsePoints(const std::string& text, int values,
+                 std::vector<std::vector<double> >& points)
+{
+  std::vector<std::string> items = Split(text, ',');
+  for (size_t i = 0; i < items.size(); ++i)
+    {
+    std::vector<std::string> fields = Split(items[i], ':');
+    if (static_cast<int>(fields.size()) != values + 1)
+      {
+      return false;
+      }
+    std::vector<double> point;
+    for (size_t k = 0; k < fields.size(); ++k)
+      {
+      point.push_back(atof(fields[k].c_str()));
+      }
+    points.push_back(point);
+    }
+  std::sort(points.begin(), points.end());
+  return !points.empty();
+}
+
+//----------------------------------------------------------------------------
+double Evaluate(const std::vector<std::vector<double> >& points, double x,
+                int output)
+{
+  if (x <= points.front()[0])
+    {
+    return points.front()[output + 1];
+    }
+  for (size_t i = 1; i < points.size(); ++i)
+    {
+    if (x <= points[i][0])
+      {
+      const std::vector<double>& a = points[i - 1];
+      const std::vector<double>& b = points[i];
+      double t = b[0] > a[0] ? (x - a[0]) / (b[0] - a[0]) : 1.0;
+      return a[output + 1] + t * (b[output + 1] - a[output + 1]);
+      }
+    }
+  return points.back()[output + 1];
+}
+
+//----------------------------------------------------------------------------
+// Samples the opacity and colour points over the table range of the
+// dataset, with the opacity corrected for the step length as by the mapper.
+// Empty point lists give the grey and opacity ramps over the scalar range.
+void BuildTransferFunction(const Dataset& dataset, float sampleDistance,
+                           std::vector<std::vector<double> > opacity,
+                           std::vector<std::vector<double> > color,
+                           std::vector<float>& table)
+{
+  const double *range = dataset.ScalarRange;
+  if (opacity.empty())
+    {
+    double lo[2] = { range[0], 0.0 }, hi[2] = { range[1], 1.0 };
+    opacity.push_back(std::vector<double>(lo, lo + 2));
+    opacity.push_back(std::vector<double>(hi, hi + 2));
+    }
+  if (color.empty())
+    {
+    double lo[4] = { range[0], 0.0, 0.0, 0.0 };
+    double hi[4] = { range[1], 1.0, 1.0, 1.0 };
+    color.push_back(std::vector<double>(lo, lo + 4));
+    color.push_back(std::vector<double>(hi, hi + 4));
+    }
+
+  const double *spacing = dataset.Spacing;
+  double exponent =
+    sampleDistance * (spacing[0] + spacing[1] + spacing[2]) / 3.0;
+  const double *tableRange = dataset.TableRange;
+  const int n = TransferFunctionSize;
+  table.resize(4 * n);
+  for (int i = 0; i < n; ++i)
+    {
+    double value =
+      tableRange[0] + (tableRange[1] - tableRange[0]) * i / (n - 1.0);
+    for (int c = 0; c < 3; ++c)
+      {
+      table[4 * i + c] = static_cast<float>(
+        std::min(1.0, std::max(0.0, Evaluate(color, value, c))));
+      }
+    double alpha = std::min(1.0, std::max(0.0, Evaluate(opacity, value, 0)));
+    table[4 * i + 3] = static_cast<float>(1.0 - pow(1.0 - alpha, exponent));
+    }
+}
+
+//----------------------------------------------------------------------------
+// The camera vtkRenderer::ResetCamera puts in front of the dataset, moved
+// as the job says, as texture to clip matrix of an image of the job's size
+Mat4 ComputeTextureToClip(const Dataset& dataset, const int size[2],
+                          double azimuth, double elevation, double roll,
+                          double zoom)
+{
+  vtkNew<vtkRenderer> ren;
+  ren->ResetCamera(const_cast<double *>(dataset.Bounds));
+  vtkCamera *camera = ren->GetActiveCamera();
+  camera->Azimuth(azimuth);
+  camera->Elevation(elevation);
+  camera->OrthogonalizeViewUp();
+  camera->Roll(roll);
+  if (zoom > 0.0)
+    {
+    camera->Zoom(zoom);
+    }
+
+  vtkNew<vtkMatrix4x4> textureToClip;
+  vtkMatrix4x4::Multiply4x4(
+    camera->GetCompositeProjectionTransformMatrix(
+      static_cast<double>(size[0]) / size[1], -1, 1),
+    dataset.TextureToWorld.GetPointer(), textureToClip.GetPointer());
+  return Mat4::FromRowMajor(&textureToClip->Element[0][0]);
+}
+
+//----------------------------------------------------------------------------
+std::string OutputName(const std::string& pattern, int job)
+{
+  std::vector<char> name(pattern.size() + 64);
+  snprintf(&name[0], name.size(), pattern.c_str(), job);
+  return std::string(&name[0]);
+}
+
+//----------------------------------------------------------------------------
+bool IsWritable(const std::string& filename)
+{
+  std::string ext = vtksys::SystemTools::LowerCase(
+    vtksys::SystemTools::GetFilenameLastExtension(filename));
+  return ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".ppm" ||
+    ext == ".pnm";
+}
+
+//----------------------------------------------------------------------------
+// Turns one line of a job file into a job; the error names what is wrong
+bool ParseJob(const std::string& line, const Options& options,
+              const std::vector<Dataset *>& datasets, int number, Job& job,
+              std::string& error)
+{
+  job.Output = OutputName(options.Output, number);
+  job.Size[0] = options.Size[0];
+  job.Size[1] = options.Size[1];
+  job.Step = 0;
+  job.BlendMode = ParseBlendMode(options.BlendMode);
+  job.SampleDistance = options.SampleDistance;
+  job.Shade = options.Shade;
+  double azimuth = 0.0, elevation = 0.0, roll = 0.0, zoom = 1.0;
+  std::vector<std::vector<double> > opacity, color;
+
+  std::istringstream tokens(line);
+  std::string token;
+  while (tokens >> token)
+    {
+    size_t equals = token.find('=');
+    if (equals == std::string::npos)
+      {
+      error = "expected key=value: " + token;
+      return false;
+      }
+    std::string key = token.substr(0, equals);
+    std::string value = token.substr(equals + 1);
+    bool valid = true;
+    if (key == "output")
+      {
+      job.Output = value;
+      }
+    else if (key == "size")
+      {
+      valid = ParseSize(value, job.Size);
+      }
+    else if (key == "azimuth")
+      {
+      azimuth = atof(value.c_str());
+      }
+    else if (key == "elevation")
+      {
+      elevation = atof(value.c_str());
+      }
+    else if (key == "roll")
+      {
+      roll = atof(value.c_str());
+      }
+    else if (key == "zoom")
+      {
+      zoom = atof(value.c_str());
+      valid = zoom > 0.0;
+      }
+    else if (key == "step")
+      {
+      job.Step = atoi(value.c_str());
+      valid = job.Step >= 0 && job.Step < static_cast<int>(datasets.size());
+      }
+    else if (key == "blend")
+      {
+      job.BlendMode = ParseBlendMode(value);
+      valid = job.BlendMode >= 0;
+      }
+    else if (key == "sample")
+      {
+      job.SampleDistance = static_cast<float>(atof(value.c_str()));
+      valid = job.SampleDistance >= 0.01f && job.SampleDistance <= 100.0f;
+      }
+    else if (key == "shade")
+      {
+      job.Shade = atoi(value.c_str()) != 0;
+      }
+    else if (key == "opacity")
+      {
+      valid = ParsePoints(value, 1, opacity);
+      }
+    else if (key == "color")
+      {
+      valid = ParsePoints(value, 3, color);
+      }
+    else
+      {
+      error = "unknown key " + key;
+      return false;
+      }
+    if (!valid)
+      {
+      error = "invalid " + key + ": " + value;
+      return false;
+      }
+    }
+  if (!IsWritable(job.Output))
+    {
+    error = "output is not .png, .jpg or .ppm: " + job.Output;
+    return false;
+    }
+
+  const Dataset& dataset = *datasets[job.Step];
+  job.TextureToClip =
+    ComputeTextureToClip(dataset, job.Size, azimuth, elevation, roll, zoom);
+  BuildTransferFunction(dataset, job.SampleDistance, opacity, color,
+                        job.TransferFunction);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Writes images on a thread of its own, so rendering goes on while they are
+// encoded and stored. At most 'capacity' images wait; Push() blocks beyond
+// that, which bounds the memory when the disk is the bottleneck.
+class AsyncImageWriter
+{
+public:
+  AsyncImageWriter(size_t capacity)
+    : Capacity(std::max(capacity, static_cast<size_t>(1))), Done(false),
+      Failures(0)
+    {
+    this->Thread = std::thread(&AsyncImageWriter::WriteLoop, this);
+    }
+
+  ~AsyncImageWriter()
+    {
+    this->Finish();
+    }
+
+  // Takes over the RGB pixels, bottom row first
+  void Push(const std::string& filename, const int size[2],
+            std::vector<unsigned char>& rgb)
+    {
+    std::unique_lock<std::mutex> lock(this->Lock);
+    this->NotFull.wait(lock,
+      [this] { return this->Queue.size() < this->Capacity; });
+    this->Queue.push_back(Item());
+    this->Queue.back().Filename = filename;
+    this->Queue.back().Size[0] = size[0];
+    this->Queue.back().Size[1] = size[1];
+    this->Queue.back().Pixels.swap(rgb);
+    this->NotEmpty.notify_one();
+    }
+
+  // Waits until every pushed image is written
+  void Finish()
+    {
+    {
+    std::lock_guard<std::mutex> lock(this->Lock);
+    this->Done = true;
+    }
+    this->NotEmpty.notify_one();
+    if (this->Thread.joinable())
+      {
+      this->Thread.join();
+      }
+    }
+
+  int GetFailures() { return this->Failures; }
+
+private:
+  struct Item
+  {
+    std::string Filename;
+    int Size[2];
+    std::vector<unsigned char> Pixels;
+  };
+
+  void WriteLoop()
+    {
+    for (;;)
+      {
+      Item item;
+      {
+      std::unique_lock<std::mutex> lock(this->Lock);
+      this->NotEmpty.wait(lock,
+        [this] { return !this->Queue.empty() || this->Done; });
+      if (this->Queue.empty())
+        {
+        return;
+        }
+      std::swap(item, this->Queue.front());
+      this->Queue.pop_front();
+      }
+      this->NotFull.notify_one();
+      if (!this->Write(item))
+        {
+        std::cerr << "Cannot write " << item.Filename << std::endl;
+        this->Failures++;
+        }
+      }
+    }
+
+  bool Write(Item& item)
+    {
+    vtkNew<vtkImageData> image;
+    image->SetDimensions(item.Size[0], item.Size[1], 1);
+    image->AllocateScalars(VTK_UNSIGNED_CHAR, 3);
+    std::copy(item.Pixels.begin(), item.Pixels.end(),
+              static_cast<unsigned char *>(image->GetScalarPointer()));
+
+    std::string ext = vtksys::SystemTools::LowerCase(
+      vtksys::SystemTools::GetFilenameLastExtension(item.Filename));
+    vtkSmartPointer<vtkImageWriter> writer;
+    if (ext == ".png")
+      {
+      writer = vtkSmartPointer<vtkPNGWriter>::New();
+      }
+    else if (ext == ".jpg" || ext == ".jpeg")
+      {
+      writer = vtkSmartPointer<vtkJPEGWriter>::New();
+      }
+    else
+      {
+      writer = vtkSmartPointer<vtkPNMWriter>::New();
+      }
+    writer->SetInputData(image.GetPointer());
+    writer->SetFileName(item.Filename.c_str());
+    writer->Write();
+    return writer->GetErrorCode() == 0;
+    }
+
+  size_t Capacity;
+  std::deque<Item> Queue;
+  std::mutex Lock;
+  std::condition_variable NotEmpty;
+  std::condition_variable NotFull;
+  std::thread Thread;
+  bool Done;
+  int Failures;
+};
+
+//----------------------------------------------------------------------------
+// A ray caster and the dataset it currently renders
+struct Engine
+{
+  CPURaycaster Raycaster;
+  int Step;
+  double RenderTime;
+};
+
+//----------------------------------------------------------------------------
+void RenderJob(const Job& job, const std::vector<Dataset *>& datasets,
+               const double background[3], Engine& engine,
+               AsyncImageWriter& writer)
+{
+  CPURaycaster& raycaster = engine.Raycaster;
+  if (job.Step != engine.Step)
+    {
+    Dataset& dataset = *datasets[job.Step];
+    if (dataset.Bricks.IsOpen())
+      {
+      raycaster.SetVolume(&dataset.Bricks);
+      raycaster.SetScalarRange(dataset.TableRange[0], dataset.TableRange[1]);
+      }
+    else
+      {
+      raycaster.SetVolume(dataset.Scalars, dataset.ScalarType,
+                          dataset.Components, dataset.Dims[0],
+                          dataset.Dims[1], dataset.Dims[2]);
+      if (dataset.ScalarType != SCALAR_UINT8)
+        {
+        raycaster.SetScalarRange(dataset.ScalarRange[0],
+                                 dataset.ScalarRange[1]);
+        }
+      }
+    engine.Step = job.Step;
+    }
+
+  // Only what the job changes is rebuilt: the ray caster compares the
+  // transfer function with the one of its previous job
+  double start = FrameProfiler::Now();
+  raycaster.SetTransferFunction(&job.TransferFunction[0],
+                                TransferFunctionSize);
+  raycaster.SetBlendMode(job.BlendMode);
+  raycaster.SetSampleDistance(job.SampleDistance);
+  raycaster.SetShading(job.Shade);
+  raycaster.Render(job.TextureToClip, job.Size[0], job.Size[1]);
+
+  // Premultiplied colour over the background
+  const size_t pixels = static_cast<size_t>(job.Size[0]) * job.Size[1];
+  const float *image = raycaster.GetImage();
+  std::vector<unsigned char> rgb(3 * pixels);
+  for (size_t i = 0; i < pixels; ++i)
+    {
+    const float *src = image + 4 * i;
+    for (int c = 0; c < 3; ++c)
+      {
+      double v = src[c] + (1.0 - src[3]) * background[c];
+      rgb[3 * i + c] = static_cast<unsigned char>(
+        std::min(1.0, std::max(0.0, v)) * 255.0 + 0.5);
+      }
+    }
+  engine.RenderTime += FrameProfiler::Now() - start;
+  writer.Push(job.Output, job.Size, rgb);
+}
+}
+
+int main(int argc, char *argv[])
+{
+  Options options;
+  options.Turntable = 0;
+  options.Output = "volbatch%04d.png";
+  options.Size[0] = options.Size[1] = 512;
+  options.BlendMode = "composite";
+  options.SampleDistance = 1.0f;
+  options.Shade = false;
+  options.Background[0] = options.Background[1] = options.Background[2] = 0.0;
+  options.Engines = 0;
+  options.Threads = 0;
+
+  for (int i = 1; i < argc; ++i)
+    {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "-data" && hasValue)
+      {
+      options.Datasets = Split(argv[++i], ',');
+      }
+    else if (arg == "-jobs" && hasValue)
+      {
+      options.JobFile = argv[++i];
+      }
+    else if (arg == "-turntable" && hasValue)
+      {
+      options.Turntable = atoi(argv[++i]);
+      }
+    else if (arg == "-output" && hasValue)
+      {
+      options.Output = argv[++i];
+      }
+    else if (arg == "-size" && hasValue)
+      {
+      if (!ParseSize(argv[++i], options.Size))
+        {
+        Usage();
+        return EXIT_FAILURE;
+        }
+      }
+    else if (arg == "-blend" && hasValue)
+      {
+      options.BlendMode = argv[++i];
+      }
+    else if (arg == "-sample" && hasValue)
+      {
+      options.SampleDistance = static_cast<float>(atof(argv[++i]));
+      }
+    else if (arg == "-shade")
+      {
+      options.Shade = true;
+      }
+    else if (arg == "-background" && hasValue)
+      {
+      std::vector<std::string> rgb = Split(argv[++i], ',');
+      for (size_t c = 0; c < 3 && c < rgb.size(); ++c)
+        {
+        options.Background[c] = atof(rgb[c].c_str());
+        }
+      }
+    else if (arg == "-engines" && hasValue)
+      {
+      options.Engines = atoi(argv[++i]);
+      }
+    else if (arg == "-threads" && hasValue)
+      {
+      options.Threads = atoi(argv[++i]);
+      }
+    else if (arg == "-json" && hasValue)
+      {
+      options.JSONFile = argv[++i];
+      }
+    else if (arg == "-csv" && hasValue)
+      {
+      options.CSVFile = argv[++i];
+      }
+    else
+      {
+      Usage();
+      return EXIT_FAILURE;
+      }
+    }
+  if (options.Datasets.empty() || ParseBlendMode(options.BlendMode) < 0 ||
+      (options.JobFile.empty() && options.Turntable < 1))
+    {
+    Usage();
+    return EXIT_FAILURE;
+    }
+
+  // Every dataset is loaded once, before any job runs
+  double start = FrameProfiler::Now();
+  std::vector<Dataset *> datasets;
+  for (size_t d = 0; d < options.Datasets.size(); ++d)
+    {
+    datasets.push_back(new Dataset);
+    datasets.back()->Name = options.Datasets[d];
+    if (!LoadDataset(*datasets.back()))
+      {
+      std::cerr << "Cannot load " << options.Datasets[d] << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+  double loadTime = FrameProfiler::Now() - start;
+
+  std::vector<Job> jobs;
+  std::string error;
+  if (!options.JobFile.empty())
+    {
+    std::ifstream file(options.JobFile.c_str());
+    if (!file)
+      {
+      std::cerr << "Cannot read " << options.JobFile << std::endl;
+      return EXIT_FAILURE;
+      }
+    std::string line;
+    for (int number = 1; std::getline(file, line); ++number)
+      {
+      line = line.substr(0, line.find('#'));
+      if (line.find_first_not_of(" \t\r") == std::string::npos)
+        {
+        continue;
+        }
+      jobs.push_back(Job());
+      if (!ParseJob(line, options, datasets, static_cast<int>(jobs.size()) - 1,
+                    jobs.back(), error))
+        {
+        std::cerr << options.JobFile << ":" << number << ": " << error
+                  << std::endl;
+        return EXIT_FAILURE;
+        }
+      }
+    }
+  else
+    {
+    for (int i = 0; i < options.Turntable; ++i)
+      {
+      std::ostringstream line;
+      line << "azimuth=" << 360.0 * i / options.Turntable;
+      jobs.push_back(Job());
+      if (!ParseJob(line.str(), options, datasets, i, jobs.back(), error))
+        {
+        std::cerr << error << std::endl;
+        return EXIT_FAILURE;
+        }
+      }
+    }
+
+  if (jobs.empty())
+    {
+    std::cerr << "No jobs in " << options.JobFile << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // The cores are shared out among the engines; by default one engine per
+  // eight cores, and at least two so that one renders while the other
+  // finishes a frame
+  int cores = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  int engines = options.Engines > 0 ? options.Engines :
+    std::max(2, cores / 8);
+  engines = std::min(engines, static_cast<int>(jobs.size()));
+  int threads = options.Threads > 0 ? options.Threads :
+    std::max(1, cores / engines);
+
+  std::vector<Engine *> pool;
+  for (int e = 0; e < engines; ++e)
+    {
+    pool.push_back(new Engine);
+    pool.back()->Raycaster.SetThreadCount(threads);
+    pool.back()->Step = -1;
+    pool.back()->RenderTime = 0.0;
+    }
+
+  // Engines take jobs as they finish their previous one; the writer holds
+  // a couple of images per engine
+  start = FrameProfiler::Now();
+  {
+  AsyncImageWriter writer(2 * engines);
+  ThreadPool scheduler(engines);
+  scheduler.ParallelFor(static_cast<int>(jobs.size()),
+    [&](int job, int worker)
+      {
+      RenderJob(jobs[job], datasets, options.Background, *pool[worker],
+                writer);
+      });
+  writer.Finish();
+  if (writer.GetFailures() > 0)
+    {
+    error = "images failed to write";
+    }
+  }
+  double seconds = FrameProfiler::Now() - start;
+
+  double renderTime = 0.0;
+  for (int e = 0; e < engines; ++e)
+    {
+    renderTime += pool[e]->RenderTime;
+    delete pool[e];
+    }
+  for (size_t d = 0; d < datasets.size(); ++d)
+    {
+    delete datasets[d];
+    }
+
+  double imagesPerSecond = jobs.size() / std::max(seconds, 1e-9);
+  std::cout << jobs.size() << " images in " << seconds << " s: "
+            << imagesPerSecond << " images/s, " << engines << " engines of "
+            << threads << " threads, "
+            << renderTime * 1000.0 / jobs.size() << " ms per image rendering, "
+            << loadTime << " s loading" << std::endl;
+
+  BenchmarkReport report;
+  report.SetEnvironment("vtk_version", vtkVersion::GetVTKVersion());
+  report.SetEnvironment("cpu_packet_width",
+    std::to_string(CPURaycaster::GetMaximumPacketWidth()));
+  report.SetEnvironment("timestamp",
+    vtksys::SystemTools::GetCurrentDateTime("%Y-%m-%dT%H:%M:%S"));
+  BenchmarkReport::Run& run = report.AddRun();
+  std::string data = options.Datasets[0];
+  for (size_t d = 1; d < options.Datasets.size(); ++d)
+    {
+    data += "," + options.Datasets[d];
+    }
+  run.SetParameter("data", data);
+  run.SetParameter("jobs", static_cast<double>(jobs.size()));
+  run.SetParameter("engines", engines);
+  run.SetParameter("threads", threads);
+  run.SetMetric("load_s", loadTime);
+  run.SetMetric("total_s", seconds);
+  run.SetMetric("images_per_second", imagesPerSecond);
+  run.SetMetric("render_ms", renderTime * 1000.0 / jobs.size());
+  run.error = error;
+
+  bool ok = error.empty();
+  if (!options.JSONFile.empty())
+    {
+    ok = report.WriteJSON(options.JSONFile) && ok;
+    }
+  if (!options.CSVFile.empty())
+    {
+    ok = report.WriteCSV(options.CSVFile) && ok;
+    }
+  if (!error.empty())
+    {
+    std::cerr << error << std::endl;
+    }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,765 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    volbench.cxx
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+// Headless volume rendering benchmark. Every combination of the given
+// datasets, mappers, blend modes, image sizes and sample distances is
+// rendered offscreen for a fixed number of frames while the camera orbits
+// the volume; per-frame latencies are written as JSON and/or CSV (see
+// Common/BenchmarkReport.h) so runs can be compared across builds.
+//
+//   volbench [-data wavelet:128,head.vti,...] [-mapper cp,gp,sp,fp]
+//            [-blend composite,mip,minip,average,additive] [-size 256,512]
+//            [-sample 1,2] [-frames 100] [-warmup 10] [-processes 1,2,4]
+//            [-json results.json] [-csv results.csv] [-onscreen] [-profile]
+//            [-skipdominated]
+//
+// With -profile the CPU mapper also reports the average time of each render
+// stage and its ray/sample counters per frame (see Common/FrameProfiler.h).
+// With -skipdominated its maximum and minimum projections skip the macro
+// cells that cannot beat a ray's extreme (see CPURaycaster).
+//
+// With -processes the CPU ray caster runs sort-last for every given process
+// count instead: the volume is split into one piece per process, the
+// processes are forked on this machine and share its cores, and the images
+// are composited over shared memory (see Common/ImageCompositor.h). Frame
+// times are those of rank 0 up to the composited image; the slowest and
+// fastest piece and the compositing time, which includes waiting for the
+// slowest piece, show how rendering scales.
+
+#include <vtkCamera.h>
+#include <vtkColorTransferFunction.h>
+#include <vtkDataArray.h>
+#include <vtkFixedPointVolumeRayCastMapper.h>
+#include <vtkGPUVolumeRayCastMapper.h>
+#include <vtkImageData.h>
+#include <vtkMatrix4x4.h>
+#include <vtkNew.h>
+#include <vtkPiecewiseFunction.h>
+#include <vtkPointData.h>
+#include <vtkRenderWindow.h>
+#include <vtkRenderer.h>
+#include <vtkRTAnalyticSource.h>
+#include <vtkSmartPointer.h>
+#include <vtkStructuredPointsReader.h>
+#include <vtkTimerLog.h>
+#include <vtkVersion.h>
+#include <vtkVolume.h>
+#include <vtkVolumeProperty.h>
+#include <vtkXMLImageDataReader.h>
+#include <vtksys/SystemTools.hxx>
+
+#include <vtkSinglePassVolumeMapper.h>
+#include "vtkCPURayCastVolumeMapper.h"
+
+#include "BenchmarkReport.h"
+#include "BrickedVolume.h"
+#include "CPURaycaster.h"
+#include "FrameProfiler.h"
+#include "ImageCompositor.h"
+#include "SharedMemoryCommunicator.h"
+#include "VolumeDecomposition.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+struct Options
+{
+  std::vector<std::string> Datasets;
+  std::vector<std::string> Mappers;
+  std::vector<std::string> BlendModes;
+  std::vector<std::string> Sizes;
+  std::vector<std::string> SampleDistances;
+  std::vector<std::string> Processes;
+  int Frames;
+  int Warmup;
+  bool OffScreen;
+  bool Profile;
+  bool SkipDominated;
+  std::string JSONFile;
+  std::string CSVFile;
+};
+
+//----------------------------------------------------------------------------
+std::vector<std::string> Split(const std::string& list)
+{
+  std::vector<std::string> items;
+  vtksys::SystemTools::Split(list, items, ',');
+  return items;
+}
+
+//----------------------------------------------------------------------------
+void Usage()
+{
+  std::cerr << "Usage: volbench [-data wavelet:N|file.vti|file.vtk|file.bvol,...]"
+            << " [-mapper cp,gp,sp,fp]"
+            << " [-blend composite,mip,minip,average,additive]"
+            << " [-size N,...] [-sample D,...] [-frames N] [-warmup N]"
+            << " [-processes N,...] [-json file] [-csv file] [-onscreen]"
+            << " [-profile] [-skipdominated]" << std::endl;
+}
+
+//----------------------------------------------------------------------------
+// Datasets are loaded once and shared by all runs. Bricked volumes are
+// opened by the CPU mapper itself, so only their name is kept.
+vtkSmartPointer<vtkImageData> LoadDataset(const std::string& name)
+{
+  vtkSmartPointer<vtkImageData> image;
+  std::string ext = vtksys::SystemTools::GetFilenameLastExtension(name);
+  if (name.compare(0, 8, "wavelet:") == 0)
+    {
+    int half = atoi(name.c_str() + 8) / 2;
+    vtkNew<vtkRTAnalyticSource> source;
+    source->SetWholeExtent(-half, half - 1, -half, half - 1, -half, half - 1);
+    source->Update();
+    image = source->GetOutput();
+    }
+  else if (ext == ".vti")
+    {
+    vtkNew<vtkXMLImageDataReader> reader;
+    reader->SetFileName(name.c_str());
+    reader->Update();
+    image = reader->GetOutput();
+    }
+  else if (ext == ".vtk")
+    {
+    vtkNew<vtkStructuredPointsReader> reader;
+    reader->SetFileName(name.c_str());
+    reader->Update();
+    image = reader->GetOutput();
+    }
+  if (image && image->GetNumberOfPoints() == 0)
+    {
+    image = NULL;
+    }
+  return image;
+}
+
+//----------------------------------------------------------------------------
+vtkSmartPointer<vtkVolumeMapper> CreateMapper(const std::string& name)
+{
+  vtkSmartPointer<vtkVolumeMapper> mapper;
+  if (name == "cp")
+    {
+    mapper = vtkSmartPointer<vtkCPURayCastVolumeMapper>::New();
+    }
+  else if (name == "gp")
+    {
+    mapper = vtkSmartPointer<vtkGPUVolumeRayCastMapper>::New();
+    }
+  else if (name == "sp")
+    {
+    mapper = vtkSmartPointer<vtkSinglePassVolumeMapper>::New();
+    }
+  else if (name == "fp")
+    {
+    mapper = vtkSmartPointer<vtkFixedPointVolumeRayCastMapper>::New();
+    }
+  return mapper;
+}
+
+//----------------------------------------------------------------------------
+// Returns false for an unknown blend mode, so the run is reported as skipped
+// instead of silently timing composite rendering.
+bool SetBlendMode(vtkVolumeMapper *mapper, const std::string& mode)
+{
+  int blendMode;
+  if (mode == "composite")
+    {
+    blendMode = vtkVolumeMapper::COMPOSITE_BLEND;
+    }
+  else if (mode == "mip")
+    {
+    blendMode = vtkVolumeMapper::MAXIMUM_INTENSITY_BLEND;
+    }
+  else if (mode == "minip")
+    {
+    blendMode = vtkVolumeMapper::MINIMUM_INTENSITY_BLEND;
+    }
+  else if (mode == "additive")
+    {
+    blendMode = vtkVolumeMapper::ADDITIVE_BLEND;
+    }
+#if VTK_MAJOR_VERSION > 7 || (VTK_MAJOR_VERSION == 7 && VTK_MINOR_VERSION >= 1)
+  else if (mode == "average")
+    {
+    blendMode = vtkVolumeMapper::AVERAGE_INTENSITY_BLEND;
+    }
+#endif
+  else
+    {
+    return false;
+    }
+
+  mapper->SetBlendMode(blendMode);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Sample distance in voxels for the mappers that expose one
+bool SetSampleDistance(vtkVolumeMapper *mapper, float distance,
+                       vtkImageData *image)
+{
+  if (vtkCPURayCastVolumeMapper *cpu =
+        vtkCPURayCastVolumeMapper::SafeDownCast(mapper))
+    {
+    cpu->SetSampleDistance(distance);
+    return true;
+    }
+
+  // The VTK mappers take world units
+  double spacing[3];
+  image->GetSpacing(spacing);
+  float world = distance * (spacing[0] + spacing[1] + spacing[2]) / 3.0f;
+  if (vtkGPUVolumeRayCastMapper *gpu =
+        vtkGPUVolumeRayCastMapper::SafeDownCast(mapper))
+    {
+    gpu->SetAutoAdjustSampleDistances(0);
+    gpu->SetSampleDistance(world);
+    return true;
+    }
+  if (vtkFixedPointVolumeRayCastMapper *fixedPoint =
+        vtkFixedPointVolumeRayCastMapper::SafeDownCast(mapper))
+    {
+    fixedPoint->SetAutoAdjustSampleDistances(0);
+    fixedPoint->SetSampleDistance(world);
+    return true;
+    }
+  return distance == 1.0f;
+}
+
+//----------------------------------------------------------------------------
+void RunBenchmark(const Options& options, const std::string& dataset,
+                  vtkImageData *image, const std::string& mapperName,
+                  const std::string& blend, int size, float sampleDistance,
+                  BenchmarkReport::Run& run)
+{
+  run.SetParameter("dataset", dataset);
+  run.SetParameter("mapper", mapperName);
+  run.SetParameter("blend", blend);
+  run.SetParameter("width", size);
+  run.SetParameter("height", size);
+  run.SetParameter("sample_distance", sampleDistance);
+  run.SetParameter("frames", options.Frames);
+  run.SetParameter("warmup", options.Warmup);
+
+  double start = vtkTimerLog::GetUniversalTime();
+  vtkSmartPointer<vtkVolumeMapper> mapper = CreateMapper(mapperName);
+  if (!mapper)
+    {
+    run.error = "unknown mapper";
+    return;
+    }
+
+  vtkCPURayCastVolumeMapper *cpuMapper =
+    vtkCPURayCastVolumeMapper::SafeDownCast(mapper);
+  if (cpuMapper)
+    {
+    cpuMapper->SetProfiling(options.Profile);
+    cpuMapper->SetDominatedCellSkipping(options.SkipDominated);
+    run.SetParameter("skip_dominated", options.SkipDominated ? "on" : "off");
+    }
+  double scalarRange[2];
+  if (!image)
+    {
+    if (!cpuMapper || !cpuMapper->OpenBrickedVolume(dataset.c_str()))
+      {
+      run.error = "dataset cannot be loaded by this mapper";
+      return;
+      }
+    image = cpuMapper->GetInput();
+    cpuMapper->GetBrickedScalarRange(scalarRange);
+    }
+  else
+    {
+    mapper->SetInputData(image);
+    image->GetScalarRange(scalarRange);
+    }
+
+  if (!SetBlendMode(mapper, blend))
+    {
+    run.error = "blend mode not supported by this mapper";
+    return;
+    }
+  if (!SetSampleDistance(mapper, sampleDistance, image))
+    {
+    run.error = "sample distance not supported by this mapper";
+    return;
+    }
+
+  vtkNew<vtkRenderWindow> renWin;
+  vtkNew<vtkRenderer> ren;
+  renWin->SetOffScreenRendering(options.OffScreen ? 1 : 0);
+  renWin->SetSize(size, size);
+  renWin->AddRenderer(ren.GetPointer());
+  ren->SetBackground(0.2, 0.2, 0.5);
+
+  // Same transfer functions as volvis
+  vtkNew<vtkVolumeProperty> volumeProperty;
+  volumeProperty->ShadeOff();
+  volumeProperty->SetInterpolationType(VTK_LINEAR_INTERPOLATION);
+  vtkPiecewiseFunction *scalarOpacity = volumeProperty->GetScalarOpacity();
+  scalarOpacity->AddPoint(scalarRange[0], 0.0);
+  scalarOpacity->AddPoint(scalarRange[1], 1.0);
+  vtkColorTransferFunction *color = volumeProperty->GetRGBTransferFunction(0);
+  color->AddRGBPoint(scalarRange[0], 0.0, 0.0, 0.0);
+  color->AddRGBPoint(scalarRange[1], 1.0, 1.0, 1.0);
+
+  vtkNew<vtkVolume> volume;
+  volume->SetMapper(mapper);
+  volume->SetProperty(volumeProperty.GetPointer());
+  ren->AddViewProp(volume.GetPointer());
+  ren->ResetCamera();
+
+  // Load-to-first-frame covers context creation and data upload
+  renWin->Render();
+  renWin->WaitForCompletion();
+  run.SetMetric("first_frame_ms",
+                (vtkTimerLog::GetUniversalTime() - start) * 1000.0);
+
+  // The camera orbits once over warmup and timed frames, so every run sees
+  // the same sequence of views
+  int total = options.Warmup + options.Frames;
+  double azimuth = 360.0 / total;
+  for (int i = 0; i < options.Warmup; ++i)
+    {
+    ren->GetActiveCamera()->Azimuth(azimuth);
+    renWin->Render();
+    }
+  renWin->WaitForCompletion();
+  if (cpuMapper)
+    {
+    cpuMapper->GetProfiler()->Reset();
+    }
+
+  run.frameTimes.reserve(options.Frames);
+  for (int i = 0; i < options.Frames; ++i)
+    {
+    ren->GetActiveCamera()->Azimuth(azimuth);
+    double frameStart = vtkTimerLog::GetUniversalTime();
+    renWin->Render();
+    renWin->WaitForCompletion();
+    run.frameTimes.push_back(vtkTimerLog::GetUniversalTime() - frameStart);
+    }
+
+  if (cpuMapper)
+    {
+    run.SetMetric("sampled_steps", cpuMapper->GetSampledSteps());
+    run.SetMetric("skipped_steps", cpuMapper->GetSkippedSteps());
+    if (options.Profile)
+      {
+      run.SetProfileMetrics(*cpuMapper->GetProfiler());
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// ScalarType of VTK scalars the ray caster samples in place, -1 for others
+int RaycastScalarType(int vtkType)
+{
+  switch (vtkType)
+    {
+    case VTK_UNSIGNED_CHAR: return SCALAR_UINT8;
+    case VTK_UNSIGNED_SHORT: return SCALAR_UINT16;
+    case VTK_SHORT: return SCALAR_INT16;
+    case VTK_FLOAT: return SCALAR_FLOAT32;
+    default: return -1;
+    }
+}
+
+//----------------------------------------------------------------------------
+// Sort-last run of the CPU ray caster over 'processes' forked processes,
+// with the camera path, transfer functions and opacity correction of the
+// mapper runs.
+void RunSortLast(const Options& options, const std::string& dataset,
+                 vtkImageData *image, const std::string& blend, int size,
+                 float sampleDistance, int processes,
+                 BenchmarkReport::Run& run)
+{
+  int threads = std::max(1,
+    static_cast<int>(std::thread::hardware_concurrency()) /
+    std::max(processes, 1));
+  run.SetParameter("dataset", dataset);
+  run.SetParameter("mapper", "cp");
+  run.SetParameter("blend", blend);
+  run.SetParameter("width", size);
+  run.SetParameter("height", size);
+  run.SetParameter("sample_distance", sampleDistance);
+  run.SetParameter("frames", options.Frames);
+  run.SetParameter("warmup", options.Warmup);
+  run.SetParameter("processes", processes);
+  run.SetParameter("threads", threads);
+  run.SetParameter("skip_dominated", options.SkipDominated ? "on" : "off");
+
+  double start = vtkTimerLog::GetUniversalTime();
+  if (processes < 1)
+    {
+    run.error = "invalid process count";
+    return;
+    }
+  if (!image)
+    {
+    run.error = "sort-last runs need an image dataset";
+    return;
+    }
+  vtkDataArray *scalars = image->GetPointData()->GetScalars();
+  int scalarType = scalars ? RaycastScalarType(scalars->GetDataType()) : -1;
+  int components = scalars ? scalars->GetNumberOfComponents() : 0;
+  if (scalarType < 0 || components < 1 || components > 4)
+    {
+    run.error = "scalars cannot be ray cast in place";
+    return;
+    }
+  int blendMode;
+  if (blend == "composite")
+    {
+    blendMode = BLEND_COMPOSITE;
+    }
+  else if (blend == "additive")
+    {
+    blendMode = BLEND_ADDITIVE;
+    }
+  else
+    {
+    run.error = "blend mode cannot be composited";
+    return;
+    }
+
+  // Same transfer functions as the mapper runs: grey and opacity ramps
+  // over the scalar range, opacity corrected for the step length. Like the
+  // mapper's, the table of 8-bit scalars spans 0..255.
+  double scalarRange[2], tableRange[2] = { 0.0, 255.0 };
+  scalars->GetRange(scalarRange, components - 1);
+  if (scalarType != SCALAR_UINT8)
+    {
+    tableRange[0] = scalarRange[0];
+    tableRange[1] = scalarRange[1];
+    }
+  double magnitude = std::max(scalarRange[1] - scalarRange[0], 1e-30);
+  double spacing[3];
+  image->GetSpacing(spacing);
+  double exponent =
+    sampleDistance * (spacing[0] + spacing[1] + spacing[2]) / 3.0;
+  std::vector<float> transferFunction(4 * 256);
+  for (int i = 0; i < 256; ++i)
+    {
+    double value = tableRange[0] + (tableRange[1] - tableRange[0]) * i / 255.0;
+    double v = std::min(1.0, std::max(0.0,
+      (value - scalarRange[0]) / magnitude));
+    transferFunction[4 * i] = transferFunction[4 * i + 1] =
+      transferFunction[4 * i + 2] = static_cast<float>(v);
+    transferFunction[4 * i + 3] =
+      static_cast<float>(1.0 - pow(1.0 - v, exponent));
+    }
+
+  // The camera path of the mapper runs, as texture to clip matrices of the
+  // whole volume: the first frame, then warmup and timed frames
+  int dims[3], extent[6];
+  image->GetDimensions(dims);
+  image->GetExtent(extent);
+  double origin[3];
+  image->GetOrigin(origin);
+  vtkNew<vtkMatrix4x4> textureToWorld;
+  for (int i = 0; i < 3; ++i)
+    {
+    textureToWorld->SetElement(i, i, spacing[i] * dims[i]);
+    textureToWorld->SetElement(i, 3,
+      origin[i] + spacing[i] * (extent[2 * i] - 0.5));
+    }
+  vtkNew<vtkRenderer> ren;
+  ren->ResetCamera(image->GetBounds());
+  int total = options.Warmup + options.Frames;
+  double azimuth = 360.0 / total;
+  std::vector<Mat4> cameras;
+  for (int i = 0; i <= total; ++i)
+    {
+    if (i > 0)
+      {
+      ren->GetActiveCamera()->Azimuth(azimuth);
+      }
+    vtkNew<vtkMatrix4x4> textureToClip;
+    vtkMatrix4x4::Multiply4x4(
+      ren->GetActiveCamera()->GetCompositeProjectionTransformMatrix(1.0, -1, 1),
+      textureToWorld.GetPointer(), textureToClip.GetPointer());
+    cameras.push_back(Mat4::FromRowMajor(&textureToClip->Element[0][0]));
+    }
+
+  VolumeDecomposition decomposition;
+  decomposition.Split(extent, processes);
+  const unsigned char *data =
+    static_cast<const unsigned char *>(scalars->GetVoidPointer(0));
+  const size_t voxelSize = ScalarTypeSize(scalarType) * components;
+  const int pixels = size * size;
+
+  SharedMemoryCommunicator::Body body = [&](Communicator& comm)
+    {
+    // Every process copies out its piece, shared voxels included
+    const int rank = comm.GetRank();
+    const int *e = decomposition.GetExtent(rank);
+    int piece[3] = { e[1] - e[0] + 1, e[3] - e[2] + 1, e[5] - e[4] + 1 };
+    size_t row = piece[0] * voxelSize;
+    std::vector<unsigned char> voxels(row * piece[1] * piece[2]);
+    for (int z = 0; z < piece[2]; ++z)
+      {
+      for (int y = 0; y < piece[1]; ++y)
+        {
+        size_t src = ((static_cast<size_t>(z + e[4] - extent[4]) * dims[1] +
+                       (y + e[2] - extent[2])) * dims[0] +
+                      (e[0] - extent[0])) * voxelSize;
+        std::copy(data + src, data + src + row,
+                  &voxels[(static_cast<size_t>(z) * piece[1] + y) * row]);
+        }
+      }
+
+    CPURaycaster raycaster;
+    raycaster.SetThreadCount(threads);
+    raycaster.SetVolume(&voxels[0], scalarType, components,
+                        piece[0], piece[1], piece[2]);
+    if (scalarType != SCALAR_UINT8)
+      {
+      raycaster.SetScalarRange(scalarRange[0], scalarRange[1]);
+      }
+    raycaster.SetTransferFunction(&transferFunction[0], 256);
+    raycaster.SetBlendMode(blendMode);
+    raycaster.SetDominatedCellSkipping(options.SkipDominated);
+    raycaster.SetSampleDistance(sampleDistance);
+    float region[6];
+    decomposition.GetRegion(rank, region);
+    const Mat4 pieceToVolume = decomposition.GetPieceToVolume(rank);
+    raycaster.SetPiece(pieceToVolume, region);
+
+    ImageCompositor compositor;
+    compositor.SetOperator(blendMode == BLEND_ADDITIVE ?
+                           ImageCompositor::ADD : ImageCompositor::OVER);
+    std::vector<float> frame(4 * pixels);
+    std::vector<int> order;
+    double renderTime = 0.0, compositeTime = 0.0;
+    for (int i = 0; i <= total; ++i)
+      {
+      double frameStart = FrameProfiler::Now();
+      raycaster.Render(cameras[i] * pieceToVolume, size, size);
+      double rendered = FrameProfiler::Now();
+      std::copy(raycaster.GetImage(), raycaster.GetImage() + 4 * pixels,
+                frame.begin());
+      decomposition.GetVisibilityOrder(cameras[i], order);
+      compositor.Composite(comm, order, &frame[0], pixels);
+      double composited = FrameProfiler::Now();
+
+      if (i == 0 && rank == 0)
+        {
+        run.SetMetric("first_frame_ms",
+                      (vtkTimerLog::GetUniversalTime() - start) * 1000.0);
+        }
+      if (i > options.Warmup)
+        {
+        renderTime += rendered - frameStart;
+        compositeTime += composited - rendered;
+        if (rank == 0)
+          {
+          run.frameTimes.push_back(composited - frameStart);
+          }
+        }
+      }
+
+    // Average times of every piece, in milliseconds
+    float times[2] = {
+      static_cast<float>(renderTime * 1000.0 / options.Frames),
+      static_cast<float>(compositeTime * 1000.0 / options.Frames) };
+    std::vector<float> all(2 * comm.GetSize());
+    comm.AllGather(times, 2, &all[0]);
+    if (rank == 0)
+      {
+      float slowest = all[0], fastest = all[0], composite = all[1];
+      for (int r = 1; r < comm.GetSize(); ++r)
+        {
+        slowest = std::max(slowest, all[2 * r]);
+        fastest = std::min(fastest, all[2 * r]);
+        composite = std::max(composite, all[2 * r + 1]);
+        }
+      run.SetMetric("render_ms_max", slowest);
+      run.SetMetric("render_ms_min", fastest);
+      run.SetMetric("composite_ms", composite);
+      run.SetMetric("composite_bytes", compositor.GetBytesSent());
+      }
+    };
+  if (!SharedMemoryCommunicator::Run(processes, 4 * pixels, body))
+    {
+    run.error = "sort-last processes failed";
+    }
+}
+}
+
+int main(int argc, char *argv[])
+{
+  Options options;
+  options.Datasets.push_back("wavelet:128");
+  options.Mappers.push_back("cp");
+  options.Mappers.push_back("gp");
+  options.BlendModes.push_back("composite");
+  options.Sizes.push_back("512");
+  options.SampleDistances.push_back("1");
+  options.Frames = 100;
+  options.Warmup = 10;
+  options.OffScreen = true;
+  options.Profile = false;
+  options.SkipDominated = false;
+
+  for (int i = 1; i < argc; ++i)
+    {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "-data" && hasValue)
+      {
+      options.Datasets = Split(argv[++i]);
+      }
+    else if (arg == "-mapper" && hasValue)
+      {
+      options.Mappers = Split(argv[++i]);
+      }
+    else if (arg == "-blend" && hasValue)
+      {
+      options.BlendModes = Split(argv[++i]);
+      }
+    else if (arg == "-size" && hasValue)
+      {
+      options.Sizes = Split(argv[++i]);
+      }
+    else if (arg == "-sample" && hasValue)
+      {
+      options.SampleDistances = Split(argv[++i]);
+      }
+    else if (arg == "-processes" && hasValue)
+      {
+      options.Processes = Split(argv[++i]);
+      }
+    else if (arg == "-frames" && hasValue)
+      {
+      options.Frames = atoi(argv[++i]);
+      }
+    else if (arg == "-warmup" && hasValue)
+      {
+      options.Warmup = atoi(argv[++i]);
+      }
+    else if (arg == "-json" && hasValue)
+      {
+      options.JSONFile = argv[++i];
+      }
+    else if (arg == "-csv" && hasValue)
+      {
+      options.CSVFile = argv[++i];
+      }
+    else if (arg == "-onscreen")
+      {
+      options.OffScreen = false;
+      }
+    else if (arg == "-profile")
+      {
+      options.Profile = true;
+      }
+    else if (arg == "-skipdominated")
+      {
+      options.SkipDominated = true;
+      }
+    else
+      {
+      Usage();
+      return EXIT_FAILURE;
+      }
+    }
+  if (options.Frames < 1 || options.Warmup < 0)
+    {
+    Usage();
+    return EXIT_FAILURE;
+    }
+
+  BenchmarkReport report;
+  report.SetEnvironment("vtk_version", vtkVersion::GetVTKVersion());
+#ifdef __VERSION__
+  report.SetEnvironment("compiler", __VERSION__);
+#endif
+  report.SetEnvironment("cpu_packet_width",
+    std::to_string(CPURaycaster::GetMaximumPacketWidth()));
+  report.SetEnvironment("timestamp",
+    vtksys::SystemTools::GetCurrentDateTime("%Y-%m-%dT%H:%M:%S"));
+
+  std::map<std::string, vtkSmartPointer<vtkImageData> > images;
+  for (size_t d = 0; d < options.Datasets.size(); ++d)
+    {
+    const std::string& dataset = options.Datasets[d];
+    if (vtksys::SystemTools::GetFilenameLastExtension(dataset) != ".bvol")
+      {
+      images[dataset] = LoadDataset(dataset);
+      if (!images[dataset])
+        {
+        std::cerr << "Cannot load " << dataset << std::endl;
+        return EXIT_FAILURE;
+        }
+      }
+    }
+
+  for (size_t d = 0; d < options.Datasets.size(); ++d)
+    {
+    for (size_t m = 0; m < options.Mappers.size(); ++m)
+      {
+      for (size_t b = 0; b < options.BlendModes.size(); ++b)
+        {
+        for (size_t s = 0; s < options.Sizes.size(); ++s)
+          {
+          for (size_t k = 0; k < options.SampleDistances.size(); ++k)
+            {
+            float sampleDistance = static_cast<float>(
+              atof(options.SampleDistances[k].c_str()));
+            if (options.Processes.empty() || options.Mappers[m] != "cp")
+              {
+              BenchmarkReport::Run& run = report.AddRun();
+              RunBenchmark(options, options.Datasets[d],
+                           images[options.Datasets[d]], options.Mappers[m],
+                           options.BlendModes[b],
+                           atoi(options.Sizes[s].c_str()), sampleDistance,
+                           run);
+              continue;
+              }
+            for (size_t p = 0; p < options.Processes.size(); ++p)
+              {
+              BenchmarkReport::Run& run = report.AddRun();
+              RunSortLast(options, options.Datasets[d],
+                          images[options.Datasets[d]], options.BlendModes[b],
+                          atoi(options.Sizes[s].c_str()), sampleDistance,
+                          atoi(options.Processes[p].c_str()), run);
+              }
+            }
+          }
+        }
+      }
+    }
+
+  report.PrintSummary(std::cout);
+  bool ok = true;
+  if (!options.JSONFile.empty())
+    {
+    ok = report.WriteJSON(options.JSONFile) && ok;
+    }
+  if (!options.CSVFile.empty())
+    {
+    ok = report.WriteCSV(options.CSVFile) && ok;
+    }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
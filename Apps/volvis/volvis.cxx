@@ -23,6 +23,7 @@
 
 #include <vtkImageChangeInformation.h>
 #include <vtkColorTransferFunction.h>
+#include <vtkCallbackCommand.h>
 #include <vtkCommand.h>
 #include <vtkFixedPointVolumeRayCastMapper.h>
 #include <vtkGPUVolumeRayCastMapper.h>
@@ -49,82 +50,298 @@
 #include <vtkStructuredPointsReader.h>
 
 #include <vtkSinglePassVolumeMapper.h>
+#include "vtkCPURayCastVolumeMapper.h"
 
 #include <vtkOutlineFilter.h>
 #include <vtkTimerLog.h>
+#include <vtkVersion.h>
 #include <vtkXMLImageDataReader.h>
 
+#include "BenchmarkReport.h"
+#include "FrameProfiler.h"
+#include "BrickedVolume.h"
+#include "RenderScheduler.h"
+#include "ThreadPool.h"
+#include "VolumeSequence.h"
+#include "VolumeStatistics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 #include <cstdlib>
+#include <vector>
 
-/// Testing
-class vtkTimerCallback : public vtkCommand
+/// Prints the stage breakdown of every frame of the CPU mapper
+static void PrintFrameProfile(vtkObject *vtkNotUsed(caller),
+                              unsigned long vtkNotUsed(eventId),
+                              void *clientData, void *vtkNotUsed(callData))
 {
-  public:
-    static vtkTimerCallback *New()
+  FrameProfiler *profiler = static_cast<FrameProfiler*>(clientData);
+  profiler->Print(std::cerr, profiler->GetLastFrame());
+}
+
+/// Progressive rendering: while the CPU mapper has refinement passes left,
+/// a render is scheduled right after every render
+static void ScheduleRefinement(vtkObject *caller,
+                               unsigned long vtkNotUsed(eventId),
+                               void *clientData, void *vtkNotUsed(callData))
+{
+  vtkCPURayCastVolumeMapper *cpuMapper =
+    static_cast<vtkCPURayCastVolumeMapper*>(clientData);
+  if (cpuMapper->IsRefining())
     {
-      vtkTimerCallback *cb = new vtkTimerCallback;
-      cb->TimerCount = 0;
-      return cb;
+    static_cast<vtkRenderWindow*>(caller)->GetInteractor()->
+      CreateOneShotTimer(1);
     }
+}
+
+static void RenderRefinement(vtkObject *vtkNotUsed(caller),
+                             unsigned long vtkNotUsed(eventId),
+                             void *clientData, void *vtkNotUsed(callData))
+{
+  static_cast<vtkRenderWindow*>(clientData)->Render();
+}
+
+/// Time series playback: the steps of a series of .vti files are read ahead
+/// of the playhead by VolumeSequence and swapped into the input of the
+/// mapper on a repeating timer. The scalars of the input point straight at
+/// the voxels of the step shown, which stay referenced here.
+struct SeriesPlayback
+{
+  VolumeSequence Sequence;
+  VolumeSequence::StepData Shown;
+  vtkSmartPointer<vtkImageData> Image;
+  vtkRenderWindow *RenderWindow;
+  double LastReport;
+};
 
-    void Set(vtkRenderWindow* rw, vtkRenderer* ren)
+static std::string SeriesFileName(const std::string& pattern, int step)
+{
+  char name[1024];
+  snprintf(name, sizeof(name), pattern.c_str(), step);
+  return name;
+}
+
+/// Loader threads: every step is read by a reader of its own
+static bool ReadSeriesStep(const std::string& pattern, int step,
+                           size_t bytes, std::vector<unsigned char>& voxels)
+{
+  vtkSmartPointer<vtkXMLImageDataReader> reader =
+    vtkSmartPointer<vtkXMLImageDataReader>::New();
+  reader->SetFileName(SeriesFileName(pattern, step).c_str());
+  reader->Update();
+  vtkDataArray *scalars = reader->GetOutput()->GetPointData()->GetScalars();
+  if (!scalars || static_cast<size_t>(scalars->GetNumberOfTuples() *
+      scalars->GetNumberOfComponents() * scalars->GetDataTypeSize()) != bytes)
     {
-      this->RenderWindow = rw;
-      this->Renderer = ren;
+    return false;
     }
+  const unsigned char *data =
+    static_cast<const unsigned char*>(scalars->GetVoidPointer(0));
+  voxels.assign(data, data + bytes);
+  return true;
+}
 
-    virtual void Execute(vtkObject *vtkNotUsed(caller), unsigned long eventId,
-                         void *vtkNotUsed(callData))
+static void PlaySeries(vtkObject *vtkNotUsed(caller),
+                       unsigned long vtkNotUsed(eventId),
+                       void *clientData, void *vtkNotUsed(callData))
+{
+  SeriesPlayback *playback = static_cast<SeriesPlayback*>(clientData);
+  double now = vtkTimerLog::GetUniversalTime();
+  int step = playback->Sequence.Update(now);
+  if (step >= 0 && step != playback->Sequence.GetShownStep())
     {
-      static int counter = 0;
-      static vtkNew<vtkTimerLog> timer;
-      static double totalTime = 0;
-      static double totalFrames = 0;
+    playback->Shown = playback->Sequence.GetStep(step);
+    vtkDataArray *scalars = playback->Image->GetPointData()->GetScalars();
+    scalars->SetVoidArray(const_cast<unsigned char*>(&(*playback->Shown)[0]),
+                          scalars->GetNumberOfTuples() *
+                          scalars->GetNumberOfComponents(), 1);
+    scalars->Modified();
+    }
+  playback->Sequence.Presented(
+    step >= 0 ? step : playback->Sequence.GetShownStep(), now);
+  playback->RenderWindow->Render();
 
-      if (counter ==  100)
-        {
-        timer->StartTimer();
-        }
-      if (vtkCommand::TimerEvent == eventId)
-        {
-        ++this->TimerCount;
-        }
-      this->Renderer->GetActiveCamera()->Azimuth(1);
-      this->RenderWindow->Render();
+  if (now - playback->LastReport >= 1.0)
+    {
+    VolumeSequence::Statistics stats = playback->Sequence.GetStatistics();
+    std::cerr << "Step " << playback->Sequence.GetShownStep() << "/"
+              << playback->Sequence.GetNumberOfSteps() << ": "
+              << stats.playbackRate << " steps/s, dropped "
+              << stats.droppedFrames << "/" << stats.frames
+              << " frames, skipped " << stats.skippedSteps << " steps, "
+              << stats.loadTime * 1000.0 << " ms per load" << std::endl;
+    playback->LastReport = now;
+    }
+}
 
-      if (counter >  100)
-        {
-        ++totalFrames;
-        }
+/// Paced rendering: the interactor does not render on every event but
+/// posts a render request, and a repeating timer renders at most once per
+/// frame interval, whatever number of requests came in since the last
+/// frame. Input-to-present latency is printed once a second.
+struct PacedRendering
+{
+  RenderScheduler Scheduler;
+  std::vector<RenderUpdate> Updates;
+  vtkRenderWindow *RenderWindow;
+  double LastReport;
+};
 
-      ++counter;
-      if (counter == 200)
-        {
-        timer->StopTimer();
-        totalTime += timer->GetElapsedTime();
+static void RequestRender(vtkObject *vtkNotUsed(caller),
+                          unsigned long vtkNotUsed(eventId),
+                          void *clientData, void *vtkNotUsed(callData))
+{
+  // The interactor style already moved the camera, the update only marks
+  // the time of the event
+  RenderUpdate update;
+  update.kind = RenderUpdate::CAMERA;
+  static_cast<PacedRendering*>(clientData)->Scheduler.Post(update);
+}
 
-        std::cerr << "totalFrames " << totalFrames << std::endl;
-        std::cerr << "totalTime " << totalTime << std::endl;
-        std::cerr << "FPS " << totalFrames / totalTime << std::endl;
+static void RenderPaced(vtkObject *vtkNotUsed(caller),
+                        unsigned long vtkNotUsed(eventId),
+                        void *clientData, void *vtkNotUsed(callData))
+{
+  PacedRendering *pacing = static_cast<PacedRendering*>(clientData);
+  double now = FrameProfiler::Now();
+  if (!pacing->Scheduler.IsFrameDue(now, false))
+    {
+    return;
+    }
+  pacing->Scheduler.TakeUpdates(pacing->Updates);
+  pacing->RenderWindow->Render();
+  pacing->Scheduler.Presented(now, FrameProfiler::Now());
 
-        totalFrames = 0;
-        timer->ResetLog();
+  if (now - pacing->LastReport >= 1.0)
+    {
+    RenderScheduler::Statistics stats = pacing->Scheduler.GetStatistics();
+    std::cerr << "Input: " << stats.updates << " updates in " << stats.frames
+              << " frames, " << stats.coalescedUpdates << " coalesced, "
+              << "latency " << stats.latency * 1000.0 << " ms average, "
+              << stats.maxLatency * 1000.0 << " ms max" << std::endl;
+    pacing->Scheduler.ResetStatistics();
+    pacing->LastReport = now;
+    }
+}
 
-        exit(0);
-        }
+/// Scalar range of the volume loaded from 'fileName': read from the
+/// statistics sidecar of the file when it is current, otherwise computed in
+/// one parallel pass and saved next to the file for the next time. False
+/// for scalars the statistics do not cover, which the caller scans itself.
+static bool LoadScalarStatistics(const std::string& fileName,
+                                 vtkImageData *image, double range[2])
+{
+  vtkDataArray *scalars = image->GetPointData()->GetScalars();
+  if (fileName.empty() || !scalars || scalars->GetNumberOfComponents() != 1)
+    {
+    return false;
+    }
+  int scalarType;
+  switch (scalars->GetDataType())
+    {
+    case VTK_UNSIGNED_CHAR: scalarType = SCALAR_UINT8; break;
+    case VTK_UNSIGNED_SHORT: scalarType = SCALAR_UINT16; break;
+    case VTK_SHORT: scalarType = SCALAR_INT16; break;
+    case VTK_FLOAT: scalarType = SCALAR_FLOAT32; break;
+    default: return false;
     }
 
-  private:
-    int TimerCount;
-    vtkSmartPointer<vtkRenderer> Renderer;
-    vtkSmartPointer<vtkRenderWindow> RenderWindow;
+  VolumeStatistics statistics;
+  const std::string sidecar = VolumeStatistics::SidecarName(fileName);
+  if (statistics.Load(sidecar, fileName))
+    {
+    std::cout << "Statistics loaded from " << sidecar << std::endl;
+    }
+  else
+    {
+    int dims[3];
+    image->GetDimensions(dims);
+    ThreadPool pool;
+    statistics.Compute(scalars->GetVoidPointer(0), scalarType, 1,
+                       dims[0], dims[1], dims[2], 32, &pool);
+    std::cout << "Statistics computed in "
+              << statistics.GetComputeTime() * 1000.0 << " ms";
+    if (statistics.Save(sidecar, fileName))
+      {
+      std::cout << ", saved to " << sidecar;
+      }
+    std::cout << std::endl;
+    }
+  if (!statistics.IsValid())
+    {
+    return false;
+    }
+  range[0] = statistics.GetRange()[0];
+  range[1] = statistics.GetRange()[1];
+  return true;
+}
 
-};
+/// Testing: orbit the camera for a fixed number of frames and print the
+/// frame time distribution. See Apps/volbench for full benchmark matrices.
+static int RunTimedFrames(vtkRenderWindow* renWin, vtkRenderer* ren,
+                          vtkVolumeMapper* mapper)
+{
+  const int warmupFrames = 100;
+  const int timedFrames = 100;
+
+  for (int i = 0; i < warmupFrames; ++i)
+    {
+    ren->GetActiveCamera()->Azimuth(1);
+    renWin->Render();
+    }
+  renWin->WaitForCompletion();
+
+  vtkCPURayCastVolumeMapper *cpuMapper =
+    vtkCPURayCastVolumeMapper::SafeDownCast(mapper);
+  if (cpuMapper)
+    {
+    cpuMapper->GetProfiler()->Reset();
+    }
+
+  BenchmarkReport report;
+  BenchmarkReport::Run& run = report.AddRun();
+  run.SetParameter("mapper", mapper->GetClassName());
+  run.frameTimes.reserve(timedFrames);
+  for (int i = 0; i < timedFrames; ++i)
+    {
+    ren->GetActiveCamera()->Azimuth(1);
+    double start = vtkTimerLog::GetUniversalTime();
+    renWin->Render();
+    renWin->WaitForCompletion();
+    run.frameTimes.push_back(vtkTimerLog::GetUniversalTime() - start);
+    }
+
+  if (cpuMapper)
+    {
+    run.SetMetric("sampled_steps", cpuMapper->GetSampledSteps());
+    run.SetMetric("skipped_steps", cpuMapper->GetSkippedSteps());
+    if (cpuMapper->GetProfiling())
+      {
+      run.SetProfileMetrics(*cpuMapper->GetProfiler());
+      }
+    }
+
+  report.PrintSummary(std::cerr);
+  return EXIT_SUCCESS;
+}
 
 int main(int argc, char *argv[])
 {
   bool testing = false;
+  bool preIntegration = false;
+  bool levelOfDetail = false;
+  bool skipDominated = false;
+  bool shade = false;
+  bool profiling = false;
+  bool progressive = false;
+  bool reproject = false;
+  bool sphere = false;
+  double speed = 10.0;
+  double frameRate = 0.0;
+  int blendMode = vtkVolumeMapper::COMPOSITE_BLEND;
   double scalarRange[2];
+  std::string dataFile;
+  SeriesPlayback series;
 
   vtkSmartPointer<vtkActor> outlineActor = vtkSmartPointer<vtkActor>::New();
   vtkSmartPointer<vtkPolyDataMapper> outlineMapper =
@@ -137,7 +354,7 @@ int main(int argc, char *argv[])
       {
       std::string arg = argv[i];
 
-      if (arg == "-fp" || arg == "-gp" || arg == "-sp")
+      if (arg == "-fp" || arg == "-gp" || arg == "-sp" || arg == "-cp")
         {
         if (arg == "-fp")
           {
@@ -147,6 +364,10 @@ int main(int argc, char *argv[])
           {
           volumeMapper = vtkSmartPointer<vtkGPUVolumeRayCastMapper>::New();
           }
+        else if (arg == "-cp")
+          {
+          volumeMapper = vtkSmartPointer<vtkCPURayCastVolumeMapper>::New();
+          }
         else
           {
           volumeMapper = vtkSmartPointer<vtkSinglePassVolumeMapper>::New();
@@ -156,6 +377,77 @@ int main(int argc, char *argv[])
         {
         testing = true;
         }
+      else if (arg == "-pi")
+        {
+        preIntegration = true;
+        }
+      else if (arg == "-lod")
+        {
+        levelOfDetail = true;
+        }
+      else if (arg == "-skipdominated")
+        {
+        skipDominated = true;
+        }
+      else if (arg == "-shade")
+        {
+        shade = true;
+        }
+      else if (arg == "-prof")
+        {
+        profiling = true;
+        }
+      else if (arg == "-progressive")
+        {
+        progressive = true;
+        }
+      else if (arg == "-reproject")
+        {
+        reproject = true;
+        }
+      else if (arg == "-sphere")
+        {
+        sphere = true;
+        }
+      else if (arg == "-speed" && i + 1 < argc)
+        {
+        speed = atof(argv[++i]);
+        }
+      else if (arg == "-pace" && i + 1 < argc)
+        {
+        frameRate = atof(argv[++i]);
+        }
+      else if (arg == "-blend" && i + 1 < argc)
+        {
+        std::string mode = argv[++i];
+        if (mode == "composite")
+          {
+          blendMode = vtkVolumeMapper::COMPOSITE_BLEND;
+          }
+        else if (mode == "mip")
+          {
+          blendMode = vtkVolumeMapper::MAXIMUM_INTENSITY_BLEND;
+          }
+        else if (mode == "minip")
+          {
+          blendMode = vtkVolumeMapper::MINIMUM_INTENSITY_BLEND;
+          }
+        else if (mode == "additive")
+          {
+          blendMode = vtkVolumeMapper::ADDITIVE_BLEND;
+          }
+#if VTK_MAJOR_VERSION > 7 || (VTK_MAJOR_VERSION == 7 && VTK_MINOR_VERSION >= 1)
+        else if (mode == "average")
+          {
+          blendMode = vtkVolumeMapper::AVERAGE_INTENSITY_BLEND;
+          }
+#endif
+        else
+          {
+          std::cout << "Unknown blend mode " << mode << std::endl;
+          return EXIT_FAILURE;
+          }
+        }
       else
         {
         // Deault is single pass volume mapper
@@ -165,12 +457,54 @@ int main(int argc, char *argv[])
           }
 
         std::string ext = vtksys::SystemTools::GetFilenameLastExtension(arg);
-        if (ext == ".vtk")
+        if (ext == ".vti" && arg.find('%') != std::string::npos)
+          {
+          // A time series, "step%03d.vti" for step000.vti, step001.vti, ...
+          // up to the first missing file. The first step is read here and
+          // sets the size every other step has to match.
+          int steps = 0;
+          while (vtksys::SystemTools::FileExists(
+                   SeriesFileName(arg, steps).c_str()))
+            {
+            ++steps;
+            }
+          vtkSmartPointer<vtkXMLImageDataReader> reader =
+            vtkSmartPointer<vtkXMLImageDataReader>::New();
+          reader->SetFileName(SeriesFileName(arg, 0).c_str());
+          reader->Update();
+          vtkDataArray *scalars =
+            reader->GetOutput()->GetPointData()->GetScalars();
+          if (steps == 0 || !scalars)
+            {
+            std::cout << "Cannot read time series " << arg << std::endl;
+            return EXIT_FAILURE;
+            }
+          series.Image = vtkSmartPointer<vtkImageData>::New();
+          series.Image->DeepCopy(reader->GetOutput());
+          dataFile = SeriesFileName(arg, 0);
+          const size_t bytes = static_cast<size_t>(
+            scalars->GetNumberOfTuples() * scalars->GetNumberOfComponents() *
+            scalars->GetDataTypeSize());
+          series.Sequence.Open(steps,
+            [arg, bytes](int step, std::vector<unsigned char>& voxels)
+            {
+            return ReadSeriesStep(arg, step, bytes, voxels);
+            });
+          volumeMapper->SetInputData(series.Image);
+
+          vtkSmartPointer<vtkOutlineFilter> outlineFilter =
+            vtkSmartPointer<vtkOutlineFilter>::New();
+          outlineFilter->SetInputData(series.Image);
+          outlineMapper->SetInputConnection(outlineFilter->GetOutputPort());
+          outlineActor->SetMapper(outlineMapper);
+          }
+        else if (ext == ".vtk")
           {
           vtkNew<vtkStructuredPointsReader> reader;
           reader->SetFileName(arg.c_str());
           reader->Update();
           volumeMapper->SetInputConnection(reader->GetOutputPort());
+          dataFile = arg;
           }
         else if (ext == ".vti")
           {
@@ -186,6 +520,7 @@ int main(int argc, char *argv[])
 //          changeInformation->SetOutputOrigin(10, 20, 30);
           changeInformation->Update();
           volumeMapper->SetInputConnection(changeInformation->GetOutputPort());
+          dataFile = arg;
 
           // Add outline filter
           vtkSmartPointer<vtkOutlineFilter> outlineFilter =
@@ -194,6 +529,29 @@ int main(int argc, char *argv[])
           outlineMapper->SetInputConnection(outlineFilter->GetOutputPort());
           outlineActor->SetMapper(outlineMapper);
           }
+        else if (ext == ".bvol")
+          {
+          // Bricked volumes are memory mapped by the CPU mapper
+          vtkCPURayCastVolumeMapper *cpuMapper =
+            vtkCPURayCastVolumeMapper::SafeDownCast(volumeMapper);
+          if (!cpuMapper)
+            {
+            std::cout << "Bricked volumes need the CPU mapper, using -cp"
+                      << std::endl;
+            volumeMapper = vtkSmartPointer<vtkCPURayCastVolumeMapper>::New();
+            cpuMapper = vtkCPURayCastVolumeMapper::SafeDownCast(volumeMapper);
+            }
+          if (!cpuMapper->OpenBrickedVolume(arg.c_str()))
+            {
+            return EXIT_FAILURE;
+            }
+
+          vtkSmartPointer<vtkOutlineFilter> outlineFilter =
+            vtkSmartPointer<vtkOutlineFilter>::New();
+          outlineFilter->SetInputData(cpuMapper->GetInput());
+          outlineMapper->SetInputConnection(outlineFilter->GetOutputPort());
+          outlineActor->SetMapper(outlineMapper);
+          }
         }
       }
     }
@@ -205,8 +563,33 @@ int main(int argc, char *argv[])
     volumeMapper->SetInputConnection(source->GetOutputPort());
     }
 
-  volumeMapper->GetInput()->GetScalarRange(scalarRange);
-  volumeMapper->SetBlendModeToComposite();
+  vtkCPURayCastVolumeMapper *cpuMapper =
+    vtkCPURayCastVolumeMapper::SafeDownCast(volumeMapper);
+  if (cpuMapper)
+    {
+    cpuMapper->SetPreIntegration(preIntegration);
+    cpuMapper->SetLevelOfDetail(levelOfDetail);
+    cpuMapper->SetDominatedCellSkipping(skipDominated);
+    cpuMapper->SetProfiling(profiling);
+    cpuMapper->SetProgressive(progressive);
+    cpuMapper->SetTemporalReprojection(reproject);
+    }
+  else if (profiling || progressive || reproject || skipDominated)
+    {
+    std::cout << "Profiling, progressive rendering, reprojection and "
+              << "dominated cell skipping need the CPU mapper (-cp)"
+              << std::endl;
+    }
+  if (cpuMapper && cpuMapper->IsBrickedVolumeOpen())
+    {
+    cpuMapper->GetBrickedScalarRange(scalarRange);
+    }
+  else if (!LoadScalarStatistics(dataFile, volumeMapper->GetInput(),
+                                 scalarRange))
+    {
+    volumeMapper->GetInput()->GetScalarRange(scalarRange);
+    }
+  volumeMapper->SetBlendMode(blendMode);
 
   vtkSmartPointer<vtkRenderWindow> renWin =
     vtkSmartPointer<vtkRenderWindow>::New();
@@ -227,7 +610,7 @@ int main(int argc, char *argv[])
 
   vtkSmartPointer<vtkVolumeProperty> volumeProperty =
     vtkSmartPointer<vtkVolumeProperty>::New();
-  volumeProperty->ShadeOff();
+  volumeProperty->SetShade(shade ? 1 : 0);
   volumeProperty->SetInterpolationType(VTK_LINEAR_INTERPOLATION);
 
   vtkSmartPointer<vtkPiecewiseFunction> scalarOpacity =
@@ -256,18 +639,29 @@ int main(int argc, char *argv[])
   volume->RotateY(45.0);
   outlineActor->RotateY(45.0);
 
-  /// Add sphere for testing
+  /// Add sphere for testing intermixed geometry: it sits in the middle of
+  /// the volume, so rays have to stop at its surface
+  double bounds[6];
+  volumeMapper->GetBounds(bounds);
   vtkSmartPointer<vtkSphereSource> sphereSource = vtkSmartPointer<vtkSphereSource>::New();
-  sphereSource->SetCenter(100, 10, 10);
-  sphereSource->SetRadius(100.0);
+  sphereSource->SetCenter(0.5 * (bounds[0] + bounds[1]),
+                          0.5 * (bounds[2] + bounds[3]),
+                          0.5 * (bounds[4] + bounds[5]));
+  sphereSource->SetRadius(0.25 * (bounds[1] - bounds[0]));
+  sphereSource->SetThetaResolution(32);
+  sphereSource->SetPhiResolution(32);
   vtkSmartPointer<vtkPolyDataMapper> sphereMapper = vtkSmartPointer<vtkPolyDataMapper>::New();
   vtkSmartPointer<vtkActor> sphereActor = vtkSmartPointer<vtkActor>::New();
   sphereMapper->SetInputConnection(sphereSource->GetOutputPort());
   sphereActor->SetMapper(sphereMapper);
+  sphereActor->RotateY(45.0);
 
   ren->AddViewProp(volume);
   ren->AddActor(outlineActor);
-//  ren->AddActor(sphereActor);
+  if (sphere)
+    {
+    ren->AddActor(sphereActor);
+    }
   ren->ResetCamera();
 
   renWin->Render();
@@ -276,13 +670,72 @@ int main(int argc, char *argv[])
   /// Testing code
   if (testing)
     {
-    vtkNew<vtkTimerCallback> cb;
-    cb->Set(renWin, ren);
-    iren->AddObserver(vtkCommand::TimerEvent, cb.GetPointer());
-    iren->CreateRepeatingTimer(10);
+    return RunTimedFrames(renWin, ren, volumeMapper);
+    }
+
+  if (cpuMapper && profiling)
+    {
+    vtkNew<vtkCallbackCommand> printProfile;
+    printProfile->SetCallback(PrintFrameProfile);
+    printProfile->SetClientData(cpuMapper->GetProfiler());
+    renWin->AddObserver(vtkCommand::EndEvent, printProfile.GetPointer());
+    }
+
+  if (series.Sequence.IsOpen())
+    {
+    series.Sequence.SetSpeed(speed);
+    series.RenderWindow = renWin.GetPointer();
+    series.LastReport = vtkTimerLog::GetUniversalTime();
+    vtkNew<vtkCallbackCommand> playSeries;
+    playSeries->SetCallback(PlaySeries);
+    playSeries->SetClientData(&series);
+    iren->AddObserver(vtkCommand::TimerEvent, playSeries.GetPointer());
+    }
+
+  if (cpuMapper && progressive)
+    {
+    vtkNew<vtkCallbackCommand> scheduleRefinement;
+    scheduleRefinement->SetCallback(ScheduleRefinement);
+    scheduleRefinement->SetClientData(cpuMapper);
+    renWin->AddObserver(vtkCommand::EndEvent,
+                        scheduleRefinement.GetPointer());
+
+    vtkNew<vtkCallbackCommand> renderRefinement;
+    renderRefinement->SetCallback(RenderRefinement);
+    renderRefinement->SetClientData(renWin.GetPointer());
+    iren->AddObserver(vtkCommand::TimerEvent, renderRefinement.GetPointer());
+    }
+
+  PacedRendering pacing;
+  if (frameRate > 0.0)
+    {
+    pacing.Scheduler.SetFrameRate(frameRate);
+    pacing.RenderWindow = renWin.GetPointer();
+    pacing.LastReport = FrameProfiler::Now();
+    iren->EnableRenderOff();
+
+    // The interactor invokes RenderEvent whether or not it renders
+    vtkNew<vtkCallbackCommand> requestRender;
+    requestRender->SetCallback(RequestRender);
+    requestRender->SetClientData(&pacing);
+    iren->AddObserver(vtkCommand::RenderEvent, requestRender.GetPointer());
+
+    vtkNew<vtkCallbackCommand> renderPaced;
+    renderPaced->SetCallback(RenderPaced);
+    renderPaced->SetClientData(&pacing);
+    iren->AddObserver(vtkCommand::TimerEvent, renderPaced.GetPointer());
     }
 
   iren->Initialize();
+  if (series.Sequence.IsOpen())
+    {
+    iren->CreateRepeatingTimer(10);
+    }
+  if (frameRate > 0.0)
+    {
+    iren->CreateRepeatingTimer(
+      static_cast<unsigned long>(std::max(1.0, std::floor(1000.0 / frameRate))));
+    }
   iren->Start();
 }
 
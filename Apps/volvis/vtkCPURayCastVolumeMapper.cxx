@@ -0,0 +1,929 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    vtkCPURayCastVolumeMapper.cxx
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+#include "vtkCPURayCastVolumeMapper.h"
+
+#include <vtkCamera.h>
+#include <vtkColorTransferFunction.h>
+#include <vtkDataArray.h>
+#include <vtkImageData.h>
+#include <vtkMatrix4x4.h>
+#include <vtkNew.h>
+#include <vtkObjectFactory.h>
+#include <vtkPiecewiseFunction.h>
+#include <vtkPointData.h>
+#include <vtkRayCastImageDisplayHelper.h>
+#include <vtkRenderWindow.h>
+#include <vtkRenderer.h>
+#include <vtkTimerLog.h>
+#include <vtkVersion.h>
+#include <vtkVolume.h>
+#include <vtkVolumeProperty.h>
+
+#include "BrickStreamer.h"
+#include "BrickedVolume.h"
+#include "Communicator.h"
+#include "CPURaycaster.h"
+#include "FrameProfiler.h"
+#include "ImageCompositor.h"
+#include "ProgressiveRefinement.h"
+#include "ReprojectionCache.h"
+#include "VolumeDecomposition.h"
+
+#include <algorithm>
+#include <cmath>
+
+vtkStandardNewMacro(vtkCPURayCastVolumeMapper);
+
+namespace
+{
+const int TransferFunctionSize = 256;
+
+//----------------------------------------------------------------------------
+template <class T>
+void ConvertToUnsignedChar(const T *in, vtkIdType tuples, int components,
+                           double shift, double scale, unsigned char *out)
+{
+  for (vtkIdType i = 0; i < tuples; ++i)
+    {
+    double v = (static_cast<double>(in[(i + 1) * components - 1]) + shift) *
+      scale;
+    out[i] = static_cast<unsigned char>(v < 0.0 ? 0.0 : (v > 255.0 ? 255.0 : v));
+    }
+}
+
+//----------------------------------------------------------------------------
+int NextPowerOfTwo(int v)
+{
+  int p = 1;
+  while (p < v)
+    {
+    p <<= 1;
+    }
+  return p;
+}
+}
+
+//----------------------------------------------------------------------------
+vtkCPURayCastVolumeMapper::vtkCPURayCastVolumeMapper()
+{
+  this->SampleDistance = 1.0f;
+  this->NumberOfThreads = 0;
+  this->PacketWidth = 0;
+  this->EmptySpaceSkipping = 1;
+  this->DominatedCellSkipping = 0;
+  this->PreIntegration = 0;
+  this->LevelOfDetail = 0;
+  this->LevelOfDetailTolerance = 1.0f;
+  this->GradientCache = 1;
+  this->IntermixIntersectingGeometry = 1;
+  this->BrickMemoryBudget = 0;
+  this->BrickCacheBudget = 512 * 1024 * 1024;
+  this->Profiling = 0;
+  this->Progressive = 0;
+  this->FrameBudget = 1.0 / 30.0;
+  this->TemporalReprojection = 0;
+  this->MaximumReprojectionError = 1.0f;
+  this->ReprojectionRefreshPeriod = 8;
+  this->Raycaster = new CPURaycaster;
+  this->Bricks = new BrickedVolume;
+  this->Streamer = new BrickStreamer(this->Bricks);
+  this->ImageDisplayHelper = vtkRayCastImageDisplayHelper::New();
+
+  // Stages are listed in the order they run
+  this->Profiler = new FrameProfiler;
+  this->ScalarsStage = this->Profiler->AddStage("scalars");
+  this->TransferFunctionStage = this->Profiler->AddStage("transfer function");
+  this->BricksStage = this->Profiler->AddStage("bricks");
+  this->ReprojectStage = this->Profiler->AddStage("reproject");
+  this->Raycaster->SetProfiler(this->Profiler);
+  this->CompositeStage = this->Profiler->AddStage("composite");
+  this->DisplayStage = this->Profiler->AddStage("display");
+  this->CulledBricksCounter = this->Profiler->AddCounter("culled bricks");
+
+  this->Refinement = new ProgressiveRefinement;
+  this->NextTile = 0;
+  std::fill(this->RefinedTextureToClip, this->RefinedTextureToClip + 16, 0.0);
+  this->RefinedTransferFunctionVersion = 0;
+  this->RefinedMTime = 0;
+
+  this->Reprojection = new ReprojectionCache;
+  this->ReprojectedTransferFunctionVersion = 0;
+  this->ReprojectedMTime = 0;
+
+  this->Comm = NULL;
+  this->Compositor = new ImageCompositor;
+  this->Decomposition = new VolumeDecomposition;
+
+  this->ScalarsBuildTime = 0;
+  this->TransferFunctionMTime = 0;
+  this->TransferFunctionRange[0] = this->TransferFunctionRange[1] = 0.0;
+  this->ScalarRange[0] = 0.0;
+  this->ScalarRange[1] = 255.0;
+}
+
+//----------------------------------------------------------------------------
+vtkCPURayCastVolumeMapper::~vtkCPURayCastVolumeMapper()
+{
+  delete this->Raycaster;
+  delete this->Streamer;
+  delete this->Bricks;
+  delete this->Profiler;
+  delete this->Refinement;
+  delete this->Reprojection;
+  delete this->Compositor;
+  delete this->Decomposition;
+  this->ImageDisplayHelper->Delete();
+}
+
+//----------------------------------------------------------------------------
+void vtkCPURayCastVolumeMapper::SetCommunicator(Communicator *comm)
+{
+  if (this->Comm != comm)
+    {
+    this->Comm = comm;
+    this->Modified();
+    }
+}
+
+//----------------------------------------------------------------------------
+bool vtkCPURayCastVolumeMapper::IsCompositing()
+{
+  return this->Comm && this->Comm->GetSize() > 1 && !this->Bricks->IsOpen();
+}
+
+//----------------------------------------------------------------------------
+bool vtkCPURayCastVolumeMapper::OpenBrickedVolume(const char *filename)
+{
+  this->Bricks->Close();
+  if (!filename || !this->Bricks->Open(filename))
+    {
+    vtkErrorMacro("Cannot open bricked volume "
+                  << (filename ? filename : "(null)"));
+    return false;
+    }
+
+  const BrickedVolumeInfo& info = this->Bricks->GetInfo();
+  if (info.components != 1 ||
+      (info.scalarType != SCALAR_UINT8 && !this->Bricks->IsCompressed()))
+    {
+    vtkErrorMacro("Only single component bricked volumes, 8-bit or "
+                  "compressed, can be rendered: " << filename);
+    this->Bricks->Close();
+    return false;
+    }
+
+  this->Streamer->SetVolume(this->Bricks);
+  this->Raycaster->VolumeModified();
+
+  vtkNew<vtkImageData> placeholder;
+  placeholder->SetDimensions(info.dims[0], info.dims[1], info.dims[2]);
+  placeholder->SetSpacing(info.spacing[0], info.spacing[1], info.spacing[2]);
+  placeholder->SetOrigin(info.origin[0], info.origin[1], info.origin[2]);
+  this->SetInputData(placeholder.GetPointer());
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkCPURayCastVolumeMapper::IsBrickedVolumeOpen()
+{
+  return this->Bricks->IsOpen();
+}
+
+//----------------------------------------------------------------------------
+void vtkCPURayCastVolumeMapper::GetBrickedScalarRange(double range[2])
+{
+  if (this->Bricks->IsOpen())
+    {
+    this->Bricks->GetScalarRange(range);
+    }
+  else
+    {
+    range[0] = 0.0;
+    range[1] = 255.0;
+    }
+}
+
+//----------------------------------------------------------------------------
+const void *vtkCPURayCastVolumeMapper::UpdateScalars(vtkImageData *input,
+                                                     int &scalarType,
+                                                     int &components)
+{
+  vtkDataArray *scalars = input->GetPointData()->GetScalars();
+  if (!scalars)
+    {
+    return NULL;
+    }
+
+  // 8-bit, 16-bit and float data of 1-4 components is ray cast in place,
+  // the wider types over the range of their last component. Components are
+  // dependent: the last one is the scalar, the others its colour.
+  int type = scalars->GetDataType();
+  components = scalars->GetNumberOfComponents();
+  if (components >= 1 && components <= 4 &&
+      (type == VTK_UNSIGNED_CHAR || type == VTK_UNSIGNED_SHORT ||
+       type == VTK_SHORT || type == VTK_FLOAT))
+    {
+    // the data array caches its range until it is modified
+    if (type == VTK_UNSIGNED_CHAR)
+      {
+      this->ScalarRange[0] = 0.0;
+      this->ScalarRange[1] = 255.0;
+      }
+    else
+      {
+      scalars->GetRange(this->ScalarRange, components - 1);
+      }
+    this->ConvertedScalars.clear();
+    if (scalars->GetMTime() > this->ScalarsBuildTime)
+      {
+      this->Raycaster->VolumeModified();
+      this->ScalarsBuildTime = scalars->GetMTime();
+      }
+    switch (type)
+      {
+      case VTK_UNSIGNED_SHORT: scalarType = SCALAR_UINT16; break;
+      case VTK_SHORT: scalarType = SCALAR_INT16; break;
+      case VTK_FLOAT: scalarType = SCALAR_FLOAT32; break;
+      default: scalarType = SCALAR_UINT8; break;
+      }
+    return scalars->GetVoidPointer(0);
+    }
+
+  // Anything else is rescaled to 8 bits over its range (last component)
+  if (scalars->GetMTime() > this->ScalarsBuildTime ||
+      this->ConvertedScalars.empty())
+    {
+    scalars->GetRange(this->ScalarRange, components - 1);
+    double magnitude = this->ScalarRange[1] - this->ScalarRange[0];
+    if (magnitude == 0.0)
+      {
+      magnitude = 1.0;
+      }
+
+    vtkIdType tuples = scalars->GetNumberOfTuples();
+    this->ConvertedScalars.resize(tuples);
+    switch (scalars->GetDataType())
+      {
+      vtkTemplateMacro(
+        ConvertToUnsignedChar(
+          static_cast<const VTK_TT *>(scalars->GetVoidPointer(0)), tuples,
+          scalars->GetNumberOfComponents(), -this->ScalarRange[0],
+          255.0 / magnitude, &this->ConvertedScalars[0]));
+      default:
+        vtkErrorMacro("Unsupported scalar type " << scalars->GetDataType());
+        this->ConvertedScalars.clear();
+        return NULL;
+      }
+    this->ScalarsBuildTime = scalars->GetMTime();
+    this->Raycaster->VolumeModified();
+    }
+
+  scalarType = SCALAR_UINT8;
+  components = 1;
+  return &this->ConvertedScalars[0];
+}
+
+//----------------------------------------------------------------------------
+// Samples the transfer functions of the property over the scalar range.
+// Nothing is done while neither they nor the range changed; after an edit
+// the ray caster compares the table with the previous one and redoes only
+// what the changed entries affect.
+void vtkCPURayCastVolumeMapper::UpdateTransferFunction(vtkVolume *vol)
+{
+  FrameProfiler::ScopedTimer timer(*this->Profiler,
+                                   this->TransferFunctionStage);
+  vtkVolumeProperty *property = vol->GetProperty();
+  const int n = TransferFunctionSize;
+
+  // The property includes its functions, the mapper the sample distance
+  // and the input the spacing
+  unsigned long mtime = std::max(property->GetMTime(), this->GetMTime());
+  mtime = std::max(mtime, this->GetInput()->GetMTime());
+  if (mtime == this->TransferFunctionMTime &&
+      std::equal(this->ScalarRange, this->ScalarRange + 2,
+                 this->TransferFunctionRange))
+    {
+    return;
+    }
+  this->TransferFunctionMTime = mtime;
+  std::copy(this->ScalarRange, this->ScalarRange + 2,
+            this->TransferFunctionRange);
+
+  float color[3 * TransferFunctionSize];
+  float opacity[TransferFunctionSize];
+  if (property->GetColorChannels() == 1)
+    {
+    property->GetGrayTransferFunction(0)->GetTable(
+      this->ScalarRange[0], this->ScalarRange[1], n, color);
+    for (int i = n - 1; i >= 0; --i)
+      {
+      color[3 * i] = color[3 * i + 1] = color[3 * i + 2] = color[i];
+      }
+    }
+  else
+    {
+    property->GetRGBTransferFunction(0)->GetTable(
+      this->ScalarRange[0], this->ScalarRange[1], n, color);
+    }
+  property->GetScalarOpacity(0)->GetTable(
+    this->ScalarRange[0], this->ScalarRange[1], n, opacity);
+
+  // Scalar opacity is defined per unit distance, correct it for the length
+  // of one sample step
+  double spacing[3];
+  this->GetInput()->GetSpacing(spacing);
+  double stepLength = this->SampleDistance *
+    (spacing[0] + spacing[1] + spacing[2]) / 3.0;
+  double unitDistance = property->GetScalarOpacityUnitDistance(0);
+  double exponent = unitDistance > 0.0 ? stepLength / unitDistance : 1.0;
+
+  this->TransferFunction.resize(4 * n);
+  for (int i = 0; i < n; ++i)
+    {
+    this->TransferFunction[4 * i] = color[3 * i];
+    this->TransferFunction[4 * i + 1] = color[3 * i + 1];
+    this->TransferFunction[4 * i + 2] = color[3 * i + 2];
+    this->TransferFunction[4 * i + 3] = static_cast<float>(
+      1.0 - pow(1.0 - std::min(1.0f, std::max(0.0f, opacity[i])), exponent));
+    }
+  this->Raycaster->SetTransferFunction(&this->TransferFunction[0], n);
+}
+
+//----------------------------------------------------------------------------
+// Picks the ray caster variant from the blend mode, the cropping of the
+// mapper and the interpolation and shading of the volume property.
+void vtkCPURayCastVolumeMapper::UpdateVariant(vtkVolume *vol)
+{
+  vtkVolumeProperty *property = vol->GetProperty();
+  CPURaycaster *raycaster = this->Raycaster;
+
+  switch (this->GetBlendMode())
+    {
+    case vtkVolumeMapper::MAXIMUM_INTENSITY_BLEND:
+      raycaster->SetBlendMode(BLEND_MAXIMUM);
+      break;
+    case vtkVolumeMapper::MINIMUM_INTENSITY_BLEND:
+      raycaster->SetBlendMode(BLEND_MINIMUM);
+      break;
+    case vtkVolumeMapper::ADDITIVE_BLEND:
+      raycaster->SetBlendMode(BLEND_ADDITIVE);
+      break;
+#if VTK_MAJOR_VERSION > 7 || (VTK_MAJOR_VERSION == 7 && VTK_MINOR_VERSION >= 1)
+    case vtkVolumeMapper::AVERAGE_INTENSITY_BLEND:
+      raycaster->SetBlendMode(BLEND_AVERAGE);
+      break;
+#endif
+    default:
+      raycaster->SetBlendMode(BLEND_COMPOSITE);
+      break;
+    }
+
+  raycaster->SetLinearInterpolation(
+    property->GetInterpolationType() != VTK_NEAREST_INTERPOLATION);
+  raycaster->SetShading(property->GetShade(0) != 0);
+  raycaster->SetShadingParameters(
+    static_cast<float>(property->GetAmbient(0)),
+    static_cast<float>(property->GetDiffuse(0)),
+    static_cast<float>(property->GetSpecular(0)),
+    static_cast<float>(property->GetSpecularPower(0)));
+
+  // Cropping planes are in data coordinates, the ray caster wants texture
+  // space (see RenderFrame)
+  raycaster->SetCropping(this->GetCropping() != 0);
+  if (this->GetCropping())
+    {
+    vtkImageData *input = this->GetInput();
+    double spacing[3], dataOrigin[3];
+    int dims[3], extent[6];
+    input->GetSpacing(spacing);
+    input->GetOrigin(dataOrigin);
+    input->GetExtent(extent);
+    input->GetDimensions(dims);
+
+    const double *planes = this->GetCroppingRegionPlanes();
+    float texturePlanes[6];
+    for (int i = 0; i < 6; ++i)
+      {
+      int axis = i / 2;
+      double low = dataOrigin[axis] + spacing[axis] * (extent[2 * axis] - 0.5);
+      texturePlanes[i] = static_cast<float>(
+        (planes[i] - low) / (spacing[axis] * dims[axis]));
+      }
+    raycaster->SetCroppingPlanes(texturePlanes);
+    raycaster->SetCroppingRegions(this->GetCroppingRegionFlags());
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkCPURayCastVolumeMapper::Render(vtkRenderer *ren, vtkVolume *vol)
+{
+  this->Profiler->SetEnabled(this->Profiling != 0);
+  this->Profiler->BeginFrame();
+  this->RenderFrame(ren, vol);
+  this->Profiler->EndFrame();
+}
+
+//----------------------------------------------------------------------------
+void vtkCPURayCastVolumeMapper::RenderFrame(vtkRenderer *ren, vtkVolume *vol)
+{
+  vtkImageData *input = this->GetInput();
+  if (!input)
+    {
+    vtkErrorMacro("No input!");
+    return;
+    }
+
+  // All ranks skip the frame alike, the collective calls stay in step
+  const bool compositing = this->IsCompositing();
+  if (compositing &&
+      this->GetBlendMode() != vtkVolumeMapper::COMPOSITE_BLEND &&
+      this->GetBlendMode() != vtkVolumeMapper::ADDITIVE_BLEND)
+    {
+    vtkErrorMacro("Intensity projections cannot be composited.");
+    return;
+    }
+
+  int dims[3];
+  input->GetDimensions(dims);
+  if (this->Bricks->IsOpen())
+    {
+    // 8-bit bricks cover 0..255 whatever their actual range, others are
+    // decoded onto it from the range of the brick table
+    this->ScalarRange[0] = 0.0;
+    this->ScalarRange[1] = 255.0;
+    if (this->Bricks->GetInfo().scalarType != SCALAR_UINT8)
+      {
+      this->Bricks->GetScalarRange(this->ScalarRange);
+      }
+    this->Raycaster->SetVolume(this->Bricks);
+    this->Raycaster->SetScalarRange(this->ScalarRange[0],
+                                    this->ScalarRange[1]);
+    this->Raycaster->SetBrickCacheBudget(
+      static_cast<size_t>(this->BrickCacheBudget));
+    }
+  else
+    {
+    FrameProfiler::ScopedTimer timer(*this->Profiler, this->ScalarsStage);
+    int scalarType = SCALAR_UINT8;
+    int components = 1;
+    const void *scalars = this->UpdateScalars(input, scalarType, components);
+    if (!scalars ||
+        !this->Raycaster->SetVolume(scalars, scalarType, components,
+                                    dims[0], dims[1], dims[2]))
+      {
+      vtkErrorMacro("Input cannot be ray cast: it needs point scalars and "
+                    "at least two samples along every axis.");
+      return;
+      }
+    if (compositing)
+      {
+      this->UpdatePieces(input);
+      }
+    if (scalarType != SCALAR_UINT8)
+      {
+      this->Raycaster->SetScalarRange(this->ScalarRange[0],
+                                      this->ScalarRange[1]);
+      }
+    }
+
+  this->UpdateTransferFunction(vol);
+  this->UpdateVariant(vol);
+  this->Raycaster->SetSampleDistance(this->SampleDistance);
+  this->Raycaster->SetThreadCount(this->NumberOfThreads);
+  this->Raycaster->SetPacketWidth(this->PacketWidth);
+  this->Raycaster->SetEmptySpaceSkipping(this->EmptySpaceSkipping != 0);
+  this->Raycaster->SetDominatedCellSkipping(this->DominatedCellSkipping != 0);
+  this->Raycaster->SetPreIntegration(this->PreIntegration != 0);
+  this->Raycaster->SetLevelOfDetail(this->LevelOfDetail != 0);
+  this->Raycaster->SetLevelOfDetailTolerance(this->LevelOfDetailTolerance);
+  this->Raycaster->SetGradientCache(this->GradientCache != 0);
+
+  int size[2], origin[2];
+  ren->GetTiledSizeAndOrigin(&size[0], &size[1], &origin[0], &origin[1]);
+  if (size[0] <= 0 || size[1] <= 0)
+    {
+    return;
+    }
+
+  // Texture space [0,1]^3 covers the voxels plus half a voxel of border,
+  // as a 3D texture does: texel centres sit at (i+0.5)/dims
+  double spacing[3], dataOrigin[3];
+  int extent[6];
+  input->GetSpacing(spacing);
+  input->GetOrigin(dataOrigin);
+  input->GetExtent(extent);
+
+  vtkNew<vtkMatrix4x4> textureToData;
+  for (int i = 0; i < 3; ++i)
+    {
+    textureToData->SetElement(i, i, spacing[i] * dims[i]);
+    textureToData->SetElement(i, 3,
+      dataOrigin[i] + spacing[i] * (extent[2 * i] - 0.5));
+    }
+
+  vtkMatrix4x4 *worldToClip = ren->GetActiveCamera()->
+    GetCompositeProjectionTransformMatrix(ren->GetTiledAspectRatio(), -1, 1);
+
+  vtkNew<vtkMatrix4x4> textureToWorld;
+  vtkNew<vtkMatrix4x4> textureToClip;
+  vtkMatrix4x4::Multiply4x4(vol->GetMatrix(), textureToData.GetPointer(),
+                            textureToWorld.GetPointer());
+  vtkMatrix4x4::Multiply4x4(worldToClip, textureToWorld.GetPointer(),
+                            textureToClip.GetPointer());
+
+  // The opaque geometry is rendered by now, its depth ends the rays
+  if (this->IntermixIntersectingGeometry)
+    {
+    this->DepthImage.resize(static_cast<size_t>(size[0]) * size[1]);
+    ren->GetRenderWindow()->GetZbufferData(
+      origin[0], origin[1], origin[0] + size[0] - 1, origin[1] + size[1] - 1,
+      &this->DepthImage[0]);
+    this->Raycaster->SetDepthImage(&this->DepthImage[0], size[0], size[1]);
+    }
+  else
+    {
+    this->DepthImage.clear();
+    this->Raycaster->SetDepthImage(NULL, 0, 0);
+    }
+
+  Mat4 textureToClipMatrix = Mat4::FromRowMajor(&textureToClip->Element[0][0]);
+  if (this->Bricks->IsOpen())
+    {
+    // Page in what the view needs, drop what it no longer does
+    FrameProfiler::ScopedTimer timer(*this->Profiler, this->BricksStage);
+    this->Streamer->SetMemoryBudget(
+      static_cast<size_t>(this->BrickMemoryBudget));
+    int visible =
+      this->Streamer->Update(textureToClipMatrix, &this->TransferFunction[3],
+                             TransferFunctionSize, 4, this->ScalarRange);
+    this->Profiler->AddCount(this->CulledBricksCounter,
+                             this->Bricks->GetNumberOfBricks() - visible);
+    }
+
+  // A piece casts rays through the region it owns only
+  if (compositing)
+    {
+    int rank = this->Comm->GetRank();
+    float region[6];
+    this->Decomposition->GetRegion(rank, region);
+    this->Raycaster->SetPiece(this->Decomposition->GetPieceToVolume(rank),
+                              region);
+    }
+  else
+    {
+    this->Raycaster->ClearPiece();
+    }
+
+  const float *image;
+  if (this->Progressive && !compositing)
+    {
+    // Anything that changes the picture restarts the refinement
+    unsigned long mtime = std::max(this->GetMTime(), this->ScalarsBuildTime);
+    mtime = std::max(mtime, vol->GetProperty()->GetMTime());
+    if (!std::equal(textureToClipMatrix.m, textureToClipMatrix.m + 16,
+                    this->RefinedTextureToClip) ||
+        this->Raycaster->GetTransferFunctionVersion() !=
+          this->RefinedTransferFunctionVersion ||
+        this->DepthImage != this->RefinedDepthImage ||
+        mtime != this->RefinedMTime)
+      {
+      std::copy(textureToClipMatrix.m, textureToClipMatrix.m + 16,
+                this->RefinedTextureToClip);
+      this->RefinedTransferFunctionVersion =
+        this->Raycaster->GetTransferFunctionVersion();
+      this->RefinedDepthImage = this->DepthImage;
+      this->RefinedMTime = mtime;
+      this->Refinement->Invalidate();
+      this->NextTile = 0;
+      }
+    this->RenderProgressive(textureToClipMatrix, size);
+    image = &this->Accumulation[0];
+    }
+  else if (this->TemporalReprojection && !compositing)
+    {
+    // The cached frame is only good for the same data and classification
+    unsigned long mtime = std::max(this->GetMTime(), this->ScalarsBuildTime);
+    mtime = std::max(mtime, vol->GetProperty()->GetMTime());
+    if (this->Raycaster->GetTransferFunctionVersion() !=
+          this->ReprojectedTransferFunctionVersion ||
+        mtime != this->ReprojectedMTime)
+      {
+      this->ReprojectedTransferFunctionVersion =
+        this->Raycaster->GetTransferFunctionVersion();
+      this->ReprojectedMTime = mtime;
+      this->Reprojection->Invalidate();
+      }
+    this->RenderReprojected(textureToClipMatrix, size);
+    image = this->Reprojection->GetImage();
+    }
+  else
+    {
+    this->Raycaster->SetJitter(0.0f, 0.0f);
+    this->Raycaster->Render(textureToClipMatrix, size[0], size[1]);
+    image = this->Raycaster->GetImage();
+    if (compositing)
+      {
+      if (!this->CompositeImage(textureToClipMatrix, size))
+        {
+        return;
+        }
+      image = &this->Composited[0];
+      }
+    }
+
+  FrameProfiler::ScopedTimer timer(*this->Profiler, this->DisplayStage);
+  // The display helper wants a power of two texture
+  int memorySize[2] = { NextPowerOfTwo(size[0]), NextPowerOfTwo(size[1]) };
+  int imageOrigin[2] = { 0, 0 };
+  this->Image.assign(4 * memorySize[0] * memorySize[1], 0);
+
+  for (int y = 0; y < size[1]; ++y)
+    {
+    const float *src = image + 4 * y * size[0];
+    unsigned char *dst = &this->Image[4 * y * memorySize[0]];
+    for (int i = 0; i < 4 * size[0]; ++i)
+      {
+      float v = std::min(1.0f, std::max(0.0f, src[i]));
+      dst[i] = static_cast<unsigned char>(v * 255.0f + 0.5f);
+      }
+    }
+
+  this->ImageDisplayHelper->RenderTexture(vol, ren, memorySize, size, size,
+                                          imageOrigin, -1.0f,
+                                          &this->Image[0]);
+}
+
+//----------------------------------------------------------------------------
+// Renders the current refinement pass, or as many of its tiles as fit into
+// the frame budget, and merges them into the full size Accumulation image.
+// Once refinement converged the accumulated image is just shown again.
+void vtkCPURayCastVolumeMapper::RenderProgressive(const Mat4 &textureToClip,
+                                                  const int size[2])
+{
+  ProgressiveRefinement *refinement = this->Refinement;
+  refinement->SetFrameBudget(this->FrameBudget);
+  refinement->SetImageSize(size[0], size[1]);
+  if (this->Accumulation.size() != static_cast<size_t>(4 * size[0] * size[1]))
+    {
+    this->Accumulation.assign(4 * size[0] * size[1], 0.0f);
+    refinement->Invalidate();
+    this->NextTile = 0;
+    }
+  if (refinement->IsConverged())
+    {
+    return;
+    }
+
+  const ProgressiveRefinement::Pass pass = refinement->GetPass();
+  const int ds = pass.downsample;
+  int passSize[2] = { (size[0] + ds - 1) / ds, (size[1] + ds - 1) / ds };
+
+  // Pass pixel p covers the full size pixels [p*ds, p*ds+ds), so clip
+  // space is scaled to put passSize*ds pixels where size pixels were
+  Mat4 fullToPass;
+  for (int i = 0; i < 2; ++i)
+    {
+    double a = static_cast<double>(size[i]) / (passSize[i] * ds);
+    fullToPass(i, i) = a;
+    fullToPass(i, 3) = a - 1.0;
+    }
+
+  // Interactive passes are rendered whole, refinement passes as far as
+  // the budget goes
+  const int tileSize = this->Raycaster->GetTileSize();
+  const int tiles = this->Raycaster->GetNumberOfTiles(passSize[0], passSize[1]);
+  int first = pass.interactive ? 0 : this->NextTile;
+  int count = tiles - first;
+  if (!pass.interactive)
+    {
+    long long budget = refinement->GetPixelBudget() / (tileSize * tileSize);
+    count = static_cast<int>(std::min<long long>(count, std::max(budget, 1LL)));
+    }
+
+  this->Raycaster->SetSampleDistance(
+    this->SampleDistance * pass.sampleDistanceScale);
+  this->Raycaster->SetJitter(pass.jitter[0], pass.jitter[1]);
+  double start = vtkTimerLog::GetUniversalTime();
+  this->Raycaster->RenderTiles(fullToPass * textureToClip,
+                               passSize[0], passSize[1], first, count);
+  double seconds = vtkTimerLog::GetUniversalTime() - start;
+
+  // Supersampling passes average into the image, the others replace it
+  // with every pass pixel repeated ds x ds times
+  const float *image = this->Raycaster->GetImage();
+  const int tilesX = (passSize[0] + tileSize - 1) / tileSize;
+  const float weight = 1.0f / (pass.supersample + 1);
+  long long pixels = 0;
+  for (int tile = first; tile < first + count; ++tile)
+    {
+    int x0 = (tile % tilesX) * tileSize;
+    int y0 = (tile / tilesX) * tileSize;
+    int x1 = std::min(x0 + tileSize, passSize[0]);
+    int y1 = std::min(y0 + tileSize, passSize[1]);
+    pixels += static_cast<long long>(x1 - x0) * (y1 - y0);
+
+    for (int y = y0 * ds; y < std::min(y1 * ds, size[1]); ++y)
+      {
+      const float *src = image + 4 * (y / ds) * passSize[0];
+      float *dst = &this->Accumulation[4 * y * size[0]];
+      for (int x = x0 * ds; x < std::min(x1 * ds, size[0]); ++x)
+        {
+        for (int c = 0; c < 4; ++c)
+          {
+          float v = src[4 * (x / ds) + c];
+          float &a = dst[4 * x + c];
+          a = pass.supersample ? a + (v - a) * weight : v;
+          }
+        }
+      }
+    }
+
+  this->NextTile = first + count;
+  bool complete = this->NextTile >= tiles;
+  if (complete)
+    {
+    this->NextTile = 0;
+    }
+  refinement->FrameRendered(seconds, pixels, complete);
+}
+
+//----------------------------------------------------------------------------
+// Moves the cached frame into the view of textureToClip, ray casts the
+// pixels it cannot supply and caches the merged image for the next frame.
+void vtkCPURayCastVolumeMapper::RenderReprojected(const Mat4 &textureToClip,
+                                                  const int size[2])
+{
+  ReprojectionCache *cache = this->Reprojection;
+  cache->SetMaximumError(this->MaximumReprojectionError);
+  cache->SetRefreshPeriod(this->ReprojectionRefreshPeriod);
+  double start = FrameProfiler::Now();
+  cache->Reproject(textureToClip, size[0], size[1],
+                   this->DepthImage.empty() ? NULL : &this->DepthImage[0]);
+  this->Profiler->AddTime(this->ReprojectStage, FrameProfiler::Now() - start);
+
+  // A ray is anchored where it reached 5% opacity
+  this->Raycaster->SetJitter(0.0f, 0.0f);
+  this->Raycaster->SetRayMask(cache->GetRecastMask());
+  this->Raycaster->SetRayDepthRecording(0.05f);
+  this->Raycaster->Render(textureToClip, size[0], size[1]);
+  this->Raycaster->SetRayMask(NULL);
+  this->Raycaster->SetRayDepthRecording(0.0f);
+
+  FrameProfiler::ScopedTimer timer(*this->Profiler, this->ReprojectStage);
+  cache->Update(this->Raycaster->GetImage(), this->Raycaster->GetRayDepths());
+}
+
+//----------------------------------------------------------------------------
+// Every rank learns the extents of all pieces and the scalar range of the
+// whole volume, so that the transfer functions and the visibility order
+// agree across ranks.
+void vtkCPURayCastVolumeMapper::UpdatePieces(vtkImageData *input)
+{
+  const int ranks = this->Comm->GetSize();
+  int extent[6];
+  input->GetExtent(extent);
+  float local[8];
+  for (int i = 0; i < 6; ++i)
+    {
+    local[i] = static_cast<float>(extent[i]);
+    }
+  local[6] = static_cast<float>(this->ScalarRange[0]);
+  local[7] = static_cast<float>(this->ScalarRange[1]);
+
+  std::vector<float> all(8 * ranks);
+  this->Comm->AllGather(local, 8, &all[0]);
+  std::vector<int> extents(6 * ranks);
+  for (int r = 0; r < ranks; ++r)
+    {
+    for (int i = 0; i < 6; ++i)
+      {
+      extents[6 * r + i] = static_cast<int>(all[8 * r + i]);
+      }
+    this->ScalarRange[0] =
+      std::min<double>(this->ScalarRange[0], all[8 * r + 6]);
+    this->ScalarRange[1] =
+      std::max<double>(this->ScalarRange[1], all[8 * r + 7]);
+    }
+  this->Decomposition->SetPieces(&extents[0], ranks);
+}
+
+//----------------------------------------------------------------------------
+// Composites the image of every piece on rank 0, front to back as seen by
+// the camera of the whole volume. The other ranks have nothing to show.
+bool vtkCPURayCastVolumeMapper::CompositeImage(const Mat4 &textureToClip,
+                                               const int size[2])
+{
+  FrameProfiler::ScopedTimer timer(*this->Profiler, this->CompositeStage);
+  const int rank = this->Comm->GetRank();
+  Mat4 volumeToPiece;
+  this->Decomposition->GetPieceToVolume(rank).Invert(volumeToPiece);
+  std::vector<int> order;
+  this->Decomposition->GetVisibilityOrder(textureToClip * volumeToPiece,
+                                          order);
+
+  const float *image = this->Raycaster->GetImage();
+  this->Composited.assign(image, image + 4 * size[0] * size[1]);
+  this->Compositor->SetOperator(
+    this->GetBlendMode() == vtkVolumeMapper::ADDITIVE_BLEND ?
+    ImageCompositor::ADD : ImageCompositor::OVER);
+  this->Compositor->Composite(*this->Comm, order, &this->Composited[0],
+                              size[0] * size[1]);
+  return rank == 0;
+}
+
+//----------------------------------------------------------------------------
+bool vtkCPURayCastVolumeMapper::IsRefining()
+{
+  return this->Progressive && !this->IsCompositing() &&
+    !this->Refinement->IsConverged();
+}
+
+//----------------------------------------------------------------------------
+vtkTypeUInt64 vtkCPURayCastVolumeMapper::GetSampledSteps()
+{
+  return this->Raycaster->GetStatistics().sampledSteps;
+}
+
+//----------------------------------------------------------------------------
+vtkTypeUInt64 vtkCPURayCastVolumeMapper::GetSkippedSteps()
+{
+  return this->Raycaster->GetStatistics().skippedSteps;
+}
+
+//----------------------------------------------------------------------------
+void vtkCPURayCastVolumeMapper::ReleaseGraphicsResources(vtkWindow *)
+{
+  this->Image.clear();
+}
+
+//----------------------------------------------------------------------------
+void vtkCPURayCastVolumeMapper::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "SampleDistance: " << this->SampleDistance << endl;
+  os << indent << "NumberOfThreads: " << this->NumberOfThreads << endl;
+  os << indent << "PacketWidth: " << this->PacketWidth
+     << " (running " << this->Raycaster->GetPacketWidth() << ")" << endl;
+  os << indent << "EmptySpaceSkipping: " << this->EmptySpaceSkipping << endl;
+  os << indent << "DominatedCellSkipping: " << this->DominatedCellSkipping
+     << endl;
+  os << indent << "PreIntegration: " << this->PreIntegration << endl;
+  os << indent << "LevelOfDetail: " << this->LevelOfDetail << endl;
+  os << indent << "LevelOfDetailTolerance: "
+     << this->LevelOfDetailTolerance << endl;
+  const GradientVolume &gradients = this->Raycaster->GetGradientVolume();
+  os << indent << "GradientCache: " << this->GradientCache;
+  if (gradients.IsValid())
+    {
+    os << " (" << gradients.GetMemorySize() << " bytes, built in "
+       << gradients.GetBuildTime() * 1000.0 << " ms)";
+    }
+  os << endl;
+  os << indent << "IntermixIntersectingGeometry: "
+     << this->IntermixIntersectingGeometry << endl;
+  os << indent << "Variant: " << this->Raycaster->GetVariant().GetName()
+     << endl;
+  os << indent << "BrickMemoryBudget: " << this->BrickMemoryBudget << endl;
+  os << indent << "BrickCacheBudget: " << this->BrickCacheBudget << endl;
+  os << indent << "Profiling: " << this->Profiling << endl;
+  os << indent << "Progressive: " << this->Progressive << endl;
+  os << indent << "FrameBudget: " << this->FrameBudget << endl;
+  os << indent << "TemporalReprojection: " << this->TemporalReprojection
+     << endl;
+  os << indent << "MaximumReprojectionError: "
+     << this->MaximumReprojectionError << endl;
+  os << indent << "ReprojectionRefreshPeriod: "
+     << this->ReprojectionRefreshPeriod << endl;
+  os << indent << "Communicator: ";
+  if (this->Comm)
+    {
+    os << "rank " << this->Comm->GetRank() << " of " << this->Comm->GetSize()
+       << endl;
+    }
+  else
+    {
+    os << "(none)" << endl;
+    }
+  os << indent << "BrickedVolume: "
+     << (this->Bricks->IsOpen() ? "open" : "none");
+  if (this->Bricks->IsOpen() && this->Bricks->IsCompressed())
+    {
+    const BrickCache& cache = this->Raycaster->GetBrickCache();
+    os << ", compressed (" << cache.GetResidentBricks()
+       << " bricks cached, " << cache.GetDecodedBricks() << " decoded in "
+       << cache.GetDecodeTime() * 1000.0 << " ms)";
+    }
+  os << endl;
+}
@@ -0,0 +1,340 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    vtkCPURayCastVolumeMapper.h
+
+  Copyright (c) Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+// .NAME vtkCPURayCastVolumeMapper - volume mapper driving the CPU ray caster
+// .SECTION Description
+// vtkCPURayCastVolumeMapper renders vtkImageData with the multithreaded,
+// SIMD ray caster of CPU/CPURaycasting, which follows the front-to-back
+// compositing of the GLSL ray caster. The finished image is handed to
+// vtkRayCastImageDisplayHelper, so no GPU ray casting support is required.
+//
+// Instead of an input, a bricked .bvol file (see Common/BrickedVolume.h) can
+// be opened with OpenBrickedVolume(). It is memory mapped and rendered in
+// place; before every frame the bricks outside the view frustum or of zero
+// opacity are released down to BrickMemoryBudget. The bricks of compressed
+// files are decoded as rays reach them into a cache of BrickCacheBudget
+// bytes, which keeps the most recently sampled ones.
+//
+// In progressive mode every frame is held to FrameBudget: while the view
+// changes the image is rendered at reduced resolution and/or sample
+// density, once it settles it is refined over the following renders up to
+// full resolution and jittered supersampling. IsRefining() tells the
+// application to keep rendering.
+//
+// The blend mode (composite, maximum, minimum, average and additive),
+// cropping, and the interpolation type and shading of the volume property
+// are honoured; each combination runs a ray march kernel specialized for
+// it. Shading uses a headlight with the ambient, diffuse, specular and
+// specular power coefficients of the property. 8-bit, 16-bit and float
+// scalars of 1-4 components are ray cast in place, anything else is
+// converted to 8 bits.
+// Components are dependent, as with IndependentComponentsOff: the last one
+// is classified by the opacity function, two components are coloured by
+// the colour function of the first one, three and four are RGB.
+//
+// With TemporalReprojection the previous frame is reused while the camera
+// orbits: its pixels are moved to where they land in the new view and only
+// the pixels they leave uncovered, those whose rays changed too much
+// (MaximumReprojectionError) and a rotating set of rows
+// (ReprojectionRefreshPeriod) are ray cast again (see
+// Common/ReprojectionCache.h). Changes to the data or its classification
+// recast the whole image.
+//
+// Given a Communicator the mapper renders sort-last in parallel: the input
+// of every process is its piece of the volume, a VTK piece extent sharing
+// its boundary points with its neighbours. Each process ray casts the
+// region its piece owns and the images are composited in visibility order
+// by binary swap (see Common/ImageCompositor.h); only rank 0 displays the
+// result. Every rank must render every frame, at the same image size.
+
+#ifndef __vtkCPURayCastVolumeMapper_h
+#define __vtkCPURayCastVolumeMapper_h
+
+#include <vtkVolumeMapper.h>
+
+#include <vector>
+
+class BrickStreamer;
+class BrickedVolume;
+class Communicator;
+class CPURaycaster;
+class FrameProfiler;
+class ImageCompositor;
+class ProgressiveRefinement;
+class ReprojectionCache;
+class VolumeDecomposition;
+struct Mat4;
+class vtkRayCastImageDisplayHelper;
+
+class vtkCPURayCastVolumeMapper : public vtkVolumeMapper
+{
+public:
+  static vtkCPURayCastVolumeMapper *New();
+  vtkTypeMacro(vtkCPURayCastVolumeMapper, vtkVolumeMapper);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  // Description:
+  // Distance between samples in voxels. Default is 1.0.
+  vtkSetClampMacro(SampleDistance, float, 0.01f, 100.0f);
+  vtkGetMacro(SampleDistance, float);
+
+  // Description:
+  // Number of threads used by the ray caster, 0 (default) uses all cores.
+  vtkSetMacro(NumberOfThreads, int);
+  vtkGetMacro(NumberOfThreads, int);
+
+  // Description:
+  // Rays per SIMD packet (1, 4, 8 or 16), 0 (default) picks the widest
+  // packet the processor supports.
+  vtkSetMacro(PacketWidth, int);
+  vtkGetMacro(PacketWidth, int);
+
+  // Description:
+  // Skip macro cells whose scalar range maps to zero opacity. Default is on.
+  vtkSetMacro(EmptySpaceSkipping, int);
+  vtkGetMacro(EmptySpaceSkipping, int);
+  vtkBooleanMacro(EmptySpaceSkipping, int);
+
+  // Description:
+  // Maximum and minimum intensity projections: with EmptySpaceSkipping on,
+  // also skip macro cells whose scalar range cannot beat a ray's extreme.
+  // Saves samples, but only saves time where large regions are dominated.
+  // Default is off.
+  vtkSetMacro(DominatedCellSkipping, int);
+  vtkGetMacro(DominatedCellSkipping, int);
+  vtkBooleanMacro(DominatedCellSkipping, int);
+
+  // Description:
+  // Composite ray segments through a pre-integrated transfer function
+  // table, so sharp transfer functions render without slicing artefacts at
+  // 2-4x larger sample distances. Default is off.
+  vtkSetMacro(PreIntegration, int);
+  vtkGetMacro(PreIntegration, int);
+  vtkBooleanMacro(PreIntegration, int);
+
+  // Description:
+  // Sample coarser levels of a mipmap pyramid of the volume where voxels
+  // project to less than a pixel, with proportionally larger sample
+  // distances. LevelOfDetailTolerance is the largest on-screen size of a
+  // sampled voxel in pixels. Default is off, tolerance 1.
+  vtkSetMacro(LevelOfDetail, int);
+  vtkGetMacro(LevelOfDetail, int);
+  vtkBooleanMacro(LevelOfDetail, int);
+  vtkSetClampMacro(LevelOfDetailTolerance, float, 0.25f, 16.0f);
+  vtkGetMacro(LevelOfDetailTolerance, float);
+
+  // Description:
+  // Shade from gradients precomputed once per volume, 3 bytes per voxel,
+  // instead of central differences at every sample. Default is on.
+  vtkSetMacro(GradientCache, int);
+  vtkGetMacro(GradientCache, int);
+  vtkBooleanMacro(GradientCache, int);
+
+  // Description:
+  // End the rays at the opaque geometry the renderer drew before the
+  // volume, read from the depth buffer of the render window, so that
+  // surfaces inside the volume are embedded in it. With a Communicator
+  // every rank reads its own depth buffer. Default is on.
+  vtkSetClampMacro(IntermixIntersectingGeometry, int, 0, 1);
+  vtkGetMacro(IntermixIntersectingGeometry, int);
+  vtkBooleanMacro(IntermixIntersectingGeometry, int);
+
+  // Description:
+  // Progressive rendering under FrameBudget (see class description).
+  // Default is off.
+  vtkSetMacro(Progressive, int);
+  vtkGetMacro(Progressive, int);
+  vtkBooleanMacro(Progressive, int);
+
+  // Description:
+  // Target time per frame in seconds for progressive rendering. The
+  // resolution and sample distance of interactive frames and the number of
+  // tiles refined per frame follow from the measured render times.
+  // Default is 1/30.
+  vtkSetClampMacro(FrameBudget, double, 0.001, 10.0);
+  vtkGetMacro(FrameBudget, double);
+
+  // Description:
+  // Temporal reprojection of the previous frame (see class description).
+  // Progressive and composited renders do not reproject. Default is off.
+  vtkSetMacro(TemporalReprojection, int);
+  vtkGetMacro(TemporalReprojection, int);
+  vtkBooleanMacro(TemporalReprojection, int);
+
+  // Description:
+  // Largest on-screen parallax in pixels between the front and back of a
+  // reused ray. Default is 1.
+  vtkSetClampMacro(MaximumReprojectionError, float, 0.0f, 100.0f);
+  vtkGetMacro(MaximumReprojectionError, float);
+
+  // Description:
+  // Every pixel is recast at least once in this many frames, 0 never
+  // refreshes. Default is 8.
+  vtkSetClampMacro(ReprojectionRefreshPeriod, int, 0, 1000);
+  vtkGetMacro(ReprojectionRefreshPeriod, int);
+
+  // Description:
+  // True while progressive rendering has passes left; render again to
+  // refine the image further.
+  bool IsRefining();
+
+  // Description:
+  // Render a bricked volume file instead of the input. A placeholder input
+  // carrying the geometry of the volume is set, so bounds and picking keep
+  // working. Only single component files can be rendered, 8-bit ones or
+  // compressed ones of any scalar type.
+  bool OpenBrickedVolume(const char *filename);
+  bool IsBrickedVolumeOpen();
+
+  // Description:
+  // Bytes of bricks kept mapped in memory while streaming a bricked volume,
+  // 0 (default) keeps every brick that was visible once.
+  vtkSetMacro(BrickMemoryBudget, vtkTypeUInt64);
+  vtkGetMacro(BrickMemoryBudget, vtkTypeUInt64);
+
+  // Description:
+  // Bytes of decoded bricks kept between frames while rendering a
+  // compressed bricked volume, 0 keeps every brick decoded once. Defaults
+  // to 512 MB.
+  vtkSetMacro(BrickCacheBudget, vtkTypeUInt64);
+  vtkGetMacro(BrickCacheBudget, vtkTypeUInt64);
+
+  // Description:
+  // Scalar range of the open bricked volume, read from the brick table
+  // without touching voxel data.
+  void GetBrickedScalarRange(double range[2]);
+
+  // Description:
+  // Samples composited and samples jumped over in empty space during the
+  // last render.
+  vtkTypeUInt64 GetSampledSteps();
+  vtkTypeUInt64 GetSkippedSteps();
+
+  // Description:
+  // Processes to composite with (see class description), NULL (default)
+  // renders alone. Progressive rendering and bricked volumes are not
+  // composited, nor are maximum, minimum and average intensity projections,
+  // whose images lack the projected scalar. Inputs converted to 8 bits map the
+  // scalar range of their own piece onto the transfer functions.
+  void SetCommunicator(Communicator *comm);
+  Communicator *GetCommunicator() { return this->Comm; }
+
+  // Description:
+  // Record a per-frame breakdown of every render: CPU time of the scalar
+  // conversion, transfer function, brick streaming, classification, ray
+  // march, compositing and display stages, and the ray, sample, skipped sample,
+  // early-terminated ray and culled brick counts. Default is off, which
+  // costs one branch per stage.
+  vtkSetMacro(Profiling, int);
+  vtkGetMacro(Profiling, int);
+  vtkBooleanMacro(Profiling, int);
+
+  // Description:
+  // Breakdown of the last frame and averages since the last Reset().
+  FrameProfiler *GetProfiler() { return this->Profiler; }
+
+  virtual void Render(vtkRenderer *ren, vtkVolume *vol);
+  virtual void ReleaseGraphicsResources(vtkWindow *);
+
+protected:
+  vtkCPURayCastVolumeMapper();
+  ~vtkCPURayCastVolumeMapper();
+
+  // Description:
+  // Make the input scalars available to the ray caster, in place or
+  // converted to 8-bit values spanning the scalar range; scalarType and
+  // components are set to their ScalarType and number of components.
+  // Returns NULL when the input cannot be rendered.
+  const void *UpdateScalars(vtkImageData *input, int &scalarType,
+                            int &components);
+  void UpdateTransferFunction(vtkVolume *vol);
+  void UpdateVariant(vtkVolume *vol);
+  void RenderFrame(vtkRenderer *ren, vtkVolume *vol);
+  void RenderProgressive(const Mat4 &textureToClip, const int size[2]);
+  void RenderReprojected(const Mat4 &textureToClip, const int size[2]);
+  bool IsCompositing();
+  void UpdatePieces(vtkImageData *input);
+  bool CompositeImage(const Mat4 &textureToClip, const int size[2]);
+
+  float SampleDistance;
+  int NumberOfThreads;
+  int PacketWidth;
+  int EmptySpaceSkipping;
+  int DominatedCellSkipping;
+  int PreIntegration;
+  int LevelOfDetail;
+  float LevelOfDetailTolerance;
+  int GradientCache;
+  int IntermixIntersectingGeometry;
+  vtkTypeUInt64 BrickMemoryBudget;
+  vtkTypeUInt64 BrickCacheBudget;
+  int Profiling;
+  int Progressive;
+  double FrameBudget;
+  int TemporalReprojection;
+  float MaximumReprojectionError;
+  int ReprojectionRefreshPeriod;
+
+  CPURaycaster *Raycaster;
+  BrickedVolume *Bricks;
+  BrickStreamer *Streamer;
+  vtkRayCastImageDisplayHelper *ImageDisplayHelper;
+
+  FrameProfiler *Profiler;
+  int ScalarsStage;
+  int TransferFunctionStage;
+  int BricksStage;
+  int CompositeStage;
+  int DisplayStage;
+  int ReprojectStage;
+  int CulledBricksCounter;
+
+  // Progressive rendering state: the full size image the passes are merged
+  // into, the next tile of an unfinished pass and what the image shows
+  ProgressiveRefinement *Refinement;
+  std::vector<float> Accumulation;
+  int NextTile;
+  double RefinedTextureToClip[16];
+  unsigned RefinedTransferFunctionVersion;
+  std::vector<float> RefinedDepthImage;
+  unsigned long RefinedMTime;
+
+  // Temporal reprojection state: the cached frame and what it shows
+  ReprojectionCache *Reprojection;
+  unsigned ReprojectedTransferFunctionVersion;
+  unsigned long ReprojectedMTime;
+
+  std::vector<unsigned char> ConvertedScalars;
+  unsigned long ScalarsBuildTime;
+  double ScalarRange[2];
+
+  // Sort-last state: the pieces of all ranks and the composited image
+  Communicator *Comm;
+  ImageCompositor *Compositor;
+  VolumeDecomposition *Decomposition;
+  std::vector<float> Composited;
+
+  // The sampled transfer function and the state it was sampled for
+  std::vector<float> TransferFunction;
+  unsigned long TransferFunctionMTime;
+  double TransferFunctionRange[2];
+  std::vector<float> DepthImage;
+  std::vector<unsigned char> Image;
+
+private:
+  vtkCPURayCastVolumeMapper(const vtkCPURayCastVolumeMapper&); // Not implemented.
+  void operator=(const vtkCPURayCastVolumeMapper&); // Not implemented.
+};
+
+#endif
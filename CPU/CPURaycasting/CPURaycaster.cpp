@@ -0,0 +1,847 @@
+#include "CPURaycaster.h"
+#include "BrickedVolume.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+//the processor features are probed once, the kernels compiled for them are
+//only linked in when the compiler could build them (see CMakeLists.txt)
+#if defined(_MSC_VER) && (defined(CPURAYCASTER_HAVE_AVX2) || defined(CPURAYCASTER_HAVE_AVX512))
+//the instruction set bits alone are not enough, the OS must also save the
+//wide registers on a context switch (OSXSAVE and the XCR0 state mask)
+static bool OsSavesState(unsigned long long mask)
+{
+    int info[4];
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 27)) == 0)
+        return false;
+    return (_xgetbv(0) & mask) == mask;
+}
+#endif
+
+static bool CpuHasAVX2()
+{
+#if defined(CPURAYCASTER_HAVE_AVX2) && (defined(__GNUC__) || defined(__clang__))
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#elif defined(CPURAYCASTER_HAVE_AVX2) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    bool avx = (info[2] & (1 << 28)) != 0;
+    bool fma = (info[2] & (1 << 12)) != 0;
+    if (!avx || !fma || !OsSavesState(0x6))
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return false;
+#endif
+}
+
+static bool CpuHasAVX512()
+{
+#if defined(CPURAYCASTER_HAVE_AVX512) && (defined(__GNUC__) || defined(__clang__))
+    return __builtin_cpu_supports("avx512f");
+#elif defined(CPURAYCASTER_HAVE_AVX512) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 28)) == 0 || !OsSavesState(0x6 | 0xE0))
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 16)) != 0;
+#else
+    return false;
+#endif
+}
+
+static RayMarchFunction KernelForWidth(int width)
+{
+    switch (width) {
+#if defined(CPURAYCASTER_HAVE_AVX512)
+    case 16: return RayMarchAVX512;
+#endif
+#if defined(CPURAYCASTER_HAVE_AVX2)
+    case 8: return RayMarchAVX2;
+#endif
+    case 4: return RayMarchSSE;
+    default: return RayMarchScalar;
+    }
+}
+
+int CPURaycaster::GetMaximumPacketWidth()
+{
+    static const int width = CpuHasAVX512() ? 16 : (CpuHasAVX2() ? 8 : 4);
+    return width;
+}
+
+CPURaycaster::CPURaycaster(void)
+{
+    _volume = 0;
+    _brickedVolume = 0;
+    _dims[0] = _dims[1] = _dims[2] = 0;
+    _scalarScale = 1.0f;
+    _scalarShift = 0.0f;
+    _ambient = 0.0f;
+    _diffuse = 1.0f;
+    _specular = 0.0f;
+    _specularPower = 1.0f;
+    _gradientCache = false;
+    _gradientsDirty = true;
+    for (int i = 0; i < 6; i++)
+        _cropPlanes[i] = i % 2 ? 1.0f : 0.0f;
+    _cropRegions = CROP_SUBVOLUME;
+    ClearPiece();
+    _depth = 0;
+    _depthWidth = _depthHeight = 0;
+    _rayMask = 0;
+    _significantOpacity = 0.0f;
+    _tfSize = 0;
+    _tfVersion = 0;
+    _preIntegration = false;
+    _emptySpaceSkipping = true;
+    _dominatedCellSkipping = false;
+    _macroCellSize = 8;
+    _gridDirty = true;
+    _valueRange[0] = 0;
+    _valueRange[1] = 255;
+    _saturation = 255.0f;
+    _classificationDirty = true;
+    _dirtyOpacity[0] = 0;
+    _dirtyOpacity[1] = -1;
+    _levelOfDetail = false;
+    _lodTolerance = 1.0f;
+    _pyramidDirty = true;
+    _levelTransferFunctionMode = -1;
+    _sampleDistance = 1.0f;
+    _earlyTermination = 0.99f;
+    _packetWidth = 0;
+    _kernel = 0;
+    _tileSize = 32;
+    _threadCount = 0;
+    _pool = 0;
+    _jitter[0] = _jitter[1] = 0.0f;
+    _width = _height = 0;
+    _tilesX = _tilesY = 0;
+    _statistics.raysCast = _statistics.terminatedRays = 0;
+    _statistics.sampledSteps = _statistics.skippedSteps = 0;
+    _statistics.decodedBricks = 0;
+    _statistics.emptyCells = _statistics.totalCells = 0;
+    _profiler = 0;
+
+    SetTransferFunction(0, 0);
+    SetPacketWidth(0);
+}
+
+CPURaycaster::~CPURaycaster(void)
+{
+    delete _pool;
+}
+
+bool CPURaycaster::SetVolume(const unsigned char* data, int xdim, int ydim, int zdim)
+{
+    return SetVolume(data, SCALAR_UINT8, xdim, ydim, zdim);
+}
+
+bool CPURaycaster::SetVolume(const void* data, int scalarType, int xdim, int ydim, int zdim)
+{
+    return SetVolume(data, scalarType, 1, xdim, ydim, zdim);
+}
+
+bool CPURaycaster::SetVolume(const void* data, int scalarType, int components,
+                             int xdim, int ydim, int zdim)
+{
+    if (!data || xdim < 2 || ydim < 2 || zdim < 2)
+        return false;
+    if (scalarType < SCALAR_UINT8 || scalarType > SCALAR_FLOAT32 || components < 1 || components > 4)
+        return false;
+    if (data == _volume && !_brickedVolume && scalarType == _variant.scalarType &&
+        components == _variant.components && xdim == _dims[0] && ydim == _dims[1] && zdim == _dims[2])
+        return true;
+    _gridDirty = true;
+    _pyramidDirty = true;
+    _gradientsDirty = true;
+    _volume = data;
+    _brickedVolume = 0;
+    _bricks.clear();
+    _brickCache.SetVolume(0);
+    _dims[0] = xdim;
+    _dims[1] = ydim;
+    _dims[2] = zdim;
+    _variant.scalarType = scalarType;
+    _variant.components = components;
+    switch (scalarType) {
+    case SCALAR_UINT16: SetScalarRange(0.0, 65535.0); break;
+    case SCALAR_INT16: SetScalarRange(-32768.0, 32767.0); break;
+    case SCALAR_FLOAT32: SetScalarRange(0.0, 1.0); break;
+    default: SetScalarRange(0.0, 255.0); break;
+    }
+    return true;
+}
+
+void CPURaycaster::SetScalarRange(double lo, double hi)
+{
+    double scale = hi > lo ? 255.0 / (hi - lo) : 1.0;
+    float scalarScale = static_cast<float>(scale);
+    float scalarShift = static_cast<float>(-lo * scale);
+    if (scalarScale != _scalarScale || scalarShift != _scalarShift) {
+        _scalarScale = scalarScale;
+        _scalarShift = scalarShift;
+        _gridDirty = true;
+        if (_brickedVolume && _brickedVolume->IsCompressed())
+            _brickCache.SetVolume(_brickedVolume, _scalarScale, _scalarShift);
+    }
+}
+
+void CPURaycaster::SetShadingParameters(float ambient, float diffuse, float specular, float specularPower)
+{
+    _ambient = ambient;
+    _diffuse = diffuse;
+    _specular = specular;
+    _specularPower = specularPower;
+}
+
+void CPURaycaster::SetCroppingPlanes(const float planes[6])
+{
+    for (int i = 0; i < 6; i++)
+        _cropPlanes[i] = planes[i];
+}
+
+void CPURaycaster::SetPiece(const Mat4& pieceToVolume, const float region[6])
+{
+    _piece = true;
+    for (int axis = 0; axis < 3; axis++) {
+        _pieceScale[axis] = float(pieceToVolume(axis, axis));
+        _pieceOffset[axis] = float(pieceToVolume(axis, 3));
+    }
+    for (int i = 0; i < 6; i++)
+        _pieceRegion[i] = region[i];
+}
+
+void CPURaycaster::ClearPiece()
+{
+    _piece = false;
+    _pieceScale = Vec3(1.0f, 1.0f, 1.0f);
+    _pieceOffset = Vec3(0.0f, 0.0f, 0.0f);
+    for (int i = 0; i < 6; i++)
+        _pieceRegion[i] = i % 2 ? 1.0f : 0.0f;
+}
+
+void CPURaycaster::SetDepthImage(const float* depth, int width, int height)
+{
+    bool valid = depth && width > 0 && height > 0;
+    _depth = valid ? depth : 0;
+    _depthWidth = valid ? width : 0;
+    _depthHeight = valid ? height : 0;
+}
+
+//steps t along origin+t*step inside box (x0,x1,y0,y1,z0,z1)
+static bool ClipRay(const Vec3& origin, const Vec3& step, const float box[6], float& tEnter, float& tExit)
+{
+    tEnter = 0.0f;
+    tExit = 1e30f;
+    bool hit = true;
+    for (int axis = 0; axis < 3 && hit; axis++) {
+        const float lo = box[2 * axis], hi = box[2 * axis + 1];
+        if (step[axis] == 0.0f) {
+            hit = origin[axis] >= lo && origin[axis] <= hi;
+            continue;
+        }
+        float t0 = (lo - origin[axis]) / step[axis];
+        float t1 = (hi - origin[axis]) / step[axis];
+        if (t0 > t1)
+            std::swap(t0, t1);
+        tEnter = std::max(tEnter, t0);
+        tExit = std::min(tExit, t1);
+        hit = tEnter < tExit;
+    }
+    return hit;
+}
+
+bool CPURaycaster::SetVolume(const BrickedVolume* volume)
+{
+    if (!volume || !volume->IsOpen())
+        return false;
+    const BrickedVolumeInfo& info = volume->GetInfo();
+    if ((info.scalarType != SCALAR_UINT8 && !volume->IsCompressed()) || info.components != 1 ||
+        info.dims[0] < 2 || info.dims[1] < 2 || info.dims[2] < 2)
+        return false;
+    if (volume == _brickedVolume)
+        return true;
+
+    _volume = 0;
+    _brickedVolume = volume;
+    _pyramid.Clear();
+    _gradients.Clear();
+    _variant.scalarType = SCALAR_UINT8;
+    _variant.components = 1;
+    _scalarScale = 1.0f;
+    _scalarShift = 0.0f;
+    for (int i = 0; i < 3; i++)
+        _dims[i] = info.dims[i];
+    _bricks.clear();
+    _brickCache.SetVolume(0);
+    if (volume->IsCompressed()) {
+        //the bricks are decoded to 8 bits, so the range applies on decode
+        double range[2] = {0.0, 255.0};
+        if (info.scalarType != SCALAR_UINT8)
+            volume->GetScalarRange(range);
+        SetScalarRange(range[0], range[1]);
+        _brickCache.SetVolume(volume, _scalarScale, _scalarShift);
+    } else {
+        _bricks.resize(volume->GetNumberOfBricks());
+        for (size_t i = 0; i < _bricks.size(); i++)
+            _bricks[i] = volume->GetBrickData(int(i));
+    }
+    _gridDirty = true;
+    return true;
+}
+
+void CPURaycaster::SetTransferFunction(const float* rgba, int entries)
+{
+    std::vector<float> table;
+    if (!rgba || entries < 2) {
+        //identity ramp: the normalized sample is both colour and opacity
+        entries = 256;
+        table.resize(4*entries);
+        for (int c = 0; c < 4; c++)
+            for (int i = 0; i < entries; i++)
+                table[c*entries + i] = i / float(entries - 1);
+    } else {
+        table.resize(4*entries);
+        for (int c = 0; c < 4; c++)
+            for (int i = 0; i < entries; i++)
+                table[c*entries + i] = rgba[4*i + c];
+    }
+    if (table == _transferFunction)
+        return;
+
+    //range of opacities the edit changed, all of them for a new size
+    int first = 0, last = entries - 1;
+    if (entries == _tfSize) {
+        const float* before = &_transferFunction[3*entries];
+        const float* after = &table[3*entries];
+        while (first < entries && before[first] == after[first])
+            first++;
+        while (last >= first && before[last] == after[last])
+            last--;
+    }
+    if (first <= last) {
+        bool clean = _dirtyOpacity[0] > _dirtyOpacity[1];
+        _dirtyOpacity[0] = clean ? first : std::min(_dirtyOpacity[0], first);
+        _dirtyOpacity[1] = clean ? last : std::max(_dirtyOpacity[1], last);
+        _classificationDirty = true;
+    }
+
+    _transferFunction.swap(table);
+    _tfSize = entries;
+    _tfVersion++;
+    _levelTransferFunctionMode = -1;
+}
+
+void CPURaycaster::SetMacroCellSize(int size)
+{
+    if (size != _macroCellSize) {
+        _macroCellSize = size;
+        _gridDirty = true;
+    }
+}
+
+void CPURaycaster::UpdateMacroCells()
+{
+    if (_gridDirty) {
+        if (_brickedVolume)
+            _grid.Build(*_brickedVolume, _macroCellSize, _pool, _scalarScale, _scalarShift);
+        else
+            _grid.Build(_volume, _variant.scalarType, _variant.components, _scalarScale, _scalarShift,
+                        _dims[0], _dims[1], _dims[2], _macroCellSize, _pool);
+        if (!_grid.GetValueRange(_valueRange)) {
+            _valueRange[0] = 0;
+            _valueRange[1] = 255;
+        }
+        _gridDirty = false;
+        _classificationDirty = true;
+    }
+    if (_classificationDirty) {
+        _statistics.emptyCells = _grid.Reclassify(&_transferFunction[3*_tfSize], _tfSize,
+                                                  _dirtyOpacity[0], _dirtyOpacity[1]);
+        _dirtyOpacity[0] = 0;
+        _dirtyOpacity[1] = -1;
+        _statistics.totalCells = _grid.GetNumberOfCells();
+        _classificationDirty = false;
+    }
+}
+
+void CPURaycaster::UpdatePreIntegration()
+{
+    //the table takes interleaved entries and only rebuilds what changed
+    std::vector<float> rgba(4*_tfSize);
+    for (int c = 0; c < 4; c++)
+        for (int i = 0; i < _tfSize; i++)
+            rgba[4*i + c] = _transferFunction[c*_tfSize + i];
+    _preIntegrationTable.Update(&rgba[0], _tfSize);
+}
+
+void CPURaycaster::UpdateLevelOfDetail()
+{
+    if (_pyramidDirty) {
+        _pyramid.Build(_volume, _variant.scalarType, _variant.components,
+                       _dims[0], _dims[1], _dims[2], 5, _pool);
+        _pyramidDirty = false;
+        _levelTransferFunctionMode = -1;
+    }
+    if (_levelTransferFunctionMode == _variant.blendMode)
+        return;
+
+    //a level L sample stands for 2^L samples at full resolution: composited
+    //opacity is corrected as for a longer sample distance, summed opacity
+    //scales with it and projections classify once, uncorrected
+    int levels = _pyramid.GetNumberOfLevels();
+    _levelTransferFunctions.assign(std::max(levels - 1, 0), _transferFunction);
+    for (int level = 1; level < levels; level++) {
+        float* alpha = &_levelTransferFunctions[level - 1][3*_tfSize];
+        float samples = float(1 << level);
+        for (int i = 0; i < _tfSize; i++) {
+            if (_variant.blendMode == BLEND_COMPOSITE)
+                alpha[i] = 1.0f - std::pow(1.0f - alpha[i], samples);
+            else if (_variant.blendMode == BLEND_ADDITIVE)
+                alpha[i] *= samples;
+        }
+    }
+    _levelTransferFunctionMode = _variant.blendMode;
+}
+
+//entries i and j of a planar RGBA table of n entries are equal
+static bool SameEntry(const std::vector<float>& table, int n, int i, int j)
+{
+    for (int c = 0; c < 4; c++)
+        if (table[c*n + i] != table[c*n + j])
+            return false;
+    return true;
+}
+
+//The scalar (0..255) at which a maximum projection becomes final: the
+//largest scalar of the volume, or the first one from which on every
+//scalar classifies to the same transfer function entry as 255. Minimum
+//projections likewise, towards 0.
+float CPURaycaster::GetSaturation() const
+{
+    const int n = _tfSize;
+    const bool maximum = _variant.blendMode == BLEND_MAXIMUM;
+    const bool skipping = IsSkipping();
+    if (n < 2)
+        return maximum ? 0.0f : 255.0f;
+
+    //a scalar s classifies to entry int(s*tfScale + 0.5)
+    const float tfScale = float(n - 1) / 255.0f;
+    if (maximum) {
+        int k = n - 1;
+        while (k > 0 && SameEntry(_transferFunction, n, k - 1, n - 1))
+            k--;
+        float saturation = (k - 0.5f) / tfScale;
+        return skipping ? std::min(saturation, float(_valueRange[1])) : saturation;
+    }
+    int k = 0;
+    while (k < n - 1 && SameEntry(_transferFunction, n, k + 1, 0))
+        k++;
+    float saturation = std::nextafter((k + 0.5f) / tfScale, -1.0f);
+    return skipping ? std::max(saturation, float(_valueRange[0])) : saturation;
+}
+
+void CPURaycaster::SetProfiler(FrameProfiler* profiler)
+{
+    _profiler = profiler;
+    if (!profiler)
+        return;
+    _classifyStage = profiler->AddStage("classify");
+    _marchStage = profiler->AddStage("march");
+    _raysCounter = profiler->AddCounter("rays");
+    _samplesCounter = profiler->AddCounter("samples");
+    _skippedCounter = profiler->AddCounter("skipped");
+    _terminatedCounter = profiler->AddCounter("terminated");
+    _decodedCounter = profiler->AddCounter("decoded bricks");
+}
+
+void CPURaycaster::SetThreadCount(int count)
+{
+    if (count == _threadCount && _pool)
+        return;
+    _threadCount = count;
+    delete _pool;
+    _pool = 0;
+}
+
+int CPURaycaster::GetThreadCount() const
+{
+    return _pool ? _pool->GetThreadCount() : _threadCount;
+}
+
+void CPURaycaster::SetPacketWidth(int width)
+{
+    int maxWidth = GetMaximumPacketWidth();
+    if (width <= 0 || width > maxWidth)
+        width = maxWidth;
+    else if (width < 4)
+        width = 1;
+    else if (width < 8)
+        width = 4;
+    else if (width < 16)
+        width = 8;
+    _packetWidth = width;
+    _kernel = KernelForWidth(width);
+}
+
+void CPURaycaster::SetTileSize(int size)
+{
+    _tileSize = std::max(16, (size + 15) / 16 * 16);
+    _tileBuffers.clear();
+}
+
+int CPURaycaster::GetNumberOfTiles(int width, int height) const
+{
+    return ((width + _tileSize - 1) / _tileSize) * ((height + _tileSize - 1) / _tileSize);
+}
+
+void CPURaycaster::Render(const Mat4& textureToClip, int width, int height)
+{
+    if (width <= 0 || height <= 0)
+        return;
+    _image.assign(size_t(width) * height * 4, 0.0f);
+    RenderTiles(textureToClip, width, height, 0, GetNumberOfTiles(width, height));
+}
+
+void CPURaycaster::RenderTiles(const Mat4& textureToClip, int width, int height, int first, int count)
+{
+    if (width <= 0 || height <= 0)
+        return;
+
+    //tiles of an earlier frame of another size must not show through the
+    //tiles not rendered this time
+    if (width != _width || height != _height ||
+        _image.size() != size_t(width) * height * 4) {
+        _width = width;
+        _height = height;
+        _image.assign(size_t(width) * height * 4, 0.0f);
+        _rayDepths.clear();
+    }
+    if (_significantOpacity <= 0.0f)
+        _rayDepths.clear();
+    else if (_rayDepths.size() != size_t(width) * height * 2)
+        _rayDepths.assign(size_t(width) * height * 2, -1.0f);
+    _statistics.raysCast = _statistics.terminatedRays = 0;
+    _statistics.sampledSteps = _statistics.skippedSteps = 0;
+    _statistics.decodedBricks = 0;
+    if ((!_volume && !_brickedVolume) || !textureToClip.Invert(_clipToTexture))
+        return;
+    _textureToClip = textureToClip;
+
+    if (!_pool)
+        _pool = new ThreadPool(_threadCount);
+
+    const bool profiling = _profiler && _profiler->IsEnabled();
+    double start = profiling ? FrameProfiler::Now() : 0.0;
+    if (IsSkipping())
+        UpdateMacroCells();
+    if (_variant.blendMode == BLEND_MAXIMUM || _variant.blendMode == BLEND_MINIMUM)
+        _saturation = GetSaturation();
+    if (IsPreIntegrating())
+        UpdatePreIntegration();
+    if (_levelOfDetail && _volume)
+        UpdateLevelOfDetail();
+    if (IsUsingGradientCache() && _gradientsDirty) {
+        _gradients.Build(_volume, _variant.scalarType, _variant.components,
+                         _dims[0], _dims[1], _dims[2], _pool);
+        _gradientsDirty = false;
+    }
+    if (profiling) {
+        double now = FrameProfiler::Now();
+        _profiler->AddTime(_classifyStage, now - start);
+        start = now;
+    }
+
+    //one set of SoA ray buffers per worker, reused across frames
+    int rays = _tileSize * _tileSize;
+    if (int(_tileBuffers.size()) != _pool->GetThreadCount()) {
+        _tileBuffers.resize(_pool->GetThreadCount());
+        for (size_t i = 0; i < _tileBuffers.size(); i++) {
+            TileBuffers& t = _tileBuffers[i];
+            t.storage.resize(size_t(rays) * (13 + 2 * MAX_CROP_GAPS));
+            float* p = &t.storage[0];
+            RayBatch& b = t.batch;
+            b.count = rays;
+            b.posX = p; p += rays;  b.posY = p; p += rays;  b.posZ = p; p += rays;
+            b.stepX = p; p += rays; b.stepY = p; p += rays; b.stepZ = p; p += rays;
+            b.samples = p; p += rays;
+            b.gapBegin = p; p += rays * MAX_CROP_GAPS;
+            b.gapEnd = p; p += rays * MAX_CROP_GAPS;
+            b.r = p; p += rays; b.g = p; p += rays; b.b = p; p += rays; b.a = p; p += rays;
+            b.significant = p; p += rays; b.last = p;
+        }
+    }
+
+    _tilesX = (width + _tileSize - 1) / _tileSize;
+    _tilesY = (height + _tileSize - 1) / _tileSize;
+    first = std::max(first, 0);
+    count = std::min(count, _tilesX * _tilesY - first);
+    for (size_t i = 0; i < _tileBuffers.size(); i++) {
+        RayBatch& b = _tileBuffers[i].batch;
+        b.raysCast = b.terminatedRays = b.sampledSteps = b.skippedSteps = 0;
+    }
+
+    const unsigned long long decoded = _brickCache.GetDecodedBricks();
+    if (count > 0)
+        _pool->ParallelFor(count, [this, first](int tile, int worker) {
+            RenderTile(first + tile, worker);
+        });
+    if (_brickCache.GetVolume()) {
+        _statistics.decodedBricks = _brickCache.GetDecodedBricks() - decoded;
+        _brickCache.EndFrame();
+    }
+
+    for (size_t i = 0; i < _tileBuffers.size(); i++) {
+        const RayBatch& b = _tileBuffers[i].batch;
+        _statistics.raysCast += b.raysCast;
+        _statistics.terminatedRays += b.terminatedRays;
+        _statistics.sampledSteps += b.sampledSteps;
+        _statistics.skippedSteps += b.skippedSteps;
+    }
+
+    if (profiling) {
+        _profiler->AddTime(_marchStage, FrameProfiler::Now() - start);
+        _profiler->AddCount(_raysCounter, _statistics.raysCast);
+        _profiler->AddCount(_samplesCounter, _statistics.sampledSteps);
+        _profiler->AddCount(_skippedCounter, _statistics.skippedSteps);
+        _profiler->AddCount(_terminatedCounter, _statistics.terminatedRays);
+        _profiler->AddCount(_decodedCounter, _statistics.decodedBricks);
+    }
+}
+
+int CPURaycaster::SetupRays(int x0, int y0, int w, int h, RayBatch& batch)
+{
+    const Vec3 stepSize(_sampleDistance / _dims[0],
+                        _sampleDistance / _dims[1],
+                        _sampleDistance / _dims[2]);
+    const Vec3 voxels = Vec3(float(_dims[0]), float(_dims[1]), float(_dims[2]));
+    const bool lod = _levelOfDetail && _volume && _pyramid.GetNumberOfLevels() > 1;
+    float footprint = 1e30f;
+
+    //first pass: entry point, step and length of every ray that hits the
+    //volume (samples holds the unfloored length, 0 for a miss)
+    for (int i = 0; i < batch.count; i++) {
+        int tx = i % _tileSize;
+        int ty = i / _tileSize;
+        for (int gap = 0; gap < MAX_CROP_GAPS; gap++) {
+            batch.gapBegin[gap * batch.count + i] = 1e30f;
+            batch.gapEnd[gap * batch.count + i] = 0.0f;
+        }
+        batch.samples[i] = 0.0f;
+        batch.posX[i] = batch.posY[i] = batch.posZ[i] = 0.0f;
+        batch.stepX[i] = batch.stepY[i] = batch.stepZ[i] = 0.0f;
+        if (tx >= w || ty >= h)
+            continue;
+        if (_rayMask && !_rayMask[size_t(y0 + ty) * _width + x0 + tx])
+            continue;
+
+        //unproject the pixel centre on the near and far plane
+        double nx = (x0 + tx + 0.5 + _jitter[0]) / _width * 2.0 - 1.0;
+        double ny = (y0 + ty + 0.5 + _jitter[1]) / _height * 2.0 - 1.0;
+        Vec3 nearPos = _clipToTexture.TransformPoint(nx, ny, -1.0);
+        Vec3 farPos = _clipToTexture.TransformPoint(nx, ny, 1.0);
+
+        //same sub-step as raycaster.frag: normalized direction scaled per
+        //axis, normalized in the texture space of the whole volume
+        Vec3 dirStep = Normalize((farPos - nearPos) * _pieceScale) * stepSize;
+
+        //the ray ends where it meets opaque geometry, the surface in the
+        //depth pixel under the ray unprojected onto it
+        float tSurface = 1e30f;
+        if (_depth) {
+            int dx = std::min(std::max(int((nx * 0.5 + 0.5) * _depthWidth), 0), _depthWidth - 1);
+            int dy = std::min(std::max(int((ny * 0.5 + 0.5) * _depthHeight), 0), _depthHeight - 1);
+            float depth = _depth[size_t(dy) * _depthWidth + dx];
+            if (depth <= 0.0f)
+                continue;
+            if (depth < 1.0f) {
+                Vec3 surface = _clipToTexture.TransformPoint(nx, ny, 2.0 * depth - 1.0);
+                tSurface = Dot(surface - nearPos, dirStep) / Dot(dirStep, dirStep);
+            }
+        }
+
+        //clip the ray against the [0,1]^3 texture box, t counts steps
+        static const float unitBox[6] = {0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 1.0f};
+        float tEnter, tExit, length;
+        if (!_piece) {
+            if (!ClipRay(nearPos, dirStep, unitBox, tEnter, tExit))
+                continue;
+            if (tSurface < tExit) {
+                if (tSurface <= tEnter)
+                    continue;
+                tExit = tSurface;
+            }
+            length = tExit - tEnter;
+        } else {
+            //a piece takes the samples of the whole volume's ray that fall
+            //into its region, both clipped in the texture space of the
+            //whole volume so that neighbours agree on their boundary
+            const Vec3 origin = nearPos * _pieceScale + _pieceOffset;
+            const Vec3 step = dirStep * _pieceScale;
+            float tFirst, tLast;
+            if (!ClipRay(origin, step, unitBox, tEnter, tExit) ||
+                !ClipRay(origin, step, _pieceRegion, tFirst, tLast))
+                continue;
+            tExit = std::min(tExit, tSurface);
+            float first = std::max(std::ceil(tFirst - tEnter), 0.0f);
+            float end = std::min(std::floor(tExit - tEnter), std::ceil(tLast - tEnter));
+            if (end <= first)
+                continue;
+            tEnter += first;
+            length = end - first;
+        }
+
+        Vec3 entry = nearPos + dirStep * tEnter;
+        batch.posX[i] = entry.x;
+        batch.posY[i] = entry.y;
+        batch.posZ[i] = entry.z;
+        batch.stepX[i] = dirStep.x;
+        batch.stepY[i] = dirStep.y;
+        batch.stepZ[i] = dirStep.z;
+        batch.samples[i] = length;
+
+        //width of the pixel in voxels where the ray enters, the nearest
+        //ray of the tile decides its level of detail
+        if (lod) {
+            Vec3 clip = _textureToClip.TransformPoint(entry.x, entry.y, entry.z);
+            Vec3 beside = _clipToTexture.TransformPoint(clip.x + 2.0 / _width, clip.y, clip.z);
+            footprint = std::min(footprint, Length((beside - entry) * voxels));
+        }
+    }
+
+    //second pass: coarser levels take proportionally longer steps, except
+    //for pre-integration whose table is built for the sample distance
+    int level = lod ? VolumePyramid::SelectLevel(footprint, _lodTolerance, _pyramid.GetNumberOfLevels()) : 0;
+    float stepScale = IsPreIntegrating() ? 1.0f : float(1 << level);
+    for (int i = 0; i < batch.count; i++) {
+        if (batch.samples[i] <= 0.0f)
+            continue;
+        Vec3 entry(batch.posX[i], batch.posY[i], batch.posZ[i]);
+        Vec3 dirStep = Vec3(batch.stepX[i], batch.stepY[i], batch.stepZ[i]) * stepScale;
+        float samples = std::floor(batch.samples[i] / stepScale);
+        batch.samples[i] = 0.0f;
+
+        //with cropping the ray starts just before its first kept span and
+        //ends with the last one, the gaps between spans are jumped over
+        if (_variant.cropping) {
+            const float origin[3] = {entry.x, entry.y, entry.z};
+            const float step[3] = {dirStep.x, dirStep.y, dirStep.z};
+            int spans[2 * MAX_CROP_SPANS];
+            int count = CropRaySpans(origin, step, int(samples), _cropPlanes, _cropRegions, spans);
+            if (count == 0)
+                continue;
+            int start = spans[0] - 1;
+            for (int span = 1; span < count; span++) {
+                batch.gapBegin[(span - 1) * batch.count + i] = float(spans[2*span-1] + 1 - start);
+                batch.gapEnd[(span - 1) * batch.count + i] = float(spans[2*span] - 1 - start);
+            }
+            entry = entry + dirStep * float(start);
+            samples = float(spans[2*count-1] - start);
+        }
+
+        batch.posX[i] = entry.x;
+        batch.posY[i] = entry.y;
+        batch.posZ[i] = entry.z;
+        batch.stepX[i] = dirStep.x;
+        batch.stepY[i] = dirStep.y;
+        batch.stepZ[i] = dirStep.z;
+        batch.samples[i] = samples;
+    }
+    return level;
+}
+
+void CPURaycaster::RenderTile(int tile, int worker)
+{
+    int x0 = (tile % _tilesX) * _tileSize;
+    int y0 = (tile / _tilesX) * _tileSize;
+    int w = std::min(_tileSize, _width - x0);
+    int h = std::min(_tileSize, _height - y0);
+
+    RayBatch& batch = _tileBuffers[worker].batch;
+    int level = SetupRays(x0, y0, w, h, batch);
+
+    RayMarchContext ctx;
+    ctx.volume = level ? _pyramid.GetLevel(level) : _volume;
+    ctx.scalarScale = _scalarScale;
+    ctx.scalarShift = _scalarShift;
+    ctx.bricks = _bricks.empty() ? 0 : &_bricks[0];
+    ctx.brickCache = _brickCache.GetVolume() ? &_brickCache : 0;
+    ctx.brickSize = _brickedVolume ? _brickedVolume->GetInfo().brickSize : 0;
+    for (int i = 0; i < 3; i++)
+        ctx.brickGrid[i] = _brickedVolume ? _brickedVolume->GetBrickGridDimensions()[i] : 0;
+    const int* dims = level ? _pyramid.GetDimensions(level) : _dims;
+    ctx.dims[0] = dims[0];
+    ctx.dims[1] = dims[1];
+    ctx.dims[2] = dims[2];
+    ctx.transferFunction = level ? &_levelTransferFunctions[level - 1][0] : &_transferFunction[0];
+    ctx.tfSize = _tfSize;
+    ctx.preIntegrated = IsPreIntegrating() ? _preIntegrationTable.GetTable() : 0;
+    ctx.earlyTermination = _earlyTermination;
+    ctx.significantOpacity = _significantOpacity;
+    ctx.occupancy = IsSkipping() && !IsSkippingDominated() ? _grid.GetOccupancy() : 0;
+    ctx.cellRanges = IsSkippingDominated() ? _grid.GetMinMax() : 0;
+    ctx.saturation = _saturation;
+    ctx.cellSize = _grid.GetCellSize();
+    for (int i = 0; i < 3; i++)
+        ctx.gridDims[i] = _grid.GetGridDimensions()[i];
+    for (int i = 0; i < 3; i++)
+        ctx.volumeDims[i] = _dims[i];
+    ctx.variant = _variant;
+    ctx.ambient = _ambient;
+    ctx.diffuse = _diffuse;
+    ctx.specular = _specular;
+    ctx.specularPower = static_cast<int>(_specularPower + 0.5f);
+    ctx.gradients = IsUsingGradientCache() ? _gradients.GetData() : 0;
+    _kernel(ctx, batch);
+
+    for (int ty = 0; ty < h; ty++) {
+        float* row = &_image[(size_t(y0 + ty) * _width + x0) * 4];
+        for (int tx = 0; tx < w; tx++) {
+            int i = ty * _tileSize + tx;
+            row[4*tx+0] = batch.r[i];
+            row[4*tx+1] = batch.g[i];
+            row[4*tx+2] = batch.b[i];
+            row[4*tx+3] = batch.a[i];
+        }
+    }
+
+    //window depths of the significant and the last sample, found by
+    //projecting their positions along the ray
+    if (_significantOpacity > 0.0f) {
+        for (int ty = 0; ty < h; ty++) {
+            float* row = &_rayDepths[(size_t(y0 + ty) * _width + x0) * 2];
+            for (int tx = 0; tx < w; tx++) {
+                int i = ty * _tileSize + tx;
+                if (batch.samples[i] <= 0.0f) {
+                    row[2*tx] = row[2*tx+1] = -1.0f;
+                    continue;
+                }
+                const Vec3 entry(batch.posX[i], batch.posY[i], batch.posZ[i]);
+                const Vec3 step(batch.stepX[i], batch.stepY[i], batch.stepZ[i]);
+                const float t[2] = {batch.significant[i], batch.last[i]};
+                for (int k = 0; k < 2; k++) {
+                    Vec3 pos = entry + step * t[k];
+                    row[2*tx+k] = 0.5f * _textureToClip.TransformPoint(pos.x, pos.y, pos.z).z + 0.5f;
+                }
+            }
+        }
+    }
+}
+
+void CPURaycaster::GetImageRGBA8(unsigned char* out) const
+{
+    for (size_t i = 0; i < _image.size(); i++) {
+        float v = std::min(std::max(_image[i], 0.0f), 1.0f);
+        out[i] = static_cast<unsigned char>(v * 255.0f + 0.5f);
+    }
+}
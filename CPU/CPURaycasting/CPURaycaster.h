@@ -0,0 +1,329 @@
+#pragma once
+#include <vector>
+
+#include "BrickCache.h"
+#include "FrameProfiler.h"
+#include "GradientVolume.h"
+#include "MacroCellGrid.h"
+#include "PreIntegrationTable.h"
+#include "RayMarch.h"
+#include "RenderVariant.h"
+#include "VectorMath.h"
+#include "VolumePyramid.h"
+
+class BrickedVolume;
+class ThreadPool;
+
+//CPU counterpart of the GLSL ray caster in OpenGL/GPURaycasting. The image
+//is split into square tiles that a work-stealing thread pool hands out to
+//the workers; every tile is marched as packets of 4/8/16 rays by the widest
+//SIMD kernel the processor supports, instantiated for the RenderVariant of
+//the current settings (see GetVariant()).
+//
+//The volume occupies texture space [0,1]^3, the camera is given as the
+//matrix taking texture coordinates to clip space (P*MV*textureToObject).
+//The output is a premultiplied RGBA float image, bottom row first.
+class CPURaycaster
+{
+public:
+    CPURaycaster(void);
+    ~CPURaycaster(void);
+
+    //the volume is referenced, not copied; every dimension must be >= 2
+    bool SetVolume(const unsigned char* data, int xdim, int ydim, int zdim);
+
+    //scalars of any ScalarType (see BrickedVolume.h), mapped onto the
+    //transfer function by SetScalarRange()
+    bool SetVolume(const void* data, int scalarType, int xdim, int ydim, int zdim);
+
+    //1-4 interleaved components per voxel, sampled in place: the last one
+    //is the scalar, the others colour it (see RenderVariant.h)
+    bool SetVolume(const void* data, int scalarType, int components, int xdim, int ydim, int zdim);
+
+    //raw scalars lo..hi span the transfer function (and the RGB range of
+    //colour components); a new volume resets it to the full range of an
+    //integer scalar type or 0..1 for float
+    void SetScalarRange(double lo, double hi);
+
+    //renders straight from the bricks of an 8-bit, single component bricked
+    //volume; only the bricks rays actually reach are touched. Compressed
+    //single component volumes of any scalar type are decoded brick by brick
+    //into an LRU cache (see BrickCache) as rays reach them, mapped onto the
+    //transfer function by SetScalarRange(), which defaults to the range of
+    //the brick table.
+    bool SetVolume(const BrickedVolume* volume);
+
+    //bytes of decoded bricks of a compressed volume kept between frames,
+    //0 keeps every brick decoded once
+    void SetBrickCacheBudget(size_t bytes) { _brickCache.SetBudget(bytes); }
+    const BrickCache& GetBrickCache() const { return _brickCache; }
+
+    //call when the referenced voxels changed in place
+    void VolumeModified() { _gridDirty = true; _pyramidDirty = true; _gradientsDirty = true; }
+
+    //interleaved RGBA entries in [0,1] spanning the scalar range 0..255.
+    //NULL restores the raycaster.frag behaviour of using the sample as
+    //both colour and opacity. The table is compared with the current one:
+    //setting the same table again costs nothing, and after an edit only
+    //the macro cells whose range spans a changed opacity are reclassified.
+    void SetTransferFunction(const float* rgba, int entries);
+
+    //incremented by every SetTransferFunction() that changed the table
+    unsigned GetTransferFunctionVersion() const { return _tfVersion; }
+
+    //distance between samples in voxels along each axis (1 = the
+    //1/XDIM,1/YDIM,1/ZDIM step_size of raycaster.frag)
+    void SetSampleDistance(float distance) { _sampleDistance = distance; }
+    float GetSampleDistance() const { return _sampleDistance; }
+
+    void SetEarlyTermination(float alpha) { _earlyTermination = alpha; }
+
+    //classify ray segments through a pre-integrated table built from the
+    //transfer function, which allows larger sample distances at the same
+    //quality. The table is rebuilt incrementally when the function changes.
+    void SetPreIntegration(bool on) { _preIntegration = on; }
+    bool GetPreIntegration() const { return _preIntegration; }
+    const PreIntegrationTable& GetPreIntegrationTable() const { return _preIntegrationTable; }
+
+    //how the samples along a ray are combined, BlendMode (see RenderVariant.h).
+    //Pre-integration applies to compositing only, empty-space skipping to
+    //additive blending too. Maximum and minimum projections end a ray once
+    //its extreme saturated and may skip dominated macro cells (see
+    //SetDominatedCellSkipping()); the average takes every sample.
+    void SetBlendMode(int mode) { _variant.blendMode = mode; }
+    int GetBlendMode() const { return _variant.blendMode; }
+
+    //trilinear (default) or nearest neighbour sampling
+    void SetLinearInterpolation(bool on) { _variant.linear = on; }
+
+    //lights composited samples by their scalar gradient (central
+    //differences) with a headlight, coefficients as in vtkVolumeProperty
+    void SetShading(bool on) { _variant.shading = on; }
+    void SetShadingParameters(float ambient, float diffuse, float specular, float specularPower);
+
+    //shades from gradients precomputed once per volume (see GradientVolume)
+    //instead of central differences at every sample, at three bytes per
+    //voxel. Built on the first shaded frame; flat volumes only.
+    void SetGradientCache(bool on) { _gradientCache = on; }
+    bool GetGradientCache() const { return _gradientCache; }
+    const GradientVolume& GetGradientVolume() const { return _gradients; }
+
+    //drops samples outside the kept regions of the cropping planes, given
+    //as x0,x1,y0,y1,z0,z1 in texture space (see RenderVariant.h). Rays are
+    //clipped to their kept spans when they are set up, cropped samples cost
+    //nothing.
+    void SetCropping(bool on) { _variant.cropping = on; }
+    void SetCroppingPlanes(const float planes[6]);
+    void SetCroppingRegions(int flags) { _cropRegions = flags; }
+
+    //sort-last rendering (see VolumeDecomposition): the volume is a piece
+    //of a larger one, pieceToVolume (scale and translation) takes its
+    //texture coordinates to those of the whole volume, and rays are cast
+    //through the region x0,x1,y0,y1,z0,z1 of the whole volume's texture
+    //space only. Rays step and place their samples as they do through the
+    //whole volume, so the images of the pieces composite seamlessly.
+    void SetPiece(const Mat4& pieceToVolume, const float region[6]);
+    void ClearPiece();
+
+    //opaque geometry drawn with the volume: window depths (0 near .. 1 far,
+    //as OpenGL's depth buffer and vtkRenderWindow::GetZbufferData hold
+    //them) of a width x height image, bottom row first, covering the same
+    //viewport as the rendered image at any resolution. Every ray ends at
+    //the surface in its pixel. Referenced, not copied; NULL casts full rays.
+    void SetDepthImage(const float* depth, int width, int height);
+
+    //temporal reprojection (see ReprojectionCache): only pixels whose mask
+    //entry is non-zero cast rays, the others are left empty. One entry per
+    //pixel of the rendered image, bottom row first; referenced, not copied.
+    //NULL casts every ray.
+    void SetRayMask(const unsigned char* mask) { _rayMask = mask; }
+
+    //records two window depths per pixel (0 near .. 1 far) with every
+    //render: of the sample at which the composited opacity first reached
+    //'opacity' and of the last sample taken. Rays that stay below it get
+    //the last sample for both, other blend modes than compositing the ray
+    //entry for the first. Pixels without samples get -1. 0 (default)
+    //records nothing.
+    void SetRayDepthRecording(float opacity) { _significantOpacity = opacity; }
+    const float* GetRayDepths() const { return _rayDepths.empty() ? 0 : &_rayDepths[0]; }
+
+    //feature combination the kernels are specialized for
+    const RenderVariant& GetVariant() const { return _variant; }
+
+    //jump over macro cells whose value range is fully transparent
+    void SetEmptySpaceSkipping(bool on) { _emptySpaceSkipping = on; }
+    bool GetEmptySpaceSkipping() const { return _emptySpaceSkipping; }
+
+    //maximum and minimum projections, with empty-space skipping on: jump
+    //over the macro cells whose range cannot beat a ray's extreme. Off by
+    //default, the cell tests only pay off on volumes where large regions
+    //are dominated.
+    void SetDominatedCellSkipping(bool on) { _dominatedCellSkipping = on; }
+    bool GetDominatedCellSkipping() const { return _dominatedCellSkipping; }
+
+    //level-of-detail sampling: every tile samples the coarsest level of a
+    //mipmap pyramid of the volume (see VolumePyramid) whose voxels still
+    //project to at most 'tolerance' pixels on its nearest ray, with the
+    //sample distance and the opacity scaled to match. Flat volumes only,
+    //bricked volumes are always sampled at full resolution. Larger
+    //tolerances trade detail for speed.
+    void SetLevelOfDetail(bool on) { _levelOfDetail = on; }
+    bool GetLevelOfDetail() const { return _levelOfDetail; }
+    void SetLevelOfDetailTolerance(float pixels) { _lodTolerance = pixels; }
+    float GetLevelOfDetailTolerance() const { return _lodTolerance; }
+    const VolumePyramid& GetPyramid() const { return _pyramid; }
+
+    //macro cell edge in voxels (8 or 16 work well)
+    void SetMacroCellSize(int size);
+    const MacroCellGrid& GetMacroCellGrid() const { return _grid; }
+
+    //0 uses all hardware threads
+    void SetThreadCount(int count);
+    int GetThreadCount() const;
+
+    //rays per packet: 1, 4, 8 or 16; 0 picks the widest supported one.
+    //Widths the CPU cannot run fall back to the next narrower kernel.
+    void SetPacketWidth(int width);
+    int GetPacketWidth() const { return _packetWidth; }
+
+    //tile edge in pixels, rounded up to a multiple of 16
+    void SetTileSize(int size);
+    int GetTileSize() const { return _tileSize; }
+
+    void Render(const Mat4& textureToClip, int width, int height);
+
+    //progressive rendering: renders only tiles [first, first+count) of the
+    //tile grid (row by row from the bottom, see GetNumberOfTiles()). The
+    //rest of the image keeps what earlier calls left there; it is cleared
+    //when the image size changes.
+    void RenderTiles(const Mat4& textureToClip, int width, int height, int first, int count);
+    int GetNumberOfTiles(int width, int height) const;
+
+    //sub-pixel offset of every ray in pixels, for jittered supersampling
+    void SetJitter(float x, float y) { _jitter[0] = x; _jitter[1] = y; }
+
+    const float* GetImage() const { return _image.empty() ? 0 : &_image[0]; }
+    int GetImageWidth() const { return _width; }
+    int GetImageHeight() const { return _height; }
+
+    //converts the float image to 8-bit premultiplied RGBA
+    void GetImageRGBA8(unsigned char* out) const;
+
+    //counters of the last Render() call
+    struct Statistics
+    {
+        unsigned long long raysCast;        //rays that hit the volume
+        unsigned long long terminatedRays;  //ended by early ray termination
+        unsigned long long sampledSteps;    //samples fetched and composited
+        unsigned long long skippedSteps;    //samples jumped in empty cells
+        unsigned long long decodedBricks;   //compressed bricks decoded
+        int emptyCells;
+        int totalCells;
+    };
+    const Statistics& GetStatistics() const { return _statistics; }
+
+    //reports the classification and ray march times and the counters of
+    //every Render() to profiler (may be NULL). The caller brackets frames.
+    void SetProfiler(FrameProfiler* profiler);
+
+    //widest packet the running processor can execute
+    static int GetMaximumPacketWidth();
+
+private:
+    struct TileBuffers
+    {
+        std::vector<float> storage;
+        RayBatch batch;
+    };
+
+    //the features the blend mode has
+    bool IsExtremum() const
+    {
+        return _variant.blendMode == BLEND_MAXIMUM || _variant.blendMode == BLEND_MINIMUM;
+    }
+    bool IsSkipping() const
+    {
+        return _emptySpaceSkipping && _variant.blendMode != BLEND_AVERAGE &&
+               (_dominatedCellSkipping || !IsExtremum());
+    }
+    bool IsSkippingDominated() const { return IsSkipping() && IsExtremum(); }
+    bool IsPreIntegrating() const { return _preIntegration && _variant.blendMode == BLEND_COMPOSITE; }
+    bool IsUsingGradientCache() const { return _gradientCache && _volume && _variant.IsShaded(); }
+
+    void UpdateMacroCells();
+    void UpdatePreIntegration();
+    void UpdateLevelOfDetail();
+    float GetSaturation() const;
+    void RenderTile(int tile, int worker);
+    int SetupRays(int x0, int y0, int w, int h, RayBatch& batch);
+
+    const void* _volume;
+    const BrickedVolume* _brickedVolume;
+    std::vector<const unsigned char*> _bricks;
+    BrickCache _brickCache;
+    int _dims[3];
+    float _scalarScale, _scalarShift;
+
+    RenderVariant _variant;
+    float _ambient, _diffuse, _specular, _specularPower;
+    bool _gradientCache;
+    GradientVolume _gradients;
+    bool _gradientsDirty;
+    float _cropPlanes[6];
+    int _cropRegions;
+    bool _piece;
+    Vec3 _pieceScale, _pieceOffset;
+    float _pieceRegion[6];
+    const float* _depth;
+    int _depthWidth, _depthHeight;
+    const unsigned char* _rayMask;
+    float _significantOpacity;
+
+    std::vector<float> _transferFunction;   //planar R,G,B,A
+    int _tfSize;
+    unsigned _tfVersion;
+
+    bool _preIntegration;
+    PreIntegrationTable _preIntegrationTable;
+
+    bool _emptySpaceSkipping;
+    bool _dominatedCellSkipping;
+    int _macroCellSize;
+    MacroCellGrid _grid;
+    unsigned char _valueRange[2];   //of the grid, for the projections
+    float _saturation;              //see RayMarchContext
+    bool _gridDirty;
+    bool _classificationDirty;
+    int _dirtyOpacity[2];   //entries changed since the last classification
+
+    bool _levelOfDetail;
+    float _lodTolerance;
+    VolumePyramid _pyramid;
+    bool _pyramidDirty;
+    std::vector<std::vector<float> > _levelTransferFunctions;  //levels 1..n
+    int _levelTransferFunctionMode;   //blend mode they were built for, -1 stale
+
+    float _sampleDistance;
+    float _earlyTermination;
+    int _packetWidth;
+    RayMarchFunction _kernel;
+    int _tileSize;
+
+    int _threadCount;
+    ThreadPool* _pool;
+    std::vector<TileBuffers> _tileBuffers;
+
+    //per-frame state
+    Mat4 _textureToClip;
+    Mat4 _clipToTexture;
+    float _jitter[2];
+    int _width, _height;
+    int _tilesX, _tilesY;
+    std::vector<float> _image;
+    std::vector<float> _rayDepths;
+    Statistics _statistics;
+
+    FrameProfiler* _profiler;
+    int _classifyStage, _marchStage;
+    int _raysCounter, _samplesCounter, _skippedCounter, _terminatedCounter, _decodedCounter;
+};
@@ -0,0 +1,122 @@
+#pragma once
+
+//Ray packet kernels of the CPU ray caster. Each kernel marches a batch of
+//rays with the same front-to-back compositing and early ray termination as
+//shaders/raycaster.frag, W rays at a time. The kernels live in separate
+//translation units so that each can be compiled for its own instruction
+//set and picked at runtime (see CPURaycaster::SetPacketWidth). Within a
+//kernel the RenderVariant of the context picks a template instantiation
+//specialized for its blend mode, interpolation, scalar type, components,
+//shading and cropping, and for pre-integration, empty-space skipping and
+//depth recording.
+
+#include "RenderVariant.h"
+
+class BrickCache;
+
+//per-frame state shared read-only by all packets
+struct RayMarchContext
+{
+    const void* volume;             //variant.components scalars of variant.scalarType per voxel, x fastest
+    int dims[3];
+
+    //raw*scalarScale+scalarShift maps a scalar to the 0..255 domain of the
+    //transfer function (unused for 8-bit scalars)
+    float scalarScale;
+    float scalarShift;
+
+    //8-bit single component bricked storage (see BrickedVolume), used
+    //instead of volume when set. Bricks hold brickSize+1 samples per edge,
+    //x fastest.
+    const unsigned char* const* bricks;
+    int brickSize;
+    int brickGrid[3];
+
+    //bricks of a compressed bricked volume, decoded on first use (see
+    //BrickCache); used instead of bricks when set, same layout
+    BrickCache* brickCache;
+
+    const float* transferFunction;  //four planes (R,G,B,A) of tfSize entries
+    int tfSize;
+
+    //pre-integrated table (see PreIntegrationTable), interleaved RGBA of
+    //tfSize x tfSize entries indexed back*tfSize+front; classifies ray
+    //segments instead of single samples when set, coloured by the scalar
+    //also for multi-component volumes
+    const float* preIntegrated;
+    float earlyTermination;         //stop once accumulated alpha exceeds this
+
+    //with depths recorded (see RayBatch::significant), the composited
+    //opacity that makes a ray significant; 0 records nothing
+    float significantOpacity;
+
+    //empty-space skipping, see MacroCellGrid; NULL occupancy disables it.
+    //The grid is built on the full resolution volume of volumeDims voxels
+    //even when a coarser level of detail is sampled (dims).
+    const unsigned char* occupancy;
+    int cellSize;
+    int gridDims[3];
+    int volumeDims[3];
+
+    //maximum and minimum projections: the (min,max) pairs of the same grid
+    //(see MacroCellGrid::GetMinMax), used instead of the occupancy to jump
+    //over cells whose range cannot beat a ray's extreme; NULL disables it.
+    //A ray's projection is final once its extreme reaches saturation (at or
+    //above for maximum, at or below for minimum): the volume holds nothing
+    //beyond it or the transfer function does not change beyond it.
+    const unsigned char* cellRanges;
+    float saturation;
+
+    RenderVariant variant;
+
+    //shading: Blinn-Phong with a headlight, the light and view direction
+    //are the ray direction. The specular power is rounded to an integer.
+    //With precomputed gradients (see GradientVolume) of the volumeDims
+    //voxels the normal of the nearest voxel is used instead of central
+    //differences.
+    const unsigned char* gradients;
+    float ambient;
+    float diffuse;
+    float specular;
+    int specularPower;
+};
+
+//gaps between the cropping spans of a ray (see CropRaySpans)
+const int MAX_CROP_GAPS = MAX_CROP_SPANS - 1;
+
+//rays of one tile in structure-of-arrays layout, count is a multiple of the
+//widest packet so the kernels never need a remainder loop
+struct RayBatch
+{
+    int count;
+    float* posX; float* posY; float* posZ;      //first sample position (texture space)
+    float* stepX; float* stepY; float* stepZ;   //per sample increment
+    float* samples;                             //samples to take along the ray
+
+    //with cropping, samples [gapBegin, gapEnd] (counted from 1) of the ray
+    //are jumped over; MAX_CROP_GAPS planes of count entries each, unused
+    //gaps are empty (gapBegin > samples)
+    float* gapBegin;
+    float* gapEnd;
+    float* r; float* g; float* b; float* a;     //composited premultiplied colour
+
+    //steps from the first sample position to the sample at which the
+    //composited opacity reached significantOpacity (the last sample when it
+    //never did, 0 for the blend modes other than compositing) and to the
+    //last sample taken; written when significantOpacity > 0
+    float* significant;
+    float* last;
+
+    //accumulated by the kernels over all batches a worker marched
+    unsigned long long raysCast;        //rays with at least one sample
+    unsigned long long terminatedRays;  //stopped by early ray termination
+    unsigned long long sampledSteps;
+    unsigned long long skippedSteps;
+};
+
+typedef void (*RayMarchFunction)(const RayMarchContext& ctx, RayBatch& batch);
+
+void RayMarchScalar(const RayMarchContext& ctx, RayBatch& batch);  //1 lane
+void RayMarchSSE(const RayMarchContext& ctx, RayBatch& batch);     //4 lanes
+void RayMarchAVX2(const RayMarchContext& ctx, RayBatch& batch);    //8 lanes
+void RayMarchAVX512(const RayMarchContext& ctx, RayBatch& batch);  //16 lanes
@@ -0,0 +1,8 @@
+#include "RayMarchKernel.h"
+
+//compiled with -mavx2 -mfma (/arch:AVX2), only called when the CPU reports AVX2
+
+void RayMarchAVX2(const RayMarchContext& ctx, RayBatch& batch)
+{
+    MarchBatch<8>(ctx, batch);
+}
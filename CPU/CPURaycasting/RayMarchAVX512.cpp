@@ -0,0 +1,8 @@
+#include "RayMarchKernel.h"
+
+//compiled with -mavx512f (/arch:AVX512), only called when the CPU reports AVX-512F
+
+void RayMarchAVX512(const RayMarchContext& ctx, RayBatch& batch)
+{
+    MarchBatch<16>(ctx, batch);
+}
@@ -0,0 +1,702 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <type_traits>
+
+#include "BrickCache.h"
+#include "BrickedVolume.h"
+#include "GradientVolume.h"
+#include "RayMarch.h"
+#include "SimdFloat.h"
+
+//Kernel template shared by the RayMarch*.cpp translation units. Only include
+//it from those files: the instruction set of simd::FloatV<W> depends on the
+//compile flags of the including file.
+
+//voxel access of a flat volume of scalar type T. Of interleaved
+//multi-component voxels the last component is read, Component() gives
+//access to the others.
+template <typename T>
+struct FlatVolume
+{
+    typedef T Scalar;
+
+    explicit FlatVolume(const RayMarchContext& ctx)
+        : data(static_cast<const T*>(ctx.volume) + ctx.variant.components - 1),
+          sx(size_t(ctx.variant.components)), sy(sx * ctx.dims[0]), sz(sy * ctx.dims[1]) {}
+
+    const T* Voxel(int x, int y, int z) const
+    {
+        return data + size_t(x)*sx + size_t(y)*sy + size_t(z)*sz;
+    }
+
+    FlatVolume Component(int c) const
+    {
+        FlatVolume volume(*this);
+        volume.data += c - int(sx - 1);
+        return volume;
+    }
+
+    const T* data;
+    size_t sx, sy, sz;
+};
+
+//voxel access of 8-bit single component bricks; the brick holding a voxel
+//also holds its +1 neighbours, so they are at the same strides
+struct BrickVolume
+{
+    typedef unsigned char Scalar;
+
+    explicit BrickVolume(const RayMarchContext& ctx)
+        : bricks(ctx.bricks), brickSize(ctx.brickSize),
+          sx(1), sy(size_t(ctx.brickSize + 1)), sz(sy * sy)
+    {
+        grid[0] = ctx.brickGrid[0];
+        grid[1] = ctx.brickGrid[1];
+    }
+
+    const unsigned char* Voxel(int x, int y, int z) const
+    {
+        const int B = brickSize;
+        int bx = x / B, by = y / B, bz = z / B;
+        const unsigned char* brick = bricks[(bz*grid[1] + by)*grid[0] + bx];
+        return brick + size_t(x - bx*B) + size_t(y - by*B)*sy + size_t(z - bz*B)*sz;
+    }
+
+    BrickVolume Component(int) const { return *this; }
+
+    const unsigned char* const* bricks;
+    int brickSize;
+    int grid[2];
+    size_t sx, sy, sz;
+};
+
+//same for the bricks of a compressed volume, which the cache decodes the
+//first time any ray reaches them
+struct CachedBrickVolume
+{
+    typedef unsigned char Scalar;
+
+    explicit CachedBrickVolume(const RayMarchContext& ctx)
+        : cache(ctx.brickCache), brickSize(ctx.brickSize),
+          sx(1), sy(size_t(ctx.brickSize + 1)), sz(sy * sy)
+    {
+        grid[0] = ctx.brickGrid[0];
+        grid[1] = ctx.brickGrid[1];
+    }
+
+    const unsigned char* Voxel(int x, int y, int z) const
+    {
+        const int B = brickSize;
+        int bx = x / B, by = y / B, bz = z / B;
+        const unsigned char* brick = cache->GetBrick((bz*grid[1] + by)*grid[0] + bx);
+        return brick + size_t(x - bx*B) + size_t(y - by*B)*sy + size_t(z - bz*B)*sz;
+    }
+
+    CachedBrickVolume Component(int) const { return *this; }
+
+    BrickCache* cache;
+    int brickSize;
+    int grid[2];
+    size_t sx, sy, sz;
+};
+
+//fetch of W samples at texture coordinates (x,y,z) in the 0..255 domain of
+//the transfer function. Linear matches GL_LINEAR with GL_CLAMP on the 3D
+//texture: the weights are computed in vector registers, the eight corners
+//are loaded per lane. Nearest picks the texel containing the position.
+template <int W, bool Linear, class Volume>
+inline simd::FloatV<W> SampleVolume(const RayMarchContext& ctx, const Volume& volume,
+                                    const simd::FloatV<W>& x,
+                                    const simd::FloatV<W>& y,
+                                    const simd::FloatV<W>& z)
+{
+    typedef simd::FloatV<W> F;
+    typedef typename Volume::Scalar T;
+    const F half = F::Set1(0.5f);
+    const F zero = F::Set1(0.0f);
+    const F dx = F::Set1(float(ctx.dims[0])), dy = F::Set1(float(ctx.dims[1])), dz = F::Set1(float(ctx.dims[2]));
+
+    F value;
+    if (Linear) {
+        //texel space with clamp to edge
+        F tx = Min(Max(x * dx - half, zero), F::Set1(float(ctx.dims[0]-1)));
+        F ty = Min(Max(y * dy - half, zero), F::Set1(float(ctx.dims[1]-1)));
+        F tz = Min(Max(z * dz - half, zero), F::Set1(float(ctx.dims[2]-1)));
+
+        //lower corner, kept one texel inside so the +1 neighbours exist
+        F x0 = Min(Floor(tx), F::Set1(float(ctx.dims[0]-2)));
+        F y0 = Min(Floor(ty), F::Set1(float(ctx.dims[1]-2)));
+        F z0 = Min(Floor(tz), F::Set1(float(ctx.dims[2]-2)));
+        F fx = tx - x0, fy = ty - y0, fz = tz - z0;
+
+        int ix[W], iy[W], iz[W];
+        ToInt(ix, x0);
+        ToInt(iy, y0);
+        ToInt(iz, z0);
+
+        const size_t sx = volume.sx, sy = volume.sy, sz = volume.sz;
+        float c[8][W];
+        for (int i = 0; i < W; i++) {
+            const T* p = volume.Voxel(ix[i], iy[i], iz[i]);
+            c[0][i] = p[0];    c[1][i] = p[sx];
+            c[2][i] = p[sy];   c[3][i] = p[sy+sx];
+            c[4][i] = p[sz];   c[5][i] = p[sz+sx];
+            c[6][i] = p[sz+sy];c[7][i] = p[sz+sy+sx];
+        }
+
+        F c00 = F::Load(c[0]) + fx * (F::Load(c[1]) - F::Load(c[0]));
+        F c10 = F::Load(c[2]) + fx * (F::Load(c[3]) - F::Load(c[2]));
+        F c01 = F::Load(c[4]) + fx * (F::Load(c[5]) - F::Load(c[4]));
+        F c11 = F::Load(c[6]) + fx * (F::Load(c[7]) - F::Load(c[6]));
+        F c0 = c00 + fy * (c10 - c00);
+        F c1 = c01 + fy * (c11 - c01);
+        value = c0 + fz * (c1 - c0);
+    } else {
+        int ix[W], iy[W], iz[W];
+        ToInt(ix, Min(Max(x * dx, zero), F::Set1(float(ctx.dims[0]-1))));
+        ToInt(iy, Min(Max(y * dy, zero), F::Set1(float(ctx.dims[1]-1))));
+        ToInt(iz, Min(Max(z * dz, zero), F::Set1(float(ctx.dims[2]-1))));
+
+        float c[W];
+        for (int i = 0; i < W; i++)
+            c[i] = *volume.Voxel(ix[i], iy[i], iz[i]);
+        value = F::Load(c);
+    }
+
+    //8-bit scalars are the transfer function domain already
+    if (std::is_same<T, unsigned char>::value)
+        return value;
+    value = value * F::Set1(ctx.scalarScale) + F::Set1(ctx.scalarShift);
+    return Min(Max(value, zero), F::Set1(255.0f));
+}
+
+//colour of the samples of a multi-component volume (see RenderVariant):
+//two components are coloured by the transfer function of the first one,
+//three or four are RGB in the 0..255 domain of the transfer function
+template <int W, bool Linear, int Components, class Volume>
+inline void ComponentColour(const RayMarchContext& ctx, const Volume& volume,
+                            const simd::FloatV<W>& x, const simd::FloatV<W>& y,
+                            const simd::FloatV<W>& z, simd::FloatV<W>& r,
+                            simd::FloatV<W>& g, simd::FloatV<W>& b)
+{
+    typedef simd::FloatV<W> F;
+    if (Components == 2) {
+        const float* tfR = ctx.transferFunction;
+        int idx[W];
+        F first = SampleVolume<W, Linear>(ctx, volume.Component(0), x, y, z);
+        ToInt(idx, first * F::Set1(float(ctx.tfSize - 1) / 255.0f) + F::Set1(0.5f));
+        r = F::Gather(tfR, idx);
+        g = F::Gather(tfR + ctx.tfSize, idx);
+        b = F::Gather(tfR + 2 * ctx.tfSize, idx);
+        return;
+    }
+    const F normalize = F::Set1(1.0f / 255.0f);
+    r = SampleVolume<W, Linear>(ctx, volume.Component(0), x, y, z) * normalize;
+    g = SampleVolume<W, Linear>(ctx, volume.Component(1), x, y, z) * normalize;
+    b = SampleVolume<W, Linear>(ctx, volume.Component(2), x, y, z) * normalize;
+}
+
+//HeadlightCosine from the precomputed normal of the voxel nearest to each
+//lane, one fetch instead of six samples
+template <int W>
+inline simd::FloatV<W> CachedHeadlightCosine(const RayMarchContext& ctx, const simd::FloatV<W>& x,
+                                             const simd::FloatV<W>& y, const simd::FloatV<W>& z,
+                                             const simd::FloatV<W> step[3])
+{
+    typedef simd::FloatV<W> F;
+    const int* dims = ctx.volumeDims;
+    const F zero = F::Set1(0.0f);
+    int ix[W], iy[W], iz[W];
+    ToInt(ix, Min(Max(x * F::Set1(float(dims[0])), zero), F::Set1(float(dims[0]-1))));
+    ToInt(iy, Min(Max(y * F::Set1(float(dims[1])), zero), F::Set1(float(dims[1]-1))));
+    ToInt(iz, Min(Max(z * F::Set1(float(dims[2])), zero), F::Set1(float(dims[2]-1))));
+
+    float nx[W], ny[W], nz[W];
+    for (int i = 0; i < W; i++) {
+        const unsigned char* g = ctx.gradients + 3 * ((size_t(iz[i]) * dims[1] + iy[i]) * dims[0] + ix[i]);
+        float n[3] = {0.0f, 0.0f, 0.0f};
+        if (g[2])
+            GradientVolume::DecodeNormal(g, n);
+        nx[i] = n[0];
+        ny[i] = n[1];
+        nz[i] = n[2];
+    }
+
+    //ray direction in voxel units, like the normal
+    F lx = step[0] * F::Set1(float(dims[0]));
+    F ly = step[1] * F::Set1(float(dims[1]));
+    F lz = step[2] * F::Set1(float(dims[2]));
+    F dot = F::Load(nx) * lx + F::Load(ny) * ly + F::Load(nz) * lz;
+    F ll = lx * lx + ly * ly + lz * lz;
+    F cosine = Max(dot, zero - dot) / Sqrt(Max(ll, F::Set1(1e-20f)));
+    return Min(cosine, F::Set1(1.0f));
+}
+
+//cosine between the scalar gradient (central differences) and the ray
+//direction, which is also the light direction of the headlight. Both sides
+//of a surface are lit; lanes without a gradient get 0.
+template <int W, bool Linear, class Volume>
+inline simd::FloatV<W> HeadlightCosine(const RayMarchContext& ctx, const Volume& volume,
+                                       const simd::FloatV<W>& x, const simd::FloatV<W>& y,
+                                       const simd::FloatV<W>& z, const simd::FloatV<W> step[3])
+{
+    typedef simd::FloatV<W> F;
+    if (ctx.gradients)
+        return CachedHeadlightCosine<W>(ctx, x, y, z, step);
+    const F hx = F::Set1(1.0f / ctx.dims[0]), hy = F::Set1(1.0f / ctx.dims[1]), hz = F::Set1(1.0f / ctx.dims[2]);
+    F gx = SampleVolume<W, Linear>(ctx, volume, x + hx, y, z) - SampleVolume<W, Linear>(ctx, volume, x - hx, y, z);
+    F gy = SampleVolume<W, Linear>(ctx, volume, x, y + hy, z) - SampleVolume<W, Linear>(ctx, volume, x, y - hy, z);
+    F gz = SampleVolume<W, Linear>(ctx, volume, x, y, z + hz) - SampleVolume<W, Linear>(ctx, volume, x, y, z - hz);
+
+    //ray direction in voxel units, like the gradient
+    F lx = step[0] * F::Set1(float(ctx.dims[0]));
+    F ly = step[1] * F::Set1(float(ctx.dims[1]));
+    F lz = step[2] * F::Set1(float(ctx.dims[2]));
+
+    F gg = gx * gx + gy * gy + gz * gz;
+    F ll = lx * lx + ly * ly + lz * lz;
+    F dot = gx * lx + gy * ly + gz * lz;
+    F cosine = Max(dot, F::Set1(0.0f) - dot) / Sqrt(Max(gg * ll, F::Set1(1e-20f)));
+    return Select(CmpGt(gg, F::Set1(1e-6f)), Min(cosine, F::Set1(1.0f)), F::Set1(0.0f));
+}
+
+//x^n for n >= 0 by repeated squaring
+template <int W>
+inline simd::FloatV<W> PowInt(simd::FloatV<W> x, int n)
+{
+    simd::FloatV<W> r = simd::FloatV<W>::Set1(1.0f);
+    for (; n > 0; n >>= 1) {
+        if (n & 1)
+            r = r * x;
+        x = x * x;
+    }
+    return r;
+}
+
+//index of the macro cell of the sample at texture position p
+inline size_t MacroCellIndex(const RayMarchContext& ctx, const float p[3], int cell[3])
+{
+    const int* dims = ctx.volumeDims;
+    for (int axis = 0; axis < 3; axis++) {
+        float t = p[axis] * dims[axis] - 0.5f;
+        t = t < 0.0f ? 0.0f : (t > dims[axis] - 1 ? float(dims[axis] - 1) : t);
+        cell[axis] = static_cast<int>(t) / ctx.cellSize;
+        if (cell[axis] >= ctx.gridDims[axis])
+            cell[axis] = ctx.gridDims[axis] - 1;
+    }
+    return (size_t(cell[2]) * ctx.gridDims[1] + cell[1]) * ctx.gridDims[0] + cell[0];
+}
+
+//number of consecutive samples, starting with the one at texture position
+//p, that stay inside the macro cell
+inline float CellRun(const RayMarchContext& ctx, const int cell[3], const float p[3], const float step[3])
+{
+    const int* dims = ctx.volumeDims;
+
+    //steps until the first sample beyond the cell boundary, per axis
+    float run = 1e30f;
+    for (int axis = 0; axis < 3; axis++) {
+        float st = step[axis] * dims[axis];
+        if (st == 0.0f)
+            continue;
+        float t = p[axis] * dims[axis] - 0.5f;
+        float boundary = float((st > 0.0f ? cell[axis] + 1 : cell[axis]) * ctx.cellSize);
+        run = std::min(run, std::ceil((boundary - t) / st));
+    }
+    return run < 1.0f ? 1.0f : run;
+}
+
+//samples from p on that stay inside p's empty macro cell; 0 when the cell
+//is not empty
+inline float EmptyCellRun(const RayMarchContext& ctx, const float p[3], const float step[3])
+{
+    int cell[3];
+    if (ctx.occupancy[MacroCellIndex(ctx, p, cell)])
+        return 0.0f;
+    return CellRun(ctx, cell, p, step);
+}
+
+//samples from p on that stay inside p's macro cell when no sample of the
+//cell can beat the extreme of a maximum or minimum projection; 0 otherwise,
+//and the samples left in the cell, which are then taken without testing
+//the cell again, go to inCell
+template <int Blend>
+inline float DominatedCellRun(const RayMarchContext& ctx, const float p[3], const float step[3],
+                              float extreme, float& inCell)
+{
+    int cell[3];
+    const unsigned char* range = ctx.cellRanges + 2 * MacroCellIndex(ctx, p, cell);
+    bool dominated = Blend == BLEND_MAXIMUM ? range[1] <= extreme : range[0] >= extreme;
+    float run = CellRun(ctx, cell, p, step);
+    inCell = dominated ? 0.0f : run;
+    return dominated ? run : 0.0f;
+}
+
+//how composited samples get their colour and opacity: a transfer function
+//lookup per sample, a pre-integrated lookup per segment between samples, or
+//the opacity of the scalar and the colour of the other components of a
+//multi-component volume (see ComponentColour)
+enum SampleClassification
+{
+    CLASSIFY_SAMPLE,
+    CLASSIFY_SEGMENT,
+    CLASSIFY_TWO_COMPONENTS,
+    CLASSIFY_RGB
+};
+
+//marches rays [first, first+W) of the batch to completion, specialized for
+//one RenderVariant and the frame's options: every feature test below is on
+//a template parameter and folds away. With Skip set, samples falling into
+//empty macro cells are jumped over a cell at a time (for maximum and minimum
+//projections cells that cannot beat the ray's extreme), with Crop set the
+//gaps between the cropping spans of the ray are jumped over in one go. With
+//CLASSIFY_SEGMENT (compositing only) every step composites the segment
+//between the previous and the current sample. Depths records the steps for
+//temporal reprojection (see RayBatch::significant).
+template <int W, class Volume, bool Linear, int Blend, int Classify, bool Skip, bool Shade, bool Crop,
+          bool Depths>
+inline void MarchPacket(const RayMarchContext& ctx, const Volume& volume, RayBatch& batch, int first)
+{
+    typedef simd::FloatV<W> F;
+    typedef simd::MaskV<W> M;
+    const bool Composite = Blend == BLEND_COMPOSITE;
+    const bool Extremum = Blend == BLEND_MAXIMUM || Blend == BLEND_MINIMUM;
+    const bool Projection = Extremum || Blend == BLEND_AVERAGE;
+
+    const F zero = F::Set1(0.0f);
+    const F one = F::Set1(1.0f);
+    const F termination = F::Set1(ctx.earlyTermination);
+    const F tfScale = F::Set1(float(ctx.tfSize - 1) / 255.0f);
+    const float* tfR = ctx.transferFunction;
+    const float* tfG = tfR + ctx.tfSize;
+    const float* tfB = tfG + ctx.tfSize;
+    const float* tfA = tfB + ctx.tfSize;
+
+    F px = F::Load(batch.posX + first), py = F::Load(batch.posY + first), pz = F::Load(batch.posZ + first);
+    F sx = F::Load(batch.stepX + first), sy = F::Load(batch.stepY + first), sz = F::Load(batch.stepZ + first);
+    const F step[3] = {sx, sy, sz};
+    F remaining = F::Load(batch.samples + first);
+    F steps = zero;     //steps taken, the next sample is steps+1
+    F r = zero, g = zero, b = zero, a = zero;
+
+    //depths for temporal reprojection, counted in steps like the gaps
+    const F significantOpacity = F::Set1(ctx.significantOpacity);
+    F significant = zero, last = zero;
+
+    //segments start at the entry point
+    const bool preIntegrated = Classify == CLASSIFY_SEGMENT;
+    F front = preIntegrated ? SampleVolume<W, Linear>(ctx, volume, px, py, pz) : zero;
+
+    //projections keep the extreme scalar, or the sum for the average, and
+    //count the samples taken
+    F extreme = F::Set1(Blend == BLEND_MAXIMUM ? -1.0f : (Blend == BLEND_MINIMUM ? 256.0f : 0.0f));
+    F taken = zero;
+    const F saturation = F::Set1(ctx.saturation);
+
+    //a cell that does not dominate the extreme is tested once, on entering
+    //it: samples of the lane left in the current cell
+    F inCell = zero;
+
+    unsigned long long sampled = 0;
+    float skipped = 0.0f;
+
+    M active = CmpGt(remaining, zero);
+    const unsigned long long rays = Count(active);
+    while (Any(active)) {
+        //advance ray by dirStep
+        F nx = px + sx, ny = py + sy, nz = pz + sz;
+
+        M sampling = active;
+        F advance = one;
+        //extremum lanes inside a cell already tested need no lane work
+        bool laneWork = Crop || (Skip && !Extremum);
+        if (Extremum && Skip && !Crop)
+            laneWork = Any(AndNot(active, CmpGt(inCell, zero)));
+        if (laneWork) {
+            float lane[10][W];
+            Store(lane[0], nx); Store(lane[1], ny); Store(lane[2], nz);
+            Store(lane[3], sx); Store(lane[4], sy); Store(lane[5], sz);
+            Store(lane[6], Select(active, remaining, zero));
+            Store(lane[7], steps);
+            if (Extremum && Skip) {
+                Store(lane[8], extreme);
+                Store(lane[9], inCell);
+            }
+
+            float run[W];
+            for (int i = 0; i < W; i++) {
+                run[i] = 0.0f;
+                if (lane[6][i] <= 0.0f)
+                    continue;
+
+                //a cropped gap ends the same way as an empty cell
+                if (Crop) {
+                    float next = lane[7][i] + 1.0f;
+                    for (int gap = 0; gap < MAX_CROP_GAPS; gap++) {
+                        const int ray = gap * batch.count + first + i;
+                        if (next >= batch.gapBegin[ray] && next <= batch.gapEnd[ray])
+                            run[i] = batch.gapEnd[ray] - next + 1.0f;
+                    }
+                }
+                if (Skip && run[i] == 0.0f) {
+                    const float p[3] = {lane[0][i], lane[1][i], lane[2][i]};
+                    const float st[3] = {lane[3][i], lane[4][i], lane[5][i]};
+                    if (!Extremum)
+                        run[i] = EmptyCellRun(ctx, p, st);
+                    else if (lane[9][i] <= 0.0f)
+                        run[i] = DominatedCellRun<Blend>(ctx, p, st, lane[8][i], lane[9][i]);
+                } else if (Extremum && Skip) {
+                    lane[9][i] = 0.0f;  //a cropped gap leaves the cell
+                }
+                run[i] = std::min(run[i], lane[6][i]);
+                skipped += run[i];
+            }
+
+            //lanes in empty cells or cropped gaps move to their last sample
+            F jump = F::Load(run);
+            M jumping = CmpGt(jump, zero);
+            sampling = AndNot(active, jumping);
+            advance = Select(jumping, jump, one);
+            F back = Select(jumping, jump - one, zero);
+            nx = nx + back * sx;
+            ny = ny + back * sy;
+            nz = nz + back * sz;
+            if (Extremum && Skip)
+                inCell = F::Load(lane[9]);
+        }
+        if (Extremum && Skip)
+            inCell = inCell - one;
+        px = nx;
+        py = ny;
+        pz = nz;
+        if (Crop || Depths)
+            steps = steps + advance;
+        if (Depths)
+            last = Select(active, steps, last);
+
+        //lanes that jumped still sample when pre-integrating, the sample at
+        //the end of the jump starts their next segment
+        if (Any(preIntegrated ? active : sampling)) {
+            F sample = SampleVolume<W, Linear>(ctx, volume, px, py, pz);
+
+            if (Projection) {
+                if (Extremum) {
+                    F candidate = Select(sampling, sample, extreme);
+                    extreme = Blend == BLEND_MAXIMUM ? Max(extreme, candidate) : Min(extreme, candidate);
+                } else {
+                    extreme = extreme + Select(sampling, sample, zero);
+                }
+                taken = taken + Select(sampling, one, zero);
+                sampled += Count(sampling);
+            } else {
+                //classify through the transfer function (nearest entry)
+                int idx[W];
+                ToInt(idx, sample * tfScale + F::Set1(0.5f));
+
+                F sr, sg, sb, sa;
+                if (preIntegrated) {
+                    //segment entries are premultiplied by the segment opacity
+                    int frontIdx[W], segment[W];
+                    ToInt(frontIdx, front * tfScale + F::Set1(0.5f));
+                    for (int i = 0; i < W; i++)
+                        segment[i] = 4 * (idx[i] * ctx.tfSize + frontIdx[i]);
+                    front = sample;
+                    sa = F::Gather(ctx.preIntegrated + 3, segment);
+                    sr = F::Gather(ctx.preIntegrated, segment);
+                    sg = F::Gather(ctx.preIntegrated + 1, segment);
+                    sb = F::Gather(ctx.preIntegrated + 2, segment);
+                } else if (Classify != CLASSIFY_SAMPLE) {
+                    sa = F::Gather(tfA, idx);
+                    ComponentColour<W, Linear, Classify == CLASSIFY_TWO_COMPONENTS ? 2 : 3>(
+                        ctx, volume, px, py, pz, sr, sg, sb);
+                    sr = sr * sa;
+                    sg = sg * sa;
+                    sb = sb * sa;
+                } else {
+                    sa = F::Gather(tfA, idx);
+                    sr = F::Gather(tfR, idx) * sa;
+                    sg = F::Gather(tfG, idx) * sa;
+                    sb = F::Gather(tfB, idx) * sa;
+                }
+
+                if (Shade) {
+                    F cosine = HeadlightCosine<W, Linear>(ctx, volume, px, py, pz, step);
+                    F lighting = F::Set1(ctx.ambient) + F::Set1(ctx.diffuse) * cosine;
+                    F highlight = F::Set1(ctx.specular) * PowInt(cosine, ctx.specularPower) * sa;
+                    sr = sr * lighting + highlight;
+                    sg = sg * lighting + highlight;
+                    sb = sb * lighting + highlight;
+                }
+
+                //front to back compositing, or a plain sum; lanes not
+                //sampling contribute nothing
+                F weight = Select(sampling, Composite ? one - a : one, zero);
+                M insignificant = CmpLt(a, significantOpacity);
+                r = r + weight * sr;
+                g = g + weight * sg;
+                b = b + weight * sb;
+                a = a + weight * sa;
+                sampled += Count(sampling);
+                if (Composite && Depths)
+                    significant = Select(AndNot(insignificant, CmpLt(a, significantOpacity)),
+                                         steps, significant);
+            }
+        }
+
+        //early ray termination and end of ray; a maximum or minimum
+        //projection is done once its extreme saturated
+        remaining = remaining - advance;
+        active = And(active, CmpGt(remaining, zero));
+        if (Composite)
+            active = And(active, CmpLt(a, termination));
+        else if (Blend == BLEND_MAXIMUM)
+            active = And(active, CmpLt(extreme, saturation));
+        else if (Blend == BLEND_MINIMUM)
+            active = And(active, CmpGt(extreme, saturation));
+    }
+
+    if (Projection) {
+        //the projected scalar is classified once
+        F projected = Blend == BLEND_AVERAGE ? extreme / Max(taken, one) : extreme;
+        int idx[W];
+        ToInt(idx, Min(Max(projected, zero), F::Set1(255.0f)) * tfScale + F::Set1(0.5f));
+        a = Select(CmpGt(taken, zero), F::Gather(tfA, idx), zero);
+        r = a * F::Gather(tfR, idx);
+        g = a * F::Gather(tfG, idx);
+        b = a * F::Gather(tfB, idx);
+    } else if (Blend == BLEND_ADDITIVE) {
+        r = Min(r, one);
+        g = Min(g, one);
+        b = Min(b, one);
+        a = Min(a, one);
+    }
+
+    Store(batch.r + first, r);
+    Store(batch.g + first, g);
+    Store(batch.b + first, b);
+    Store(batch.a + first, a);
+    if (Depths) {
+        //rays that stayed insignificant are placed at their last sample
+        if (Composite)
+            significant = Select(CmpLt(a, significantOpacity), last, significant);
+        Store(batch.significant + first, significant);
+        Store(batch.last + first, last);
+    }
+    batch.raysCast += rays;
+    batch.terminatedRays += Count(CmpGt(remaining, zero));
+    batch.sampledSteps += sampled;
+    batch.skippedSteps += static_cast<unsigned long long>(skipped);
+}
+
+template <int W, class Volume, bool Linear, int Blend, int Classify, bool Skip, bool Shade, bool Crop,
+          bool Depths>
+inline void MarchPackets(const RayMarchContext& ctx, RayBatch& batch)
+{
+    const Volume volume(ctx);
+    for (int first = 0; first < batch.count; first += W)
+        MarchPacket<W, Volume, Linear, Blend, Classify, Skip, Shade, Crop, Depths>(ctx, volume, batch, first);
+}
+
+//The variant of the context picks the instantiation one feature at a time.
+//Features a blend mode does not have are folded into the template
+//arguments, so they add no instantiations: shading and pre-integration exist
+//for compositing only, component colours for the blend modes that classify
+//every sample, and skipping only where transparent samples add nothing or,
+//for maximum and minimum projections, where no sample can beat the extreme.
+template <int W, class Volume, bool Linear, int Blend, int Classify, bool Skip, bool Shade, bool Crop>
+inline void DispatchDepths(const RayMarchContext& ctx, RayBatch& batch)
+{
+    if (ctx.significantOpacity > 0.0f)
+        MarchPackets<W, Volume, Linear, Blend, Classify, Skip, Shade, Crop, true>(ctx, batch);
+    else
+        MarchPackets<W, Volume, Linear, Blend, Classify, Skip, Shade, Crop, false>(ctx, batch);
+}
+
+template <int W, class Volume, bool Linear, int Blend, int Classify, bool Skip, bool Shade>
+inline void DispatchCropping(const RayMarchContext& ctx, RayBatch& batch)
+{
+    if (ctx.variant.cropping)
+        DispatchDepths<W, Volume, Linear, Blend, Classify, Skip, Shade, true>(ctx, batch);
+    else
+        DispatchDepths<W, Volume, Linear, Blend, Classify, Skip, Shade, false>(ctx, batch);
+}
+
+template <int W, class Volume, bool Linear, int Blend, int Classify>
+inline void DispatchSkippingAndShading(const RayMarchContext& ctx, RayBatch& batch)
+{
+    const bool CanSkip = Blend != BLEND_AVERAGE;
+    const bool CanShade = Blend == BLEND_COMPOSITE;
+    if (Blend == BLEND_MAXIMUM || Blend == BLEND_MINIMUM ? ctx.cellRanges != 0 : ctx.occupancy != 0) {
+        if (ctx.variant.shading)
+            DispatchCropping<W, Volume, Linear, Blend, Classify, CanSkip, CanShade>(ctx, batch);
+        else
+            DispatchCropping<W, Volume, Linear, Blend, Classify, CanSkip, false>(ctx, batch);
+    } else {
+        if (ctx.variant.shading)
+            DispatchCropping<W, Volume, Linear, Blend, Classify, false, CanShade>(ctx, batch);
+        else
+            DispatchCropping<W, Volume, Linear, Blend, Classify, false, false>(ctx, batch);
+    }
+}
+
+//bricks hold a single component, so only flat volumes have component colours
+template <int W, class Volume, bool Linear, int Blend>
+inline void DispatchClassification(const RayMarchContext& ctx, RayBatch& batch)
+{
+    const bool CanPreIntegrate = Blend == BLEND_COMPOSITE;
+    const bool CanColour = (Blend == BLEND_COMPOSITE || Blend == BLEND_ADDITIVE) &&
+                           std::is_same<Volume, FlatVolume<typename Volume::Scalar> >::value;
+    const int Segment = CanPreIntegrate ? CLASSIFY_SEGMENT : CLASSIFY_SAMPLE;
+    const int TwoComponents = CanColour ? CLASSIFY_TWO_COMPONENTS : CLASSIFY_SAMPLE;
+    const int RGB = CanColour ? CLASSIFY_RGB : CLASSIFY_SAMPLE;
+    if (CanPreIntegrate && ctx.preIntegrated)
+        DispatchSkippingAndShading<W, Volume, Linear, Blend, Segment>(ctx, batch);
+    else if (ctx.variant.components == 2)
+        DispatchSkippingAndShading<W, Volume, Linear, Blend, TwoComponents>(ctx, batch);
+    else if (ctx.variant.components > 2)
+        DispatchSkippingAndShading<W, Volume, Linear, Blend, RGB>(ctx, batch);
+    else
+        DispatchSkippingAndShading<W, Volume, Linear, Blend, CLASSIFY_SAMPLE>(ctx, batch);
+}
+
+template <int W, class Volume, bool Linear>
+inline void DispatchBlendMode(const RayMarchContext& ctx, RayBatch& batch)
+{
+    switch (ctx.variant.blendMode) {
+    case BLEND_MAXIMUM: DispatchClassification<W, Volume, Linear, BLEND_MAXIMUM>(ctx, batch); break;
+    case BLEND_MINIMUM: DispatchClassification<W, Volume, Linear, BLEND_MINIMUM>(ctx, batch); break;
+    case BLEND_ADDITIVE: DispatchClassification<W, Volume, Linear, BLEND_ADDITIVE>(ctx, batch); break;
+    case BLEND_AVERAGE: DispatchClassification<W, Volume, Linear, BLEND_AVERAGE>(ctx, batch); break;
+    default: DispatchClassification<W, Volume, Linear, BLEND_COMPOSITE>(ctx, batch); break;
+    }
+}
+
+template <int W, class Volume>
+inline void DispatchInterpolation(const RayMarchContext& ctx, RayBatch& batch)
+{
+    if (ctx.variant.linear)
+        DispatchBlendMode<W, Volume, true>(ctx, batch);
+    else
+        DispatchBlendMode<W, Volume, false>(ctx, batch);
+}
+
+template <int W>
+inline void MarchBatch(const RayMarchContext& ctx, RayBatch& batch)
+{
+    if (ctx.brickCache) {
+        DispatchInterpolation<W, CachedBrickVolume>(ctx, batch);
+        return;
+    }
+    if (ctx.bricks) {
+        DispatchInterpolation<W, BrickVolume>(ctx, batch);
+        return;
+    }
+    switch (ctx.variant.scalarType) {
+    case SCALAR_UINT16: DispatchInterpolation<W, FlatVolume<unsigned short> >(ctx, batch); break;
+    case SCALAR_INT16: DispatchInterpolation<W, FlatVolume<short> >(ctx, batch); break;
+    case SCALAR_FLOAT32: DispatchInterpolation<W, FlatVolume<float> >(ctx, batch); break;
+    default: DispatchInterpolation<W, FlatVolume<unsigned char> >(ctx, batch); break;
+    }
+}
@@ -0,0 +1,13 @@
+#include "RayMarchKernel.h"
+
+//baseline kernels, built with the default flags of the target (SSE2 on x86-64)
+
+void RayMarchScalar(const RayMarchContext& ctx, RayBatch& batch)
+{
+    MarchBatch<1>(ctx, batch);
+}
+
+void RayMarchSSE(const RayMarchContext& ctx, RayBatch& batch)
+{
+    MarchBatch<4>(ctx, batch);
+}
@@ -0,0 +1,186 @@
+#pragma once
+#include <cmath>
+
+#if defined(__SSE2__) || defined(__AVX__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+//Thin W-wide float vector used by the ray packet kernels. The generic
+//template is a plain array the compiler is free to auto-vectorize; the
+//specializations map 4/8/16 lanes onto SSE2/AVX2/AVX-512 registers when the
+//translation unit is compiled for that instruction set (see RayMarch*.cpp).
+namespace simd
+{
+
+inline int BitCount(unsigned bits)
+{
+    int n = 0;
+    for (; bits; bits &= bits - 1)
+        n++;
+    return n;
+}
+
+template <int W>
+struct FloatV
+{
+    float v[W];
+
+    static FloatV Set1(float s)
+    { FloatV r; for (int i = 0; i < W; i++) r.v[i] = s; return r; }
+    static FloatV Load(const float* p)
+    { FloatV r; for (int i = 0; i < W; i++) r.v[i] = p[i]; return r; }
+    static FloatV Gather(const float* base, const int* idx)
+    { FloatV r; for (int i = 0; i < W; i++) r.v[i] = base[idx[i]]; return r; }
+};
+
+template <int W>
+struct MaskV
+{
+    bool v[W];
+};
+
+template <int W> inline void Store(float* p, const FloatV<W>& a)
+{ for (int i = 0; i < W; i++) p[i] = a.v[i]; }
+template <int W> inline FloatV<W> operator+(const FloatV<W>& a, const FloatV<W>& b)
+{ FloatV<W> r; for (int i = 0; i < W; i++) r.v[i] = a.v[i] + b.v[i]; return r; }
+template <int W> inline FloatV<W> operator-(const FloatV<W>& a, const FloatV<W>& b)
+{ FloatV<W> r; for (int i = 0; i < W; i++) r.v[i] = a.v[i] - b.v[i]; return r; }
+template <int W> inline FloatV<W> operator*(const FloatV<W>& a, const FloatV<W>& b)
+{ FloatV<W> r; for (int i = 0; i < W; i++) r.v[i] = a.v[i] * b.v[i]; return r; }
+template <int W> inline FloatV<W> operator/(const FloatV<W>& a, const FloatV<W>& b)
+{ FloatV<W> r; for (int i = 0; i < W; i++) r.v[i] = a.v[i] / b.v[i]; return r; }
+template <int W> inline FloatV<W> Sqrt(const FloatV<W>& a)
+{ FloatV<W> r; for (int i = 0; i < W; i++) r.v[i] = std::sqrt(a.v[i]); return r; }
+template <int W> inline FloatV<W> Min(const FloatV<W>& a, const FloatV<W>& b)
+{ FloatV<W> r; for (int i = 0; i < W; i++) r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]; return r; }
+template <int W> inline FloatV<W> Max(const FloatV<W>& a, const FloatV<W>& b)
+{ FloatV<W> r; for (int i = 0; i < W; i++) r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]; return r; }
+template <int W> inline FloatV<W> Floor(const FloatV<W>& a)
+{ FloatV<W> r; for (int i = 0; i < W; i++) r.v[i] = std::floor(a.v[i]); return r; }
+template <int W> inline void ToInt(int* p, const FloatV<W>& a)
+{ for (int i = 0; i < W; i++) p[i] = static_cast<int>(a.v[i]); }
+
+template <int W> inline MaskV<W> CmpLt(const FloatV<W>& a, const FloatV<W>& b)
+{ MaskV<W> r; for (int i = 0; i < W; i++) r.v[i] = a.v[i] < b.v[i]; return r; }
+template <int W> inline MaskV<W> CmpGt(const FloatV<W>& a, const FloatV<W>& b)
+{ MaskV<W> r; for (int i = 0; i < W; i++) r.v[i] = a.v[i] > b.v[i]; return r; }
+template <int W> inline MaskV<W> And(const MaskV<W>& a, const MaskV<W>& b)
+{ MaskV<W> r; for (int i = 0; i < W; i++) r.v[i] = a.v[i] && b.v[i]; return r; }
+template <int W> inline MaskV<W> AndNot(const MaskV<W>& a, const MaskV<W>& b)
+{ MaskV<W> r; for (int i = 0; i < W; i++) r.v[i] = a.v[i] && !b.v[i]; return r; }
+template <int W> inline bool Any(const MaskV<W>& a)
+{ for (int i = 0; i < W; i++) if (a.v[i]) return true; return false; }
+template <int W> inline int Count(const MaskV<W>& a)
+{ int n = 0; for (int i = 0; i < W; i++) n += a.v[i] ? 1 : 0; return n; }
+template <int W> inline FloatV<W> Select(const MaskV<W>& m, const FloatV<W>& a, const FloatV<W>& b)
+{ FloatV<W> r; for (int i = 0; i < W; i++) r.v[i] = m.v[i] ? a.v[i] : b.v[i]; return r; }
+
+#if defined(__SSE2__)
+template <> struct FloatV<4>
+{
+    __m128 v;
+
+    static FloatV Set1(float s) { FloatV r; r.v = _mm_set1_ps(s); return r; }
+    static FloatV Load(const float* p) { FloatV r; r.v = _mm_loadu_ps(p); return r; }
+    static FloatV Gather(const float* base, const int* idx)
+    { FloatV r; r.v = _mm_setr_ps(base[idx[0]], base[idx[1]], base[idx[2]], base[idx[3]]); return r; }
+};
+template <> struct MaskV<4> { __m128 v; };
+
+inline void Store(float* p, const FloatV<4>& a) { _mm_storeu_ps(p, a.v); }
+inline FloatV<4> operator+(const FloatV<4>& a, const FloatV<4>& b) { FloatV<4> r; r.v = _mm_add_ps(a.v, b.v); return r; }
+inline FloatV<4> operator-(const FloatV<4>& a, const FloatV<4>& b) { FloatV<4> r; r.v = _mm_sub_ps(a.v, b.v); return r; }
+inline FloatV<4> operator*(const FloatV<4>& a, const FloatV<4>& b) { FloatV<4> r; r.v = _mm_mul_ps(a.v, b.v); return r; }
+inline FloatV<4> operator/(const FloatV<4>& a, const FloatV<4>& b) { FloatV<4> r; r.v = _mm_div_ps(a.v, b.v); return r; }
+inline FloatV<4> Sqrt(const FloatV<4>& a) { FloatV<4> r; r.v = _mm_sqrt_ps(a.v); return r; }
+inline FloatV<4> Min(const FloatV<4>& a, const FloatV<4>& b) { FloatV<4> r; r.v = _mm_min_ps(a.v, b.v); return r; }
+inline FloatV<4> Max(const FloatV<4>& a, const FloatV<4>& b) { FloatV<4> r; r.v = _mm_max_ps(a.v, b.v); return r; }
+inline FloatV<4> Floor(const FloatV<4>& a)
+{
+    //SSE2 has no round instruction: truncate and fix up negative values
+    FloatV<4> r;
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+    r.v = _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.v), _mm_set1_ps(1.0f)));
+    return r;
+}
+inline void ToInt(int* p, const FloatV<4>& a) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_cvttps_epi32(a.v)); }
+inline MaskV<4> CmpLt(const FloatV<4>& a, const FloatV<4>& b) { MaskV<4> r; r.v = _mm_cmplt_ps(a.v, b.v); return r; }
+inline MaskV<4> CmpGt(const FloatV<4>& a, const FloatV<4>& b) { MaskV<4> r; r.v = _mm_cmpgt_ps(a.v, b.v); return r; }
+inline MaskV<4> And(const MaskV<4>& a, const MaskV<4>& b) { MaskV<4> r; r.v = _mm_and_ps(a.v, b.v); return r; }
+inline MaskV<4> AndNot(const MaskV<4>& a, const MaskV<4>& b) { MaskV<4> r; r.v = _mm_andnot_ps(b.v, a.v); return r; }
+inline bool Any(const MaskV<4>& a) { return _mm_movemask_ps(a.v) != 0; }
+inline int Count(const MaskV<4>& a) { return BitCount(static_cast<unsigned>(_mm_movemask_ps(a.v))); }
+inline FloatV<4> Select(const MaskV<4>& m, const FloatV<4>& a, const FloatV<4>& b)
+{ FloatV<4> r; r.v = _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v)); return r; }
+#endif
+
+#if defined(__AVX2__)
+template <> struct FloatV<8>
+{
+    __m256 v;
+
+    static FloatV Set1(float s) { FloatV r; r.v = _mm256_set1_ps(s); return r; }
+    static FloatV Load(const float* p) { FloatV r; r.v = _mm256_loadu_ps(p); return r; }
+    static FloatV Gather(const float* base, const int* idx)
+    {
+        FloatV r;
+        r.v = _mm256_i32gather_ps(base, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx)), 4);
+        return r;
+    }
+};
+template <> struct MaskV<8> { __m256 v; };
+
+inline void Store(float* p, const FloatV<8>& a) { _mm256_storeu_ps(p, a.v); }
+inline FloatV<8> operator+(const FloatV<8>& a, const FloatV<8>& b) { FloatV<8> r; r.v = _mm256_add_ps(a.v, b.v); return r; }
+inline FloatV<8> operator-(const FloatV<8>& a, const FloatV<8>& b) { FloatV<8> r; r.v = _mm256_sub_ps(a.v, b.v); return r; }
+inline FloatV<8> operator*(const FloatV<8>& a, const FloatV<8>& b) { FloatV<8> r; r.v = _mm256_mul_ps(a.v, b.v); return r; }
+inline FloatV<8> operator/(const FloatV<8>& a, const FloatV<8>& b) { FloatV<8> r; r.v = _mm256_div_ps(a.v, b.v); return r; }
+inline FloatV<8> Sqrt(const FloatV<8>& a) { FloatV<8> r; r.v = _mm256_sqrt_ps(a.v); return r; }
+inline FloatV<8> Min(const FloatV<8>& a, const FloatV<8>& b) { FloatV<8> r; r.v = _mm256_min_ps(a.v, b.v); return r; }
+inline FloatV<8> Max(const FloatV<8>& a, const FloatV<8>& b) { FloatV<8> r; r.v = _mm256_max_ps(a.v, b.v); return r; }
+inline FloatV<8> Floor(const FloatV<8>& a) { FloatV<8> r; r.v = _mm256_floor_ps(a.v); return r; }
+inline void ToInt(int* p, const FloatV<8>& a) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), _mm256_cvttps_epi32(a.v)); }
+inline MaskV<8> CmpLt(const FloatV<8>& a, const FloatV<8>& b) { MaskV<8> r; r.v = _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); return r; }
+inline MaskV<8> CmpGt(const FloatV<8>& a, const FloatV<8>& b) { MaskV<8> r; r.v = _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); return r; }
+inline MaskV<8> And(const MaskV<8>& a, const MaskV<8>& b) { MaskV<8> r; r.v = _mm256_and_ps(a.v, b.v); return r; }
+inline MaskV<8> AndNot(const MaskV<8>& a, const MaskV<8>& b) { MaskV<8> r; r.v = _mm256_andnot_ps(b.v, a.v); return r; }
+inline bool Any(const MaskV<8>& a) { return _mm256_movemask_ps(a.v) != 0; }
+inline int Count(const MaskV<8>& a) { return BitCount(static_cast<unsigned>(_mm256_movemask_ps(a.v))); }
+inline FloatV<8> Select(const MaskV<8>& m, const FloatV<8>& a, const FloatV<8>& b)
+{ FloatV<8> r; r.v = _mm256_blendv_ps(b.v, a.v, m.v); return r; }
+#endif
+
+#if defined(__AVX512F__)
+template <> struct FloatV<16>
+{
+    __m512 v;
+
+    static FloatV Set1(float s) { FloatV r; r.v = _mm512_set1_ps(s); return r; }
+    static FloatV Load(const float* p) { FloatV r; r.v = _mm512_loadu_ps(p); return r; }
+    static FloatV Gather(const float* base, const int* idx)
+    { FloatV r; r.v = _mm512_i32gather_ps(_mm512_loadu_si512(idx), base, 4); return r; }
+};
+template <> struct MaskV<16> { __mmask16 v; };
+
+inline void Store(float* p, const FloatV<16>& a) { _mm512_storeu_ps(p, a.v); }
+inline FloatV<16> operator+(const FloatV<16>& a, const FloatV<16>& b) { FloatV<16> r; r.v = _mm512_add_ps(a.v, b.v); return r; }
+inline FloatV<16> operator-(const FloatV<16>& a, const FloatV<16>& b) { FloatV<16> r; r.v = _mm512_sub_ps(a.v, b.v); return r; }
+inline FloatV<16> operator*(const FloatV<16>& a, const FloatV<16>& b) { FloatV<16> r; r.v = _mm512_mul_ps(a.v, b.v); return r; }
+inline FloatV<16> operator/(const FloatV<16>& a, const FloatV<16>& b) { FloatV<16> r; r.v = _mm512_div_ps(a.v, b.v); return r; }
+inline FloatV<16> Sqrt(const FloatV<16>& a) { FloatV<16> r; r.v = _mm512_sqrt_ps(a.v); return r; }
+inline FloatV<16> Min(const FloatV<16>& a, const FloatV<16>& b) { FloatV<16> r; r.v = _mm512_min_ps(a.v, b.v); return r; }
+inline FloatV<16> Max(const FloatV<16>& a, const FloatV<16>& b) { FloatV<16> r; r.v = _mm512_max_ps(a.v, b.v); return r; }
+inline FloatV<16> Floor(const FloatV<16>& a)
+{ FloatV<16> r; r.v = _mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); return r; }
+inline void ToInt(int* p, const FloatV<16>& a) { _mm512_storeu_si512(p, _mm512_cvttps_epi32(a.v)); }
+inline MaskV<16> CmpLt(const FloatV<16>& a, const FloatV<16>& b) { MaskV<16> r; r.v = _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ); return r; }
+inline MaskV<16> CmpGt(const FloatV<16>& a, const FloatV<16>& b) { MaskV<16> r; r.v = _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ); return r; }
+inline MaskV<16> And(const MaskV<16>& a, const MaskV<16>& b) { MaskV<16> r; r.v = static_cast<__mmask16>(a.v & b.v); return r; }
+inline MaskV<16> AndNot(const MaskV<16>& a, const MaskV<16>& b) { MaskV<16> r; r.v = static_cast<__mmask16>(a.v & ~b.v); return r; }
+inline bool Any(const MaskV<16>& a) { return a.v != 0; }
+inline int Count(const MaskV<16>& a) { return BitCount(a.v); }
+inline FloatV<16> Select(const MaskV<16>& m, const FloatV<16>& a, const FloatV<16>& b)
+{ FloatV<16> r; r.v = _mm512_mask_blend_ps(m.v, b.v, a.v); return r; }
+#endif
+
+} //namespace simd
@@ -0,0 +1,291 @@
+#include "BenchmarkReport.h"
+#include "FrameProfiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace
+{
+std::string ToString(double value)
+{
+    std::ostringstream os;
+    os << std::setprecision(9) << value;
+    return os.str();
+}
+
+void Set(std::vector<std::pair<std::string, std::string> >& list,
+         const std::string& key, const std::string& value)
+{
+    for (size_t i = 0; i < list.size(); i++)
+        if (list[i].first == key) {
+            list[i].second = value;
+            return;
+        }
+    list.push_back(std::make_pair(key, value));
+}
+
+//profiler names may contain spaces
+std::string MetricName(const std::string& name)
+{
+    std::string key = name;
+    std::replace(key.begin(), key.end(), ' ', '_');
+    return key;
+}
+
+std::string JSONString(const std::string& s)
+{
+    std::string out = "\"";
+    for (size_t i = 0; i < s.size(); i++) {
+        char c = s[i];
+        if (c == '"' || c == '\\')
+            out += '\\';
+        if (static_cast<unsigned char>(c) < 0x20) {
+            char buffer[8];
+            snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+            out += buffer;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+//JSON has no representation for inf/nan
+std::string JSONNumber(double value)
+{
+    return std::isfinite(value) ? ToString(value) : "null";
+}
+
+std::string CSVField(const std::string& s)
+{
+    if (s.find_first_of(",\"\n") == std::string::npos)
+        return s;
+    std::string out = "\"";
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] == '"')
+            out += '"';
+        out += s[i];
+    }
+    return out + "\"";
+}
+
+const char* const StatisticNames[] = {
+    "frames", "mean_ms", "stddev_ms", "min_ms", "p50_ms", "p90_ms", "p95_ms", "p99_ms", "max_ms"
+};
+
+//statistic values in the order of StatisticNames, times in milliseconds
+std::vector<double> StatisticValues(const BenchmarkReport::Statistics& s)
+{
+    const double ms = 1000.0;
+    double values[] = {double(s.frames), s.mean*ms, s.stddev*ms, s.min*ms,
+                       s.p50*ms, s.p90*ms, s.p95*ms, s.p99*ms, s.max*ms};
+    return std::vector<double>(values, values + 9);
+}
+}
+
+void BenchmarkReport::Run::SetParameter(const std::string& key, const std::string& value)
+{
+    Set(parameters, key, value);
+}
+
+void BenchmarkReport::Run::SetParameter(const std::string& key, double value)
+{
+    Set(parameters, key, ToString(value));
+}
+
+void BenchmarkReport::Run::SetMetric(const std::string& key, double value)
+{
+    for (size_t i = 0; i < metrics.size(); i++)
+        if (metrics[i].first == key) {
+            metrics[i].second = value;
+            return;
+        }
+    metrics.push_back(std::make_pair(key, value));
+}
+
+void BenchmarkReport::Run::SetProfileMetrics(const FrameProfiler& profiler)
+{
+    FrameProfiler::Frame average = profiler.GetAverage();
+    for (int i = 0; i < profiler.GetNumberOfStages(); i++) {
+        std::string key = MetricName(profiler.GetStageName(i));
+        SetMetric(key + "_ms", average.cpu[i] * 1000.0);
+        if (average.gpu[i] >= 0.0)
+            SetMetric(key + "_gpu_ms", average.gpu[i] * 1000.0);
+    }
+    for (int i = 0; i < profiler.GetNumberOfCounters(); i++)
+        SetMetric(MetricName(profiler.GetCounterName(i)),
+                  static_cast<double>(average.counters[i]));
+}
+
+void BenchmarkReport::SetEnvironment(const std::string& key, const std::string& value)
+{
+    Set(_environment, key, value);
+}
+
+BenchmarkReport::Run& BenchmarkReport::AddRun()
+{
+    _runs.push_back(Run());
+    return _runs.back();
+}
+
+double BenchmarkReport::Percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0.0;
+    double rank = std::ceil(p / 100.0 * sorted.size());
+    size_t index = rank < 1.0 ? 0 : std::min(sorted.size(), size_t(rank)) - 1;
+    return sorted[index];
+}
+
+BenchmarkReport::Statistics BenchmarkReport::ComputeStatistics(const std::vector<double>& frameTimes)
+{
+    Statistics s;
+    s.frames = static_cast<int>(frameTimes.size());
+    s.mean = s.stddev = s.min = s.max = 0.0;
+    s.p50 = s.p90 = s.p95 = s.p99 = 0.0;
+    if (frameTimes.empty())
+        return s;
+
+    std::vector<double> sorted(frameTimes);
+    std::sort(sorted.begin(), sorted.end());
+    double sum = 0.0;
+    for (size_t i = 0; i < sorted.size(); i++)
+        sum += sorted[i];
+    s.mean = sum / sorted.size();
+    double variance = 0.0;
+    for (size_t i = 0; i < sorted.size(); i++)
+        variance += (sorted[i] - s.mean) * (sorted[i] - s.mean);
+    s.stddev = std::sqrt(variance / sorted.size());
+    s.min = sorted.front();
+    s.max = sorted.back();
+    s.p50 = Percentile(sorted, 50.0);
+    s.p90 = Percentile(sorted, 90.0);
+    s.p95 = Percentile(sorted, 95.0);
+    s.p99 = Percentile(sorted, 99.0);
+    return s;
+}
+
+void BenchmarkReport::WriteJSON(std::ostream& os) const
+{
+    os << "{\n  \"environment\": {";
+    for (size_t i = 0; i < _environment.size(); i++)
+        os << (i ? ",\n" : "\n") << "    " << JSONString(_environment[i].first)
+           << ": " << JSONString(_environment[i].second);
+    os << "\n  },\n  \"runs\": [";
+
+    for (size_t r = 0; r < _runs.size(); r++) {
+        const Run& run = _runs[r];
+        os << (r ? ",\n" : "\n") << "    {\n      \"parameters\": {";
+        for (size_t i = 0; i < run.parameters.size(); i++)
+            os << (i ? ", " : "") << JSONString(run.parameters[i].first)
+               << ": " << JSONString(run.parameters[i].second);
+        os << "},\n      \"metrics\": {";
+        for (size_t i = 0; i < run.metrics.size(); i++)
+            os << (i ? ", " : "") << JSONString(run.metrics[i].first)
+               << ": " << JSONNumber(run.metrics[i].second);
+        os << "},\n      \"statistics\": {";
+        std::vector<double> values = StatisticValues(ComputeStatistics(run.frameTimes));
+        for (size_t i = 0; i < values.size(); i++)
+            os << (i ? ", " : "") << "\"" << StatisticNames[i] << "\": " << JSONNumber(values[i]);
+        os << "},\n";
+        if (!run.error.empty())
+            os << "      \"error\": " << JSONString(run.error) << ",\n";
+        os << "      \"frame_times_ms\": [";
+        for (size_t i = 0; i < run.frameTimes.size(); i++)
+            os << (i ? ", " : "") << JSONNumber(run.frameTimes[i] * 1000.0);
+        os << "]\n    }";
+    }
+    os << "\n  ]\n}\n";
+}
+
+void BenchmarkReport::WriteCSV(std::ostream& os) const
+{
+    //columns are the union of all parameter and metric keys, in the order
+    //they first appear
+    std::vector<std::string> parameterKeys, metricKeys;
+    for (size_t r = 0; r < _runs.size(); r++) {
+        const Run& run = _runs[r];
+        for (size_t i = 0; i < run.parameters.size(); i++)
+            if (std::find(parameterKeys.begin(), parameterKeys.end(), run.parameters[i].first) == parameterKeys.end())
+                parameterKeys.push_back(run.parameters[i].first);
+        for (size_t i = 0; i < run.metrics.size(); i++)
+            if (std::find(metricKeys.begin(), metricKeys.end(), run.metrics[i].first) == metricKeys.end())
+                metricKeys.push_back(run.metrics[i].first);
+    }
+
+    for (size_t i = 0; i < parameterKeys.size(); i++)
+        os << CSVField(parameterKeys[i]) << ",";
+    for (size_t i = 0; i < metricKeys.size(); i++)
+        os << CSVField(metricKeys[i]) << ",";
+    for (size_t i = 0; i < 9; i++)
+        os << StatisticNames[i] << ",";
+    os << "error\n";
+
+    for (size_t r = 0; r < _runs.size(); r++) {
+        const Run& run = _runs[r];
+        for (size_t k = 0; k < parameterKeys.size(); k++) {
+            for (size_t i = 0; i < run.parameters.size(); i++)
+                if (run.parameters[i].first == parameterKeys[k])
+                    os << CSVField(run.parameters[i].second);
+            os << ",";
+        }
+        for (size_t k = 0; k < metricKeys.size(); k++) {
+            for (size_t i = 0; i < run.metrics.size(); i++)
+                if (run.metrics[i].first == metricKeys[k])
+                    os << ToString(run.metrics[i].second);
+            os << ",";
+        }
+        std::vector<double> values = StatisticValues(ComputeStatistics(run.frameTimes));
+        for (size_t i = 0; i < values.size(); i++)
+            os << ToString(values[i]) << ",";
+        os << CSVField(run.error) << "\n";
+    }
+}
+
+bool BenchmarkReport::WriteJSON(const std::string& filename) const
+{
+    std::ofstream os(filename.c_str());
+    if (!os.good()) {
+        std::cerr << "Cannot write " << filename << std::endl;
+        return false;
+    }
+    WriteJSON(os);
+    return os.good();
+}
+
+bool BenchmarkReport::WriteCSV(const std::string& filename) const
+{
+    std::ofstream os(filename.c_str());
+    if (!os.good()) {
+        std::cerr << "Cannot write " << filename << std::endl;
+        return false;
+    }
+    WriteCSV(os);
+    return os.good();
+}
+
+void BenchmarkReport::PrintSummary(std::ostream& os) const
+{
+    std::ios_base::fmtflags flags = os.flags();
+    std::streamsize precision = os.precision();
+    for (size_t r = 0; r < _runs.size(); r++) {
+        const Run& run = _runs[r];
+        for (size_t i = 0; i < run.parameters.size(); i++)
+            os << (i ? " " : "") << run.parameters[i].first << "=" << run.parameters[i].second;
+        if (!run.error.empty()) {
+            os << "  skipped: " << run.error << "\n";
+            continue;
+        }
+        Statistics s = ComputeStatistics(run.frameTimes);
+        os << std::fixed << std::setprecision(2)
+           << "  p50 " << s.p50*1000.0 << " ms  p95 " << s.p95*1000.0
+           << " ms  p99 " << s.p99*1000.0 << " ms  max " << s.max*1000.0 << " ms\n";
+        os.flags(flags);
+        os.precision(precision);
+    }
+}
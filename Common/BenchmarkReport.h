@@ -0,0 +1,66 @@
+#pragma once
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+class FrameProfiler;
+
+//Per-frame latencies of benchmark runs and their machine-readable output.
+//Every run carries its parameters (dataset, mapper, image size, ...) as
+//ordered key/value pairs and its frame times; percentiles are computed on
+//output. JSON holds everything including the raw frame times, CSV one row
+//per run with a column per parameter, metric and statistic.
+class BenchmarkReport
+{
+public:
+    typedef std::vector<std::pair<std::string, std::string> > Parameters;
+    typedef std::vector<std::pair<std::string, double> > Metrics;
+
+    struct Run
+    {
+        Parameters parameters;
+        Metrics metrics;                //single values, e.g. time to first frame
+        std::vector<double> frameTimes; //seconds
+        std::string error;              //why the run did not produce frames
+
+        void SetParameter(const std::string& key, const std::string& value);
+        void SetParameter(const std::string& key, double value);
+        void SetMetric(const std::string& key, double value);
+
+        //adds the profiler's per-frame averages as <stage>_ms,
+        //<stage>_gpu_ms and <counter> metrics
+        void SetProfileMetrics(const FrameProfiler& profiler);
+    };
+
+    //summary of a run's frame times, in seconds
+    struct Statistics
+    {
+        int frames;
+        double mean, stddev, min, max;
+        double p50, p90, p95, p99;
+    };
+
+    //describes the machine and build, written once per report
+    void SetEnvironment(const std::string& key, const std::string& value);
+
+    Run& AddRun();
+    const std::vector<Run>& GetRuns() const { return _runs; }
+
+    static Statistics ComputeStatistics(const std::vector<double>& frameTimes);
+
+    //nearest-rank percentile of sorted values, p in [0,100]
+    static double Percentile(const std::vector<double>& sorted, double p);
+
+    void WriteJSON(std::ostream& os) const;
+    void WriteCSV(std::ostream& os) const;
+    bool WriteJSON(const std::string& filename) const;
+    bool WriteCSV(const std::string& filename) const;
+
+    //one human readable line per run
+    void PrintSummary(std::ostream& os) const;
+
+private:
+    Parameters _environment;
+    std::vector<Run> _runs;
+};
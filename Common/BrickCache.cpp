@@ -0,0 +1,124 @@
+#include "BrickCache.h"
+#include "BrickedVolume.h"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+BrickCache::BrickCache(void)
+{
+    _volume = 0;
+    _scale = 1.0f;
+    _shift = 0.0f;
+    _budget = 0;
+    _brickBytes = 0;
+    _frame = 1;
+    _residentBricks = 0;
+    _decodedBricks = 0;
+    _decodeNanoseconds = 0;
+}
+
+BrickCache::~BrickCache(void)
+{
+}
+
+void BrickCache::SetVolume(const BrickedVolume* volume, float scale, float shift)
+{
+    if (volume == _volume && scale == _scale && shift == _shift)
+        return;
+    _volume = volume;
+    _scale = scale;
+    _shift = shift;
+    _storage.clear();
+    _freeSlots.clear();
+    _residentBricks = 0;
+    _decodedBricks = 0;
+    _decodeNanoseconds = 0;
+    _frame = 1;
+
+    //atomics cannot be copied, so the tables are rebuilt rather than resized
+    int bricks = volume && volume->IsOpen() ? volume->GetNumberOfBricks() : 0;
+    _brickBytes = bricks ? size_t(volume->GetBrickEdge())*volume->GetBrickEdge()*volume->GetBrickEdge() : 0;
+    std::vector<std::atomic<const unsigned char*> > data(bricks);
+    std::vector<std::atomic<unsigned> > lastUse(bricks);
+    for (int i = 0; i < bricks; i++) {
+        data[i] = 0;
+        lastUse[i] = 0;
+    }
+    _data.swap(data);
+    _lastUse.swap(lastUse);
+    _slot.assign(bricks, -1);
+}
+
+void BrickCache::Clear()
+{
+    for (size_t i = 0; i < _data.size(); i++)
+        _data[i] = 0;
+    _slot.assign(_slot.size(), -1);
+    _storage.clear();
+    _freeSlots.clear();
+    _residentBricks = 0;
+}
+
+size_t BrickCache::GetResidentBytes() const
+{
+    return size_t(_residentBricks) * _brickBytes;
+}
+
+const unsigned char* BrickCache::Decode(int brick)
+{
+    std::lock_guard<std::mutex> decodeGuard(_decodeLocks[brick % DECODE_LOCKS]);
+    const unsigned char* data = _data[brick].load(std::memory_order_acquire);
+    if (data)
+        return data;    //decoded by another thread meanwhile
+
+    //the buffers of other bricks do not move when _storage grows
+    unsigned char* target;
+    {
+        std::lock_guard<std::mutex> guard(_storageLock);
+        int slot;
+        if (_freeSlots.empty()) {
+            slot = int(_storage.size());
+            _storage.push_back(std::vector<unsigned char>());
+        } else {
+            slot = _freeSlots.back();
+            _freeSlots.pop_back();
+        }
+        _storage[slot].resize(_brickBytes);
+        _slot[brick] = slot;
+        _residentBricks++;
+        target = &_storage[slot][0];
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    _volume->DecodeBrick8(brick, _scale, _shift, target);
+    std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+    _decodeNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    _decodedBricks++;
+
+    _data[brick].store(target, std::memory_order_release);
+    return target;
+}
+
+void BrickCache::EndFrame()
+{
+    if (_budget > 0 && GetResidentBytes() > _budget) {
+        //least recently sampled first
+        std::vector<std::pair<unsigned, int> > resident;
+        resident.reserve(_residentBricks);
+        for (size_t i = 0; i < _slot.size(); i++)
+            if (_slot[i] >= 0)
+                resident.push_back(std::make_pair(_lastUse[i].load(), int(i)));
+        std::sort(resident.begin(), resident.end());
+
+        for (size_t i = 0; i < resident.size() && GetResidentBytes() > _budget; i++) {
+            int brick = resident[i].second;
+            _data[brick] = 0;
+            std::vector<unsigned char>().swap(_storage[_slot[brick]]);
+            _freeSlots.push_back(_slot[brick]);
+            _slot[brick] = -1;
+            _residentBricks--;
+        }
+    }
+    _frame++;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+class BrickedVolume;
+
+//LRU cache of the decoded bricks of a compressed BrickedVolume, which the
+//CPU ray caster samples instead of the mapping. A brick is decoded to 8
+//bits by whichever thread reaches it first and stays cached across frames;
+//EndFrame() then drops the least recently used bricks until the cache fits
+//its budget. Nothing is evicted during a frame, so a brick pointer stays
+//valid until the next EndFrame(), and a frame that reaches more bricks than
+//the budget holds briefly exceeds it.
+class BrickCache
+{
+public:
+    BrickCache(void);
+    ~BrickCache(void);
+
+    //raw scalars are mapped onto 0..255 by raw*scale+shift; a different
+    //volume or mapping empties the cache
+    void SetVolume(const BrickedVolume* volume, float scale = 1.0f, float shift = 0.0f);
+    const BrickedVolume* GetVolume() const { return _volume; }
+
+    //bytes of decoded bricks kept between frames, 0 keeps every brick
+    void SetBudget(size_t bytes) { _budget = bytes; }
+    size_t GetBudget() const { return _budget; }
+
+    //(B+1)^3 decoded samples of a brick, x fastest; safe from any thread
+    const unsigned char* GetBrick(int brick)
+    {
+        if (_lastUse[brick].load(std::memory_order_relaxed) != _frame)
+            _lastUse[brick].store(_frame, std::memory_order_relaxed);
+        const unsigned char* data = _data[brick].load(std::memory_order_acquire);
+        return data ? data : Decode(brick);
+    }
+
+    //between frames: evicts down to the budget and starts the next frame
+    void EndFrame();
+    void Clear();
+
+    int GetResidentBricks() const { return _residentBricks; }
+    size_t GetResidentBytes() const;
+
+    //bricks decoded and the time spent on it since the volume was set
+    unsigned long long GetDecodedBricks() const { return _decodedBricks; }
+    double GetDecodeTime() const { return _decodeNanoseconds * 1e-9; }
+
+private:
+    static const int DECODE_LOCKS = 64;
+
+    const unsigned char* Decode(int brick);
+
+    const BrickedVolume* _volume;
+    float _scale, _shift;
+    size_t _budget;
+    size_t _brickBytes;
+    unsigned _frame;
+
+    std::vector<std::atomic<const unsigned char*> > _data;
+    std::vector<std::atomic<unsigned> > _lastUse;   //frame the brick was last sampled in
+
+    //decoded bricks, guarded by _storageLock
+    std::vector<std::vector<unsigned char> > _storage;
+    std::vector<int> _slot;         //storage of every brick, -1 if not decoded
+    std::vector<int> _freeSlots;
+    int _residentBricks;
+    std::mutex _storageLock;
+
+    //a brick is decoded under the lock of its stripe, once
+    std::mutex _decodeLocks[DECODE_LOCKS];
+    std::atomic<unsigned long long> _decodedBricks;
+    std::atomic<unsigned long long> _decodeNanoseconds;
+};
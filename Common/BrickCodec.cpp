@@ -0,0 +1,196 @@
+#include "BrickCodec.h"
+#include "BrickedVolume.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+//3-bit indices of the 64 samples of a block, eight to every three bytes
+static const size_t BC4_INDEX_BYTES = 24;
+
+static int BlocksPerEdge(int edge)
+{
+    return (edge + 3) / 4;
+}
+
+//palette entry i of 0..7 between the block endpoints, rounded for integers
+template <class T>
+static T PaletteValue(T lo, T hi, int i)
+{
+    return static_cast<T>(lo + ((int(hi) - int(lo)) * 2 * i + 7) / 14);
+}
+
+static float PaletteValue(float lo, float hi, int i)
+{
+    return lo + (hi - lo) * (i / 7.0f);
+}
+
+template <class T>
+static void EncodeBlocks(int edge, const T* samples, unsigned char* encoded)
+{
+    const int blocks = BlocksPerEdge(edge);
+    T block[64];
+    for (int bz = 0; bz < blocks; bz++)
+        for (int by = 0; by < blocks; by++)
+            for (int bx = 0; bx < blocks; bx++) {
+                //gather the block, clamping at the brick edge
+                for (int z = 0; z < 4; z++)
+                    for (int y = 0; y < 4; y++) {
+                        int sz = std::min(4*bz + z, edge - 1);
+                        int sy = std::min(4*by + y, edge - 1);
+                        const T* row = samples + (size_t(sz)*edge + sy)*edge;
+                        for (int x = 0; x < 4; x++)
+                            block[(z*4 + y)*4 + x] = row[std::min(4*bx + x, edge - 1)];
+                    }
+
+                T lo = *std::min_element(block, block + 64);
+                T hi = *std::max_element(block, block + 64);
+                memcpy(encoded, &lo, sizeof(T));
+                memcpy(encoded + sizeof(T), &hi, sizeof(T));
+                unsigned char* indices = encoded + 2*sizeof(T);
+
+                //nearest palette entry of every sample
+                const double range = double(hi) - double(lo);
+                for (int group = 0; group < 8; group++) {
+                    unsigned bits = 0;
+                    for (int k = 0; k < 8; k++) {
+                        double v = double(block[group*8 + k]);
+                        int index = range > 0.0 ? int((v - lo) * 7.0 / range + 0.5) : 0;
+                        index = std::max(0, std::min(index, 7));
+                        bits |= unsigned(index) << (3*k);
+                    }
+                    indices[3*group] = static_cast<unsigned char>(bits);
+                    indices[3*group+1] = static_cast<unsigned char>(bits >> 8);
+                    indices[3*group+2] = static_cast<unsigned char>(bits >> 16);
+                }
+                encoded += 2*sizeof(T) + BC4_INDEX_BYTES;
+            }
+}
+
+//decodes through convert, which takes a palette value to the output type
+template <class T, class Out, class Convert>
+static void DecodeBlocks(int edge, const unsigned char* encoded, Out* samples, Convert convert)
+{
+    const int blocks = BlocksPerEdge(edge);
+    unsigned char index[64];
+    for (int bz = 0; bz < blocks; bz++)
+        for (int by = 0; by < blocks; by++)
+            for (int bx = 0; bx < blocks; bx++) {
+                T lo, hi;
+                memcpy(&lo, encoded, sizeof(T));
+                memcpy(&hi, encoded + sizeof(T), sizeof(T));
+                const unsigned char* indices = encoded + 2*sizeof(T);
+                encoded += 2*sizeof(T) + BC4_INDEX_BYTES;
+
+                Out palette[8];
+                for (int i = 0; i < 8; i++)
+                    palette[i] = convert(PaletteValue(lo, hi, i));
+                if (lo == hi) {
+                    memset(index, 0, sizeof(index));
+                } else {
+                    for (int group = 0; group < 8; group++) {
+                        unsigned bits = indices[3*group] | (indices[3*group+1] << 8) |
+                                        (indices[3*group+2] << 16);
+                        for (int k = 0; k < 8; k++)
+                            index[group*8 + k] = (bits >> (3*k)) & 7;
+                    }
+                }
+
+                const int nx = std::min(4, edge - 4*bx);
+                const int ny = std::min(4, edge - 4*by);
+                const int nz = std::min(4, edge - 4*bz);
+                for (int z = 0; z < nz; z++)
+                    for (int y = 0; y < ny; y++) {
+                        Out* row = samples + (size_t(4*bz + z)*edge + 4*by + y)*edge + 4*bx;
+                        const unsigned char* rowIndex = index + (z*4 + y)*4;
+                        for (int x = 0; x < nx; x++)
+                            row[x] = palette[rowIndex[x]];
+                    }
+            }
+}
+
+template <class T>
+struct Identity
+{
+    T operator()(T v) const { return v; }
+};
+
+struct MapTo8
+{
+    MapTo8(float scale, float shift) : scale(scale), shift(shift) {}
+    unsigned char operator()(float v) const
+    {
+        float mapped = std::floor(v * scale + shift + 0.5f);
+        return static_cast<unsigned char>(std::min(std::max(mapped, 0.0f), 255.0f));
+    }
+    float scale, shift;
+};
+
+template <class T>
+static void DecodeBrick(int codec, int edge, const unsigned char* encoded, T* samples)
+{
+    if (codec == BRICK_CODEC_BC4)
+        DecodeBlocks<T>(edge, encoded, samples, Identity<T>());
+    else
+        memcpy(samples, encoded, size_t(edge)*edge*edge*sizeof(T));
+}
+
+template <class T>
+static void DecodeBrick8(int codec, int edge, const unsigned char* encoded,
+                         float scale, float shift, unsigned char* samples)
+{
+    const MapTo8 map(scale, shift);
+    if (codec == BRICK_CODEC_BC4) {
+        DecodeBlocks<T>(edge, encoded, samples, map);
+    } else {
+        const T* raw = reinterpret_cast<const T*>(encoded);
+        for (size_t i = 0, n = size_t(edge)*edge*edge; i < n; i++)
+            samples[i] = map(float(raw[i]));
+    }
+}
+
+size_t EncodedBrickSize(int codec, int scalarType, int edge)
+{
+    const size_t scalarSize = ScalarTypeSize(scalarType);
+    const size_t blocks = BlocksPerEdge(edge);
+    switch (codec) {
+    case BRICK_CODEC_NONE: return size_t(edge)*edge*edge*scalarSize;
+    case BRICK_CODEC_BC4: return scalarSize ? blocks*blocks*blocks*(2*scalarSize + BC4_INDEX_BYTES) : 0;
+    default: return 0;
+    }
+}
+
+void EncodeBrick(int codec, int scalarType, int edge, const void* samples, unsigned char* encoded)
+{
+    if (codec != BRICK_CODEC_BC4) {
+        memcpy(encoded, samples, EncodedBrickSize(BRICK_CODEC_NONE, scalarType, edge));
+        return;
+    }
+    switch (scalarType) {
+    case SCALAR_UINT8: EncodeBlocks(edge, static_cast<const unsigned char*>(samples), encoded); break;
+    case SCALAR_UINT16: EncodeBlocks(edge, static_cast<const unsigned short*>(samples), encoded); break;
+    case SCALAR_INT16: EncodeBlocks(edge, static_cast<const short*>(samples), encoded); break;
+    case SCALAR_FLOAT32: EncodeBlocks(edge, static_cast<const float*>(samples), encoded); break;
+    }
+}
+
+void DecodeBrick(int codec, int scalarType, int edge, const unsigned char* encoded, void* samples)
+{
+    switch (scalarType) {
+    case SCALAR_UINT8: DecodeBrick(codec, edge, encoded, static_cast<unsigned char*>(samples)); break;
+    case SCALAR_UINT16: DecodeBrick(codec, edge, encoded, static_cast<unsigned short*>(samples)); break;
+    case SCALAR_INT16: DecodeBrick(codec, edge, encoded, static_cast<short*>(samples)); break;
+    case SCALAR_FLOAT32: DecodeBrick(codec, edge, encoded, static_cast<float*>(samples)); break;
+    }
+}
+
+void DecodeBrick8(int codec, int scalarType, int edge, const unsigned char* encoded,
+                  float scale, float shift, unsigned char* samples)
+{
+    switch (scalarType) {
+    case SCALAR_UINT8: DecodeBrick8<unsigned char>(codec, edge, encoded, scale, shift, samples); break;
+    case SCALAR_UINT16: DecodeBrick8<unsigned short>(codec, edge, encoded, scale, shift, samples); break;
+    case SCALAR_INT16: DecodeBrick8<short>(codec, edge, encoded, scale, shift, samples); break;
+    case SCALAR_FLOAT32: DecodeBrick8<float>(codec, edge, encoded, scale, shift, samples); break;
+    }
+}
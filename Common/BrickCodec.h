@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+
+//Fixed-rate codecs for the bricks of a BrickedVolume. Every brick of a
+//volume encodes to the same number of bytes, so compressed bricks keep
+//their place in the file and are found without an index.
+//
+//BRICK_CODEC_BC4 extends the BC4 texture format to 3D: the samples of a
+//single component brick are split into 4x4x4 blocks, each stored as its
+//minimum and maximum (in the scalar type of the volume) and a 3-bit index
+//per sample into the eight values evenly spaced between them. Blocks are
+//stored x fastest; samples past the brick edge are padded with the edge
+//sample. The error of a sample is at most 1/14 of its block's range and
+//constant blocks are exact. 8-bit bricks shrink to 26 and 16-bit bricks to
+//28 bytes per 64 samples.
+
+enum BrickCodec
+{
+    BRICK_CODEC_NONE = 0,
+    BRICK_CODEC_BC4 = 1
+};
+
+//bytes of one encoded brick of edge^3 samples of a single component, 0 if
+//the codec or scalar type is unknown
+size_t EncodedBrickSize(int codec, int scalarType, int edge);
+
+//edge^3 samples, x fastest, to EncodedBrickSize() bytes and back
+void EncodeBrick(int codec, int scalarType, int edge, const void* samples, unsigned char* encoded);
+void DecodeBrick(int codec, int scalarType, int edge, const unsigned char* encoded, void* samples);
+
+//decodes straight into the 0..255 domain of the ray caster: raw*scale+shift,
+//rounded and clamped
+void DecodeBrick8(int codec, int scalarType, int edge, const unsigned char* encoded,
+                  float scale, float shift, unsigned char* samples);
@@ -0,0 +1,115 @@
+#include "BrickStreamer.h"
+#include "BrickedVolume.h"
+
+#include <algorithm>
+
+BrickStreamer::BrickStreamer(BrickedVolume* volume)
+{
+    _volume = 0;
+    _budget = 0;
+    SetVolume(volume);
+}
+
+void BrickStreamer::SetVolume(BrickedVolume* volume)
+{
+    _volume = volume;
+    _frame = 0;
+    int bricks = (volume && volume->IsOpen()) ? volume->GetNumberOfBricks() : 0;
+    _lastVisible.assign(bricks, 0);
+    _resident.assign(bricks, 0);
+    _visibleBricks = _residentBricks = 0;
+    _prefetched = _released = 0;
+}
+
+bool BrickStreamer::InFrustum(const Mat4& m, int bx, int by, int bz) const
+{
+    const BrickedVolumeInfo& info = _volume->GetInfo();
+    const int B = info.brickSize;
+
+    //texture space box of the voxels the brick holds (texel centres at (i+0.5)/dim)
+    double lo[3], hi[3];
+    const int b[3] = {bx, by, bz};
+    for (int i = 0; i < 3; i++) {
+        lo[i] = (b[i]*B) / double(info.dims[i]);
+        hi[i] = std::min(b[i]*B + B + 1, info.dims[i]) / double(info.dims[i]);
+    }
+
+    //a box is outside when all corners lie beyond the same clip plane
+    int outside[6] = {0, 0, 0, 0, 0, 0};
+    for (int c = 0; c < 8; c++) {
+        double p[3] = {(c & 1) ? hi[0] : lo[0], (c & 2) ? hi[1] : lo[1], (c & 4) ? hi[2] : lo[2]};
+        double clip[4];
+        for (int row = 0; row < 4; row++)
+            clip[row] = m(row,0)*p[0] + m(row,1)*p[1] + m(row,2)*p[2] + m(row,3);
+        for (int axis = 0; axis < 3; axis++) {
+            outside[2*axis] += clip[axis] < -clip[3] ? 1 : 0;
+            outside[2*axis+1] += clip[axis] > clip[3] ? 1 : 0;
+        }
+    }
+    for (int i = 0; i < 6; i++)
+        if (outside[i] == 8)
+            return false;
+    return true;
+}
+
+int BrickStreamer::Update(const Mat4& textureToClip, const float* opacity, int entries,
+                          int stride, const double* range)
+{
+    _prefetched = _released = 0;
+    _visibleBricks = 0;
+    if (!_volume || !_volume->IsOpen())
+        return 0;
+
+    //prefix count of visible opacity entries for the range test
+    std::vector<int> visible;
+    double scale = 0.0;
+    if (opacity && entries > 1 && range && range[1] > range[0]) {
+        visible.resize(entries + 1, 0);
+        for (int i = 0; i < entries; i++)
+            visible[i+1] = visible[i] + (opacity[i*stride] > 0.0f ? 1 : 0);
+        scale = (entries - 1) / (range[1] - range[0]);
+    }
+
+    _frame++;
+    const int* grid = _volume->GetBrickGridDimensions();
+    for (int bz = 0; bz < grid[2]; bz++)
+        for (int by = 0; by < grid[1]; by++)
+            for (int bx = 0; bx < grid[0]; bx++) {
+                int brick = _volume->GetBrickIndex(bx, by, bz);
+                if (!visible.empty()) {
+                    int lo = std::max(0, std::min(entries - 1, int((_volume->GetBrickMin(brick) - range[0]) * scale)));
+                    int hi = std::max(0, std::min(entries - 1, int((_volume->GetBrickMax(brick) - range[0]) * scale + 1.0)));
+                    if (visible[hi+1] - visible[lo] == 0)
+                        continue;
+                }
+                if (!InFrustum(textureToClip, bx, by, bz))
+                    continue;
+
+                _lastVisible[brick] = _frame;
+                _visibleBricks++;
+                if (!_resident[brick]) {
+                    _volume->Prefetch(brick);
+                    _resident[brick] = 1;
+                    _residentBricks++;
+                    _prefetched++;
+                }
+            }
+
+    //release the least recently visible bricks beyond the budget
+    size_t brickBytes = _volume->GetBrickBytes();
+    if (_budget > 0 && size_t(_residentBricks)*brickBytes > _budget) {
+        std::vector< std::pair<unsigned, int> > candidates;
+        for (size_t i = 0; i < _resident.size(); i++)
+            if (_resident[i] && _lastVisible[i] != _frame)
+                candidates.push_back(std::make_pair(_lastVisible[i], int(i)));
+        std::sort(candidates.begin(), candidates.end());
+        for (size_t i = 0; i < candidates.size() &&
+             size_t(_residentBricks)*brickBytes > _budget; i++) {
+            _volume->Release(candidates[i].second);
+            _resident[candidates[i].second] = 0;
+            _residentBricks--;
+            _released++;
+        }
+    }
+    return _visibleBricks;
+}
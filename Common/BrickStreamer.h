@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+#include "VectorMath.h"
+
+class BrickedVolume;
+
+//Keeps the resident part of a memory mapped BrickedVolume close to what the
+//current view needs. Update() culls the bricks against the view frustum
+//(and optionally against the opacity transfer function using the per-brick
+//ranges), prefetches bricks that became visible and, once the memory
+//budget is exceeded, releases the least recently visible ones.
+class BrickStreamer
+{
+public:
+    explicit BrickStreamer(BrickedVolume* volume = 0);
+
+    void SetVolume(BrickedVolume* volume);
+
+    //0 keeps every brick that was ever visible
+    void SetMemoryBudget(size_t bytes) { _budget = bytes; }
+    size_t GetMemoryBudget() const { return _budget; }
+
+    //textureToClip maps the [0,1]^3 texture space of the volume to clip
+    //space. The opacity table spans the scalar range of the brick table
+    //(range[0]..range[1]) and may be NULL. Returns the visible brick count.
+    int Update(const Mat4& textureToClip, const float* opacity = 0, int entries = 0,
+               int stride = 1, const double* range = 0);
+
+    bool IsVisible(int brick) const { return _lastVisible[brick] == _frame; }
+    int GetVisibleBricks() const { return _visibleBricks; }
+    int GetResidentBricks() const { return _residentBricks; }
+    int GetPrefetchedBricks() const { return _prefetched; }   //during last Update
+    int GetReleasedBricks() const { return _released; }       //during last Update
+
+private:
+    bool InFrustum(const Mat4& textureToClip, int bx, int by, int bz) const;
+
+    BrickedVolume* _volume;
+    size_t _budget;
+    unsigned _frame;
+    std::vector<unsigned> _lastVisible;   //frame the brick was last visible in
+    std::vector<unsigned char> _resident;
+    int _visibleBricks;
+    int _residentBricks;
+    int _prefetched;
+    int _released;
+};
@@ -0,0 +1,459 @@
+#include "BrickedVolume.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const char BVOL_MAGIC[4] = {'B','V','O','L'};
+//version 2 adds the codec, uncompressed volumes are still written as 1
+static const int BVOL_VERSION = 1;
+static const int BVOL_VERSION_CODEC = 2;
+static const size_t BVOL_HEADER_SIZE = 256;
+static const size_t BVOL_ALIGNMENT = 4096;
+
+static size_t Align(size_t v)
+{
+    return (v + BVOL_ALIGNMENT - 1) / BVOL_ALIGNMENT * BVOL_ALIGNMENT;
+}
+
+size_t ScalarTypeSize(int scalarType)
+{
+    switch (scalarType) {
+    case SCALAR_UINT8: return 1;
+    case SCALAR_UINT16: return 2;
+    case SCALAR_INT16: return 2;
+    case SCALAR_FLOAT32: return 4;
+    default: return 0;
+    }
+}
+
+//number of bricks along an axis: lower interpolation corners run 0..dim-2
+static int BrickCount(int dim, int brickSize)
+{
+    return (std::max(dim - 1, 1) + brickSize - 1) / brickSize;
+}
+
+//fixed header layout, all fields at explicit offsets
+static void PackHeader(const BrickedVolumeInfo& info, unsigned long long dataOffset, unsigned char* h)
+{
+    int version = info.codec != BRICK_CODEC_NONE ? BVOL_VERSION_CODEC : BVOL_VERSION;
+    memset(h, 0, BVOL_HEADER_SIZE);
+    memcpy(h, BVOL_MAGIC, 4);
+    memcpy(h + 4, &version, 4);
+    memcpy(h + 8, info.dims, 12);
+    memcpy(h + 24, info.spacing, 24);
+    memcpy(h + 48, info.origin, 24);
+    memcpy(h + 72, &info.scalarType, 4);
+    memcpy(h + 76, &info.components, 4);
+    memcpy(h + 80, &info.brickSize, 4);
+    memcpy(h + 88, &dataOffset, 8);
+    memcpy(h + 96, &info.codec, 4);
+}
+
+static bool UnpackHeader(const unsigned char* h, BrickedVolumeInfo& info, unsigned long long& dataOffset)
+{
+    int version = 0;
+    memcpy(&version, h + 4, 4);
+    if (memcmp(h, BVOL_MAGIC, 4) != 0 || version < BVOL_VERSION || version > BVOL_VERSION_CODEC)
+        return false;
+    memcpy(info.dims, h + 8, 12);
+    memcpy(info.spacing, h + 24, 24);
+    memcpy(info.origin, h + 48, 24);
+    memcpy(&info.scalarType, h + 72, 4);
+    memcpy(&info.components, h + 76, 4);
+    memcpy(&info.brickSize, h + 80, 4);
+    memcpy(&dataOffset, h + 88, 8);
+    info.codec = BRICK_CODEC_NONE;
+    if (version >= BVOL_VERSION_CODEC)
+        memcpy(&info.codec, h + 96, 4);
+    return true;
+}
+
+template <class T>
+static void UpdateRange(const void* data, size_t count, float& lo, float& hi)
+{
+    const T* p = static_cast<const T*>(data);
+    for (size_t i = 0; i < count; i++) {
+        float v = static_cast<float>(p[i]);
+        lo = std::min(lo, v);
+        hi = std::max(hi, v);
+    }
+}
+
+static void UpdateRange(int scalarType, const void* data, size_t count, float& lo, float& hi)
+{
+    switch (scalarType) {
+    case SCALAR_UINT8: UpdateRange<unsigned char>(data, count, lo, hi); break;
+    case SCALAR_UINT16: UpdateRange<unsigned short>(data, count, lo, hi); break;
+    case SCALAR_INT16: UpdateRange<short>(data, count, lo, hi); break;
+    case SCALAR_FLOAT32: UpdateRange<float>(data, count, lo, hi); break;
+    }
+}
+
+//squared difference of the first n[0] x n[1] x n[2] samples of two bricks
+template <class T>
+static double SquaredError(const void* a, const void* b, int edge, const int n[3])
+{
+    const T* p = static_cast<const T*>(a);
+    const T* q = static_cast<const T*>(b);
+    double sum = 0.0;
+    for (int z = 0; z < n[2]; z++)
+        for (int y = 0; y < n[1]; y++) {
+            size_t row = (size_t(z)*edge + y)*edge;
+            for (int x = 0; x < n[0]; x++) {
+                double d = double(p[row + x]) - double(q[row + x]);
+                sum += d*d;
+            }
+        }
+    return sum;
+}
+
+static double SquaredError(int scalarType, const void* a, const void* b, int edge, const int n[3])
+{
+    switch (scalarType) {
+    case SCALAR_UINT8: return SquaredError<unsigned char>(a, b, edge, n);
+    case SCALAR_UINT16: return SquaredError<unsigned short>(a, b, edge, n);
+    case SCALAR_INT16: return SquaredError<short>(a, b, edge, n);
+    case SCALAR_FLOAT32: return SquaredError<float>(a, b, edge, n);
+    default: return 0.0;
+    }
+}
+
+double BrickedVolume::WriteStatistics::GetCompressionRatio() const
+{
+    return storedBytes ? double(rawBytes) / double(storedBytes) : 1.0;
+}
+
+double BrickedVolume::WriteStatistics::GetPSNR() const
+{
+    double mse = voxels ? squaredError / double(voxels) : 0.0;
+    double peak = range[1] - range[0];
+    if (mse <= 0.0 || peak <= 0.0)
+        return std::numeric_limits<double>::infinity();
+    return 10.0 * std::log10(peak*peak / mse);
+}
+
+BrickedVolume::BrickedVolume(void)
+{
+    memset(&_info, 0, sizeof(_info));
+    _brickGrid[0] = _brickGrid[1] = _brickGrid[2] = 0;
+    _brickBytes = 0;
+    _dataOffset = 0;
+    _mapping = 0;
+    _mappingSize = 0;
+#ifdef _WIN32
+    _fileHandle = INVALID_HANDLE_VALUE;
+    _mappingHandle = 0;
+#else
+    _fileHandle = -1;
+#endif
+}
+
+BrickedVolume::~BrickedVolume(void)
+{
+    Close();
+}
+
+bool BrickedVolume::Open(const string& filename)
+{
+    Close();
+
+#ifdef _WIN32
+    _fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER size;
+    if (_fileHandle == INVALID_HANDLE_VALUE || !GetFileSizeEx(_fileHandle, &size)) {
+        cerr<<"Cannot open bricked volume: "<<filename<<endl;
+        Close();
+        return false;
+    }
+    _mappingSize = static_cast<size_t>(size.QuadPart);
+    _mappingHandle = CreateFileMappingA(_fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (_mappingHandle)
+        _mapping = static_cast<unsigned char*>(MapViewOfFile(_mappingHandle, FILE_MAP_READ, 0, 0, 0));
+#else
+    struct stat st;
+    _fileHandle = open(filename.c_str(), O_RDONLY);
+    if (_fileHandle < 0 || fstat(_fileHandle, &st) != 0) {
+        cerr<<"Cannot open bricked volume: "<<filename<<endl;
+        Close();
+        return false;
+    }
+    _mappingSize = static_cast<size_t>(st.st_size);
+    void* p = mmap(0, _mappingSize, PROT_READ, MAP_SHARED, _fileHandle, 0);
+    _mapping = (p == MAP_FAILED) ? 0 : static_cast<unsigned char*>(p);
+#endif
+    if (!_mapping || _mappingSize < BVOL_HEADER_SIZE) {
+        cerr<<"Cannot map bricked volume: "<<filename<<endl;
+        Close();
+        return false;
+    }
+
+    unsigned long long dataOffset = 0;
+    if (!UnpackHeader(_mapping, _info, dataOffset) || ScalarTypeSize(_info.scalarType) == 0 ||
+        _info.components < 1 || _info.brickSize < 1 ||
+        EncodedBrickSize(_info.codec, _info.scalarType, 2) == 0 ||
+        (_info.codec != BRICK_CODEC_NONE && _info.components != 1)) {
+        cerr<<"Not a bricked volume: "<<filename<<endl;
+        Close();
+        return false;
+    }
+
+    for (int i = 0; i < 3; i++)
+        _brickGrid[i] = BrickCount(_info.dims[i], _info.brickSize);
+    _brickBytes = Align(EncodedBrickSize(_info.codec, _info.scalarType, GetBrickEdge()) * _info.components);
+    _dataOffset = static_cast<size_t>(dataOffset);
+
+    size_t bricks = GetNumberOfBricks();
+    if (_dataOffset + bricks*_brickBytes > _mappingSize) {
+        cerr<<"Truncated bricked volume: "<<filename<<endl;
+        Close();
+        return false;
+    }
+    _brickRange.resize(2*bricks);
+    memcpy(&_brickRange[0], _mapping + BVOL_HEADER_SIZE, 2*bricks*sizeof(float));
+    return true;
+}
+
+void BrickedVolume::Close()
+{
+#ifdef _WIN32
+    if (_mapping)
+        UnmapViewOfFile(_mapping);
+    if (_mappingHandle)
+        CloseHandle(_mappingHandle);
+    if (_fileHandle != INVALID_HANDLE_VALUE)
+        CloseHandle(_fileHandle);
+    _mappingHandle = 0;
+    _fileHandle = INVALID_HANDLE_VALUE;
+#else
+    if (_mapping)
+        munmap(_mapping, _mappingSize);
+    if (_fileHandle >= 0)
+        close(_fileHandle);
+    _fileHandle = -1;
+#endif
+    _mapping = 0;
+    _mappingSize = 0;
+    _brickRange.clear();
+    _brickGrid[0] = _brickGrid[1] = _brickGrid[2] = 0;
+}
+
+const unsigned char* BrickedVolume::GetBrickData(int brick) const
+{
+    return _mapping + _dataOffset + size_t(brick)*_brickBytes;
+}
+
+size_t BrickedVolume::GetDecodedBrickBytes() const
+{
+    size_t edge = GetBrickEdge();
+    return edge*edge*edge * ScalarTypeSize(_info.scalarType) * _info.components;
+}
+
+void BrickedVolume::DecodeBrick(int brick, void* samples) const
+{
+    if (IsCompressed())
+        ::DecodeBrick(_info.codec, _info.scalarType, GetBrickEdge(), GetBrickData(brick), samples);
+    else
+        memcpy(samples, GetBrickData(brick), GetDecodedBrickBytes());
+}
+
+void BrickedVolume::DecodeBrick8(int brick, float scale, float shift, unsigned char* samples) const
+{
+    ::DecodeBrick8(_info.codec, _info.scalarType, GetBrickEdge(), GetBrickData(brick),
+                   scale, shift, samples);
+}
+
+void BrickedVolume::GetScalarRange(double range[2]) const
+{
+    range[0] = range[1] = 0.0;
+    for (int i = 0; i < GetNumberOfBricks(); i++) {
+        range[0] = (i == 0) ? _brickRange[0] : std::min<double>(range[0], _brickRange[2*i]);
+        range[1] = (i == 0) ? _brickRange[1] : std::max<double>(range[1], _brickRange[2*i+1]);
+    }
+}
+
+void BrickedVolume::Prefetch(int brick) const
+{
+#ifdef _WIN32
+    //PrefetchVirtualMemory needs Windows 8, rely on demand paging
+    (void)brick;
+#else
+    madvise(const_cast<unsigned char*>(GetBrickData(brick)), _brickBytes, MADV_WILLNEED);
+#endif
+}
+
+void BrickedVolume::Release(int brick) const
+{
+#ifdef _WIN32
+    (void)brick;
+#else
+    //the mapping is read-only and file backed: dropped pages are simply
+    //read again from the file if the brick is touched later
+    madvise(const_cast<unsigned char*>(GetBrickData(brick)), _brickBytes, MADV_DONTNEED);
+#endif
+}
+
+size_t BrickedVolume::GetResidentBytes() const
+{
+#if defined(__linux__)
+    if (!_mapping)
+        return 0;
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t pages = (_mappingSize + page - 1) / page;
+    vector<unsigned char> resident(pages);
+    if (mincore(_mapping, _mappingSize, &resident[0]) != 0)
+        return 0;
+    size_t count = 0;
+    for (size_t i = 0; i < pages; i++)
+        count += resident[i] & 1;
+    return count * page;
+#else
+    return 0;
+#endif
+}
+
+bool BrickedVolume::Write(const string& filename, const BrickedVolumeInfo& info,
+                          const SliceReader& reader, WriteStatistics* statistics)
+{
+    const size_t voxelBytes = ScalarTypeSize(info.scalarType) * info.components;
+    const bool compressed = info.codec != BRICK_CODEC_NONE;
+    if (voxelBytes == 0 || info.brickSize < 1 ||
+        info.dims[0] < 1 || info.dims[1] < 1 || info.dims[2] < 1 ||
+        EncodedBrickSize(info.codec, info.scalarType, 2) == 0 || (compressed && info.components != 1)) {
+        cerr<<"Invalid bricked volume description for "<<filename<<endl;
+        return false;
+    }
+
+    ofstream out(filename.c_str(), ios_base::binary);
+    if (!out.good()) {
+        cerr<<"Cannot write bricked volume: "<<filename<<endl;
+        return false;
+    }
+
+    const int B = info.brickSize;
+    const int edge = B + 1;
+    int grid[3];
+    for (int i = 0; i < 3; i++)
+        grid[i] = BrickCount(info.dims[i], B);
+    const size_t bricks = size_t(grid[0])*grid[1]*grid[2];
+    const size_t rawBrickBytes = size_t(edge)*edge*edge*voxelBytes;
+    const size_t brickBytes = Align(EncodedBrickSize(info.codec, info.scalarType, edge) * info.components);
+    const size_t dataOffset = Align(BVOL_HEADER_SIZE + 2*bricks*sizeof(float));
+    const size_t sliceBytes = size_t(info.dims[0])*info.dims[1]*voxelBytes;
+
+    //header and brick table are rewritten once the ranges are known
+    vector<unsigned char> header(BVOL_HEADER_SIZE);
+    vector<float> ranges(2*bricks, 0.0f);
+    PackHeader(info, dataOffset, &header[0]);
+    out.write(reinterpret_cast<const char*>(&header[0]), header.size());
+    vector<char> zeros(dataOffset - BVOL_HEADER_SIZE, 0);
+    out.write(&zeros[0], zeros.size());
+
+    //the B+1 slices of one layer of bricks; the last one is the first of the next layer
+    vector< vector<unsigned char> > slices(edge, vector<unsigned char>(sliceBytes));
+    int loadedLast = -1;
+    vector<unsigned char> brick(compressed ? rawBrickBytes : brickBytes, 0);
+    vector<unsigned char> encoded(compressed ? brickBytes : 0, 0);
+    vector<unsigned char> decoded(compressed && statistics ? rawBrickBytes : 0);
+    size_t index = 0;
+    if (statistics) {
+        statistics->rawBytes = statistics->storedBytes = statistics->voxels = 0;
+        statistics->squaredError = 0.0;
+    }
+
+    for (int bz = 0; bz < grid[2]; bz++) {
+        for (int k = 0; k < edge; k++) {
+            int z = std::min(bz*B + k, info.dims[2] - 1);
+            if (k == 0 && z == loadedLast) {
+                slices[0].swap(slices[edge-1]);
+                continue;
+            }
+            if (k > 0 && z == std::min(bz*B + k - 1, info.dims[2] - 1)) {
+                slices[k] = slices[k-1];   //clamped past the last slice
+                continue;
+            }
+            if (!reader(z, &slices[k][0])) {
+                cerr<<"Cannot read slice "<<z<<" while writing "<<filename<<endl;
+                return false;
+            }
+        }
+        loadedLast = std::min(bz*B + B, info.dims[2] - 1);
+
+        for (int by = 0; by < grid[1]; by++) {
+            for (int bx = 0; bx < grid[0]; bx++, index++) {
+                int x0 = bx*B;
+                int run = std::min(edge, info.dims[0] - x0);
+                unsigned char* dst = &brick[0];
+                for (int lz = 0; lz < edge; lz++) {
+                    for (int ly = 0; ly < edge; ly++) {
+                        int y = std::min(by*B + ly, info.dims[1] - 1);
+                        const unsigned char* src = &slices[lz][(size_t(y)*info.dims[0] + x0)*voxelBytes];
+                        memcpy(dst, src, run*voxelBytes);
+                        //replicate the edge voxel past the volume border
+                        for (int lx = run; lx < edge; lx++)
+                            memcpy(dst + lx*voxelBytes, src + (run-1)*voxelBytes, voxelBytes);
+                        dst += edge*voxelBytes;
+                    }
+                }
+
+                float lo = 1e30f, hi = -1e30f;
+                UpdateRange(info.scalarType, &brick[0], size_t(edge)*edge*edge*info.components, lo, hi);
+                ranges[2*index] = lo;
+                ranges[2*index+1] = hi;
+                if (!compressed) {
+                    out.write(reinterpret_cast<const char*>(&brick[0]), brickBytes);
+                } else {
+                    EncodeBrick(info.codec, info.scalarType, edge, &brick[0], &encoded[0]);
+                    out.write(reinterpret_cast<const char*>(&encoded[0]), brickBytes);
+                }
+
+                //every voxel counted once: B per axis in every brick, the rest in the last
+                if (statistics) {
+                    const int b[3] = {bx, by, bz};
+                    int n[3];
+                    for (int i = 0; i < 3; i++)
+                        n[i] = b[i] == grid[i] - 1 ? info.dims[i] - b[i]*B : B;
+                    statistics->rawBytes += Align(rawBrickBytes);
+                    statistics->storedBytes += brickBytes;
+                    statistics->voxels += (unsigned long long)(n[0])*n[1]*n[2];
+                    if (compressed) {
+                        ::DecodeBrick(info.codec, info.scalarType, edge, &encoded[0], &decoded[0]);
+                        statistics->squaredError += SquaredError(info.scalarType, &brick[0], &decoded[0], edge, n);
+                    }
+                }
+            }
+        }
+    }
+
+    if (statistics) {
+        statistics->range[0] = statistics->range[1] = 0.0;
+        for (size_t i = 0; i < bricks; i++) {
+            statistics->range[0] = i ? std::min<double>(statistics->range[0], ranges[2*i]) : ranges[0];
+            statistics->range[1] = i ? std::max<double>(statistics->range[1], ranges[2*i+1]) : ranges[1];
+        }
+    }
+
+    out.seekp(BVOL_HEADER_SIZE);
+    out.write(reinterpret_cast<const char*>(&ranges[0]), ranges.size()*sizeof(float));
+    out.close();
+    if (out.fail()) {
+        cerr<<"Error writing bricked volume: "<<filename<<endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,134 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "BrickCodec.h"
+
+//Bricked on-disk volume (.bvol) accessed through a read-only memory map.
+//
+//Layout (little endian):
+//  header       256 bytes, see BrickedVolumeInfo
+//  brick table  per brick: float min, float max over all its samples
+//  bricks       page aligned, each (B+1)^3 samples for brick size B, x fastest
+//
+//Single component volumes may store their bricks compressed by a fixed-rate
+//codec (see BrickCodec.h, version 2 of the format). The brick table still
+//holds the ranges of the original samples.
+//
+//Every brick stores one extra layer of voxels towards +x/+y/+z (copied from
+//the neighbour, or the clamped edge at the volume border), so a trilinear
+//sample whose lower corner lies inside a brick never reads outside of it.
+//Since only the header and the brick table are read on Open(), opening is
+//independent of the volume size and the operating system pages bricks in
+//when they are first touched.
+
+enum ScalarType
+{
+    SCALAR_UINT8 = 0,
+    SCALAR_UINT16 = 1,
+    SCALAR_INT16 = 2,
+    SCALAR_FLOAT32 = 3
+};
+
+//bytes of one component of the given scalar type, 0 if unknown
+size_t ScalarTypeSize(int scalarType);
+
+struct BrickedVolumeInfo
+{
+    int dims[3];
+    double spacing[3];
+    double origin[3];
+    int scalarType;     //ScalarType
+    int components;
+    int brickSize;      //brick edge B in voxels, without the extra layer
+    int codec;          //BrickCodec the bricks are stored with
+};
+
+class BrickedVolume
+{
+public:
+    BrickedVolume(void);
+    ~BrickedVolume(void);
+
+    bool Open(const std::string& filename);
+    void Close();
+    bool IsOpen() const { return _mapping != 0; }
+
+    const BrickedVolumeInfo& GetInfo() const { return _info; }
+    const int* GetBrickGridDimensions() const { return _brickGrid; }
+    int GetNumberOfBricks() const { return _brickGrid[0]*_brickGrid[1]*_brickGrid[2]; }
+    int GetBrickIndex(int bx, int by, int bz) const { return (bz*_brickGrid[1] + by)*_brickGrid[0] + bx; }
+
+    //samples per brick edge (brick size + 1) and bytes per brick as stored
+    int GetBrickEdge() const { return _info.brickSize + 1; }
+    size_t GetBrickBytes() const { return _brickBytes; }
+
+    bool IsCompressed() const { return _info.codec != BRICK_CODEC_NONE; }
+
+    //bytes of a brick once decoded
+    size_t GetDecodedBrickBytes() const;
+
+    //first byte of a brick inside the mapping: its first sample, or the
+    //encoded brick of a compressed volume
+    const unsigned char* GetBrickData(int brick) const;
+
+    //(B+1)^3 samples of a brick in the scalar type of the volume, or mapped
+    //onto 0..255 by raw*scale+shift; both work for uncompressed bricks too
+    void DecodeBrick(int brick, void* samples) const;
+    void DecodeBrick8(int brick, float scale, float shift, unsigned char* samples) const;
+    float GetBrickMin(int brick) const { return _brickRange[2*brick]; }
+    float GetBrickMax(int brick) const { return _brickRange[2*brick+1]; }
+
+    //range over all bricks, known without touching voxel data
+    void GetScalarRange(double range[2]) const;
+
+    //asks the OS to read a brick ahead of use / to drop its pages again
+    void Prefetch(int brick) const;
+    void Release(int brick) const;
+
+    //bytes of the mapping currently resident in physical memory
+    size_t GetResidentBytes() const;
+
+    //reads slice z (dims[0]*dims[1] samples) into the given buffer
+    typedef std::function<bool(int z, void* slice)> SliceReader;
+
+    //what Write() stored; the error is that of the decoded voxels against
+    //the source, zero for uncompressed bricks
+    struct WriteStatistics
+    {
+        unsigned long long rawBytes;        //bricks uncompressed
+        unsigned long long storedBytes;     //bricks as written
+        unsigned long long voxels;
+        double squaredError;                //summed over all voxels
+        double range[2];                    //of the source scalars
+
+        double GetCompressionRatio() const;
+        //peak signal to noise ratio in dB with the scalar range as the peak,
+        //infinite when lossless
+        double GetPSNR() const;
+    };
+
+    //writes a .bvol file reading the source one slice at a time, so only
+    //brickSize+1 slices are ever held in memory. Bricks are compressed with
+    //info.codec, which needs a single component.
+    static bool Write(const std::string& filename, const BrickedVolumeInfo& info,
+                      const SliceReader& reader, WriteStatistics* statistics = 0);
+
+private:
+    BrickedVolumeInfo _info;
+    int _brickGrid[3];
+    size_t _brickBytes;
+    size_t _dataOffset;
+    std::vector<float> _brickRange;
+
+    unsigned char* _mapping;
+    size_t _mappingSize;
+#ifdef _WIN32
+    void* _fileHandle;
+    void* _mappingHandle;
+#else
+    int _fileHandle;
+#endif
+};
@@ -0,0 +1,27 @@
+#pragma once
+
+//Message passing between the processes of a sort-last renderer (see
+//ImageCompositor). Every call is collective: all ranks make the same
+//calls in the same order, a rank with nothing to exchange in a round
+//passes peer -1. Messages are float arrays; counts are in floats.
+class Communicator
+{
+public:
+    virtual ~Communicator() {}
+
+    virtual int GetRank() const = 0;
+    virtual int GetSize() const = 0;
+
+    //sends sendCount floats to peer and receives recvCount floats from it,
+    //the peer makes the mirrored call
+    virtual void Exchange(int peer, const float* send, int sendCount, float* recv, int recvCount) = 0;
+
+    //rank 0 receives counts[r] floats from every rank r at recv+offsets[r];
+    //counts and offsets are the same on all ranks
+    virtual void Gather(const float* send, const int* counts, const int* offsets, float* recv) = 0;
+
+    //every rank receives count floats from every rank r at recv+r*count
+    virtual void AllGather(const float* send, int count, float* recv) = 0;
+
+    virtual void Barrier() = 0;
+};
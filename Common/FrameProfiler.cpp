@@ -0,0 +1,147 @@
+#include "FrameProfiler.h"
+
+#include <chrono>
+#include <iomanip>
+
+FrameProfiler::FrameProfiler(void)
+    : _enabled(false), _frameStart(0.0), _frames(0)
+{
+    ResetFrame(_current);
+    ResetFrame(_last);
+    Reset();
+}
+
+void FrameProfiler::SetEnabled(bool on)
+{
+    if (on && !_enabled) {
+        ResetFrame(_current);
+        _frameStart = Now();
+    }
+    _enabled = on;
+}
+
+int FrameProfiler::AddStage(const std::string& name)
+{
+    for (size_t i = 0; i < _stages.size(); i++)
+        if (_stages[i] == name)
+            return static_cast<int>(i);
+    _stages.push_back(name);
+    _current.cpu.push_back(0.0);
+    _current.gpu.push_back(-1.0);
+    _last.cpu.push_back(0.0);
+    _last.gpu.push_back(-1.0);
+    _sum.cpu.push_back(0.0);
+    _sum.gpu.push_back(0.0);
+    _gpuFrames.push_back(0);
+    return static_cast<int>(_stages.size()) - 1;
+}
+
+int FrameProfiler::AddCounter(const std::string& name)
+{
+    for (size_t i = 0; i < _counters.size(); i++)
+        if (_counters[i] == name)
+            return static_cast<int>(i);
+    _counters.push_back(name);
+    _current.counters.push_back(0);
+    _last.counters.push_back(0);
+    _sum.counters.push_back(0);
+    return static_cast<int>(_counters.size()) - 1;
+}
+
+void FrameProfiler::ResetFrame(Frame& frame) const
+{
+    frame.total = 0.0;
+    frame.cpu.assign(_stages.size(), 0.0);
+    frame.gpu.assign(_stages.size(), -1.0);
+    frame.counters.assign(_counters.size(), 0);
+}
+
+void FrameProfiler::BeginFrame()
+{
+    if (!_enabled)
+        return;
+    ResetFrame(_current);
+    _frameStart = Now();
+}
+
+void FrameProfiler::EndFrame()
+{
+    if (!_enabled)
+        return;
+    _current.total = Now() - _frameStart;
+    _last = _current;
+
+    _frames++;
+    _sum.total += _current.total;
+    for (size_t i = 0; i < _stages.size(); i++) {
+        _sum.cpu[i] += _current.cpu[i];
+        if (_current.gpu[i] >= 0.0) {
+            _sum.gpu[i] += _current.gpu[i];
+            _gpuFrames[i]++;
+        }
+    }
+    for (size_t i = 0; i < _counters.size(); i++)
+        _sum.counters[i] += _current.counters[i];
+}
+
+void FrameProfiler::AddGPUTime(int stage, double seconds)
+{
+    if (!_enabled)
+        return;
+    double& gpu = _current.gpu[stage];
+    gpu = gpu < 0.0 ? seconds : gpu + seconds;
+}
+
+FrameProfiler::Frame FrameProfiler::GetAverage() const
+{
+    Frame average;
+    ResetFrame(average);
+    if (_frames == 0)
+        return average;
+
+    average.total = _sum.total / _frames;
+    for (size_t i = 0; i < _stages.size(); i++) {
+        average.cpu[i] = _sum.cpu[i] / _frames;
+        if (_gpuFrames[i] > 0)
+            average.gpu[i] = _sum.gpu[i] / _gpuFrames[i];
+    }
+    for (size_t i = 0; i < _counters.size(); i++)
+        average.counters[i] = _sum.counters[i] / _frames;
+    return average;
+}
+
+void FrameProfiler::Reset()
+{
+    _frames = 0;
+    ResetFrame(_sum);
+    _sum.gpu.assign(_stages.size(), 0.0);
+    _gpuFrames.assign(_stages.size(), 0);
+}
+
+void FrameProfiler::Print(std::ostream& os, const Frame& frame) const
+{
+    std::ios::fmtflags flags = os.flags();
+    std::streamsize precision = os.precision();
+    os << std::fixed << std::setprecision(3);
+
+    os << "frame " << frame.total * 1000.0 << " ms |";
+    for (size_t i = 0; i < _stages.size(); i++) {
+        os << " " << _stages[i] << " " << frame.cpu[i] * 1000.0;
+        if (frame.gpu[i] >= 0.0)
+            os << "/" << frame.gpu[i] * 1000.0 << "gpu";
+    }
+    if (!_counters.empty())
+        os << " |";
+    for (size_t i = 0; i < _counters.size(); i++)
+        os << " " << _counters[i] << " " << frame.counters[i];
+    os << std::endl;
+
+    os.flags(flags);
+    os.precision(precision);
+}
+
+double FrameProfiler::Now()
+{
+    typedef std::chrono::steady_clock Clock;
+    return std::chrono::duration<double>(Clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include <ostream>
+#include <string>
+#include <vector>
+
+//Per-frame breakdown of where the render time goes. Stages (transfer
+//function update, upload, ray march, ...) and counters (rays, samples, ...)
+//are registered once by name; the render code then adds CPU time, GPU time
+//and counts per stage index between BeginFrame() and EndFrame().
+//
+//While disabled every call returns right away and ScopedTimer does not read
+//the clock, so the instrumentation can stay in the render path.
+class FrameProfiler
+{
+public:
+    FrameProfiler(void);
+
+    void SetEnabled(bool on);
+    bool IsEnabled() const { return _enabled; }
+
+    //registering an existing name returns its index
+    int AddStage(const std::string& name);
+    int AddCounter(const std::string& name);
+    int GetNumberOfStages() const { return static_cast<int>(_stages.size()); }
+    int GetNumberOfCounters() const { return static_cast<int>(_counters.size()); }
+    const std::string& GetStageName(int stage) const { return _stages[stage]; }
+    const std::string& GetCounterName(int counter) const { return _counters[counter]; }
+
+    void BeginFrame();
+    void EndFrame();
+
+    void AddTime(int stage, double seconds)
+    {
+        if (_enabled)
+            _current.cpu[stage] += seconds;
+    }
+
+    //GPU timer results arrive a few frames late; they are booked to the
+    //frame during which they became available
+    void AddGPUTime(int stage, double seconds);
+
+    void AddCount(int counter, unsigned long long count)
+    {
+        if (_enabled)
+            _current.counters[counter] += count;
+    }
+
+    struct Frame
+    {
+        double total;                           //BeginFrame to EndFrame, seconds
+        std::vector<double> cpu;                //seconds per stage
+        std::vector<double> gpu;                //seconds per stage, <0 if not measured
+        std::vector<unsigned long long> counters;
+    };
+
+    const Frame& GetLastFrame() const { return _last; }
+
+    //mean over the frames since Reset(); GPU stages average over the
+    //frames that measured them
+    Frame GetAverage() const;
+    int GetFrameCount() const { return _frames; }
+    void Reset();
+
+    //one line: total, then cpu[/gpu] ms per stage, then the counters
+    void Print(std::ostream& os, const Frame& frame) const;
+
+    //monotonic clock in seconds
+    static double Now();
+
+    class ScopedTimer
+    {
+    public:
+        ScopedTimer(FrameProfiler& profiler, int stage)
+            : _profiler(profiler.IsEnabled() ? &profiler : 0), _stage(stage),
+              _start(_profiler ? Now() : 0.0) {}
+        ~ScopedTimer()
+        {
+            if (_profiler)
+                _profiler->AddTime(_stage, Now() - _start);
+        }
+
+    private:
+        ScopedTimer(const ScopedTimer&);
+        void operator=(const ScopedTimer&);
+
+        FrameProfiler* _profiler;
+        int _stage;
+        double _start;
+    };
+
+private:
+    void ResetFrame(Frame& frame) const;
+
+    bool _enabled;
+    std::vector<std::string> _stages;
+    std::vector<std::string> _counters;
+
+    Frame _current;
+    Frame _last;
+    double _frameStart;
+
+    //sums since Reset()
+    int _frames;
+    Frame _sum;
+    std::vector<int> _gpuFrames;
+};
@@ -0,0 +1,162 @@
+#include "GradientVolume.h"
+#include "BrickedVolume.h"
+#include "FrameProfiler.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+GradientVolume::GradientVolume(void)
+{
+    _dims[0] = _dims[1] = _dims[2] = 0;
+    _maxMagnitude = 0.0f;
+    _buildTime = 0.0;
+}
+
+void GradientVolume::Clear()
+{
+    _gradients.clear();
+    _dims[0] = _dims[1] = _dims[2] = 0;
+    _maxMagnitude = 0.0f;
+}
+
+void GradientVolume::EncodeNormal(float x, float y, float z, unsigned char out[2])
+{
+    //project onto the octahedron |x|+|y|+|z| = 1 and fold the lower half
+    //over the diagonals of the upper one
+    float l1 = std::fabs(x) + std::fabs(y) + std::fabs(z);
+    x /= l1;
+    y /= l1;
+    if (z < 0.0f) {
+        float fx = (1.0f - std::fabs(y)) * (x < 0.0f ? -1.0f : 1.0f);
+        y = (1.0f - std::fabs(x)) * (y < 0.0f ? -1.0f : 1.0f);
+        x = fx;
+    }
+    out[0] = static_cast<unsigned char>((x * 0.5f + 0.5f) * 255.0f + 0.5f);
+    out[1] = static_cast<unsigned char>((y * 0.5f + 0.5f) * 255.0f + 0.5f);
+}
+
+//central differences of row (y,z), neighbours clamped to the volume. The
+//loops run over whole rows so that the compiler can vectorize them; rows
+//is scratch space for five rows. Voxels are sx values apart.
+template <typename T>
+static void RowGradients(const T* data, size_t sx, const int dims[3], int y, int z, float* rows,
+                         float* gx, float* gy, float* gz)
+{
+    const int n = dims[0];
+    const size_t sy = sx * n;
+    const int ys[3] = {y, std::max(y - 1, 0), std::min(y + 1, dims[1] - 1)};
+    const int zs[2] = {std::max(z - 1, 0), std::min(z + 1, dims[2] - 1)};
+    const T* src[5] = {data + (size_t(z) * dims[1] + ys[0]) * sy,
+                       data + (size_t(z) * dims[1] + ys[1]) * sy,
+                       data + (size_t(z) * dims[1] + ys[2]) * sy,
+                       data + (size_t(zs[0]) * dims[1] + y) * sy,
+                       data + (size_t(zs[1]) * dims[1] + y) * sy};
+    if (sx == 1) {
+        for (int r = 0; r < 5; r++)
+            for (int x = 0; x < n; x++)
+                rows[r * n + x] = float(src[r][x]);
+    } else {
+        for (int r = 0; r < 5; r++)
+            for (int x = 0; x < n; x++)
+                rows[r * n + x] = float(src[r][x * sx]);
+    }
+
+    const float* c = rows;
+    for (int x = 1; x < n - 1; x++)
+        gx[x] = (c[x + 1] - c[x - 1]) * 0.5f;
+    gx[0] = (c[1] - c[0]) * 0.5f;
+    gx[n - 1] = (c[n - 1] - c[n - 2]) * 0.5f;
+    for (int x = 0; x < n; x++) {
+        gy[x] = (rows[2 * n + x] - rows[n + x]) * 0.5f;
+        gz[x] = (rows[4 * n + x] - rows[3 * n + x]) * 0.5f;
+    }
+}
+
+template <typename T>
+static void BuildGradients(const T* data, size_t sx, const int dims[3], ThreadPool* pool,
+                           unsigned char* out, float& maxMagnitude)
+{
+    const int n = dims[0];
+    std::vector<float> sliceMax(dims[2], 0.0f);
+    float scale = 0.0f;
+
+    //two passes over the slices: the largest magnitude, then the encoding
+    //of every voxel relative to it
+    for (int pass = 0; pass < 2; pass++) {
+        ThreadPool::TaskFunction slice = [&](int z, int) {
+            std::vector<float> scratch(8 * size_t(n));
+            float* rows = &scratch[0];
+            float* gx = rows + 5 * n;
+            float* gy = gx + n;
+            float* gz = gy + n;
+            float largest = 0.0f;
+            for (int y = 0; y < dims[1]; y++) {
+                RowGradients(data, sx, dims, y, z, rows, gx, gy, gz);
+                for (int x = 0; x < n; x++)
+                    rows[x] = std::sqrt(gx[x] * gx[x] + gy[x] * gy[x] + gz[x] * gz[x]);
+                if (pass == 0) {
+                    for (int x = 0; x < n; x++)
+                        largest = std::max(largest, rows[x]);
+                    continue;
+                }
+
+                unsigned char* voxel = out + 3 * (size_t(z) * dims[1] + y) * n;
+                for (int x = 0; x < n; x++, voxel += 3) {
+                    float magnitude = rows[x];
+                    if (magnitude <= 0.0f) {
+                        voxel[0] = voxel[1] = 128;
+                        voxel[2] = 0;
+                        continue;
+                    }
+                    GradientVolume::EncodeNormal(gx[x], gy[x], gz[x], voxel);
+                    //nonzero gradients keep a nonzero magnitude
+                    float q = magnitude * scale + 0.5f;
+                    voxel[2] = static_cast<unsigned char>(std::min(std::max(q, 1.0f), 255.0f));
+                }
+            }
+            if (pass == 0)
+                sliceMax[z] = largest;
+        };
+        if (pool)
+            pool->ParallelFor(dims[2], slice);
+        else
+            for (int z = 0; z < dims[2]; z++)
+                slice(z, 0);
+
+        if (pass == 0) {
+            maxMagnitude = *std::max_element(sliceMax.begin(), sliceMax.end());
+            scale = maxMagnitude > 0.0f ? 255.0f / maxMagnitude : 0.0f;
+        }
+    }
+}
+
+void GradientVolume::Build(const void* data, int scalarType, int components,
+                           int xdim, int ydim, int zdim, ThreadPool* pool)
+{
+    Clear();
+    if (!data || xdim < 2 || ydim < 2 || zdim < 2)
+        return;
+
+    double start = FrameProfiler::Now();
+    _dims[0] = xdim;
+    _dims[1] = ydim;
+    _dims[2] = zdim;
+    _gradients.resize(size_t(xdim) * ydim * zdim * 3);
+    const size_t sx = size_t(components);
+    data = static_cast<const unsigned char*>(data) + (components - 1) * ScalarTypeSize(scalarType);
+    switch (scalarType) {
+    case SCALAR_UINT16:
+        BuildGradients(static_cast<const unsigned short*>(data), sx, _dims, pool, &_gradients[0], _maxMagnitude);
+        break;
+    case SCALAR_INT16:
+        BuildGradients(static_cast<const short*>(data), sx, _dims, pool, &_gradients[0], _maxMagnitude);
+        break;
+    case SCALAR_FLOAT32:
+        BuildGradients(static_cast<const float*>(data), sx, _dims, pool, &_gradients[0], _maxMagnitude);
+        break;
+    default:
+        BuildGradients(static_cast<const unsigned char*>(data), sx, _dims, pool, &_gradients[0], _maxMagnitude);
+        break;
+    }
+    _buildTime = FrameProfiler::Now() - start;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+class ThreadPool;
+
+//Precomputed gradients of a volume for shading: one pass over the volume
+//takes central differences at every voxel (clamped at the borders) and
+//stores the direction as an 8-bit octahedral encoded normal and the length
+//quantized to 8 bits, three bytes per voxel (x fastest). Shading then
+//reads one voxel instead of sampling six neighbours, and the magnitude can
+//serve as the second axis of a 2D transfer function.
+//
+//Magnitudes are normalized by the largest one in the volume, so the
+//encoding is independent of the scalar range; a magnitude of 0 marks a
+//voxel without a gradient.
+class GradientVolume
+{
+public:
+    GradientVolume(void);
+
+    //scalars of any ScalarType (see BrickedVolume.h); of interleaved
+    //multi-component voxels the gradient is the one of the last component
+    void Build(const void* data, int scalarType, int components, int xdim, int ydim, int zdim,
+               ThreadPool* pool = 0);
+    void Clear();
+
+    bool IsValid() const { return !_gradients.empty(); }
+    const unsigned char* GetData() const { return _gradients.empty() ? 0 : &_gradients[0]; }
+    const int* GetDimensions() const { return _dims; }
+
+    //gradient length, in raw scalar units per voxel, of magnitude 255
+    float GetMaximumMagnitude() const { return _maxMagnitude; }
+
+    size_t GetMemorySize() const { return _gradients.size(); }
+    double GetBuildTime() const { return _buildTime; }  //seconds
+
+    //octahedral mapping of a unit vector onto two bytes and back (the
+    //decoded normal is unit length)
+    static void EncodeNormal(float x, float y, float z, unsigned char out[2]);
+    static void DecodeNormal(const unsigned char in[2], float n[3])
+    {
+        float x = in[0] * (2.0f / 255.0f) - 1.0f;
+        float y = in[1] * (2.0f / 255.0f) - 1.0f;
+        float z = 1.0f - std::fabs(x) - std::fabs(y);
+        if (z < 0.0f) {
+            float fx = (1.0f - std::fabs(y)) * (x < 0.0f ? -1.0f : 1.0f);
+            y = (1.0f - std::fabs(x)) * (y < 0.0f ? -1.0f : 1.0f);
+            x = fx;
+        }
+        float scale = 1.0f / std::sqrt(x * x + y * y + z * z);
+        n[0] = x * scale;
+        n[1] = y * scale;
+        n[2] = z * scale;
+    }
+
+private:
+    std::vector<unsigned char> _gradients;
+    int _dims[3];
+    float _maxMagnitude;
+    double _buildTime;
+};
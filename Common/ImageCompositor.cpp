@@ -0,0 +1,130 @@
+#include "ImageCompositor.h"
+#include "Communicator.h"
+#include "FrameProfiler.h"
+
+#include <algorithm>
+
+ImageCompositor::ImageCompositor(void)
+{
+    _operator = OVER;
+    _compositeTime = 0.0;
+    _bytesSent = 0;
+}
+
+void ImageCompositor::Over(const float* front, const float* back, float* out, int pixels)
+{
+    for (int i = 0; i < pixels; i++, front += 4, back += 4, out += 4) {
+        float transmit = 1.0f - front[3];
+        for (int c = 0; c < 4; c++)
+            out[c] = front[c] + transmit * back[c];
+    }
+}
+
+void ImageCompositor::Blend(const float* front, const float* back, float* out, int pixels) const
+{
+    if (_operator == ADD) {
+        for (int i = 0; i < 4 * pixels; i++)
+            out[i] = std::min(front[i] + back[i], 1.0f);
+    } else {
+        Over(front, back, out, pixels);
+    }
+}
+
+void ImageCompositor::OwnedSpan(int position, int ranks, int pixels, int& first, int& count)
+{
+    first = 0;
+    count = pixels;
+    for (int bit = 1; bit < ranks; bit <<= 1) {
+        int half = count / 2;
+        if (position & bit) {
+            first += half;
+            count -= half;
+        } else {
+            count = half;
+        }
+    }
+}
+
+void ImageCompositor::Composite(Communicator& comm, const std::vector<int>& order, float* image, int pixels)
+{
+    double start = FrameProfiler::Now();
+    _bytesSent = 0;
+    const int size = comm.GetSize();
+    const int rank = comm.GetRank();
+    if (size < 2) {
+        _compositeTime = FrameProfiler::Now() - start;
+        return;
+    }
+    _buffer.resize(4 * size_t(pixels));
+    float* other = &_buffer[0];
+
+    int ranks = 1;
+    while (ranks * 2 <= size)
+        ranks *= 2;
+    const int folded = size - ranks;
+    const int position = int(std::find(order.begin(), order.end(), rank) - order.begin());
+
+    //fold the ranks beyond the power of two into their front neighbours:
+    //positions 2i and 2i+1 merge for i < folded, the rest move up
+    std::vector<int> survivors(ranks);
+    for (int p = 0; p < ranks; p++)
+        survivors[p] = order[p < folded ? 2 * p : p + folded];
+    int swapPosition = -1;
+    if (position < 2 * folded) {
+        int peer = order[position ^ 1];
+        if (position & 1) {
+            comm.Exchange(peer, image, 4 * pixels, 0, 0);
+            _bytesSent += 4 * size_t(pixels) * sizeof(float);
+        } else {
+            comm.Exchange(peer, 0, 0, other, 4 * pixels);
+            Blend(image, other, image, pixels);
+            swapPosition = position / 2;
+        }
+    } else {
+        if (folded > 0)
+            comm.Exchange(-1, 0, 0, 0, 0);
+        swapPosition = position - folded;
+    }
+
+    //binary swap: the lower position of a pair is in front and keeps the
+    //lower half of the span both of them own
+    int first = 0, count = pixels;
+    for (int bit = 1; bit < ranks; bit <<= 1) {
+        if (swapPosition < 0) {
+            comm.Exchange(-1, 0, 0, 0, 0);
+            continue;
+        }
+        const int half = count / 2;
+        const bool front = (swapPosition & bit) == 0;
+        const int keepFirst = front ? first : first + half;
+        const int keepCount = front ? half : count - half;
+        const int sendFirst = front ? first + half : first;
+        const int sendCount = count - keepCount;
+
+        comm.Exchange(survivors[swapPosition ^ bit], image + 4 * size_t(sendFirst), 4 * sendCount,
+                      other, 4 * keepCount);
+        _bytesSent += 4 * size_t(sendCount) * sizeof(float);
+        float* kept = image + 4 * size_t(keepFirst);
+        if (front)
+            Blend(kept, other, kept, keepCount);
+        else
+            Blend(other, kept, kept, keepCount);
+        first = keepFirst;
+        count = keepCount;
+    }
+
+    //every rank knows which span every other one ended up with
+    std::vector<int> counts(size, 0), offsets(size, 0);
+    for (int p = 0; p < ranks; p++) {
+        int spanFirst, spanCount;
+        OwnedSpan(p, ranks, pixels, spanFirst, spanCount);
+        counts[survivors[p]] = 4 * spanCount;
+        offsets[survivors[p]] = 4 * spanFirst;
+    }
+    comm.Gather(image + 4 * size_t(first), &counts[0], &offsets[0], other);
+    if (rank == 0)
+        std::copy(other, other + 4 * size_t(pixels), image);
+    else
+        _bytesSent += counts[rank] * sizeof(float);
+    _compositeTime = FrameProfiler::Now() - start;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+class Communicator;
+
+//Sort-last compositing of the premultiplied RGBA float images that every
+//rank rendered of its own piece of the volume (see CPURaycaster and
+//VolumeDecomposition), by binary swap: in round r every rank pairs with
+//the rank 2^r positions away in visibility order, keeps one half of the
+//pixels it still owns, sends the other half to its partner and composites
+//the partner's half of its own. After log2(N) rounds every rank owns a
+//fully composited 1/N of the image and rank 0 gathers the pieces. With a
+//rank count that is not a power of two, the ranks beyond the largest
+//power of two first hand their whole image to their front neighbour.
+//
+//Composite images are blended by the front-to-back "over" of
+//raycaster.frag (out = front + (1 - front.a) * back), additive images are
+//summed. Maximum and minimum intensity images cannot be composited: they
+//are classified from the projected scalar, which the images do not carry.
+class ImageCompositor
+{
+public:
+    enum Operator
+    {
+        OVER = 0,   //front over back, premultiplied alpha
+        ADD = 1     //clamped sum, order independent
+    };
+
+    ImageCompositor(void);
+
+    void SetOperator(int op) { _operator = op; }
+    int GetOperator() const { return _operator; }
+
+    //composites 'image' (pixels RGBA pixels, the same size on every rank)
+    //across all ranks of comm; order lists the ranks front to back. On
+    //return rank 0 holds the composited image, the images of the other
+    //ranks are left partially composited.
+    void Composite(Communicator& comm, const std::vector<int>& order, float* image, int pixels);
+
+    //out = front over back, out may alias either input
+    static void Over(const float* front, const float* back, float* out, int pixels);
+
+    //seconds spent in the last Composite() and bytes this rank sent
+    double GetCompositeTime() const { return _compositeTime; }
+    size_t GetBytesSent() const { return _bytesSent; }
+
+private:
+    //pixels [first, first+count) rank 'position' owns after the swaps,
+    //positions counted among the ranks left after folding
+    static void OwnedSpan(int position, int ranks, int pixels, int& first, int& count);
+
+    void Blend(const float* front, const float* back, float* out, int pixels) const;
+
+    int _operator;
+    std::vector<float> _buffer;
+    double _compositeTime;
+    size_t _bytesSent;
+};
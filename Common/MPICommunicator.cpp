@@ -0,0 +1,35 @@
+#include "MPICommunicator.h"
+
+static const int EXCHANGE_TAG = 4617;
+
+MPICommunicator::MPICommunicator(MPI_Comm comm)
+{
+    _comm = comm;
+    MPI_Comm_rank(comm, &_rank);
+    MPI_Comm_size(comm, &_size);
+}
+
+void MPICommunicator::Exchange(int peer, const float* send, int sendCount, float* recv, int recvCount)
+{
+    //point to point, ranks sitting a round out have nothing to match
+    if (peer < 0)
+        return;
+    MPI_Sendrecv(const_cast<float*>(send), sendCount, MPI_FLOAT, peer, EXCHANGE_TAG,
+                 recv, recvCount, MPI_FLOAT, peer, EXCHANGE_TAG, _comm, MPI_STATUS_IGNORE);
+}
+
+void MPICommunicator::Gather(const float* send, const int* counts, const int* offsets, float* recv)
+{
+    MPI_Gatherv(const_cast<float*>(send), counts[_rank], MPI_FLOAT, recv,
+                const_cast<int*>(counts), const_cast<int*>(offsets), MPI_FLOAT, 0, _comm);
+}
+
+void MPICommunicator::AllGather(const float* send, int count, float* recv)
+{
+    MPI_Allgather(const_cast<float*>(send), count, MPI_FLOAT, recv, count, MPI_FLOAT, _comm);
+}
+
+void MPICommunicator::Barrier()
+{
+    MPI_Barrier(_comm);
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <mpi.h>
+
+#include "Communicator.h"
+
+//Communicator over an MPI communicator, one rank per MPI process. The
+//caller initializes and finalizes MPI. Built with VOLUME_USE_MPI.
+class MPICommunicator : public Communicator
+{
+public:
+    explicit MPICommunicator(MPI_Comm comm = MPI_COMM_WORLD);
+
+    virtual int GetRank() const { return _rank; }
+    virtual int GetSize() const { return _size; }
+
+    virtual void Exchange(int peer, const float* send, int sendCount, float* recv, int recvCount);
+    virtual void Gather(const float* send, const int* counts, const int* offsets, float* recv);
+    virtual void AllGather(const float* send, int count, float* recv);
+    virtual void Barrier();
+
+private:
+    MPI_Comm _comm;
+    int _rank;
+    int _size;
+};
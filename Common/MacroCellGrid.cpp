@@ -0,0 +1,426 @@
+#include "MacroCellGrid.h"
+#include "BrickedVolume.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+MacroCellGrid::MacroCellGrid(void)
+{
+    _cellSize = 8;
+    _dims[0] = _dims[1] = _dims[2] = 0;
+    _gridDims[0] = _gridDims[1] = _gridDims[2] = 0;
+    _emptyCells = 0;
+    _classifiedEntries = 0;
+}
+
+void MacroCellGrid::RangesChanged()
+{
+    _classifiedEntries = 0;
+    _rangeOrder.clear();
+    _rangeStart.clear();
+}
+
+//raw range mapped onto 0..255, widened to whole values
+template <typename T>
+static void MapRange(T vmin, T vmax, float scale, float shift,
+                     unsigned char& outMin, unsigned char& outMax)
+{
+    float fmin = std::floor(float(vmin) * scale + shift);
+    float fmax = std::ceil(float(vmax) * scale + shift);
+    outMin = static_cast<unsigned char>(std::min(std::max(fmin, 0.0f), 255.0f));
+    outMax = static_cast<unsigned char>(std::min(std::max(fmax, 0.0f), 255.0f));
+}
+
+//min/max of the voxels [x0,x1]x[y0,y1]x[z0,z1] mapped onto 0..255; sx is
+//the distance between voxels of a row (the number of components)
+template <typename T>
+static void CellRange(const T* data, size_t sx, size_t sy, size_t sz, const int lo[3], const int hi[3],
+                      float scale, float shift, unsigned char& cellMin, unsigned char& cellMax)
+{
+    T vmin = data[size_t(lo[2])*sz + size_t(lo[1])*sy + lo[0]*sx], vmax = vmin;
+    for (int z = lo[2]; z <= hi[2]; z++)
+        for (int y = lo[1]; y <= hi[1]; y++) {
+            const T* row = data + size_t(z)*sz + size_t(y)*sy;
+            for (int x = lo[0]; x <= hi[0]; x++) {
+                vmin = std::min(vmin, row[x*sx]);
+                vmax = std::max(vmax, row[x*sx]);
+            }
+        }
+    MapRange(vmin, vmax, scale, shift, cellMin, cellMax);
+}
+
+//per cell range of one row of voxels, see CellRange()
+template <typename T>
+static void RowRanges(const T* row, size_t sx, int xdim, int cells, int cellSize,
+                      float scale, float shift, unsigned char* rowMin, unsigned char* rowMax)
+{
+    for (int cx = 0; cx < cells; cx++) {
+        int x0 = cx * cellSize, x1 = std::min(x0 + cellSize, xdim - 1);
+        T lo = row[x0*sx], hi = lo;
+        for (int x = x0 + 1; x <= x1; x++) {
+            lo = std::min(lo, row[x*sx]);
+            hi = std::max(hi, row[x*sx]);
+        }
+        MapRange(lo, hi, scale, shift, rowMin[cx], rowMax[cx]);
+    }
+}
+
+void MacroCellGrid::Build(const unsigned char* data, int xdim, int ydim, int zdim,
+                          int cellSize, ThreadPool* pool)
+{
+    Build(data, SCALAR_UINT8, 1, 1.0f, 0.0f, xdim, ydim, zdim, cellSize, pool);
+}
+
+void MacroCellGrid::Build(const void* data, int scalarType, int components, float scale, float shift,
+                          int xdim, int ydim, int zdim, int cellSize, ThreadPool* pool)
+{
+    _cellSize = std::min(64, std::max(2, cellSize));
+    _dims[0] = xdim;
+    _dims[1] = ydim;
+    _dims[2] = zdim;
+    for (int i = 0; i < 3; i++)
+        _gridDims[i] = (std::max(_dims[i] - 1, 1) + _cellSize - 1) / _cellSize;
+
+    _minMax.assign(size_t(GetNumberOfCells()) * 2, 0);
+    _occupancy.assign(GetNumberOfCells(), 255);
+    RangesChanged();
+
+    const size_t sx = size_t(components);
+    const size_t sy = sx * size_t(xdim);
+    const size_t sz = sy * size_t(ydim);
+    const size_t scalar = (components - 1) * ScalarTypeSize(scalarType);
+    data = static_cast<const unsigned char*>(data) + scalar;
+
+    //one task per slab of cells along z
+    ThreadPool::TaskFunction slab = [&](int cz, int) {
+        int lo[3], hi[3];
+        lo[2] = cz * _cellSize;
+        hi[2] = std::min(lo[2] + _cellSize, zdim - 1);
+        for (int cy = 0; cy < _gridDims[1]; cy++) {
+            lo[1] = cy * _cellSize;
+            hi[1] = std::min(lo[1] + _cellSize, ydim - 1);
+            for (int cx = 0; cx < _gridDims[0]; cx++) {
+                lo[0] = cx * _cellSize;
+                hi[0] = std::min(lo[0] + _cellSize, xdim - 1);
+                size_t cell = (size_t(cz)*_gridDims[1] + cy)*_gridDims[0] + cx;
+                unsigned char& cellMin = _minMax[2*cell];
+                unsigned char& cellMax = _minMax[2*cell+1];
+                switch (scalarType) {
+                case SCALAR_UINT16:
+                    CellRange(static_cast<const unsigned short*>(data), sx, sy, sz, lo, hi, scale, shift, cellMin, cellMax);
+                    break;
+                case SCALAR_INT16:
+                    CellRange(static_cast<const short*>(data), sx, sy, sz, lo, hi, scale, shift, cellMin, cellMax);
+                    break;
+                case SCALAR_FLOAT32:
+                    CellRange(static_cast<const float*>(data), sx, sy, sz, lo, hi, scale, shift, cellMin, cellMax);
+                    break;
+                default:
+                    CellRange(static_cast<const unsigned char*>(data), sx, sy, sz, lo, hi, scale, shift, cellMin, cellMax);
+                    break;
+                }
+            }
+        }
+    };
+
+    if (pool)
+        pool->ParallelFor(_gridDims[2], slab);
+    else
+        for (int cz = 0; cz < _gridDims[2]; cz++)
+            slab(cz, 0);
+}
+
+bool MacroCellGrid::Build(const BrickedVolume& volume, int cellSize, ThreadPool* pool,
+                          float scale, float shift)
+{
+    const BrickedVolumeInfo& info = volume.GetInfo();
+    if (!volume.IsOpen() || info.components != 1 ||
+        (info.scalarType != SCALAR_UINT8 && !volume.IsCompressed()))
+        return false;
+
+    const int B = info.brickSize;
+    _cellSize = std::min(64, std::max(2, cellSize));
+    while (B % _cellSize != 0)
+        _cellSize--;
+    for (int i = 0; i < 3; i++) {
+        _dims[i] = info.dims[i];
+        _gridDims[i] = (std::max(_dims[i] - 1, 1) + _cellSize - 1) / _cellSize;
+    }
+
+    _minMax.assign(size_t(GetNumberOfCells()) * 2, 0);
+    _occupancy.assign(GetNumberOfCells(), 255);
+    RangesChanged();
+
+    const int edge = volume.GetBrickEdge();
+    const int cellsPerBrick = B / _cellSize;
+    const int* brickGrid = volume.GetBrickGridDimensions();
+
+    //compressed bricks are decoded into a buffer per worker, rounded onto
+    //0..255 as the ray caster samples them
+    std::vector<std::vector<unsigned char> > decoded(volume.IsCompressed() ? (pool ? pool->GetThreadCount() : 1) : 0);
+
+    //one task per layer of bricks along z
+    ThreadPool::TaskFunction layer = [&](int bz, int worker) {
+        for (int by = 0; by < brickGrid[1]; by++)
+            for (int bx = 0; bx < brickGrid[0]; bx++) {
+                const int brickIndex = volume.GetBrickIndex(bx, by, bz);
+                const int b[3] = {bx, by, bz};
+
+                //constant bricks are known from the brick table, their
+                //voxels are never paged in (or decoded)
+                const bool constant = volume.GetBrickMin(brickIndex) == volume.GetBrickMax(brickIndex);
+                const float mapped = std::floor(volume.GetBrickMin(brickIndex) * scale + shift + 0.5f);
+                const unsigned char value = static_cast<unsigned char>(std::min(std::max(mapped, 0.0f), 255.0f));
+                const unsigned char* brick = volume.GetBrickData(brickIndex);
+                if (!decoded.empty() && !constant) {
+                    decoded[worker].resize(volume.GetDecodedBrickBytes());
+                    volume.DecodeBrick8(brickIndex, scale, shift, &decoded[worker][0]);
+                    brick = &decoded[worker][0];
+                }
+                for (int k = 0; k < cellsPerBrick*cellsPerBrick*cellsPerBrick; k++) {
+                    int local[3] = {k % cellsPerBrick, (k / cellsPerBrick) % cellsPerBrick, k / (cellsPerBrick*cellsPerBrick)};
+                    int cell[3];
+                    bool inside = true;
+                    for (int i = 0; i < 3; i++) {
+                        cell[i] = b[i]*cellsPerBrick + local[i];
+                        inside = inside && cell[i] < _gridDims[i];
+                    }
+                    if (!inside)
+                        continue;
+
+                    unsigned char lo = constant ? value : 255, hi = constant ? value : 0;
+                    for (int z = local[2]*_cellSize; !constant && z <= (local[2]+1)*_cellSize; z++)
+                        for (int y = local[1]*_cellSize; y <= (local[1]+1)*_cellSize; y++) {
+                            const unsigned char* row = brick + (size_t(z)*edge + y)*edge;
+                            for (int x = local[0]*_cellSize; x <= (local[0]+1)*_cellSize; x++) {
+                                lo = std::min(lo, row[x]);
+                                hi = std::max(hi, row[x]);
+                            }
+                        }
+                    size_t index = (size_t(cell[2])*_gridDims[1] + cell[1])*_gridDims[0] + cell[0];
+                    _minMax[2*index] = lo;
+                    _minMax[2*index+1] = hi;
+                }
+            }
+    };
+
+    if (pool)
+        pool->ParallelFor(brickGrid[2], layer);
+    else
+        for (int bz = 0; bz < brickGrid[2]; bz++)
+            layer(bz, 0);
+    return true;
+}
+
+void MacroCellGrid::Allocate(int xdim, int ydim, int zdim, int cellSize)
+{
+    _cellSize = std::min(64, std::max(2, cellSize));
+    _dims[0] = xdim;
+    _dims[1] = ydim;
+    _dims[2] = zdim;
+    for (int i = 0; i < 3; i++)
+        _gridDims[i] = (std::max(_dims[i] - 1, 1) + _cellSize - 1) / _cellSize;
+
+    //min starts above max so the first merged voxel sets both
+    _minMax.resize(size_t(GetNumberOfCells()) * 2);
+    for (size_t cell = 0; cell < _minMax.size(); cell += 2) {
+        _minMax[cell] = 255;
+        _minMax[cell+1] = 0;
+    }
+    _occupancy.assign(GetNumberOfCells(), 255);
+    RangesChanged();
+}
+
+void MacroCellGrid::AddSlices(const unsigned char* slices, int z0, int count)
+{
+    AddSlices(slices, SCALAR_UINT8, 1, 1.0f, 0.0f, z0, count);
+}
+
+void MacroCellGrid::AddSlices(const void* slices, int scalarType, int components, float scale,
+                              float shift, int z0, int count)
+{
+    const int S = _cellSize;
+    const size_t voxelSize = ScalarTypeSize(scalarType) * components;
+    const size_t rowSize = voxelSize * _dims[0];
+    const size_t sliceSize = rowSize * _dims[1];
+    const unsigned char* bytes = static_cast<const unsigned char*>(slices) +
+                                 (components - 1) * ScalarTypeSize(scalarType);
+    std::vector<unsigned char> rowMin(_gridDims[0]), rowMax(_gridDims[0]);
+    RangesChanged();
+
+    for (int z = z0; z < z0 + count; z++) {
+        //voxel layer v belongs to cell v/S and, on a cell boundary, also to
+        //the cell before it
+        const int cz1 = std::min(z / S, _gridDims[2] - 1);
+        const int cz0 = (z % S == 0 && z > 0) ? z / S - 1 : cz1;
+        for (int y = 0; y < _dims[1]; y++) {
+            const unsigned char* row = bytes + size_t(z - z0)*sliceSize + size_t(y)*rowSize;
+            switch (scalarType) {
+            case SCALAR_UINT16:
+                RowRanges(reinterpret_cast<const unsigned short*>(row), components, _dims[0], _gridDims[0], S,
+                          scale, shift, &rowMin[0], &rowMax[0]);
+                break;
+            case SCALAR_INT16:
+                RowRanges(reinterpret_cast<const short*>(row), components, _dims[0], _gridDims[0], S,
+                          scale, shift, &rowMin[0], &rowMax[0]);
+                break;
+            case SCALAR_FLOAT32:
+                RowRanges(reinterpret_cast<const float*>(row), components, _dims[0], _gridDims[0], S,
+                          scale, shift, &rowMin[0], &rowMax[0]);
+                break;
+            default:
+                RowRanges(row, components, _dims[0], _gridDims[0], S,
+                          scale, shift, &rowMin[0], &rowMax[0]);
+                break;
+            }
+
+            const int cy1 = std::min(y / S, _gridDims[1] - 1);
+            const int cy0 = (y % S == 0 && y > 0) ? y / S - 1 : cy1;
+            for (int cz = cz0; cz <= cz1; cz++)
+                for (int cy = cy0; cy <= cy1; cy++) {
+                    unsigned char* cell = &_minMax[2*(size_t(cz)*_gridDims[1] + cy)*_gridDims[0]];
+                    for (int cx = 0; cx < _gridDims[0]; cx++) {
+                        cell[2*cx] = std::min(cell[2*cx], rowMin[cx]);
+                        cell[2*cx+1] = std::max(cell[2*cx+1], rowMax[cx]);
+                    }
+                }
+        }
+    }
+}
+
+int MacroCellGrid::Classify(const float* opacity, int entries, int stride)
+{
+    if (!IsValid() || !opacity || entries < 1)
+        return 0;
+
+    //prefix count of visible table entries, a cell is empty when no entry
+    //between its min and max has non-zero opacity
+    std::vector<int> visible(entries + 1, 0);
+    for (int i = 0; i < entries; i++)
+        visible[i+1] = visible[i] + (opacity[i*stride] > 0.0f ? 1 : 0);
+
+    const float scale = (entries - 1) / 255.0f;
+    int empty = 0;
+    for (int cell = 0; cell < GetNumberOfCells(); cell++) {
+        //entries the kernels may pick for values in [min,max] (nearest lookup)
+        int lo = static_cast<int>(_minMax[2*cell] * scale + 0.5f);
+        int hi = static_cast<int>(_minMax[2*cell+1] * scale + 0.5f);
+        bool isEmpty = visible[hi+1] - visible[lo] == 0;
+        _occupancy[cell] = isEmpty ? 0 : 255;
+        empty += isEmpty ? 1 : 0;
+    }
+    _emptyCells = empty;
+    _classifiedEntries = entries;
+    return empty;
+}
+
+void MacroCellGrid::BuildRangeIndex()
+{
+    //counting sort by descending max, then stably by ascending min
+    const int cells = GetNumberOfCells();
+    std::vector<int> count(257, 0), byMax(cells);
+    for (int cell = 0; cell < cells; cell++)
+        count[256 - _minMax[2*cell+1]]++;
+    for (int v = 1; v < 257; v++)
+        count[v] += count[v-1];
+    for (int cell = cells - 1; cell >= 0; cell--)
+        byMax[--count[256 - _minMax[2*cell+1]]] = cell;
+
+    _rangeStart.assign(257, 0);
+    for (int cell = 0; cell < cells; cell++)
+        _rangeStart[_minMax[2*cell] + 1]++;
+    for (int v = 1; v < 257; v++)
+        _rangeStart[v] += _rangeStart[v-1];
+    std::vector<int> next(_rangeStart.begin(), _rangeStart.end() - 1);
+    _rangeOrder.resize(cells);
+    for (int i = 0; i < cells; i++)
+        _rangeOrder[next[_minMax[2*byMax[i]]]++] = byMax[i];
+}
+
+int MacroCellGrid::Reclassify(const float* opacity, int entries, int first, int last, int stride)
+{
+    if (!IsValid() || !opacity || entries < 1)
+        return 0;
+    if (entries != _classifiedEntries)
+        return Classify(opacity, entries, stride);
+    first = std::max(first, 0);
+    last = std::min(last, entries - 1);
+    if (first > last)
+        return _emptyCells;
+    if (_rangeOrder.empty())
+        BuildRangeIndex();
+
+    std::vector<int> visible(entries + 1, 0);
+    for (int i = 0; i < entries; i++)
+        visible[i+1] = visible[i] + (opacity[i*stride] > 0.0f ? 1 : 0);
+
+    //a cell is affected when its min maps to an entry <= last and its max
+    //to one >= first; in value terms min <= lastValue and max >= firstValue
+    const float scale = (entries - 1) / 255.0f;
+    int firstValue = 256, lastValue = -1;
+    for (int v = 0; v < 256; v++) {
+        int entry = static_cast<int>(v * scale + 0.5f);
+        if (entry >= first)
+            firstValue = std::min(firstValue, v);
+        if (entry <= last)
+            lastValue = v;
+    }
+
+    for (int v = 0; v <= lastValue; v++) {
+        for (int i = _rangeStart[v]; i < _rangeStart[v+1]; i++) {
+            const int cell = _rangeOrder[i];
+            if (_minMax[2*cell+1] < firstValue)
+                break;
+            int lo = static_cast<int>(_minMax[2*cell] * scale + 0.5f);
+            int hi = static_cast<int>(_minMax[2*cell+1] * scale + 0.5f);
+            unsigned char occupancy = visible[hi+1] - visible[lo] == 0 ? 0 : 255;
+            if (occupancy != _occupancy[cell]) {
+                _emptyCells += occupancy ? -1 : 1;
+                _occupancy[cell] = occupancy;
+            }
+        }
+    }
+    return _emptyCells;
+}
+
+bool MacroCellGrid::GetValueRange(unsigned char range[2]) const
+{
+    range[0] = 255;
+    range[1] = 0;
+    for (size_t cell = 0; cell < _minMax.size(); cell += 2) {
+        range[0] = std::min(range[0], _minMax[cell]);
+        range[1] = std::max(range[1], _minMax[cell+1]);
+    }
+    return range[0] <= range[1];
+}
+
+bool MacroCellGrid::GetOccupiedBounds(float box[6]) const
+{
+    if (!IsValid() || _occupancy.empty())
+        return false;
+
+    int lo[3] = {_gridDims[0], _gridDims[1], _gridDims[2]};
+    int hi[3] = {-1, -1, -1};
+    for (int cz = 0; cz < _gridDims[2]; cz++)
+        for (int cy = 0; cy < _gridDims[1]; cy++)
+            for (int cx = 0; cx < _gridDims[0]; cx++) {
+                if (IsEmpty(cx, cy, cz))
+                    continue;
+                const int cell[3] = {cx, cy, cz};
+                for (int i = 0; i < 3; i++) {
+                    lo[i] = std::min(lo[i], cell[i]);
+                    hi[i] = std::max(hi[i], cell[i]);
+                }
+            }
+    if (hi[0] < 0)
+        return false;
+
+    //cell c covers texel coordinates [c*S, (c+1)*S), texel = pos*dim - 0.5
+    for (int i = 0; i < 3; i++) {
+        const float dim = float(_dims[i]);
+        box[2*i] = lo[i] == 0 ? 0.0f : (lo[i] * _cellSize + 0.5f) / dim;
+        box[2*i+1] = hi[i] == _gridDims[i] - 1 ? 1.0f : ((hi[i] + 1) * _cellSize + 0.5f) / dim;
+    }
+    return true;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+class BrickedVolume;
+class ThreadPool;
+
+//Coarse min/max grid over a volume used for empty-space skipping, with the
+//ranges kept in the 0..255 domain of the transfer function.
+//A cell of edge S covers texel coordinates [c*S, (c+1)*S) along each axis;
+//since linear interpolation there reads voxels c*S .. c*S+S, each cell's
+//range includes the first voxel layer of its +1 neighbour. Classify() then
+//marks every cell whose value range maps to zero opacity as empty.
+class MacroCellGrid
+{
+public:
+    MacroCellGrid(void);
+
+    //computes the per-cell ranges, cellSize is clamped to [2,64]
+    void Build(const unsigned char* data, int xdim, int ydim, int zdim,
+               int cellSize = 8, ThreadPool* pool = 0);
+
+    //same for scalars of any ScalarType (see BrickedVolume.h), mapped onto
+    //0..255 by raw*scale+shift; cell ranges are widened to whole values. Of
+    //interleaved multi-component voxels the last component is the scalar.
+    void Build(const void* data, int scalarType, int components, float scale, float shift,
+               int xdim, int ydim, int zdim, int cellSize = 8, ThreadPool* pool = 0);
+
+    //same from the bricks of an 8-bit bricked volume, touching each brick
+    //once. The cell size is reduced to a divisor of the brick size.
+    //Compressed bricks of any scalar type are decoded onto 0..255 by
+    //raw*scale+shift, so the ranges are those of the decoded voxels.
+    bool Build(const BrickedVolume& volume, int cellSize = 8, ThreadPool* pool = 0,
+               float scale = 1.0f, float shift = 0.0f);
+
+    //incremental build while a volume streams in slice by slice: Allocate()
+    //sizes the grid and AddSlices() merges 'count' consecutive slices
+    //starting at z0 into every cell whose range includes them. Slices may
+    //arrive in any order; the grid is complete once every slice was added.
+    void Allocate(int xdim, int ydim, int zdim, int cellSize = 8);
+    void AddSlices(const unsigned char* slices, int z0, int count);
+    void AddSlices(const void* slices, int scalarType, int components, float scale, float shift,
+                   int z0, int count);
+
+    //opacity table of 'entries' values spanning scalars 0..255, read with
+    //the given stride (4 for an interleaved RGBA table). Returns the number
+    //of empty cells.
+    int Classify(const float* opacity, int entries, int stride = 1);
+
+    //same after an edit that changed only the table entries first..last:
+    //just the cells whose range maps onto one of them are visited, found
+    //through an index of the cells by range built on first use. Without a
+    //Classify() of the current ranges with as many entries it classifies
+    //all cells. Returns the number of empty cells.
+    int Reclassify(const float* opacity, int entries, int first, int last, int stride = 1);
+
+    bool IsValid() const { return !_minMax.empty(); }
+    int GetCellSize() const { return _cellSize; }
+    const int* GetGridDimensions() const { return _gridDims; }
+    int GetNumberOfCells() const { return _gridDims[0]*_gridDims[1]*_gridDims[2]; }
+
+    //two bytes (min,max) per cell, x fastest
+    const unsigned char* GetMinMax() const { return _minMax.empty() ? 0 : &_minMax[0]; }
+
+    //smallest and largest value of the volume, false before any was merged
+    bool GetValueRange(unsigned char range[2]) const;
+
+    //one byte per cell, 0 = empty, 255 = has visible samples. Laid out to be
+    //uploaded as a GL_R8 3D texture of GetGridDimensions().
+    const unsigned char* GetOccupancy() const { return _occupancy.empty() ? 0 : &_occupancy[0]; }
+
+    //texture space box x0,x1,y0,y1,z0,z1 around the non-empty cells, with
+    //voxel i at (i+0.5)/dim; boxes touching the first or last cell extend to
+    //the volume's face. Returns false when every cell is empty.
+    bool GetOccupiedBounds(float box[6]) const;
+
+    bool IsEmpty(int cx, int cy, int cz) const
+    {
+        return _occupancy[(size_t(cz)*_gridDims[1] + cy)*_gridDims[0] + cx] == 0;
+    }
+
+private:
+    void RangesChanged();
+    void BuildRangeIndex();
+
+    int _cellSize;
+    int _dims[3];
+    int _gridDims[3];
+    std::vector<unsigned char> _minMax;
+    std::vector<unsigned char> _occupancy;
+
+    //result of the last classification, entries 0 when the ranges changed
+    int _emptyCells;
+    int _classifiedEntries;
+
+    //cells ordered by min, then descending max, and where each min starts
+    std::vector<int> _rangeOrder;
+    std::vector<int> _rangeStart;
+};
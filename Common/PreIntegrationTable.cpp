@@ -0,0 +1,81 @@
+#include "PreIntegrationTable.h"
+
+#include <algorithm>
+#include <cmath>
+
+PreIntegrationTable::PreIntegrationTable(void)
+{
+    _size = 0;
+}
+
+int PreIntegrationTable::Update(const float* rgba, int entries)
+{
+    if (!rgba || entries < 2)
+        return 0;
+
+    //range of entries that changed since the last update
+    int lo = 0, hi = entries - 1;
+    if (entries == _size) {
+        lo = entries;
+        hi = -1;
+        for (int i = 0; i < 4*entries; i++)
+            if (rgba[i] != _transferFunction[i]) {
+                lo = std::min(lo, i / 4);
+                hi = std::max(hi, i / 4);
+            }
+        if (hi < 0)
+            return 0;
+    } else {
+        _size = entries;
+        _table.resize(size_t(4) * entries * entries);
+    }
+    _transferFunction.assign(rgba, rgba + 4*entries);
+
+    //extinction per entry, then the running integrals along the scalar
+    //axis with the transfer function linear between entries
+    _extinction.resize(entries);
+    for (int i = 0; i < entries; i++) {
+        double alpha = std::min(std::max(double(rgba[4*i+3]), 0.0), 0.9999);
+        _extinction[i] = -std::log(1.0 - alpha);
+    }
+    _integral.assign(entries, 0.0);
+    _colourIntegral.assign(size_t(3) * entries, 0.0);
+    for (int i = 1; i < entries; i++) {
+        _integral[i] = _integral[i-1] + 0.5 * (_extinction[i-1] + _extinction[i]);
+        for (int c = 0; c < 3; c++)
+            _colourIntegral[3*i+c] = _colourIntegral[3*(i-1)+c] +
+                0.5 * (rgba[4*(i-1)+c] * _extinction[i-1] + rgba[4*i+c] * _extinction[i]);
+    }
+
+    //a segment from s0 to s1 (s0 <= s1) integrates over the entries in
+    //between, so it is affected iff s0 <= hi and s1 >= lo. The table is
+    //symmetric as self-attenuation inside a segment is neglected.
+    int rebuilt = 0;
+    for (int s0 = 0; s0 <= hi; s0++) {
+        for (int s1 = std::max(s0, lo); s1 < entries; s1++) {
+            double tau, rgb[3];
+            if (s0 == s1) {
+                tau = _extinction[s0];
+                for (int c = 0; c < 3; c++)
+                    rgb[c] = rgba[4*s0+c] * tau;
+            } else {
+                double length = s1 - s0;
+                tau = (_integral[s1] - _integral[s0]) / length;
+                for (int c = 0; c < 3; c++)
+                    rgb[c] = (_colourIntegral[3*s1+c] - _colourIntegral[3*s0+c]) / length;
+            }
+
+            //opacity of the segment and the extinction weighted colour
+            //scaled to it; alpha/tau tends to 1 for vanishing extinction
+            double alpha = 1.0 - std::exp(-tau);
+            double scale = tau > 1e-6 ? alpha / tau : 1.0;
+            float* entry = &_table[4 * (size_t(s1) * entries + s0)];
+            float* mirror = &_table[4 * (size_t(s0) * entries + s1)];
+            for (int c = 0; c < 3; c++)
+                entry[c] = mirror[c] = static_cast<float>(std::min(rgb[c] * scale, 1.0));
+            entry[3] = mirror[3] = static_cast<float>(alpha);
+            rebuilt += s0 == s1 ? 1 : 2;
+        }
+    }
+    return rebuilt;
+}
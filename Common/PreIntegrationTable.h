@@ -0,0 +1,37 @@
+#pragma once
+#include <vector>
+
+//Pre-integrated transfer function: a 2D table holding, for every pair of
+//front and back scalar of a ray segment, the colour and opacity of the
+//segment with the transfer function integrated over all scalars in
+//between (assuming the scalar varies linearly along the segment). Sharp
+//transfer function features then no longer depend on a sample landing on
+//them, so much larger sample distances render without slicing artefacts.
+//
+//The table is N x N interleaved RGBA for a transfer function of N entries,
+//row = back entry, column = front entry. Colours are premultiplied by the
+//segment opacity, so compositing is C += (1-A)*rgb, A += (1-A)*a.
+class PreIntegrationTable
+{
+public:
+    PreIntegrationTable(void);
+
+    //interleaved RGBA entries spanning scalars 0..255, opacity per segment
+    //(already corrected for the sample distance). Only table entries whose
+    //segment spans a changed transfer function entry are recomputed.
+    //Returns the number of table entries that were rebuilt, 0 when the
+    //transfer function did not change.
+    int Update(const float* rgba, int entries);
+
+    bool IsValid() const { return !_table.empty(); }
+    int GetSize() const { return _size; }
+    const float* GetTable() const { return _table.empty() ? 0 : &_table[0]; }
+
+private:
+    int _size;
+    std::vector<float> _transferFunction;   //copy of the last input
+    std::vector<double> _extinction;        //per entry
+    std::vector<double> _integral;          //running integrals of extinction
+    std::vector<double> _colourIntegral;    //and of extinction-weighted RGB
+    std::vector<float> _table;
+};
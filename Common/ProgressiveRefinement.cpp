@@ -0,0 +1,118 @@
+#include "ProgressiveRefinement.h"
+
+#include <algorithm>
+
+//radical inverse in base b, low discrepancy jitter offsets
+static float Halton(int index, int base)
+{
+    float result = 0.0f, f = 1.0f;
+    for (int i = index; i > 0; i /= base) {
+        f /= base;
+        result += f * (i % base);
+    }
+    return result;
+}
+
+ProgressiveRefinement::ProgressiveRefinement(void)
+{
+    _budget = 1.0 / 30.0;
+    _maxDownsample = 8;
+    _maxSampleDistanceScale = 2.0f;
+    _supersamples = 4;
+    _width = _height = 0;
+    _pixelCost = 0.0;
+    Invalidate();
+}
+
+void ProgressiveRefinement::SetMaximumDownsample(int downsample)
+{
+    _maxDownsample = 1;
+    while (_maxDownsample * 2 <= downsample)
+        _maxDownsample *= 2;
+}
+
+void ProgressiveRefinement::SetMaximumSampleDistanceScale(float scale)
+{
+    _maxSampleDistanceScale = std::max(scale, 1.0f);
+}
+
+void ProgressiveRefinement::SetImageSize(int width, int height)
+{
+    if (width == _width && height == _height)
+        return;
+    _width = width;
+    _height = height;
+    Invalidate();
+}
+
+void ProgressiveRefinement::Invalidate()
+{
+    _converged = false;
+    ChooseInteractivePass();
+}
+
+void ProgressiveRefinement::ChooseInteractivePass()
+{
+    _pass.supersample = 0;
+    _pass.jitter[0] = _pass.jitter[1] = 0.0f;
+    _pass.interactive = true;
+
+    //nothing measured yet: start coarse, the first frames calibrate
+    if (_pixelCost <= 0.0) {
+        _pass.downsample = std::min(2, _maxDownsample);
+        _pass.sampleDistanceScale = 1.0f;
+        return;
+    }
+
+    //the sample distance is raised before the resolution is lowered, a
+    //coarser sample distance is the less visible of the two
+    double fullFrame = double(_width) * _height * _pixelCost;
+    for (int ds = 1; ds <= _maxDownsample; ds *= 2) {
+        double scale = fullFrame / (ds * ds) / _budget;
+        if (scale <= _maxSampleDistanceScale) {
+            _pass.downsample = ds;
+            _pass.sampleDistanceScale = float(std::max(scale, 1.0));
+            return;
+        }
+    }
+    _pass.downsample = _maxDownsample;
+    _pass.sampleDistanceScale = _maxSampleDistanceScale;
+}
+
+void ProgressiveRefinement::SetRefinementPass(int downsample, int supersample)
+{
+    _pass.downsample = downsample;
+    _pass.sampleDistanceScale = 1.0f;
+    _pass.supersample = supersample;
+    _pass.jitter[0] = supersample ? Halton(supersample, 2) - 0.5f : 0.0f;
+    _pass.jitter[1] = supersample ? Halton(supersample, 3) - 0.5f : 0.0f;
+    _pass.interactive = false;
+}
+
+long long ProgressiveRefinement::GetPixelBudget() const
+{
+    if (_pixelCost <= 0.0)
+        return (long long)(_width) * _height;
+    double pixels = _budget * _pass.sampleDistanceScale / _pixelCost;
+    return std::max(1LL, (long long)(pixels));
+}
+
+void ProgressiveRefinement::FrameRendered(double seconds, long long pixels, bool passComplete)
+{
+    if (pixels > 0 && seconds > 0.0) {
+        double cost = seconds * _pass.sampleDistanceScale / pixels;
+        _pixelCost = _pixelCost > 0.0 ? 0.7 * _pixelCost + 0.3 * cost : cost;
+    }
+    if (_converged || !passComplete)
+        return;
+
+    //halve the downsampling down to full resolution, then supersample
+    if (_pass.supersample == 0 && _pass.downsample > 1)
+        SetRefinementPass(_pass.downsample / 2, 0);
+    else if (_pass.supersample == 0 && _pass.sampleDistanceScale > 1.0f)
+        SetRefinementPass(1, 0);
+    else if (_pass.supersample < _supersamples)
+        SetRefinementPass(1, _pass.supersample + 1);
+    else
+        _converged = true;
+}
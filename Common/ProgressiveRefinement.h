@@ -0,0 +1,75 @@
+#pragma once
+
+//Schedules progressive refinement of a ray cast image under a frame time
+//budget. While the view changes (Invalidate() every frame) each frame is an
+//interactive pass: the whole image at a reduced resolution and/or a larger
+//sample distance, chosen from the measured cost so that it fits the budget.
+//Once the view settles the image is refined in passes of doubling
+//resolution up to full resolution, followed by jittered supersampling
+//passes that are averaged into the image. Refinement passes may take
+//several frames; the caller renders GetPixelBudget() pixels worth of tiles
+//per frame and keeps the tiles that are already done.
+//
+//The cost model is seconds per pixel at sample distance 1, smoothed over
+//the measured frames; a pass at sample distance scale s costs 1/s of that.
+class ProgressiveRefinement
+{
+public:
+    ProgressiveRefinement(void);
+
+    struct Pass
+    {
+        int downsample;             //image is rendered at size/downsample
+        float sampleDistanceScale;  //multiplies the sample distance
+        int supersample;            //0, or the index of the jittered pass
+        float jitter[2];            //pixel offset of the rays in [-0.5,0.5]
+        bool interactive;           //rendered completely within one frame
+    };
+
+    void SetFrameBudget(double seconds) { _budget = seconds; }
+    double GetFrameBudget() const { return _budget; }
+
+    //coarsest interactive settings, downsample is a power of two
+    void SetMaximumDownsample(int downsample);
+    void SetMaximumSampleDistanceScale(float scale);
+
+    //jittered passes after the full resolution one, 0 disables them
+    void SetSupersamples(int count) { _supersamples = count; }
+    int GetSupersamples() const { return _supersamples; }
+
+    void SetImageSize(int width, int height);
+
+    //the view or data changed: the next frame is an interactive pass
+    void Invalidate();
+
+    //pass to render in the current frame
+    const Pass& GetPass() const { return _pass; }
+
+    //pixels of the current pass that fit into the budget, at least one
+    long long GetPixelBudget() const;
+
+    //reports the frame: pixels rendered of the current pass in seconds
+    //and whether the pass is finished. Advances to the next pass.
+    void FrameRendered(double seconds, long long pixels, bool passComplete);
+
+    //nothing is left to refine
+    bool IsConverged() const { return _converged; }
+
+    //measured seconds per full resolution pixel at sample distance 1
+    double GetPixelCost() const { return _pixelCost; }
+
+private:
+    void ChooseInteractivePass();
+    void SetRefinementPass(int downsample, int supersample);
+
+    double _budget;
+    int _maxDownsample;
+    float _maxSampleDistanceScale;
+    int _supersamples;
+    int _width, _height;
+
+    Pass _pass;
+    bool _invalidated;
+    bool _converged;
+    double _pixelCost;
+};
@@ -0,0 +1,120 @@
+#include "RenderScheduler.h"
+#include "FrameProfiler.h"
+
+#include <algorithm>
+
+RenderScheduler::RenderScheduler(size_t capacity)
+    : _queue(capacity)
+{
+    _droppedUpdates = 0;
+    _frameRate = 0.0;
+    _interval = 0.0;
+    _lastFrame = -1e30;
+    _oldestTaken = -1.0;
+    _lastLatency = 0.0;
+    _latencyTotal = 0.0;
+}
+
+void RenderScheduler::SetFrameRate(double framesPerSecond)
+{
+    _frameRate = std::max(framesPerSecond, 0.0);
+    _interval = _frameRate > 0.0 ? 1.0 / _frameRate : 0.0;
+}
+
+bool RenderScheduler::Post(const RenderUpdate& update)
+{
+    RenderUpdate stamped = update;
+    if (stamped.time <= 0.0)
+        stamped.time = FrameProfiler::Now();
+    if (_queue.Push(stamped))
+        return true;
+    _droppedUpdates++;
+    return false;
+}
+
+bool RenderScheduler::IsFrameDue(double now, bool continuous) const
+{
+    if (now < _lastFrame + _interval)
+        return false;
+    return continuous || _oldestTaken >= 0.0 || !_queue.IsEmpty();
+}
+
+int RenderScheduler::TakeUpdates(std::vector<RenderUpdate>& updates)
+{
+    updates.clear();
+    RenderUpdate update;
+    while (_queue.Pop(update))
+        updates.push_back(update);
+    if (updates.empty())
+        return 0;
+
+    //the latest camera and transfer function stand for all of the frame;
+    //the transfer function's entries widen to every edit's
+    int camera = -1, transferFunction = -1;
+    int first = 0, last = -1;
+    double oldest = updates[0].time;
+    for (size_t i = 0; i < updates.size(); i++) {
+        oldest = std::min(oldest, updates[i].time);
+        if (updates[i].kind == RenderUpdate::CAMERA) {
+            camera = int(i);
+        } else if (updates[i].kind == RenderUpdate::TRANSFER_FUNCTION) {
+            if (transferFunction < 0) {
+                first = updates[i].first;
+                last = updates[i].last;
+            } else {
+                first = std::min(first, updates[i].first);
+                last = std::max(last, updates[i].last);
+            }
+            transferFunction = int(i);
+        }
+    }
+    if (transferFunction >= 0) {
+        updates[transferFunction].first = first;
+        updates[transferFunction].last = last;
+    }
+
+    const int taken = int(updates.size());
+    size_t kept = 0;
+    for (size_t i = 0; i < updates.size(); i++) {
+        const int kind = updates[i].kind;
+        if ((kind == RenderUpdate::CAMERA && int(i) != camera) ||
+            (kind == RenderUpdate::TRANSFER_FUNCTION && int(i) != transferFunction))
+            continue;
+        updates[kept++] = updates[i];
+    }
+    updates.resize(kept);
+
+    _statistics.updates += taken;
+    _statistics.coalescedUpdates += taken - int(kept);
+    if (_oldestTaken < 0.0 || oldest < _oldestTaken)
+        _oldestTaken = oldest;
+    return taken;
+}
+
+void RenderScheduler::Presented(double frameStart, double now)
+{
+    _lastFrame = frameStart;
+    if (_oldestTaken < 0.0)
+        return;
+
+    _lastLatency = now - _oldestTaken;
+    _oldestTaken = -1.0;
+    _statistics.frames++;
+    _latencyTotal += _lastLatency;
+    _statistics.maxLatency = std::max(_statistics.maxLatency, _lastLatency);
+}
+
+RenderScheduler::Statistics RenderScheduler::GetStatistics() const
+{
+    Statistics statistics = _statistics;
+    statistics.droppedUpdates = _droppedUpdates;
+    statistics.latency = _statistics.frames ? _latencyTotal / _statistics.frames : 0.0;
+    return statistics;
+}
+
+void RenderScheduler::ResetStatistics()
+{
+    _statistics = Statistics();
+    _latencyTotal = 0.0;
+    _droppedUpdates = 0;
+}
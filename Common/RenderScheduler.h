@@ -0,0 +1,98 @@
+#pragma once
+#include <atomic>
+#include <vector>
+
+#include "SPSCQueue.h"
+
+//An input event for the render loop. Camera and transfer function updates
+//carry the complete new state, so only the latest of a frame matters;
+//state updates (a key press) are applied one by one.
+struct RenderUpdate
+{
+    enum Kind {CAMERA, TRANSFER_FUNCTION, STATE};
+
+    RenderUpdate(void) : kind(STATE), key(0), first(0), last(-1), time(0.0)
+    {
+        values[0] = values[1] = values[2] = values[3] = 0.0f;
+    }
+
+    int kind;
+    int key;            //STATE: the setting or key
+    int first, last;    //TRANSFER_FUNCTION: table entries that changed
+    float values[4];    //CAMERA: the camera parameters of the application
+    double time;        //FrameProfiler::Now() of the input event
+};
+
+//Decouples interaction from rendering. Event handlers Post() updates
+//instead of rendering; the render loop asks IsFrameDue() on its pacing
+//tick, takes the updates of the frame coalesced to the latest state and
+//calls Presented() after the buffer swap. A burst of input thus costs one
+//frame per frame interval rather than one frame per event.
+//
+//The updates travel through a lock-free single producer, single consumer
+//queue: Post() may run on an input thread of its own while a frame is in
+//progress. Input-to-present latency is measured from the oldest update a
+//frame took to its Presented() call.
+class RenderScheduler
+{
+public:
+    struct Statistics
+    {
+        Statistics(void) : frames(0), updates(0), coalescedUpdates(0), droppedUpdates(0),
+                           latency(0.0), maxLatency(0.0) {}
+
+        long long frames;           //frames that presented updates
+        long long updates;          //updates taken
+        long long coalescedUpdates; //updates superseded by a later one of the same frame
+        long long droppedUpdates;   //posted while the queue was full
+        double latency;             //average input-to-present seconds
+        double maxLatency;
+    };
+
+    explicit RenderScheduler(size_t capacity = 256);
+
+    //frames per second the render loop is paced to, 0 renders whenever
+    //there is something to show
+    void SetFrameRate(double framesPerSecond);
+    double GetFrameRate() const { return _frameRate; }
+
+    //producer: stamps the update with the current time unless it has one;
+    //false if it was dropped because the queue is full
+    bool Post(const RenderUpdate& update);
+
+    //consumer: whether the frame slot at 'now' has come and there are
+    //updates, or 'continuous' rendering (streaming, playback, refinement)
+    bool IsFrameDue(double now, bool continuous) const;
+
+    //consumer: start of the next frame slot, for the pacing timer
+    double GetNextFrameTime() const { return _lastFrame + _interval; }
+
+    //consumer: the pending updates coalesced, in posting order: the latest
+    //camera, one transfer function update spanning all changed entries and
+    //every state update. Returns the number of updates taken.
+    int TakeUpdates(std::vector<RenderUpdate>& updates);
+
+    //consumer, after every frame: the frame started at frameStart is on
+    //screen; books the latency of the updates it took
+    void Presented(double frameStart, double now);
+
+    //input-to-present seconds of the last frame that took updates
+    double GetLastLatency() const { return _lastLatency; }
+
+    Statistics GetStatistics() const;
+    void ResetStatistics();
+
+private:
+    SPSCQueue<RenderUpdate> _queue;
+
+    std::atomic<long long> _droppedUpdates;
+
+    //consumer side
+    double _frameRate;
+    double _interval;
+    double _lastFrame;
+    double _oldestTaken;    //time of the oldest update not presented yet, <0 if none
+    double _lastLatency;
+    Statistics _statistics;
+    double _latencyTotal;
+};
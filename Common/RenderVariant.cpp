@@ -0,0 +1,141 @@
+#include "RenderVariant.h"
+#include "BrickedVolume.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+static const char* BlendModeName(int mode)
+{
+    switch (mode) {
+    case BLEND_MAXIMUM: return "maximum";
+    case BLEND_MINIMUM: return "minimum";
+    case BLEND_ADDITIVE: return "additive";
+    case BLEND_AVERAGE: return "average";
+    default: return "composite";
+    }
+}
+
+static const char* ScalarTypeName(int type)
+{
+    switch (type) {
+    case SCALAR_UINT16: return "uint16";
+    case SCALAR_INT16: return "int16";
+    case SCALAR_FLOAT32: return "float32";
+    default: return "uint8";
+    }
+}
+
+RenderVariant::RenderVariant(void)
+{
+    blendMode = BLEND_COMPOSITE;
+    linear = true;
+    scalarType = SCALAR_UINT8;
+    components = 1;
+    shading = false;
+    cropping = false;
+    statistics = false;
+}
+
+unsigned RenderVariant::GetKey() const
+{
+    return unsigned(blendMode & 7) | (linear ? 8u : 0u) | (unsigned(scalarType & 3) << 4) |
+           (IsShaded() ? 64u : 0u) | (cropping ? 128u : 0u) | (unsigned((components - 1) & 3) << 8) |
+           (statistics ? 1024u : 0u);
+}
+
+std::string RenderVariant::GetName() const
+{
+    std::ostringstream name;
+    name << BlendModeName(blendMode) << (linear ? " linear " : " nearest ")
+         << ScalarTypeName(scalarType);
+    if (components > 1)
+        name << " x" << components;
+    if (IsShaded())
+        name << " shaded";
+    if (cropping)
+        name << " cropped";
+    if (statistics)
+        name << " counted";
+    return name.str();
+}
+
+std::string RenderVariant::GetShaderDefines() const
+{
+    std::ostringstream defines;
+    defines << "#define BLEND_MODE " << blendMode << "\n"
+            << "#define SCALAR_TYPE " << scalarType << "\n";
+    if (components > 1)
+        defines << "#define COMPONENTS " << components << "\n";
+    if (!linear)
+        defines << "#define NEAREST\n";
+    if (IsShaded())
+        defines << "#define SHADING\n";
+    if (cropping)
+        defines << "#define CROPPING\n";
+    if (statistics)
+        defines << "#define REPORT_STATS\n";
+    return defines.str();
+}
+
+int CropRaySpans(const float origin[3], const float step[3], int samples,
+                 const float planes[6], int regions, int spans[2*MAX_CROP_SPANS])
+{
+    //ray ends and plane crossings within them, sorted
+    float t[8];
+    int n = 0;
+    t[n++] = 0.0f;
+    for (int i = 0; i < 6; i++) {
+        float s = step[i / 2];
+        if (s == 0.0f)
+            continue;
+        float crossing = (planes[i] - origin[i / 2]) / s;
+        if (crossing > 0.0f && crossing < samples)
+            t[n++] = crossing;
+    }
+    t[n++] = float(samples);
+    for (int i = 1; i < n; i++)
+        for (int j = i; j > 0 && t[j] < t[j-1]; j--)
+            std::swap(t[j], t[j-1]);
+
+    int count = 0;
+    float keptUntil = -1.0f;
+    for (int i = 0; i + 1 < n; i++) {
+        if (t[i+1] <= t[i])
+            continue;
+
+        //region of the piece from its midpoint, see RenderVariant
+        float mid = 0.5f * (t[i] + t[i+1]);
+        int bit = 0;
+        for (int axis = 0, weight = 1; axis < 3; axis++, weight *= 3) {
+            float p = origin[axis] + mid * step[axis];
+            bit += weight * ((p < planes[2*axis] ? 0 : 1) + (p > planes[2*axis+1] ? 1 : 0));
+        }
+        if (!((regions >> bit) & 1))
+            continue;
+
+        //extend the previous span when the pieces touch
+        if (count > 0 && keptUntil == t[i]) {
+            keptUntil = t[i+1];
+            continue;
+        }
+        if (count > 0)
+            spans[2*count-1] = int(std::floor(keptUntil));
+        spans[2*count] = std::max(1, int(std::ceil(t[i])));
+        keptUntil = t[i+1];
+        count++;
+    }
+    if (count > 0)
+        spans[2*count-1] = int(std::floor(keptUntil));
+
+    //drop spans too short to hold a sample
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        if (spans[2*i] > spans[2*i+1])
+            continue;
+        spans[2*kept] = spans[2*i];
+        spans[2*kept+1] = spans[2*i+1];
+        kept++;
+    }
+    return kept;
+}
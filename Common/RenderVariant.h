@@ -0,0 +1,77 @@
+#pragma once
+#include <string>
+
+//compositing of the samples along a ray
+enum BlendMode
+{
+    BLEND_COMPOSITE = 0,    //front to back "over", early ray termination
+    BLEND_MAXIMUM = 1,      //maximum intensity projection
+    BLEND_MINIMUM = 2,      //minimum intensity projection
+    BLEND_ADDITIVE = 3,     //order independent sum of the classified samples
+    BLEND_AVERAGE = 4       //average intensity projection
+};
+
+//the projections classify a single scalar per ray: the extreme or the mean
+//of the samples
+inline bool IsProjection(int blendMode)
+{
+    return blendMode == BLEND_MAXIMUM || blendMode == BLEND_MINIMUM || blendMode == BLEND_AVERAGE;
+}
+
+//Feature combination a ray caster is specialized for. The GLSL ray caster
+//is compiled once per variant with the features selected by preprocessor
+//defines (GetShaderDefines()); the CPU kernels are instantiated per variant
+//with the features as template parameters. Either way the ray march loop
+//holds only the code of the enabled features and no branches on them.
+//
+//Multi-component volumes hold 2-4 interleaved dependent components: the
+//last one is the scalar that is classified by the opacity transfer function
+//(and skipped, projected and shaded), the others colour the samples. Two
+//components colour by the transfer function of the first one, three or four
+//are RGB directly.
+//
+//Cropping follows vtkVolumeMapper: two planes per axis split the volume
+//into 27 regions, region (i,j,k) with i,j,k in 0..2 is kept when bit
+//i+3j+9k of the region flags is set.
+struct RenderVariant
+{
+    RenderVariant(void);
+
+    int blendMode;      //BlendMode
+    bool linear;        //trilinear interpolation, nearest otherwise
+    int scalarType;     //ScalarType of the volume (see BrickedVolume.h)
+    int components;     //1..4 interleaved components per voxel
+    bool shading;       //gradient lit samples, composite only
+    bool cropping;      //samples in regions not kept are not composited
+    bool statistics;    //count ray steps into the RayStats buffer, GLSL only
+
+    //shading is only defined for compositing, other blend modes ignore it
+    bool IsShaded() const { return shading && blendMode == BLEND_COMPOSITE; }
+
+    //distinct for every combination that renders differently
+    unsigned GetKey() const;
+
+    //e.g. "composite linear uint8 shaded", for logs and benchmark reports
+    std::string GetName() const;
+
+    //"#define ..." lines for shaders/raycaster.frag
+    std::string GetShaderDefines() const;
+
+    bool operator==(const RenderVariant& other) const { return GetKey() == other.GetKey(); }
+    bool operator!=(const RenderVariant& other) const { return GetKey() != other.GetKey(); }
+};
+
+//VTK's cropping region flags keeping only the centre region
+const int CROP_SUBVOLUME = 0x0002000;
+
+//a ray crosses at most seven regions, so at most four separate spans of it
+//lie in kept ones
+const int MAX_CROP_SPANS = 4;
+
+//Intersects the ray origin + t*step, sampled at t = 1..samples, with the
+//cropping regions analytically instead of testing every sample: the six
+//plane crossings (planes x0,x1,y0,y1,z0,z1) split the ray into pieces that
+//each lie in one region. Writes the first and last sample of every kept
+//span, adjacent pieces merged, to spans and returns the number of spans.
+int CropRaySpans(const float origin[3], const float step[3], int samples,
+                 const float planes[6], int regions, int spans[2*MAX_CROP_SPANS]);
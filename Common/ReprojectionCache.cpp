@@ -0,0 +1,137 @@
+#include "ReprojectionCache.h"
+
+#include <algorithm>
+
+ReprojectionCache::ReprojectionCache(void)
+{
+    _maxError = 1.0f;
+    _refreshPeriod = 8;
+    _valid = false;
+    _frame = 0;
+    _recastCount = 0;
+    _width = _height = 0;
+}
+
+void ReprojectionCache::Reproject(const Mat4& textureToClip, int width, int height, const float* sceneDepth)
+{
+    const size_t pixels = size_t(std::max(width, 0)) * std::max(height, 0);
+    const bool invertible = textureToClip.Invert(_clipToTexture);
+    const bool reuse = _valid && invertible && width == _width && height == _height;
+    _width = width;
+    _height = height;
+    _frame++;
+
+    _nextImage.assign(pixels * 4, 0.0f);
+    _nextPoints.assign(pixels * 6, 0.0f);
+    _nextCached.assign(pixels, 0);
+    _nextDepth.assign(pixels, 1.0f);
+    _mask.assign(pixels, 1);
+
+    //every cached pixel lands where its significant point projects to, a
+    //nearer one replaces what landed before
+    const float maxError2 = _maxError * _maxError;
+    for (size_t s = 0; reuse && s < pixels; s++) {
+        if (!_cached[s])
+            continue;
+        const float* p = &_points[6 * s];
+        Vec3 first = textureToClip.TransformPoint(p[0], p[1], p[2]);
+        if (first.z < -1.0f || first.z >= 1.0f)
+            continue;
+        float x = (first.x * 0.5f + 0.5f) * width;
+        float y = (first.y * 0.5f + 0.5f) * height;
+        if (x < 0.0f || y < 0.0f || x >= width || y >= height)
+            continue;
+        size_t t = size_t(y) * width + size_t(x);
+        if (first.z >= _nextDepth[t])
+            continue;
+
+        //parallax: both points were under the pixel when it was cast
+        Vec3 last = textureToClip.TransformPoint(p[3], p[4], p[5]);
+        float dx = (last.x - first.x) * 0.5f * width;
+        float dy = (last.y - first.y) * 0.5f * height;
+
+        _nextDepth[t] = first.z;
+        std::copy(&_image[4 * s], &_image[4 * s] + 4, &_nextImage[4 * t]);
+        std::copy(p, p + 6, &_nextPoints[6 * t]);
+        _nextCached[t] = 1;
+        _mask[t] = dx * dx + dy * dy > maxError2;
+    }
+
+    //cracks between pixels that spread apart: a hole between two reused
+    //pixels in its row or column takes over the farther one, moved onto
+    //the ray through its own centre
+    for (int y = 1; reuse && y + 1 < height; y++) {
+        for (int x = 1; x + 1 < width; x++) {
+            size_t t = size_t(y) * width + x;
+            if (_nextCached[t])
+                continue;
+            size_t s = 0;
+            const size_t pairs[2][2] = {{t - 1, t + 1}, {t - width, t + width}};
+            for (int k = 0; k < 2; k++) {
+                size_t a = pairs[k][0], b = pairs[k][1];
+                if (_nextCached[a] == 1 && _nextCached[b] == 1 && !_mask[a] && !_mask[b]) {
+                    size_t farther = _nextDepth[a] > _nextDepth[b] ? a : b;
+                    if (!s || _nextDepth[farther] > _nextDepth[s])
+                        s = farther;
+                }
+            }
+            if (!s)
+                continue;
+
+            double nx = (x + 0.5) / width * 2.0 - 1.0;
+            double ny = (y + 0.5) / height * 2.0 - 1.0;
+            const float* p = &_nextPoints[6 * s];
+            for (int k = 0; k < 2; k++) {
+                Vec3 q = textureToClip.TransformPoint(p[3 * k], p[3 * k + 1], p[3 * k + 2]);
+                q = _clipToTexture.TransformPoint(nx, ny, q.z);
+                _nextPoints[6 * t + 3 * k] = q.x;
+                _nextPoints[6 * t + 3 * k + 1] = q.y;
+                _nextPoints[6 * t + 3 * k + 2] = q.z;
+            }
+            std::copy(&_nextImage[4 * s], &_nextImage[4 * s] + 4, &_nextImage[4 * t]);
+            _nextDepth[t] = _nextDepth[s];
+            _nextCached[t] = 2;
+            _mask[t] = 0;
+        }
+    }
+
+    _recastCount = 0;
+    for (int y = 0; y < height; y++) {
+        const bool refresh = _refreshPeriod > 0 && (y + _frame) % _refreshPeriod == 0;
+        for (int x = 0; x < width; x++) {
+            size_t t = size_t(y) * width + x;
+            if (refresh || (sceneDepth && sceneDepth[t] < 1.0f))
+                _mask[t] = 1;
+            _recastCount += _mask[t];
+        }
+    }
+}
+
+void ReprojectionCache::Update(const float* image, const float* depths)
+{
+    const size_t pixels = _mask.size();
+    for (size_t t = 0; t < pixels; t++) {
+        if (!_mask[t])
+            continue;
+        std::copy(image + 4 * t, image + 4 * t + 4, &_nextImage[4 * t]);
+        _nextCached[t] = 0;
+        if (!depths || depths[2 * t] < 0.0f)
+            continue;
+
+        //both depths lie on the ray through the pixel centre
+        double nx = (t % _width + 0.5) / _width * 2.0 - 1.0;
+        double ny = (t / _width + 0.5) / _height * 2.0 - 1.0;
+        for (int k = 0; k < 2; k++) {
+            Vec3 p = _clipToTexture.TransformPoint(nx, ny, 2.0 * depths[2 * t + k] - 1.0);
+            _nextPoints[6 * t + 3 * k] = p.x;
+            _nextPoints[6 * t + 3 * k + 1] = p.y;
+            _nextPoints[6 * t + 3 * k + 2] = p.z;
+        }
+        _nextCached[t] = 1;
+    }
+
+    _image.swap(_nextImage);
+    _points.swap(_nextPoints);
+    _cached.swap(_nextCached);
+    _valid = true;
+}
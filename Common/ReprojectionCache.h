@@ -0,0 +1,78 @@
+#pragma once
+#include <vector>
+
+#include "VectorMath.h"
+
+//Temporal reuse of ray cast pixels while the camera moves a little from
+//frame to frame. Every cached pixel keeps its premultiplied colour and two
+//points of its ray in texture space: the sample at which it became
+//significant and the last sample taken (see
+//CPURaycaster::SetRayDepthRecording). Reproject() moves the pixels of the
+//previous frame to where their significant point lands in the new view,
+//the nearest one winning where several land, and marks for recasting
+//  - pixels nothing landed on: disocclusions and the image border, but
+//    not one pixel cracks between reused pixels, which are filled,
+//  - pixels whose two points drifted more than the error bound apart on
+//    screen, the parallax the cached colour cannot show,
+//  - pixels covered by opaque geometry, whose rays may end elsewhere now,
+//  - every RefreshPeriod-th row, rotating, so no pixel ages beyond that
+//    many frames.
+//The caller ray casts the marked pixels and merges them with Update(). As
+//the points live in texture space, moving the volume reprojects as well.
+class ReprojectionCache
+{
+public:
+    ReprojectionCache(void);
+
+    //screen distance in pixels the two points of a reused pixel may have
+    void SetMaximumError(float pixels) { _maxError = pixels; }
+    float GetMaximumError() const { return _maxError; }
+
+    //frames between recasts of every row, 0 never refreshes
+    void SetRefreshPeriod(int frames) { _refreshPeriod = frames; }
+    int GetRefreshPeriod() const { return _refreshPeriod; }
+
+    //the data or its classification changed: the next frame recasts all
+    void Invalidate() { _valid = false; }
+
+    //reprojects the cached frame into the view of textureToClip at the given
+    //size and marks the pixels to recast. sceneDepth (window depths of the
+    //opaque geometry, width x height, may be NULL) marks covered pixels.
+    //Without a cached frame of this size every pixel is marked.
+    void Reproject(const Mat4& textureToClip, int width, int height, const float* sceneDepth);
+
+    //one entry per pixel, bottom row first, non-zero to recast
+    const unsigned char* GetRecastMask() const { return _mask.empty() ? 0 : &_mask[0]; }
+    long long GetRecastCount() const { return _recastCount; }
+
+    //merges the ray cast image (premultiplied RGBA) and its ray depths (two
+    //per pixel, see CPURaycaster::GetRayDepths) into the reprojected frame
+    //at the marked pixels; the result is cached for the next frame
+    void Update(const float* image, const float* depths);
+
+    //the merged frame, premultiplied RGBA
+    const float* GetImage() const { return _image.empty() ? 0 : &_image[0]; }
+
+private:
+    float _maxError;
+    int _refreshPeriod;
+    bool _valid;
+    int _frame;
+    long long _recastCount;
+
+    int _width, _height;
+    Mat4 _clipToTexture;
+
+    //cached frame: colour, significant and last point (x,y,z each) and
+    //whether the pixel is cached at all
+    std::vector<float> _image;
+    std::vector<float> _points;
+    std::vector<unsigned char> _cached;
+
+    //the reprojected frame being built, and the depth of what landed
+    std::vector<float> _nextImage;
+    std::vector<float> _nextPoints;
+    std::vector<unsigned char> _nextCached;
+    std::vector<float> _nextDepth;
+    std::vector<unsigned char> _mask;
+};
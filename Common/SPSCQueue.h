@@ -0,0 +1,69 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+//Bounded lock-free queue between exactly one producer and one consumer
+//thread. Each side writes only its own index and publishes it with release
+//semantics, so Push() and Pop() never block and never take a lock. The
+//capacity is rounded up to a power of two.
+template <class T>
+class SPSCQueue
+{
+public:
+    explicit SPSCQueue(size_t capacity = 256)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        _items.resize(size);
+        _mask = size - 1;
+        _head = 0;
+        _tail = 0;
+    }
+
+    size_t GetCapacity() const { return _items.size(); }
+
+    //producer; false when the queue is full
+    bool Push(const T& item)
+    {
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _head.load(std::memory_order_acquire) == _items.size())
+            return false;
+        _items[tail & _mask] = item;
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    //consumer; false when the queue is empty
+    bool Pop(T& item)
+    {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire))
+            return false;
+        item = _items[head & _mask];
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    //consumer; items pushed meanwhile may already be there
+    bool IsEmpty() const
+    {
+        return _head.load(std::memory_order_relaxed) == _tail.load(std::memory_order_acquire);
+    }
+
+private:
+    SPSCQueue(const SPSCQueue&);
+    void operator=(const SPSCQueue&);
+
+    std::vector<T> _items;
+    size_t _mask;
+
+    //the indices only grow and live on cache lines of their own, so the
+    //two sides do not keep stealing the same line from each other
+    char _padHead[64];
+    std::atomic<size_t> _head;
+    char _padTail[64];
+    std::atomic<size_t> _tail;
+    char _padEnd[64];
+};
@@ -0,0 +1,190 @@
+#include "SharedMemoryCommunicator.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+//the barrier sits in front of the round counts and the mailboxes, each
+//padded to a cache line
+static const size_t BARRIER_SIZE = 256;
+
+size_t SharedMemoryCommunicator::GetHeaderSize(int size)
+{
+    return BARRIER_SIZE + (size * sizeof(unsigned) + 63) / 64 * 64;
+}
+
+SharedMemoryCommunicator::SharedMemoryCommunicator(int rank, int size, size_t capacity, void* memory)
+{
+    _rank = rank;
+    _size = size;
+    _capacity = capacity;
+    _barrier = memory;
+    _rounds = reinterpret_cast<unsigned*>(static_cast<char*>(memory) + BARRIER_SIZE);
+    _mailboxes = reinterpret_cast<float*>(static_cast<char*>(memory) + GetHeaderSize(size));
+}
+
+#ifdef _WIN32
+
+bool SharedMemoryCommunicator::Run(int, size_t, const Body&)
+{
+    return false;
+}
+
+void SharedMemoryCommunicator::Barrier()
+{
+}
+
+#else
+
+bool SharedMemoryCommunicator::Run(int size, size_t capacity, const Body& body)
+{
+    if (size < 1 || capacity < 1 || sizeof(pthread_barrier_t) > BARRIER_SIZE)
+        return false;
+
+    const size_t bytes = GetHeaderSize(size) + (size + 1) * capacity * sizeof(float);
+    void* memory = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return false;
+
+    pthread_barrierattr_t attr;
+    pthread_barrierattr_init(&attr);
+    pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    bool ok = pthread_barrier_init(static_cast<pthread_barrier_t*>(memory), &attr, size) == 0;
+    pthread_barrierattr_destroy(&attr);
+    if (!ok) {
+        munmap(memory, bytes);
+        return false;
+    }
+
+    //a child that cannot be forked would leave the barrier one short, so
+    //the children only start once all of them exist
+    std::vector<pid_t> children;
+    int ready[2];
+    if (pipe(ready) != 0) {
+        pthread_barrier_destroy(static_cast<pthread_barrier_t*>(memory));
+        munmap(memory, bytes);
+        return false;
+    }
+    for (int rank = 1; rank < size; rank++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(ready[1]);
+            char go = 0;
+            bool start = read(ready[0], &go, 1) == 1 && go;
+            close(ready[0]);
+            if (start) {
+                SharedMemoryCommunicator comm(rank, size, capacity, memory);
+                body(comm);
+            }
+            _exit(start ? 0 : 1);
+        }
+        if (pid < 0) {
+            ok = false;
+            break;
+        }
+        children.push_back(pid);
+    }
+
+    const char go = ok ? 1 : 0;
+    for (size_t i = 0; i < children.size(); i++)
+        if (write(ready[1], &go, 1) != 1)
+            ok = false;
+    close(ready[0]);
+    close(ready[1]);
+
+    if (ok) {
+        SharedMemoryCommunicator comm(0, size, capacity, memory);
+        body(comm);
+    }
+
+    for (size_t i = 0; i < children.size(); i++) {
+        int status = 0;
+        if (waitpid(children[i], &status, 0) != children[i] || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != 0)
+            ok = false;
+    }
+
+    pthread_barrier_destroy(static_cast<pthread_barrier_t*>(memory));
+    munmap(memory, bytes);
+    return ok;
+}
+
+void SharedMemoryCommunicator::Barrier()
+{
+    pthread_barrier_wait(static_cast<pthread_barrier_t*>(_barrier));
+}
+
+#endif
+
+void SharedMemoryCommunicator::Exchange(int peer, const float* send, int sendCount, float* recv, int recvCount)
+{
+    if (peer < 0)
+        sendCount = recvCount = 0;
+
+    //every rank takes part in as many rounds as the longest exchange of any
+    //pair needs; the counts are agreed on along with the first round
+    _rounds[_rank] = unsigned(std::max(Rounds(sendCount), Rounds(recvCount)));
+    size_t rounds = 1;
+    for (size_t round = 0; round < rounds; round++) {
+        const size_t begin = round * _capacity;
+        if (begin < size_t(sendCount))
+            std::memcpy(Mailbox(_rank), send + begin,
+                        std::min(_capacity, sendCount - begin) * sizeof(float));
+        Barrier();
+        if (round == 0)
+            rounds = std::max<size_t>(1, *std::max_element(_rounds, _rounds + _size));
+        if (begin < size_t(recvCount))
+            std::memcpy(recv + begin, Mailbox(peer),
+                        std::min(_capacity, recvCount - begin) * sizeof(float));
+        //the mailbox is only written again once the peer has read it
+        Barrier();
+    }
+}
+
+void SharedMemoryCommunicator::Gather(const float* send, const int* counts, const int* offsets, float* recv)
+{
+    //the gathered range passes a mailbox at a time; counts and offsets are
+    //the same on all ranks, so is the number of rounds
+    size_t total = 0;
+    for (int r = 0; r < _size; r++)
+        if (counts[r] > 0)
+            total = std::max(total, size_t(offsets[r] + counts[r]));
+
+    float* gathered = Mailbox(_size);
+    for (size_t window = 0; window < total; window += _capacity) {
+        const size_t end = std::min(total, window + _capacity);
+        size_t first = std::max(window, size_t(offsets[_rank]));
+        size_t last = std::min(end, size_t(offsets[_rank] + std::max(counts[_rank], 0)));
+        if (first < last)
+            std::memcpy(gathered + (first - window), send + (first - offsets[_rank]),
+                        (last - first) * sizeof(float));
+        Barrier();
+        if (_rank == 0)
+            for (int r = 0; r < _size; r++) {
+                first = std::max(window, size_t(offsets[r]));
+                last = std::min(end, size_t(offsets[r] + std::max(counts[r], 0)));
+                if (first < last)
+                    std::memcpy(recv + first, gathered + (first - window), (last - first) * sizeof(float));
+            }
+        Barrier();
+    }
+}
+
+void SharedMemoryCommunicator::AllGather(const float* send, int count, float* recv)
+{
+    for (size_t begin = 0; begin < size_t(std::max(count, 0)); begin += _capacity) {
+        const size_t length = std::min(_capacity, count - begin);
+        std::memcpy(Mailbox(_rank), send + begin, length * sizeof(float));
+        Barrier();
+        for (int r = 0; r < _size; r++)
+            std::memcpy(recv + r * size_t(count) + begin, Mailbox(r), length * sizeof(float));
+        Barrier();
+    }
+}
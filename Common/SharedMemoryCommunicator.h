@@ -0,0 +1,52 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+
+#include "Communicator.h"
+
+//Communicator between processes forked on one machine, so sort-last
+//rendering can be run and measured without MPI. Every rank owns a mailbox
+//of 'capacity' floats in an anonymous shared mapping inherited over fork();
+//a message is written into the sender's mailbox and read by its peer on
+//the other side of a process-shared barrier. Messages longer than a mailbox
+//are passed a mailbox at a time. POSIX only.
+class SharedMemoryCommunicator : public Communicator
+{
+public:
+    typedef std::function<void(Communicator& comm)> Body;
+
+    //forks size-1 children and runs body on every rank, the calling
+    //process being rank 0; children exit when their body returns. The
+    //mailboxes hold capacity floats, a larger capacity means fewer barrier
+    //rounds for long messages. Returns false when the processes could
+    //not be started or a child did not exit cleanly. A rank that stops
+    //making the collective calls blocks the others.
+    static bool Run(int size, size_t capacity, const Body& body);
+
+    virtual int GetRank() const { return _rank; }
+    virtual int GetSize() const { return _size; }
+
+    virtual void Exchange(int peer, const float* send, int sendCount, float* recv, int recvCount);
+    virtual void Gather(const float* send, const int* counts, const int* offsets, float* recv);
+    virtual void AllGather(const float* send, int count, float* recv);
+    virtual void Barrier();
+
+private:
+    SharedMemoryCommunicator(int rank, int size, size_t capacity, void* memory);
+
+    //bytes in front of the mailboxes: the barrier and the round counts
+    static size_t GetHeaderSize(int size);
+
+    //mailbox loads needed to pass count floats
+    size_t Rounds(int count) const { return count > 0 ? (size_t(count) + _capacity - 1) / _capacity : 0; }
+
+    //mailbox of rank r, the one past the last rank collects Gather()
+    float* Mailbox(int rank) const { return _mailboxes + rank * _capacity; }
+
+    int _rank;
+    int _size;
+    size_t _capacity;
+    void* _barrier;
+    unsigned* _rounds;      //per rank, agreed on by Exchange()
+    float* _mailboxes;
+};
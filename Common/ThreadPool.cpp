@@ -0,0 +1,144 @@
+#include "ThreadPool.h"
+
+//pool the current thread is a worker of, used to detect nested calls
+static thread_local ThreadPool* currentPool = 0;
+static thread_local int currentWorker = -1;
+
+ThreadPool::ThreadPool(int threadCount)
+{
+    if (threadCount <= 0)
+        threadCount = static_cast<int>(std::thread::hardware_concurrency());
+    if (threadCount <= 0)
+        threadCount = 1;
+
+    _job = 0;
+    _generation = 0;
+    _pendingTasks = 0;
+    _busyWorkers = 0;
+    _quit = false;
+
+    for (int i = 0; i < threadCount; i++)
+        _queues.push_back(new WorkQueue());
+
+    //worker 0 is the thread calling ParallelFor
+    for (int i = 1; i < threadCount; i++)
+        _threads.push_back(std::thread(&ThreadPool::WorkerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _quit = true;
+    }
+    _wake.notify_all();
+    for (size_t i = 0; i < _threads.size(); i++)
+        _threads[i].join();
+    for (size_t i = 0; i < _queues.size(); i++)
+        delete _queues[i];
+}
+
+void ThreadPool::ParallelFor(int taskCount, const TaskFunction& fn)
+{
+    if (taskCount <= 0)
+        return;
+
+    //nested call from one of our own tasks: run inline
+    if (currentPool == this || _queues.size() == 1) {
+        int worker = (currentPool == this) ? currentWorker : 0;
+        for (int i = 0; i < taskCount; i++)
+            fn(i, worker);
+        return;
+    }
+
+    std::lock_guard<std::mutex> submit(_submitLock);
+
+    //publish the job before any task becomes visible, then deal the tasks
+    //round-robin so every worker starts on its own share
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _job = &fn;
+        _pendingTasks = taskCount;
+
+        int workers = GetThreadCount();
+        for (int i = 0; i < taskCount; i++) {
+            WorkQueue* q = _queues[i % workers];
+            std::lock_guard<std::mutex> qguard(q->lock);
+            q->tasks.push_back(i);
+        }
+        _generation++;
+    }
+    _wake.notify_all();
+
+    //the caller works as worker 0
+    currentPool = this;
+    currentWorker = 0;
+    while (RunOne(0)) {}
+    currentPool = 0;
+    currentWorker = -1;
+
+    //wait until the last task finished and no worker still holds the job
+    std::unique_lock<std::mutex> guard(_lock);
+    _done.wait(guard, [this] { return _pendingTasks == 0 && _busyWorkers == 0; });
+    _job = 0;
+}
+
+bool ThreadPool::RunOne(int worker)
+{
+    int task = -1;
+    int workers = GetThreadCount();
+
+    //own queue first (LIFO end), then steal from the others (FIFO end)
+    for (int i = 0; i < workers && task < 0; i++) {
+        WorkQueue* q = _queues[(worker + i) % workers];
+        std::lock_guard<std::mutex> guard(q->lock);
+        if (!q->tasks.empty()) {
+            if (i == 0) {
+                task = q->tasks.back();
+                q->tasks.pop_back();
+            } else {
+                task = q->tasks.front();
+                q->tasks.pop_front();
+            }
+        }
+    }
+    if (task < 0)
+        return false;
+
+    (*_job)(task, worker);
+
+    bool last = false;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        last = (--_pendingTasks == 0);
+    }
+    if (last)
+        _done.notify_all();
+    return true;
+}
+
+void ThreadPool::WorkerLoop(int worker)
+{
+    currentPool = this;
+    currentWorker = worker;
+
+    unsigned long seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            _wake.wait(guard, [&] { return _quit || _generation != seen; });
+            if (_quit)
+                return;
+            seen = _generation;
+            _busyWorkers++;
+        }
+
+        while (RunOne(worker)) {}
+
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            _busyWorkers--;
+        }
+        _done.notify_all();
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Fixed size pool of worker threads executing parallel-for style jobs.
+//Each worker owns a task deque; tasks are dealt round-robin into the deques
+//and a worker that runs dry steals from the opposite end of its neighbours'
+//deques, so uneven tiles (empty space vs. dense data) even out on their own.
+class ThreadPool
+{
+public:
+    typedef std::function<void(int task, int worker)> TaskFunction;
+
+    //threadCount<=0 uses one thread per hardware core; the calling thread
+    //always counts as worker 0
+    explicit ThreadPool(int threadCount = 0);
+    ~ThreadPool();
+
+    int GetThreadCount() const { return static_cast<int>(_queues.size()); }
+
+    //runs fn(task, worker) for every task in [0,taskCount) and blocks until
+    //all of them finished. Calls made from inside a running task execute
+    //serially on the calling worker.
+    void ParallelFor(int taskCount, const TaskFunction& fn);
+
+private:
+    struct WorkQueue
+    {
+        std::mutex lock;
+        std::deque<int> tasks;
+    };
+
+    void WorkerLoop(int worker);
+    bool RunOne(int worker);
+
+    std::vector<std::thread> _threads;
+    std::vector<WorkQueue*> _queues;
+
+    std::mutex _submitLock;         //serializes concurrent ParallelFor callers
+    std::mutex _lock;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    const TaskFunction* _job;
+    unsigned long _generation;
+    int _pendingTasks;
+    int _busyWorkers;
+    bool _quit;
+};
@@ -0,0 +1,126 @@
+#pragma once
+#include <cmath>
+
+//minimal vector/matrix helpers shared by the CPU ray caster and the tools
+//that feed it. Matrices are row-major double[16] (same layout as
+//vtkMatrix4x4) so VTK matrices can be passed in directly; GLM/OpenGL
+//callers go through Mat4::FromColumnMajor.
+
+struct Vec3
+{
+    float x, y, z;
+
+    Vec3() : x(0), y(0), z(0) {}
+    Vec3(float x_, float y_, float z_) : x(x_), y(y_), z(z_) {}
+
+    float& operator[](int i) { return (&x)[i]; }
+    float operator[](int i) const { return (&x)[i]; }
+
+    Vec3 operator+(const Vec3& o) const { return Vec3(x+o.x, y+o.y, z+o.z); }
+    Vec3 operator-(const Vec3& o) const { return Vec3(x-o.x, y-o.y, z-o.z); }
+    Vec3 operator*(float s) const { return Vec3(x*s, y*s, z*s); }
+    Vec3 operator*(const Vec3& o) const { return Vec3(x*o.x, y*o.y, z*o.z); }
+};
+
+inline float Dot(const Vec3& a, const Vec3& b)
+{
+    return a.x*b.x + a.y*b.y + a.z*b.z;
+}
+
+inline float Length(const Vec3& v)
+{
+    return std::sqrt(Dot(v, v));
+}
+
+inline Vec3 Normalize(const Vec3& v)
+{
+    float len = Length(v);
+    return len > 0.0f ? v * (1.0f/len) : v;
+}
+
+struct Mat4
+{
+    double m[16];
+
+    Mat4() { Identity(); }
+
+    void Identity()
+    {
+        for (int i = 0; i < 16; i++)
+            m[i] = (i % 5 == 0) ? 1.0 : 0.0;
+    }
+
+    double& operator()(int row, int col) { return m[row*4+col]; }
+    double operator()(int row, int col) const { return m[row*4+col]; }
+
+    static Mat4 FromRowMajor(const double* p)
+    {
+        Mat4 r;
+        for (int i = 0; i < 16; i++)
+            r.m[i] = p[i];
+        return r;
+    }
+
+    static Mat4 FromColumnMajor(const float* p)
+    {
+        Mat4 r;
+        for (int row = 0; row < 4; row++)
+            for (int col = 0; col < 4; col++)
+                r(row, col) = p[col*4+row];
+        return r;
+    }
+
+    Mat4 operator*(const Mat4& o) const
+    {
+        Mat4 r;
+        for (int row = 0; row < 4; row++)
+            for (int col = 0; col < 4; col++) {
+                double sum = 0.0;
+                for (int k = 0; k < 4; k++)
+                    sum += (*this)(row, k) * o(k, col);
+                r(row, col) = sum;
+            }
+        return r;
+    }
+
+    //transforms a point and performs the perspective divide
+    Vec3 TransformPoint(double x, double y, double z) const
+    {
+        double out[4];
+        for (int row = 0; row < 4; row++)
+            out[row] = m[row*4]*x + m[row*4+1]*y + m[row*4+2]*z + m[row*4+3];
+        double w = (out[3] != 0.0) ? 1.0/out[3] : 1.0;
+        return Vec3(float(out[0]*w), float(out[1]*w), float(out[2]*w));
+    }
+
+    //general 4x4 inverse by cofactor expansion, returns false if singular
+    bool Invert(Mat4& inv) const
+    {
+        const double* a = m;
+        double* o = inv.m;
+        o[0]  =  a[5]*a[10]*a[15] - a[5]*a[11]*a[14] - a[9]*a[6]*a[15] + a[9]*a[7]*a[14] + a[13]*a[6]*a[11] - a[13]*a[7]*a[10];
+        o[4]  = -a[4]*a[10]*a[15] + a[4]*a[11]*a[14] + a[8]*a[6]*a[15] - a[8]*a[7]*a[14] - a[12]*a[6]*a[11] + a[12]*a[7]*a[10];
+        o[8]  =  a[4]*a[9]*a[15]  - a[4]*a[11]*a[13] - a[8]*a[5]*a[15] + a[8]*a[7]*a[13] + a[12]*a[5]*a[11] - a[12]*a[7]*a[9];
+        o[12] = -a[4]*a[9]*a[14]  + a[4]*a[10]*a[13] + a[8]*a[5]*a[14] - a[8]*a[6]*a[13] - a[12]*a[5]*a[10] + a[12]*a[6]*a[9];
+        o[1]  = -a[1]*a[10]*a[15] + a[1]*a[11]*a[14] + a[9]*a[2]*a[15] - a[9]*a[3]*a[14] - a[13]*a[2]*a[11] + a[13]*a[3]*a[10];
+        o[5]  =  a[0]*a[10]*a[15] - a[0]*a[11]*a[14] - a[8]*a[2]*a[15] + a[8]*a[3]*a[14] + a[12]*a[2]*a[11] - a[12]*a[3]*a[10];
+        o[9]  = -a[0]*a[9]*a[15]  + a[0]*a[11]*a[13] + a[8]*a[1]*a[15] - a[8]*a[3]*a[13] - a[12]*a[1]*a[11] + a[12]*a[3]*a[9];
+        o[13] =  a[0]*a[9]*a[14]  - a[0]*a[10]*a[13] - a[8]*a[1]*a[14] + a[8]*a[2]*a[13] + a[12]*a[1]*a[10] - a[12]*a[2]*a[9];
+        o[2]  =  a[1]*a[6]*a[15]  - a[1]*a[7]*a[14]  - a[5]*a[2]*a[15] + a[5]*a[3]*a[14] + a[13]*a[2]*a[7]  - a[13]*a[3]*a[6];
+        o[6]  = -a[0]*a[6]*a[15]  + a[0]*a[7]*a[14]  + a[4]*a[2]*a[15] - a[4]*a[3]*a[14] - a[12]*a[2]*a[7]  + a[12]*a[3]*a[6];
+        o[10] =  a[0]*a[5]*a[15]  - a[0]*a[7]*a[13]  - a[4]*a[1]*a[15] + a[4]*a[3]*a[13] + a[12]*a[1]*a[7]  - a[12]*a[3]*a[5];
+        o[14] = -a[0]*a[5]*a[14]  + a[0]*a[6]*a[13]  + a[4]*a[1]*a[14] - a[4]*a[2]*a[13] - a[12]*a[1]*a[6]  + a[12]*a[2]*a[5];
+        o[3]  = -a[1]*a[6]*a[11]  + a[1]*a[7]*a[10]  + a[5]*a[2]*a[11] - a[5]*a[3]*a[10] - a[9]*a[2]*a[7]   + a[9]*a[3]*a[6];
+        o[7]  =  a[0]*a[6]*a[11]  - a[0]*a[7]*a[10]  - a[4]*a[2]*a[11] + a[4]*a[3]*a[10] + a[8]*a[2]*a[7]   - a[8]*a[3]*a[6];
+        o[11] = -a[0]*a[5]*a[11]  + a[0]*a[7]*a[9]   + a[4]*a[1]*a[11] - a[4]*a[3]*a[9]  - a[8]*a[1]*a[7]   + a[8]*a[3]*a[5];
+        o[15] =  a[0]*a[5]*a[10]  - a[0]*a[6]*a[9]   - a[4]*a[1]*a[10] + a[4]*a[2]*a[9]  + a[8]*a[1]*a[6]   - a[8]*a[2]*a[5];
+
+        double det = a[0]*o[0] + a[1]*o[4] + a[2]*o[8] + a[3]*o[12];
+        if (det == 0.0)
+            return false;
+        det = 1.0/det;
+        for (int i = 0; i < 16; i++)
+            o[i] *= det;
+        return true;
+    }
+};
@@ -0,0 +1,140 @@
+#include "VolumeDecomposition.h"
+
+#include <algorithm>
+
+VolumeDecomposition::VolumeDecomposition(void)
+{
+    for (int i = 0; i < 6; i++)
+        _whole[i] = 0;
+}
+
+void VolumeDecomposition::Split(const int wholeExtent[6], int count)
+{
+    std::copy(wholeExtent, wholeExtent + 6, _whole);
+    _extents.clear();
+    SplitExtent(wholeExtent, std::max(count, 1));
+}
+
+void VolumeDecomposition::SplitExtent(const int extent[6], int count)
+{
+    if (count == 1) {
+        _extents.insert(_extents.end(), extent, extent + 6);
+        return;
+    }
+
+    int axis = 0;
+    for (int i = 1; i < 3; i++)
+        if (extent[2 * i + 1] - extent[2 * i] > extent[2 * axis + 1] - extent[2 * axis])
+            axis = i;
+
+    //the cut layer belongs to both sides, each keeps at least two layers
+    const int lower = count / 2;
+    const int lo = extent[2 * axis], hi = extent[2 * axis + 1];
+    int cut = lo + int((long long)(hi - lo) * lower / count);
+    cut = std::max(lo + 1, std::min(cut, hi - 1));
+
+    int front[6], back[6];
+    std::copy(extent, extent + 6, front);
+    std::copy(extent, extent + 6, back);
+    front[2 * axis + 1] = cut;
+    back[2 * axis] = cut;
+    SplitExtent(front, lower);
+    SplitExtent(back, count - lower);
+}
+
+void VolumeDecomposition::SetPieces(const int* extents, int count)
+{
+    _extents.assign(extents, extents + 6 * count);
+    for (int i = 0; i < 6; i++)
+        _whole[i] = count > 0 ? extents[i] : 0;
+    for (int p = 1; p < count; p++)
+        for (int axis = 0; axis < 3; axis++) {
+            _whole[2 * axis] = std::min(_whole[2 * axis], extents[6 * p + 2 * axis]);
+            _whole[2 * axis + 1] = std::max(_whole[2 * axis + 1], extents[6 * p + 2 * axis + 1]);
+        }
+}
+
+double VolumeDecomposition::LayerCentre(int axis, int index) const
+{
+    return (index - _whole[2 * axis] + 0.5) / (_whole[2 * axis + 1] - _whole[2 * axis] + 1);
+}
+
+void VolumeDecomposition::GetRegion(int piece, float region[6]) const
+{
+    const int* extent = GetExtent(piece);
+    for (int axis = 0; axis < 3; axis++) {
+        const int lo = extent[2 * axis], hi = extent[2 * axis + 1];
+        region[2 * axis] = lo > _whole[2 * axis] ? float(LayerCentre(axis, lo)) : 0.0f;
+        region[2 * axis + 1] = hi < _whole[2 * axis + 1] ? float(LayerCentre(axis, hi)) : 1.0f;
+    }
+}
+
+Mat4 VolumeDecomposition::GetPieceToVolume(int piece) const
+{
+    const int* extent = GetExtent(piece);
+    Mat4 m;
+    for (int axis = 0; axis < 3; axis++) {
+        double dims = _whole[2 * axis + 1] - _whole[2 * axis] + 1;
+        m(axis, axis) = (extent[2 * axis + 1] - extent[2 * axis] + 1) / dims;
+        m(axis, 3) = (extent[2 * axis] - _whole[2 * axis]) / dims;
+    }
+    return m;
+}
+
+void VolumeDecomposition::GetVisibilityOrder(const Mat4& textureToClip, std::vector<int>& order) const
+{
+    order.clear();
+    Mat4 clipToTexture;
+    if (!textureToClip.Invert(clipToTexture))
+        return;
+
+    //clip space (0,0,-1,0) is the eye of a perspective projection and the
+    //point at infinity towards the viewer of a parallel one; either way
+    //the eye lies on the high side of a plane x=c where x - c*w > 0
+    double eye[4];
+    for (int row = 0; row < 4; row++)
+        eye[row] = -clipToTexture(row, 2);
+
+    std::vector<int> pieces(GetNumberOfPieces());
+    for (size_t p = 0; p < pieces.size(); p++)
+        pieces[p] = int(p);
+    Order(pieces, eye, order);
+}
+
+//finds a plane through shared boundary layers that no piece straddles and
+//emits the side of the eye first, recursively
+void VolumeDecomposition::Order(std::vector<int>& pieces, const double eye[4], std::vector<int>& order) const
+{
+    if (pieces.size() == 1) {
+        order.push_back(pieces[0]);
+        return;
+    }
+
+    for (int axis = 0; axis < 3; axis++) {
+        for (size_t i = 0; i < pieces.size(); i++) {
+            const int cut = GetExtent(pieces[i])[2 * axis + 1];
+            std::vector<int> below, above;
+            for (size_t j = 0; j < pieces.size(); j++) {
+                const int* extent = GetExtent(pieces[j]);
+                if (extent[2 * axis + 1] <= cut)
+                    below.push_back(pieces[j]);
+                else if (extent[2 * axis] >= cut)
+                    above.push_back(pieces[j]);
+                else
+                    break;
+            }
+            if (below.empty() || above.empty() || below.size() + above.size() != pieces.size())
+                continue;
+
+            //the boundary runs through the centres of the shared voxels
+            double plane = LayerCentre(axis, cut);
+            bool eyeAbove = eye[axis] - plane * eye[3] > 0.0;
+            Order(eyeAbove ? above : below, eye, order);
+            Order(eyeAbove ? below : above, eye, order);
+            return;
+        }
+    }
+
+    //not a k-d tiling, fall back to the given order
+    order.insert(order.end(), pieces.begin(), pieces.end());
+}
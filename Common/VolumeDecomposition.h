@@ -0,0 +1,54 @@
+#pragma once
+#include <vector>
+
+#include "VectorMath.h"
+
+//Splits a volume into pieces for sort-last rendering and orders them by
+//visibility. Pieces are point extents x0,x1,y0,y1,z0,z1 the way VTK
+//pieces are: neighbours share the layer of voxels on their boundary, so a
+//piece interpolates right up to the boundary without ghost data. Every
+//piece renders the region between the centres of its boundary voxels
+//(see GetRegion()), the outer faces reach the border of the volume.
+//
+//Each piece has its own texture space [0,1]^3 over its voxels, laid out
+//like the texture space of the whole volume (texel centres at
+//(i+0.5)/dims); GetPieceToVolume() converts between the two.
+class VolumeDecomposition
+{
+public:
+    VolumeDecomposition(void);
+
+    //k-d split of wholeExtent into count pieces, every split cuts the
+    //longest axis in proportion to the pieces on either side
+    void Split(const int wholeExtent[6], int count);
+
+    //pieces given by their extents, 6 ints each, for example gathered
+    //from the processes of a pipeline. They must tile their bounding
+    //extent as the cells of a k-d tree do.
+    void SetPieces(const int* extents, int count);
+
+    int GetNumberOfPieces() const { return int(_extents.size() / 6); }
+    const int* GetExtent(int piece) const { return &_extents[6 * piece]; }
+    const int* GetWholeExtent() const { return _whole; }
+
+    //region piece renders, x0,x1,y0,y1,z0,z1 in the texture space of the
+    //whole volume (see CPURaycaster::SetPiece())
+    void GetRegion(int piece, float region[6]) const;
+
+    //takes texture coordinates of piece to those of the whole volume, so
+    //the camera of a piece is textureToClip * GetPieceToVolume(piece)
+    Mat4 GetPieceToVolume(int piece) const;
+
+    //pieces front to back as seen through textureToClip, the camera of the
+    //whole volume; perspective and parallel projections
+    void GetVisibilityOrder(const Mat4& textureToClip, std::vector<int>& order) const;
+
+private:
+    void SplitExtent(const int extent[6], int count);
+    //texture coordinate of the centre of the voxel layer at index
+    double LayerCentre(int axis, int index) const;
+    void Order(std::vector<int>& pieces, const double eye[4], std::vector<int>& order) const;
+
+    int _whole[6];
+    std::vector<int> _extents;
+};
@@ -0,0 +1,127 @@
+#include "VolumePyramid.h"
+#include "BrickedVolume.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+
+//averages 2x2x2 voxels of 'in' into each voxel of 'out', slices
+//[z0, z1) of the output, every one of the 'nc' components on its own.
+//Output dimensions are the input ones halved and rounded down, so the last
+//voxel of an odd input dimension is dropped.
+template <typename T>
+static void Downsample(const T* in, const int inDims[3], T* out, const int outDims[3], int nc,
+                       int z0, int z1)
+{
+    const size_t sy = size_t(inDims[0]) * nc, sz = sy * inDims[1];
+    const float rounding = std::is_floating_point<T>::value ? 0.0f : 0.5f;
+    for (int z = z0; z < z1; z++) {
+        const size_t zs[2] = {size_t(2*z) * sz, size_t(std::min(2*z + 1, inDims[2] - 1)) * sz};
+        for (int y = 0; y < outDims[1]; y++) {
+            const size_t ys[2] = {size_t(2*y) * sy, size_t(std::min(2*y + 1, inDims[1] - 1)) * sy};
+            T* row = out + (size_t(z) * outDims[1] + y) * outDims[0] * nc;
+            for (int x = 0; x < outDims[0]; x++) {
+                const size_t xs[2] = {size_t(2*x) * nc, size_t(std::min(2*x + 1, inDims[0] - 1)) * nc};
+                for (int c = 0; c < nc; c++) {
+                    float sum = 0.0f;
+                    for (int k = 0; k < 2; k++)
+                        for (int j = 0; j < 2; j++)
+                            sum += float(in[zs[k] + ys[j] + xs[0] + c]) + float(in[zs[k] + ys[j] + xs[1] + c]);
+                    row[x*nc + c] = static_cast<T>(sum * 0.125f + rounding);
+                }
+            }
+        }
+    }
+}
+
+template <typename T>
+static void DownsampleLevel(const void* in, const int inDims[3], void* out, const int outDims[3],
+                            int components, ThreadPool* pool)
+{
+    //one task per slab of output slices
+    const int slab = 4;
+    int tasks = (outDims[2] + slab - 1) / slab;
+    ThreadPool::TaskFunction fn = [&](int task, int) {
+        Downsample(static_cast<const T*>(in), inDims, static_cast<T*>(out), outDims, components,
+                   task * slab, std::min((task + 1) * slab, outDims[2]));
+    };
+    if (pool)
+        pool->ParallelFor(tasks, fn);
+    else
+        for (int task = 0; task < tasks; task++)
+            fn(task, 0);
+}
+
+VolumePyramid::VolumePyramid(void)
+{
+}
+
+void VolumePyramid::Clear()
+{
+    _levels.clear();
+    _storage.clear();
+}
+
+void VolumePyramid::Build(const void* data, int scalarType, int components,
+                          int xdim, int ydim, int zdim, int maxLevels, ThreadPool* pool)
+{
+    Clear();
+    if (!data)
+        return;
+
+    Level base;
+    base.data = data;
+    base.dims[0] = xdim;
+    base.dims[1] = ydim;
+    base.dims[2] = zdim;
+    _levels.push_back(base);
+
+    const size_t voxelSize = ScalarTypeSize(scalarType) * components;
+    while (int(_levels.size()) < maxLevels) {
+        const Level& fine = _levels.back();
+        Level coarse;
+        for (int i = 0; i < 3; i++)
+            coarse.dims[i] = fine.dims[i] / 2;
+        if (coarse.dims[0] < 2 || coarse.dims[1] < 2 || coarse.dims[2] < 2)
+            break;
+
+        _storage.push_back(std::vector<unsigned char>(
+            size_t(coarse.dims[0]) * coarse.dims[1] * coarse.dims[2] * voxelSize));
+        void* out = &_storage.back()[0];
+        switch (scalarType) {
+        case SCALAR_UINT16:
+            DownsampleLevel<unsigned short>(fine.data, fine.dims, out, coarse.dims, components, pool);
+            break;
+        case SCALAR_INT16:
+            DownsampleLevel<short>(fine.data, fine.dims, out, coarse.dims, components, pool);
+            break;
+        case SCALAR_FLOAT32:
+            DownsampleLevel<float>(fine.data, fine.dims, out, coarse.dims, components, pool);
+            break;
+        default:
+            DownsampleLevel<unsigned char>(fine.data, fine.dims, out, coarse.dims, components, pool);
+            break;
+        }
+        coarse.data = out;
+        _levels.push_back(coarse);
+    }
+}
+
+size_t VolumePyramid::GetMemorySize() const
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < _storage.size(); i++)
+        bytes += _storage[i].size();
+    return bytes;
+}
+
+int VolumePyramid::SelectLevel(float pixelFootprint, float tolerance, int levels)
+{
+    //a level L voxel is 2^L level 0 voxels wide
+    float voxels = pixelFootprint * tolerance;
+    if (!(voxels >= 2.0f))
+        return 0;
+    int level = static_cast<int>(std::floor(std::log2(voxels)));
+    return std::min(level, levels - 1);
+}
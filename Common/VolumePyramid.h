@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+class ThreadPool;
+
+//Mipmap pyramid of a volume for level-of-detail ray casting, the CPU
+//counterpart of the mipmaps of the 3D texture. Level 0 is the volume itself
+//(referenced, not copied); every further level halves each dimension by
+//averaging 2x2x2 voxels in the scalar type of the volume, until a dimension
+//would drop below 2. All levels span the same [0,1]^3 texture space.
+class VolumePyramid
+{
+public:
+    VolumePyramid(void);
+
+    //builds the levels of a volume of any ScalarType (see BrickedVolume.h)
+    //and 1-4 interleaved components, at most maxLevels including level 0
+    void Build(const void* data, int scalarType, int components, int xdim, int ydim, int zdim,
+               int maxLevels = 5, ThreadPool* pool = 0);
+    void Clear();
+
+    int GetNumberOfLevels() const { return int(_levels.size()); }
+    const void* GetLevel(int level) const { return _levels[level].data; }
+    const int* GetDimensions(int level) const { return _levels[level].dims; }
+
+    //bytes held by the levels above 0
+    size_t GetMemorySize() const;
+
+    //coarsest level whose voxels project to at most 'tolerance' pixels,
+    //given the size of a pixel in level 0 voxels
+    static int SelectLevel(float pixelFootprint, float tolerance, int levels);
+
+private:
+    struct Level
+    {
+        const void* data;
+        int dims[3];
+    };
+
+    std::vector<Level> _levels;
+    std::vector<std::vector<unsigned char> > _storage;  //levels 1..n
+};
@@ -0,0 +1,236 @@
+#include "VolumeSequence.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+VolumeSequence::VolumeSequence(void)
+{
+    _count = 0;
+    _speed = 0.0;
+    _loop = true;
+    _prefetch = 2;
+    _position = 0.0;
+    _playhead = 0;
+    _lastUpdate = -1.0;
+    _shown = -1;
+    _pending = -1;
+    _loadTotal = 0.0;
+    _loadedSteps = 0;
+    _failedSteps = 0;
+    _stop = false;
+}
+
+VolumeSequence::~VolumeSequence(void)
+{
+    Close();
+}
+
+bool VolumeSequence::Open(int steps, const StepReader& reader, int threads)
+{
+    Close();
+    if (steps < 1 || !reader)
+        return false;
+
+    _reader = reader;
+    _count = steps;
+    _steps.assign(steps, StepData());
+    _state.assign(steps, STEP_EMPTY);
+    _wanted.assign(steps, 0);
+    _queue.clear();
+    _position = 0.0;
+    _playhead = 0;
+    _lastUpdate = -1.0;
+    _shown = _pending = -1;
+    _loadTotal = 0.0;
+    _loadedSteps = _failedSteps = 0;
+    _stop = false;
+    ResetStatistics();
+
+    for (int i = 0; i < std::max(threads, 1); i++)
+        _threads.push_back(std::thread(&VolumeSequence::LoaderLoop, this));
+    return true;
+}
+
+void VolumeSequence::Close()
+{
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stop = true;
+        _queue.clear();
+    }
+    _wake.notify_all();
+    for (size_t i = 0; i < _threads.size(); i++)
+        _threads[i].join();
+    _threads.clear();
+    _steps.clear();
+    _state.clear();
+    _wanted.clear();
+    _count = 0;
+}
+
+void VolumeSequence::SetSpeed(double stepsPerSecond)
+{
+    _speed = stepsPerSecond;
+}
+
+void VolumeSequence::Seek(int step)
+{
+    if (_count == 0)
+        return;
+    _playhead = std::max(0, std::min(step, _count - 1));
+    _position = _playhead;
+}
+
+int VolumeSequence::Wrap(int step) const
+{
+    if (_loop)
+        return ((step % _count) + _count) % _count;
+    return step < 0 || step >= _count ? -1 : step;
+}
+
+int VolumeSequence::Update(double now)
+{
+    if (_count == 0)
+        return -1;
+
+    //advance the playhead by the time since the last frame
+    if (_lastUpdate >= 0.0)
+        _position += _speed * (now - _lastUpdate);
+    _lastUpdate = now;
+    if (_loop) {
+        _position = std::fmod(_position, double(_count));
+        if (_position < 0.0)
+            _position += _count;
+    } else {
+        _position = std::max(0.0, std::min(_position, double(_count - 1)));
+    }
+    _playhead = std::min(int(std::floor(_position)), _count - 1);
+
+    std::lock_guard<std::mutex> guard(_lock);
+    const int direction = _speed < 0.0 ? -1 : 1;
+    const double loadTime = _loadedSteps ? _loadTotal / _loadedSteps : 0.0;
+    const int ahead = std::min(_prefetch + int(std::ceil(std::fabs(_speed) * loadTime)), _count - 1);
+
+    //the window, nearest first
+    std::fill(_wanted.begin(), _wanted.end(), 0);
+    _queue.clear();
+    for (int i = 0; i <= ahead; i++) {
+        int step = Wrap(_playhead + direction*i);
+        if (step < 0 || _wanted[step])
+            break;
+        _wanted[step] = 1;
+        if (_state[step] == STEP_EMPTY)
+            _queue.push_back(step);
+    }
+
+    //the playhead if it is loaded, otherwise the newest loaded step it
+    //passed since the step on screen
+    int show = _state[_playhead] == STEP_LOADED ? _playhead : -1;
+    for (int i = 1; show < 0 && i < _count; i++) {
+        int step = Wrap(_playhead - direction*i);
+        if (step < 0 || step == _shown)
+            break;
+        if (_state[step] == STEP_LOADED)
+            show = step;
+    }
+    if (show < 0)
+        show = _shown >= 0 && _state[_shown] == STEP_LOADED ? _shown : -1;
+    _pending = show;
+
+    //drop what the window moved past, but not what is or will be on screen
+    for (int step = 0; step < _count; step++)
+        if (_state[step] == STEP_LOADED && !_wanted[step] && step != _shown && step != show) {
+            _steps[step].reset();
+            _state[step] = STEP_EMPTY;
+        }
+
+    if (!_queue.empty())
+        _wake.notify_all();
+    return show;
+}
+
+VolumeSequence::StepData VolumeSequence::GetStep(int step) const
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    if (step < 0 || step >= _count)
+        return StepData();
+    return _steps[step];
+}
+
+void VolumeSequence::Presented(int step, double now)
+{
+    _statistics.frames++;
+    if (step != _playhead)
+        _statistics.droppedFrames++;
+    if (step >= 0 && step != _shown) {
+        //steps between the previous and this one in playback direction
+        if (_shown >= 0) {
+            int distance = _speed < 0.0 ? _shown - step : step - _shown;
+            if (_loop)
+                distance = ((distance % _count) + _count) % _count;
+            _statistics.skippedSteps += std::max(distance - 1, 0);
+        }
+        _statistics.shownSteps++;
+        _shownTimes.push_back(now);
+        _shown = step;
+    }
+    while (!_shownTimes.empty() && _shownTimes.front() <= now - 1.0)
+        _shownTimes.pop_front();
+    _statistics.playbackRate = double(_shownTimes.size());
+}
+
+VolumeSequence::Statistics VolumeSequence::GetStatistics() const
+{
+    Statistics statistics = _statistics;
+    std::lock_guard<std::mutex> guard(_lock);
+    statistics.loadTime = _loadedSteps ? _loadTotal / _loadedSteps : 0.0;
+    statistics.loadedSteps = _loadedSteps;
+    statistics.failedSteps = _failedSteps;
+    statistics.residentSteps = int(std::count(_state.begin(), _state.end(), STEP_LOADED));
+    return statistics;
+}
+
+void VolumeSequence::ResetStatistics()
+{
+    _statistics = Statistics();
+    _shownTimes.clear();
+}
+
+void VolumeSequence::LoaderLoop()
+{
+    std::unique_lock<std::mutex> lock(_lock);
+    while (!_stop) {
+        if (_queue.empty()) {
+            _wake.wait(lock);
+            continue;
+        }
+        int step = _queue.front();
+        _queue.pop_front();
+        if (_state[step] != STEP_EMPTY)
+            continue;
+        _state[step] = STEP_LOADING;
+        lock.unlock();
+
+        std::shared_ptr<std::vector<unsigned char> > voxels(new std::vector<unsigned char>());
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool ok = _reader(step, *voxels);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        lock.lock();
+        if (!ok) {
+            _state[step] = STEP_FAILED;
+            _failedSteps++;
+            continue;
+        }
+        _loadTotal += elapsed.count();
+        _loadedSteps++;
+        //the window may have moved on while the step was read
+        if (_wanted[step] || step == _pending) {
+            _steps[step] = voxels;
+            _state[step] = STEP_LOADED;
+        } else {
+            _state[step] = STEP_EMPTY;
+        }
+    }
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Plays back a time series of volumes of equal size. Loader threads read
+//the steps ahead of the playhead, in the direction and at the speed it
+//moves, so a step is usually in memory by the time it is due; steps that
+//fall out of the window are dropped again. The render thread calls
+//Update() once per frame to learn which step to show and Presented() once
+//the frame shows it, which keeps the playback statistics.
+//
+//A step the playhead reaches before it is loaded is not waited for: the
+//newest loaded step behind it stays up and the frame counts as dropped.
+//The window reaches prefetch steps ahead plus the steps the playhead
+//passes during an average load, so fast playback reads further ahead.
+class VolumeSequence
+{
+public:
+    //reads all voxels of a step; called from the loader threads, several
+    //steps at once when there is more than one
+    typedef std::function<bool(int step, std::vector<unsigned char>& voxels)> StepReader;
+
+    //the voxels of a loaded step stay valid as long as they are referenced
+    typedef std::shared_ptr<const std::vector<unsigned char> > StepData;
+
+    struct Statistics
+    {
+        Statistics(void) : frames(0), droppedFrames(0), shownSteps(0), skippedSteps(0),
+                           playbackRate(0.0), loadTime(0.0), loadedSteps(0),
+                           failedSteps(0), residentSteps(0) {}
+
+        long long frames;           //Presented() calls
+        long long droppedFrames;    //frames that lagged behind the playhead
+        long long shownSteps;       //step changes on screen
+        long long skippedSteps;     //steps passed without being shown
+        double playbackRate;        //steps shown during the last second
+        double loadTime;            //average seconds to read a step
+        long long loadedSteps;
+        long long failedSteps;
+        int residentSteps;
+    };
+
+    VolumeSequence(void);
+    ~VolumeSequence(void);
+
+    //starts the loader threads, the playhead rests on step 0
+    bool Open(int steps, const StepReader& reader, int threads = 2);
+    void Close();
+    bool IsOpen() const { return !_threads.empty(); }
+    int GetNumberOfSteps() const { return _count; }
+
+    //steps per second, negative plays backwards and 0 pauses
+    void SetSpeed(double stepsPerSecond);
+    double GetSpeed() const { return _speed; }
+
+    //without looping the playhead stops at either end
+    void SetLoop(bool loop) { _loop = loop; }
+    bool GetLoop() const { return _loop; }
+
+    //steps read ahead of the playhead on top of those covering the load time
+    void SetPrefetch(int steps) { _prefetch = steps < 0 ? 0 : steps; }
+    int GetPrefetch() const { return _prefetch; }
+
+    void Seek(int step);
+    int GetPlayhead() const { return _playhead; }
+
+    //render thread, once per frame with the time in seconds: advances the
+    //playhead, queues the steps of the window and drops the others.
+    //Returns the step to show, -1 while none is loaded.
+    int Update(double now);
+
+    //voxels of a loaded step, empty if it is not in memory
+    StepData GetStep(int step) const;
+
+    //the frame shows the given step
+    void Presented(int step, double now);
+    int GetShownStep() const { return _shown; }
+
+    Statistics GetStatistics() const;
+    void ResetStatistics();
+
+private:
+    enum StepState {STEP_EMPTY, STEP_LOADING, STEP_LOADED, STEP_FAILED};
+
+    void LoaderLoop();
+    int Wrap(int step) const;
+
+    StepReader _reader;
+    int _count;
+    double _speed;
+    bool _loop;
+    int _prefetch;
+    double _position;
+    int _playhead;
+    double _lastUpdate;
+    int _shown;
+    int _pending;               //step Update() last asked to show
+
+    //guarded by _lock
+    std::vector<StepData> _steps;
+    std::vector<unsigned char> _state;
+    std::vector<unsigned char> _wanted;
+    std::deque<int> _queue;     //nearest to the playhead first
+    double _loadTotal;
+    long long _loadedSteps;
+    long long _failedSteps;
+    bool _stop;
+
+    Statistics _statistics;
+    std::deque<double> _shownTimes;
+
+    std::vector<std::thread> _threads;
+    mutable std::mutex _lock;
+    std::condition_variable _wake;
+};
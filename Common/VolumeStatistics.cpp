@@ -0,0 +1,419 @@
+#include "VolumeStatistics.h"
+#include "BrickedVolume.h"
+#include "FrameProfiler.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <type_traits>
+
+#include <sys/stat.h>
+
+using namespace std;
+
+static const char STATS_MAGIC[4] = {'V','S','T','A'};
+static const int STATS_VERSION = 1;
+
+//size and modification time of a file
+static bool FileSignature(const string& name, long long signature[2])
+{
+#ifdef _WIN32
+    struct _stat64 info;
+    if (_stat64(name.c_str(), &info) != 0)
+        return false;
+#else
+    struct stat info;
+    if (stat(name.c_str(), &info) != 0)
+        return false;
+#endif
+    signature[0] = static_cast<long long>(info.st_size);
+    signature[1] = static_cast<long long>(info.st_mtime);
+    return true;
+}
+
+//integer sums stay exact, float ones are taken in double. A run of at
+//most a brick's row sums into a narrower type first.
+template <typename T>
+struct ScalarSum
+{
+    typedef typename conditional<is_integral<T>::value, long long, double>::type Type;
+    typedef typename conditional<is_integral<T>::value, int, float>::type Run;
+};
+
+//adds 'count' scalars spaced 'stride' apart to the min, max and sum of a
+//brick. Integer min/max/sum reduce in any order, so the contiguous loop
+//vectorizes as written.
+template <typename T>
+static void ScanRun(const T* p, size_t stride, int count, T& lo, T& hi, typename ScalarSum<T>::Type& sum)
+{
+    typedef typename ScalarSum<T>::Run R;
+    T l = lo, h = hi;
+    R run = 0;
+    if (stride == 1) {
+        for (int i = 0; i < count; i++) {
+            T v = p[i];
+            l = v < l ? v : l;
+            h = v > h ? v : h;
+            run += R(v);
+        }
+    } else {
+        for (int i = 0; i < count; i++) {
+            T v = p[i * stride];
+            l = v < l ? v : l;
+            h = v > h ? v : h;
+            run += R(v);
+        }
+    }
+    lo = l;
+    hi = h;
+    sum += run;
+}
+
+//floats are reduced in LANES lanes, each taking every LANES-th scalar, which
+//the compiler turns into vector instructions without reordering the sum
+static const int LANES = 8;
+
+static void ScanRun(const float* p, size_t stride, int count, float& lo, float& hi, double& sum)
+{
+    float l[LANES], h[LANES], run[LANES];
+    for (int k = 0; k < LANES; k++) {
+        l[k] = lo;
+        h[k] = hi;
+        run[k] = 0.0f;
+    }
+    int i = 0;
+    if (stride == 1) {
+        for (; i + LANES <= count; i += LANES)
+            for (int k = 0; k < LANES; k++) {
+                float v = p[i + k];
+                l[k] = v < l[k] ? v : l[k];
+                h[k] = v > h[k] ? v : h[k];
+                run[k] += v;
+            }
+    }
+    for (; i < count; i++) {
+        float v = p[i * stride];
+        l[0] = v < l[0] ? v : l[0];
+        h[0] = v > h[0] ? v : h[0];
+        run[0] += v;
+    }
+    for (int k = 0; k < LANES; k++) {
+        lo = l[k] < lo ? l[k] : lo;
+        hi = h[k] > hi ? h[k] : hi;
+        sum += run[k];
+    }
+}
+
+//counts the raw values of a row, integer scalars only. Byte values go to
+//four interleaved tables: runs of one value (the air around a scan) would
+//otherwise make every increment wait for the one before.
+static const int BYTE_COUNT_TABLES = 4;
+
+template <typename T>
+static void CountRow(const T* row, size_t sx, int n, unsigned long long* counts)
+{
+    const long long first = numeric_limits<T>::min();
+    for (int x = 0; x < n; x++)
+        counts[row[x * sx] - first]++;
+}
+
+static void CountRow(const unsigned char* row, size_t sx, int n, unsigned long long* counts)
+{
+    int x = 0;
+    for (; x + BYTE_COUNT_TABLES <= n; x += BYTE_COUNT_TABLES)
+        for (int t = 0; t < BYTE_COUNT_TABLES; t++)
+            counts[t * 256 + row[(x + t) * sx]]++;
+    for (; x < n; x++)
+        counts[row[x * sx]]++;
+}
+
+static void CountRow(const float*, size_t, int, unsigned long long*)
+{
+}
+
+//one pass, a slab of bricks per task: the min/max/mean of every brick,
+//the sum of every slab and, of integer scalars, per worker counts of the
+//raw values
+template <typename T>
+static void ScanVolume(const T* data, size_t sx, const int dims[3], int B, const int grid[3], ThreadPool* pool,
+                       vector<VolumeStatistics::Brick>& bricks, vector<double>& slabSums,
+                       vector<vector<unsigned long long> >& counts)
+{
+    typedef typename ScalarSum<T>::Type S;
+    const int layerBricks = grid[0] * grid[1];
+    slabSums.assign(grid[2], 0.0);
+    if (is_integral<T>::value) {
+        const size_t values = size_t(1) << (8 * sizeof(T));
+        const int tables = sizeof(T) == 1 ? BYTE_COUNT_TABLES : 1;
+        counts.assign(pool ? pool->GetThreadCount() : 1, vector<unsigned long long>(values * tables, 0));
+    }
+
+    ThreadPool::TaskFunction slab = [&](int bz, int worker) {
+        vector<T> lo(layerBricks, numeric_limits<T>::max());
+        vector<T> hi(layerBricks, numeric_limits<T>::lowest());
+        vector<S> sum(layerBricks, 0);
+        unsigned long long* rowCounts = counts.empty() ? 0 : &counts[worker][0];
+        const int z0 = bz * B, z1 = min(z0 + B, dims[2]);
+        for (int z = z0; z < z1; z++)
+            for (int y = 0; y < dims[1]; y++) {
+                const T* row = data + (size_t(z) * dims[1] + y) * dims[0] * sx;
+                const int first = (y / B) * grid[0];
+                for (int bx = 0; bx < grid[0]; bx++) {
+                    int x0 = bx * B;
+                    ScanRun(row + x0 * sx, sx, min(B, dims[0] - x0), lo[first + bx], hi[first + bx],
+                            sum[first + bx]);
+                }
+                if (rowCounts)
+                    CountRow(row, sx, dims[0], rowCounts);
+            }
+
+        double slabSum = 0.0;
+        for (int i = 0; i < layerBricks; i++) {
+            int bx = i % grid[0], by = i / grid[0];
+            double voxels = double(min(B, dims[0] - bx * B)) * min(B, dims[1] - by * B) * (z1 - z0);
+            VolumeStatistics::Brick& brick = bricks[size_t(bz) * layerBricks + i];
+            brick.min = float(lo[i]);
+            brick.max = float(hi[i]);
+            brick.mean = float(double(sum[i]) / voxels);
+            slabSum += double(sum[i]);
+        }
+        slabSums[bz] = slabSum;
+    };
+    if (pool)
+        pool->ParallelFor(grid[2], slab);
+    else
+        for (int bz = 0; bz < grid[2]; bz++)
+            slab(bz, 0);
+
+    if (sizeof(T) == 1)
+        for (size_t w = 0; w < counts.size(); w++) {
+            for (size_t i = 256; i < counts[w].size(); i++)
+                counts[w][i % 256] += counts[w][i];
+            counts[w].resize(256);
+        }
+}
+
+//second pass for float scalars: per worker histograms over [lo,hi] with
+//bins of the given width. Values outside, NaN among them, are not counted.
+static void HistogramVolume(const float* data, size_t sx, const int dims[3], ThreadPool* pool,
+                            double lo, double hi, int bins, double width,
+                            vector<vector<unsigned long long> >& counts)
+{
+    counts.assign(pool ? pool->GetThreadCount() : 1, vector<unsigned long long>(bins, 0));
+    const float low = float(lo), high = float(hi);
+    const float scale = float(1.0 / width);
+    ThreadPool::TaskFunction slice = [&](int z, int worker) {
+        unsigned long long* sliceCounts = &counts[worker][0];
+        const float* p = data + size_t(z) * dims[1] * dims[0] * sx;
+        const size_t n = size_t(dims[1]) * dims[0];
+        for (size_t i = 0; i < n; i++) {
+            float v = p[i * sx];
+            if (!(v >= low && v <= high))
+                continue;
+            sliceCounts[min(int((v - low) * scale), bins - 1)]++;
+        }
+    };
+    if (pool)
+        pool->ParallelFor(dims[2], slice);
+    else
+        for (int z = 0; z < dims[2]; z++)
+            slice(z, 0);
+}
+
+VolumeStatistics::VolumeStatistics(void)
+{
+    Clear();
+}
+
+void VolumeStatistics::Clear()
+{
+    _scalarType = SCALAR_UINT8;
+    _components = 1;
+    _dims[0] = _dims[1] = _dims[2] = 0;
+    _range[0] = _range[1] = 0.0;
+    _mean = 0.0;
+    _count = 0;
+    _binWidth = 1.0;
+    _histograms.clear();
+    _brickSize = 0;
+    _brickGrid[0] = _brickGrid[1] = _brickGrid[2] = 0;
+    _bricks.clear();
+    _computeTime = 0.0;
+}
+
+void VolumeStatistics::Compute(const void* data, int scalarType, int components, int xdim, int ydim, int zdim,
+                               int brickSize, ThreadPool* pool)
+{
+    Clear();
+    const size_t scalarBytes = ScalarTypeSize(scalarType);
+    if (!data || scalarBytes == 0 || components < 1 || xdim < 1 || ydim < 1 || zdim < 1)
+        return;
+
+    double start = FrameProfiler::Now();
+    _scalarType = scalarType;
+    _components = components;
+    _dims[0] = xdim;
+    _dims[1] = ydim;
+    _dims[2] = zdim;
+    //a brick's row is summed in int before it is added to its lanes
+    _brickSize = min(max(brickSize, 1), 1024);
+    for (int i = 0; i < 3; i++)
+        _brickGrid[i] = (_dims[i] + _brickSize - 1) / _brickSize;
+    _bricks.resize(size_t(_brickGrid[0]) * _brickGrid[1] * _brickGrid[2]);
+
+    const size_t sx = size_t(components);
+    data = static_cast<const unsigned char*>(data) + (components - 1) * scalarBytes;
+    vector<double> slabSums;
+    vector<vector<unsigned long long> > counts;
+    switch (scalarType) {
+    case SCALAR_UINT16:
+        ScanVolume(static_cast<const unsigned short*>(data), sx, _dims, _brickSize, _brickGrid, pool,
+                   _bricks, slabSums, counts);
+        break;
+    case SCALAR_INT16:
+        ScanVolume(static_cast<const short*>(data), sx, _dims, _brickSize, _brickGrid, pool,
+                   _bricks, slabSums, counts);
+        break;
+    case SCALAR_FLOAT32:
+        ScanVolume(static_cast<const float*>(data), sx, _dims, _brickSize, _brickGrid, pool,
+                   _bricks, slabSums, counts);
+        break;
+    default:
+        ScanVolume(static_cast<const unsigned char*>(data), sx, _dims, _brickSize, _brickGrid, pool,
+                   _bricks, slabSums, counts);
+        break;
+    }
+
+    _range[0] = _bricks[0].min;
+    _range[1] = _bricks[0].max;
+    for (size_t i = 1; i < _bricks.size(); i++) {
+        _range[0] = min(_range[0], double(_bricks[i].min));
+        _range[1] = max(_range[1], double(_bricks[i].max));
+    }
+    _count = (unsigned long long)xdim * ydim * zdim;
+    double sum = 0.0;
+    for (size_t i = 0; i < slabSums.size(); i++)
+        sum += slabSums[i];
+    _mean = sum / double(_count);
+
+    //the finest histogram: integer values are rebinned from the raw counts
+    //of the pass, float ones take a second pass
+    _histograms.assign(1, vector<unsigned long long>());
+    vector<unsigned long long>& histogram = _histograms[0];
+    if (scalarType != SCALAR_FLOAT32) {
+        const long long first = scalarType == SCALAR_INT16 ? -32768 : 0;
+        const long long lo = (long long)_range[0], hi = (long long)_range[1];
+        const long long values = hi - lo + 1;
+        const int bins = int(min<long long>(MAX_BINS, values));
+        _binWidth = double(values) / bins;
+        histogram.assign(bins, 0);
+        for (long long v = lo; v <= hi; v++) {
+            unsigned long long n = 0;
+            for (size_t w = 0; w < counts.size(); w++)
+                n += counts[w][size_t(v - first)];
+            histogram[min(int((v - lo) / _binWidth), bins - 1)] += n;
+        }
+    } else {
+        const int bins = _range[1] > _range[0] ? MAX_BINS : 1;
+        _binWidth = _range[1] > _range[0] ? (_range[1] - _range[0]) / bins : 1.0;
+        HistogramVolume(static_cast<const float*>(data), sx, _dims, pool, _range[0], _range[1],
+                        bins, _binWidth, counts);
+        histogram.assign(bins, 0);
+        for (size_t w = 0; w < counts.size(); w++)
+            for (int i = 0; i < bins; i++)
+                histogram[i] += counts[w][i];
+    }
+    BuildLevels();
+    _computeTime = FrameProfiler::Now() - start;
+}
+
+void VolumeStatistics::BuildLevels()
+{
+    _histograms.resize(1);
+    while (int(_histograms.back().size()) > MIN_BINS) {
+        const vector<unsigned long long>& fine = _histograms.back();
+        vector<unsigned long long> coarse((fine.size() + 1) / 2, 0);
+        for (size_t i = 0; i < fine.size(); i++)
+            coarse[i / 2] += fine[i];
+        _histograms.push_back(coarse);
+    }
+}
+
+bool VolumeStatistics::Save(const string& filename, const string& dataset) const
+{
+    long long signature[2];
+    if (!IsValid() || !FileSignature(dataset, signature))
+        return false;
+    ofstream out(filename.c_str(), ios_base::binary);
+    if (!out.good())
+        return false;
+
+    const int bins = GetNumberOfBins(0);
+    out.write(STATS_MAGIC, 4);
+    out.write(reinterpret_cast<const char*>(&STATS_VERSION), 4);
+    out.write(reinterpret_cast<const char*>(signature), 16);
+    out.write(reinterpret_cast<const char*>(&_scalarType), 4);
+    out.write(reinterpret_cast<const char*>(&_components), 4);
+    out.write(reinterpret_cast<const char*>(_dims), 12);
+    out.write(reinterpret_cast<const char*>(_range), 16);
+    out.write(reinterpret_cast<const char*>(&_mean), 8);
+    out.write(reinterpret_cast<const char*>(&_count), 8);
+    out.write(reinterpret_cast<const char*>(&_binWidth), 8);
+    out.write(reinterpret_cast<const char*>(&bins), 4);
+    out.write(reinterpret_cast<const char*>(&_histograms[0][0]), bins * sizeof(unsigned long long));
+    out.write(reinterpret_cast<const char*>(&_brickSize), 4);
+    out.write(reinterpret_cast<const char*>(_brickGrid), 12);
+    out.write(reinterpret_cast<const char*>(&_bricks[0]), _bricks.size() * sizeof(Brick));
+    return out.good();
+}
+
+bool VolumeStatistics::Load(const string& filename, const string& dataset)
+{
+    Clear();
+    long long signature[2], saved[2];
+    if (!FileSignature(dataset, signature))
+        return false;
+    ifstream in(filename.c_str(), ios_base::binary);
+    char magic[4];
+    int version = 0;
+    in.read(magic, 4);
+    in.read(reinterpret_cast<char*>(&version), 4);
+    in.read(reinterpret_cast<char*>(saved), 16);
+    if (!in.good() || !equal(magic, magic + 4, STATS_MAGIC) || version != STATS_VERSION ||
+        saved[0] != signature[0] || saved[1] != signature[1])
+        return false;
+
+    int bins = 0;
+    in.read(reinterpret_cast<char*>(&_scalarType), 4);
+    in.read(reinterpret_cast<char*>(&_components), 4);
+    in.read(reinterpret_cast<char*>(_dims), 12);
+    in.read(reinterpret_cast<char*>(_range), 16);
+    in.read(reinterpret_cast<char*>(&_mean), 8);
+    in.read(reinterpret_cast<char*>(&_count), 8);
+    in.read(reinterpret_cast<char*>(&_binWidth), 8);
+    in.read(reinterpret_cast<char*>(&bins), 4);
+    if (!in.good() || bins < 1 || bins > MAX_BINS) {
+        Clear();
+        return false;
+    }
+    _histograms.assign(1, vector<unsigned long long>(bins));
+    in.read(reinterpret_cast<char*>(&_histograms[0][0]), bins * sizeof(unsigned long long));
+    in.read(reinterpret_cast<char*>(&_brickSize), 4);
+    in.read(reinterpret_cast<char*>(_brickGrid), 12);
+    bool valid = in.good() && _brickSize > 0;
+    for (int i = 0; valid && i < 3; i++)
+        valid = _dims[i] > 0 && _brickGrid[i] == (_dims[i] + _brickSize - 1) / _brickSize;
+    if (!valid) {
+        Clear();
+        return false;
+    }
+    _bricks.resize(size_t(_brickGrid[0]) * _brickGrid[1] * _brickGrid[2]);
+    in.read(reinterpret_cast<char*>(&_bricks[0]), _bricks.size() * sizeof(Brick));
+    if (!in.good()) {
+        Clear();
+        return false;
+    }
+    BuildLevels();
+    return true;
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+//Statistics of a volume gathered when it is loaded: the scalar range and
+//mean, histograms of the scalars at several resolutions (for transfer
+//function editors) and the min/max/mean of every brick of BrickSize^3
+//voxels. Bricks do not overlap; those at the +x/+y/+z faces may be
+//smaller.
+//
+//Compute() makes one parallel pass over the voxels, slab of bricks by slab
+//of bricks, with inner loops the compiler vectorizes; float volumes take a
+//second pass for the histogram, whose bins depend on the range. The
+//results are saved to a sidecar file next to the dataset and loaded from
+//it as long as the dataset keeps its size and modification time, so
+//reopening a volume costs no pass at all.
+class VolumeStatistics
+{
+public:
+    //bins of the finest histogram; integer volumes spanning fewer values
+    //get one bin per value
+    static const int MAX_BINS = 1024;
+
+    //every further level has half the bins, down to at most MIN_BINS
+    static const int MIN_BINS = 16;
+
+    struct Brick
+    {
+        float min, max, mean;   //raw scalar values
+    };
+
+    VolumeStatistics(void);
+
+    //scalars of any ScalarType (see BrickedVolume.h); of interleaved
+    //multi-component voxels the statistics are those of the last component
+    void Compute(const void* data, int scalarType, int components, int xdim, int ydim, int zdim,
+                 int brickSize = 32, ThreadPool* pool = 0);
+    void Clear();
+
+    bool IsValid() const { return _count > 0; }
+    int GetScalarType() const { return _scalarType; }
+    int GetNumberOfComponents() const { return _components; }
+    const int* GetDimensions() const { return _dims; }
+
+    //raw scalar values
+    const double* GetRange() const { return _range; }
+    double GetMean() const { return _mean; }
+    unsigned long long GetCount() const { return _count; }
+
+    //histograms over GetRange(), level 0 the finest. Bin i of a level
+    //covers [range[0] + i*width, range[0] + (i+1)*width) with the width of
+    //GetBinWidth(level); the last bin includes range[1].
+    int GetNumberOfLevels() const { return static_cast<int>(_histograms.size()); }
+    int GetNumberOfBins(int level) const { return static_cast<int>(_histograms[level].size()); }
+    double GetBinWidth(int level) const { return _binWidth * (1 << level); }
+    const unsigned long long* GetHistogram(int level) const { return &_histograms[level][0]; }
+
+    //bricks x fastest
+    int GetBrickSize() const { return _brickSize; }
+    const int* GetBrickGridDimensions() const { return _brickGrid; }
+    const std::vector<Brick>& GetBricks() const { return _bricks; }
+
+    double GetComputeTime() const { return _computeTime; }  //seconds, 0 when loaded
+
+    //the sidecar of a dataset file
+    static std::string SidecarName(const std::string& dataset) { return dataset + ".stats"; }
+
+    //writes the statistics with the size and modification time of the
+    //dataset they were computed from
+    bool Save(const std::string& filename, const std::string& dataset) const;
+
+    //false if the file is missing or damaged, or the dataset changed since
+    bool Load(const std::string& filename, const std::string& dataset);
+
+private:
+    void BuildLevels();
+
+    int _scalarType;
+    int _components;
+    int _dims[3];
+    double _range[2];
+    double _mean;
+    unsigned long long _count;
+    double _binWidth;
+    std::vector<std::vector<unsigned long long> > _histograms;
+    int _brickSize;
+    int _brickGrid[3];
+    std::vector<Brick> _bricks;
+    double _computeTime;
+};
@@ -1,13 +1,39 @@
 #include "GLSLShader.h"
+#include <cstring>
 #include <iostream>
+#include <iterator>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+string GLSLShader::_cacheDirectory;
+
+//FNV-1a, keys the program binaries
+static unsigned long long HashBytes(unsigned long long hash, const void* data, size_t size) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
 
+static unsigned long long HashString(unsigned long long hash, const char* s) {
+    return s ? HashBytes(hash, s, strlen(s) + 1) : hash;
+}
+
+//tags a cache file, followed by the binary format and the binary
+static const char CACHE_MAGIC[8] = {'G','L','S','L','B','I','N','1'};
 
 GLSLShader::GLSLShader(void)
 {
+    _program=0;
     _totalShaders=0;
-    _shaders[VERTEX_SHADER]=0;
-    _shaders[FRAGMENT_SHADER]=0;
-    _shaders[GEOMETRY_SHADER]=0;
+    _fromCache=false;
     _attributeList.clear();
     _uniformLocationList.clear();
 }
@@ -18,43 +44,108 @@ GLSLShader::~GLSLShader(void)
     _uniformLocationList.clear();
 }
 
+void GLSLShader::SetCacheDirectory(const string& directory) {
+    _cacheDirectory = directory;
+}
+
 void GLSLShader::DeleteShaderProgram() {
     glDeleteProgram(_program);
 }
 
 void GLSLShader::LoadFromString(GLenum type, const string& source) {
-    GLuint shader = glCreateShader (type);
+    //compiled in CreateAndLinkProgram, unless a cached binary is found
+    _types[_totalShaders]=type;
+    _sources[_totalShaders++]=source;
+}
 
-    const char * ptmp = source.c_str();
-    glShaderSource (shader, 1, &ptmp, NULL);
+string GLSLShader::GetCachePath() const {
+    //a driver update invalidates the binaries, so the driver is hashed too
+    unsigned long long hash = 14695981039346656037ULL;
+    hash = HashString(hash, reinterpret_cast<const char*>(glGetString(GL_VENDOR)));
+    hash = HashString(hash, reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+    hash = HashString(hash, reinterpret_cast<const char*>(glGetString(GL_VERSION)));
+    for (int i = 0; i < _totalShaders; i++) {
+        hash = HashBytes(hash, &_types[i], sizeof(_types[i]));
+        hash = HashString(hash, _sources[i].c_str());
+    }
+    ostringstream path;
+    path << _cacheDirectory << "/" << hex << setw(16) << setfill('0') << hash << ".bin";
+    return path.str();
+}
 
-    //check whether the shader loads fine
+bool GLSLShader::LoadBinary(const string& path) {
+    ifstream fp(path.c_str(), ios_base::in | ios_base::binary);
+    char magic[sizeof(CACHE_MAGIC)];
+    GLenum format;
+    if (!fp.read(magic, sizeof(magic)) || memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0 ||
+        !fp.read(reinterpret_cast<char*>(&format), sizeof(format)))
+        return false;
+    vector<char> binary((istreambuf_iterator<char>(fp)), istreambuf_iterator<char>());
+    if (binary.empty())
+        return false;
+
+    glProgramBinary(_program, format, &binary[0], GLsizei(binary.size()));
     GLint status;
-    glCompileShader (shader);
-    glGetShaderiv (shader, GL_COMPILE_STATUS, &status);
-    if (status == GL_FALSE) {
-        GLint infoLogLength;
-        glGetShaderiv (shader, GL_INFO_LOG_LENGTH, &infoLogLength);
-        GLchar *infoLog= new GLchar[infoLogLength];
-        glGetShaderInfoLog (shader, infoLogLength, NULL, infoLog);
-        cerr<<"Compile log: "<<infoLog<<endl;
-        delete [] infoLog;
-    }
-    _shaders[_totalShaders++]=shader;
+    glGetProgramiv(_program, GL_LINK_STATUS, &status);
+    return status == GL_TRUE;
 }
 
+void GLSLShader::SaveBinary(const string& path) {
+    GLint length = 0;
+    glGetProgramiv(_program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+    vector<char> binary(length);
+    GLenum format;
+    glGetProgramBinary(_program, length, NULL, &format, &binary[0]);
+
+#ifdef _WIN32
+    _mkdir(_cacheDirectory.c_str());
+#else
+    mkdir(_cacheDirectory.c_str(), 0755);
+#endif
+    ofstream fp(path.c_str(), ios_base::out | ios_base::binary);
+    fp.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    fp.write(reinterpret_cast<const char*>(&format), sizeof(format));
+    fp.write(&binary[0], length);
+    if (!fp)
+        cerr<<"Cannot write shader cache: "<<path<<endl;
+}
 
 void GLSLShader::CreateAndLinkProgram() {
     _program = glCreateProgram ();
-    if (_shaders[VERTEX_SHADER] != 0) {
-        glAttachShader (_program, _shaders[VERTEX_SHADER]);
-    }
-    if (_shaders[FRAGMENT_SHADER] != 0) {
-        glAttachShader (_program, _shaders[FRAGMENT_SHADER]);
-    }
-    if (_shaders[GEOMETRY_SHADER] != 0) {
-        glAttachShader (_program, _shaders[GEOMETRY_SHADER]);
+
+    //try the binary cache first
+    bool useCache = !_cacheDirectory.empty() && (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary);
+    string cachePath = useCache ? GetCachePath() : string();
+    _fromCache = useCache && LoadBinary(cachePath);
+    if (_fromCache)
+        return;
+
+    GLuint shaders[3];
+    for (int i = 0; i < _totalShaders; i++) {
+        GLuint shader = glCreateShader (_types[i]);
+
+        const char * ptmp = _sources[i].c_str();
+        glShaderSource (shader, 1, &ptmp, NULL);
+
+        //check whether the shader loads fine
+        GLint status;
+        glCompileShader (shader);
+        glGetShaderiv (shader, GL_COMPILE_STATUS, &status);
+        if (status == GL_FALSE) {
+            GLint infoLogLength;
+            glGetShaderiv (shader, GL_INFO_LOG_LENGTH, &infoLogLength);
+            GLchar *infoLog= new GLchar[infoLogLength];
+            glGetShaderInfoLog (shader, infoLogLength, NULL, infoLog);
+            cerr<<"Compile log: "<<infoLog<<endl;
+            delete [] infoLog;
+        }
+        glAttachShader (_program, shader);
+        shaders[i] = shader;
     }
+    if (useCache)
+        glProgramParameteri(_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 
     //link and check whether the program links fine
     GLint status;
@@ -68,11 +159,12 @@ void GLSLShader::CreateAndLinkProgram() {
         glGetProgramInfoLog (_program, infoLogLength, NULL, infoLog);
         cerr<<"Link log: "<<infoLog<<endl;
         delete [] infoLog;
+    } else if (useCache) {
+        SaveBinary(cachePath);
     }
 
-    glDeleteShader(_shaders[VERTEX_SHADER]);
-    glDeleteShader(_shaders[FRAGMENT_SHADER]);
-    glDeleteShader(_shaders[GEOMETRY_SHADER]);
+    for (int i = 0; i < _totalShaders; i++)
+        glDeleteShader(shaders[i]);
 }
 
 void GLSLShader::Use() {
@@ -83,32 +175,48 @@ void GLSLShader::UnUse() {
     glUseProgram(0);
 }
 
-void GLSLShader::AddAttribute(const string& attribute) {
-    _attributeList[attribute]= glGetAttribLocation(_program, attribute.c_str());
+int GLSLShader::AddAttribute(const string& attribute) {
+    map<string,int>::iterator it = _attributeList.find(attribute);
+    if (it != _attributeList.end())
+        return it->second;
+    _attributes.push_back(glGetAttribLocation(_program, attribute.c_str()));
+    return _attributeList[attribute] = int(_attributes.size()) - 1;
 }
 
 //An indexer that returns the location of the attribute
 GLuint GLSLShader::operator [](const string& attribute) {
-    return _attributeList[attribute];
+    return _attributes[AddAttribute(attribute)];
 }
 
-void GLSLShader::AddUniform(const string& uniform) {
-    _uniformLocationList[uniform] = glGetUniformLocation(_program, uniform.c_str());
+int GLSLShader::AddUniform(const string& uniform) {
+    map<string,int>::iterator it = _uniformLocationList.find(uniform);
+    if (it != _uniformLocationList.end())
+        return it->second;
+    _uniforms.push_back(glGetUniformLocation(_program, uniform.c_str()));
+    return _uniformLocationList[uniform] = int(_uniforms.size()) - 1;
 }
 
 GLuint GLSLShader::operator()(const string& uniform){
-    return _uniformLocationList[uniform];
+    return _uniforms[AddUniform(uniform)];
 }
 
-#include <fstream>
-void GLSLShader::LoadFromFile(GLenum whichShader, const string& filename){
+void GLSLShader::SetStorageBlockBinding(const string& block, GLuint binding){
+    GLuint index = glGetProgramResourceIndex(_program, GL_SHADER_STORAGE_BLOCK, block.c_str());
+    if (index != GL_INVALID_INDEX)
+        glShaderStorageBlockBinding(_program, index, binding);
+}
+
+void GLSLShader::LoadFromFile(GLenum whichShader, const string& filename, const string& defines){
     ifstream fp;
     fp.open(filename.c_str(), ios_base::in);
     if(fp) {
-        string line, buffer;
-        while(getline(fp, line)) {
-            buffer.append(line);
-            buffer.append("\r\n");
+        //read the file in one go
+        string buffer((istreambuf_iterator<char>(fp)), istreambuf_iterator<char>());
+        //inject the defines after the #version directive
+        if(!defines.empty()) {
+            size_t pos = buffer.find("#version");
+            pos = (pos == string::npos) ? 0 : buffer.find('\n', pos) + 1;
+            buffer.insert(pos, defines);
         }
         //copy to source
         LoadFromString(whichShader, buffer);
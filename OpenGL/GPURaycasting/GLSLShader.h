@@ -3,32 +3,66 @@
 
 #include <GL/glew.h>
 #include <map>
+#include <vector>
 
 using namespace std;
 
+//Sources are collected by LoadFromString/LoadFromFile and compiled when the
+//program is linked. With a cache directory set (SetCacheDirectory) linked
+//programs are stored through glGetProgramBinary under a hash of the driver
+//and the sources including their defines, and later runs load the binary
+//instead of compiling. A binary the driver rejects is rebuilt from source.
 class GLSLShader
 {
 public:
     GLSLShader(void);
     ~GLSLShader(void);
     void LoadFromString(GLenum whichShader, const string& source);
-    void LoadFromFile(GLenum whichShader, const string& filename);
+    //defines (e.g. "#define FOO\n") are inserted right after the #version line
+    void LoadFromFile(GLenum whichShader, const string& filename, const string& defines = "");
     void CreateAndLinkProgram();
     void Use();
     void UnUse();
-    void AddAttribute(const string& attribute);
-    void AddUniform(const string& uniform);
 
-    //An indexer that returns the location of the attribute/uniform
+    //resolve the location once after linking and return its slot; adding
+    //a name again returns the existing slot
+    int AddAttribute(const string& attribute);
+    int AddUniform(const string& uniform);
+
+    //location of the attribute/uniform in a slot, for per-frame updates
+    GLint operator[](int slot) const { return _attributes[slot]; }
+    GLint operator()(int slot) const { return _uniforms[slot]; }
+
+    //An indexer that returns the location of the attribute/uniform by name
     GLuint operator[](const string& attribute);
     GLuint operator()(const string& uniform);
+
+    //binds a shader storage block of the linked program to a binding point,
+    //ignored when the program has no such block
+    void SetStorageBlockBinding(const string& block, GLuint binding);
     void DeleteShaderProgram();
 
+    //directory of the program binary cache, empty (the default) disables it
+    static void SetCacheDirectory(const string& directory);
+
+    //whether the last CreateAndLinkProgram() loaded a cached binary
+    bool IsFromCache() const { return _fromCache; }
+
 private:
+    bool LoadBinary(const string& path);
+    void SaveBinary(const string& path);
+    string GetCachePath() const;
+
     enum ShaderType {VERTEX_SHADER, FRAGMENT_SHADER, GEOMETRY_SHADER};
     GLuint	_program;
     int _totalShaders;
-    GLuint _shaders[3];//0->vertexshader, 1->fragmentshader, 2->geometryshader
-    map<string,GLuint> _attributeList;
-    map<string,GLuint> _uniformLocationList;
+    GLenum _types[3];
+    string _sources[3];//0->vertexshader, 1->fragmentshader, 2->geometryshader
+    bool _fromCache;
+    map<string,int> _attributeList;
+    map<string,int> _uniformLocationList;
+    vector<GLint> _attributes;
+    vector<GLint> _uniforms;
+
+    static string _cacheDirectory;
 };
@@ -0,0 +1,83 @@
+#include "GPUStageTimer.h"
+#include "FrameProfiler.h"
+
+GPUStageTimer::GPUStageTimer(void)
+{
+    _profiler = 0;
+    _current = 0;
+}
+
+GPUStageTimer::~GPUStageTimer(void)
+{
+    //the queries belong to the GL context, Destroy() releases them while
+    //it is current
+}
+
+bool GPUStageTimer::Init(FrameProfiler* profiler, int latency)
+{
+    Destroy();
+    if (!profiler || !(GLEW_VERSION_3_3 || GLEW_ARB_timer_query))
+        return false;
+
+    int stages = profiler->GetNumberOfStages();
+    _frames.resize(latency < 1 ? 1 : latency);
+    for (size_t i = 0; i < _frames.size(); i++) {
+        _frames[i].queries.resize(2*stages);
+        _frames[i].issued.assign(stages, 0);
+        glGenQueries(2*stages, &_frames[i].queries[0]);
+    }
+    _profiler = profiler;
+    _current = 0;
+    return true;
+}
+
+void GPUStageTimer::Destroy()
+{
+    for (size_t i = 0; i < _frames.size(); i++)
+        if (!_frames[i].queries.empty())
+            glDeleteQueries(GLsizei(_frames[i].queries.size()), &_frames[i].queries[0]);
+    _frames.clear();
+    _profiler = 0;
+}
+
+void GPUStageTimer::Collect(FrameQueries& frame)
+{
+    for (size_t stage = 0; stage < frame.issued.size(); stage++) {
+        if (!frame.issued[stage])
+            continue;
+        frame.issued[stage] = 0;
+
+        //after 'latency' frames the result is there unless the GPU is that
+        //far behind, in which case the wait is the honest measurement
+        GLuint64 begin, end;
+        glGetQueryObjectui64v(frame.queries[2*stage], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(frame.queries[2*stage+1], GL_QUERY_RESULT, &end);
+        if (_profiler->IsEnabled())
+            _profiler->AddGPUTime(int(stage), (end - begin) * 1e-9);
+    }
+}
+
+void GPUStageTimer::BeginFrame()
+{
+    if (!_profiler)
+        return;
+    _current = (_current + 1) % int(_frames.size());
+    Collect(_frames[_current]);
+}
+
+void GPUStageTimer::Begin(int stage)
+{
+    if (!_profiler || !_profiler->IsEnabled())
+        return;
+    FrameQueries& frame = _frames[_current];
+    glQueryCounter(frame.queries[2*stage], GL_TIMESTAMP);
+}
+
+void GPUStageTimer::End(int stage)
+{
+    if (!_profiler || !_profiler->IsEnabled())
+        return;
+    FrameQueries& frame = _frames[_current];
+    glQueryCounter(frame.queries[2*stage+1], GL_TIMESTAMP);
+    frame.issued[stage] = 1;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <GL/glew.h>
+
+#include <vector>
+
+class FrameProfiler;
+
+//GPU side of FrameProfiler: Begin()/End() put GL_TIMESTAMP queries around
+//the commands of a profiler stage. The queries of a frame are read back
+//'latency' frames later, when they are normally long available, so timing
+//never stalls the pipeline; the results are booked with AddGPUTime() to the
+//frame during which they were read. Nothing is issued while the profiler is
+//disabled.
+class GPUStageTimer
+{
+public:
+    GPUStageTimer(void);
+    ~GPUStageTimer(void);
+
+    //the profiler's stages must be registered before; fails without timer
+    //query support (GL 3.3 or GL_ARB_timer_query)
+    bool Init(FrameProfiler* profiler, int latency = 3);
+    void Destroy();
+
+    //once per frame after FrameProfiler::BeginFrame()
+    void BeginFrame();
+
+    void Begin(int stage);
+    void End(int stage);
+
+    bool IsInitialized() const { return _profiler != 0; }
+
+private:
+    struct FrameQueries
+    {
+        std::vector<GLuint> queries;    //begin and end query per stage
+        std::vector<char> issued;       //stage was timed in this frame
+    };
+
+    void Collect(FrameQueries& frame);
+
+    FrameProfiler* _profiler;
+    std::vector<FrameQueries> _frames;
+    int _current;
+};
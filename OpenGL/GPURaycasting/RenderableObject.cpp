@@ -3,7 +3,7 @@
 
 RenderableObject::RenderableObject(void)
 {
-	
+	mvpUniform = -1;
 }
 
 
@@ -18,6 +18,9 @@ void RenderableObject::Init() {
 	glGenBuffers(1, &vboVerticesID);
 	glGenBuffers(1, &vboIndicesID);
 
+	//the per-frame uniform, AddUniform returns the slot of an added name
+	mvpUniform = shader.AddUniform("MVP");
+
 	//get total vertices and indices
 	totalVertices = GetTotalVertices();
 	totalIndices  = GetTotalIndices();
@@ -59,7 +62,7 @@ void RenderableObject::Destroy() {
 
 void RenderableObject::Render(const GLfloat* MVP) {
 	shader.Use();				
-		glUniformMatrix4fv(shader("MVP"), 1, GL_FALSE, MVP);
+		glUniformMatrix4fv(shader(mvpUniform), 1, GL_FALSE, MVP);
 		SetCustomUniforms();
 		glBindVertexArray(vaoID);
 			glDrawElements(primType, totalIndices, GL_UNSIGNED_INT, 0);
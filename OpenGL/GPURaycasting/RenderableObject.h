@@ -26,6 +26,7 @@ protected:
 	GLuint vboIndicesID;
 	
 	GLSLShader shader;
+	int mvpUniform;
 
 	GLenum primType;
 	int totalVertices, totalIndices;
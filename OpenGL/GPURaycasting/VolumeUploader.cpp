@@ -0,0 +1,306 @@
+#include "VolumeUploader.h"
+#include "BrickedVolume.h"
+#include "MacroCellGrid.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+VolumeUploader::VolumeUploader(void)
+{
+    _texture = 0;
+    _dims[0] = _dims[1] = _dims[2] = 0;
+    _pixelFormat = GL_RED;
+    _pixelType = GL_UNSIGNED_BYTE;
+    _slabDepth = 0;
+    _sliceBytes = 0;
+    _slabBytes = 0;
+    _maxLevel = 0;
+    _persistent = false;
+    _compressed = false;
+    _textureBytes = 0;
+    _cells = 0;
+    _nextUpload = 0;
+    _uploadedSlices = 0;
+    _complete = false;
+    _failed = false;
+    _readFailed = false;
+    _cancel = false;
+}
+
+VolumeUploader::~VolumeUploader(void)
+{
+    //the GL objects have to be released with a current context, so only
+    //stop the thread here
+    if (_thread.joinable()) {
+        {
+            lock_guard<mutex> guard(_lock);
+            _cancel = true;
+        }
+        _slotFreed.notify_all();
+        _thread.join();
+    }
+}
+
+void VolumeUploader::TextureFormat(int scalarType, int components, GLint& internalFormat,
+                                   GLenum& format, GLenum& type) {
+    static const GLint formats[4][4] = {
+        {GL_R8, GL_RG8, GL_RGB8, GL_RGBA8},
+        {GL_R16, GL_RG16, GL_RGB16, GL_RGBA16},
+        {GL_R16_SNORM, GL_RG16_SNORM, GL_RGB16_SNORM, GL_RGBA16_SNORM},
+        {GL_R32F, GL_RG32F, GL_RGB32F, GL_RGBA32F}};
+    static const GLenum layouts[4] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+    static const GLenum types[4] = {GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT, GL_SHORT, GL_FLOAT};
+    scalarType = max(0, min(scalarType, 3));
+    components = max(1, min(components, 4));
+    internalFormat = formats[scalarType][components - 1];
+    format = layouts[components - 1];
+    type = types[scalarType];
+}
+
+GLint VolumeUploader::CompressedTextureFormat(int components) {
+    static const GLint formats[4] = {GL_COMPRESSED_RED, GL_COMPRESSED_RG, GL_COMPRESSED_RGB, GL_COMPRESSED_RGBA};
+    return formats[max(1, min(components, 4)) - 1];
+}
+
+bool VolumeUploader::Start(GLuint texture, int xdim, int ydim, int zdim, const Format& format,
+                           const SlabReader& reader, MacroCellGrid* cells, int slabDepth,
+                           int ringSize) {
+    Cancel();
+    if (xdim < 1 || ydim < 1 || zdim < 1 || !reader)
+        return false;
+
+    _texture = texture;
+    _dims[0] = xdim;
+    _dims[1] = ydim;
+    _dims[2] = zdim;
+    _format = format;
+    _slabDepth = max(1, min(slabDepth, zdim));
+    _sliceBytes = size_t(xdim) * ydim * format.components * ScalarTypeSize(format.scalarType);
+    _slabBytes = _sliceBytes * _slabDepth;
+    _reader = reader;
+    _cells = cells;
+    _nextUpload = 0;
+    _uploadedSlices = 0;
+    _complete = false;
+    _failed = false;
+    _readFailed = false;
+    _cancel = false;
+    _compressed = false;
+    _textureBytes = 0;
+    _startTime = chrono::steady_clock::now();
+
+    //allocate the storage only, and sample the base level while streaming
+    //since the mipmaps do not exist yet
+    glBindTexture(GL_TEXTURE_3D, _texture);
+    glGetTexParameteriv(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, &_maxLevel);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, 0);
+    GLint internalFormat;
+    TextureFormat(format.scalarType, format.components, internalFormat, _pixelFormat, _pixelType);
+    if (format.compressed)
+        internalFormat = CompressedTextureFormat(format.components);
+    glTexImage3D(GL_TEXTURE_3D, 0, internalFormat, xdim, ydim, zdim, 0, _pixelFormat, _pixelType, NULL);
+
+    //persistent mappings stay valid while the GL reads from the buffer, so
+    //the reader writes into them without any map/unmap round trip
+    _persistent = GLEW_ARB_buffer_storage != 0;
+    _slots.resize(max(2, ringSize));
+    for (size_t i = 0; i < _slots.size(); i++) {
+        Slot& slot = _slots[i];
+        glGenBuffers(1, &slot.buffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+        if (_persistent) {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_PIXEL_UNPACK_BUFFER, _slabBytes, NULL, flags);
+            slot.data = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, _slabBytes, flags));
+        } else {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, _slabBytes, NULL, GL_STREAM_DRAW);
+            MapSlot(slot);
+        }
+        slot.fence = 0;
+        slot.state = SLOT_FREE;
+        slot.z0 = slot.depth = 0;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    _thread = thread(&VolumeUploader::ReaderLoop, this);
+    return true;
+}
+
+//maps a buffer the GL no longer reads from, the slot's buffer is bound
+void VolumeUploader::MapSlot(Slot& slot) {
+    slot.data = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, _slabBytes,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+}
+
+void VolumeUploader::ReaderLoop() {
+    //slabs are read into system memory first when they also feed the macro
+    //cells, since mapped buffer memory is slow to read back
+    vector<unsigned char> staging(_cells ? _slabBytes : 0);
+    const int slabs = (_dims[2] + _slabDepth - 1) / _slabDepth;
+
+    for (int slab = 0; slab < slabs; slab++) {
+        Slot& slot = _slots[slab % _slots.size()];
+        {
+            unique_lock<mutex> guard(_lock);
+            _slotFreed.wait(guard, [&] { return _cancel || slot.state == SLOT_FREE; });
+            if (_cancel)
+                return;
+            slot.state = SLOT_FILLING;
+        }
+
+        const int z0 = slab * _slabDepth;
+        const int depth = min(_slabDepth, _dims[2] - z0);
+        unsigned char* target = _cells ? &staging[0] : slot.data;
+        bool ok = slot.data != 0 && _reader(z0, depth, target);
+        if (ok && _cells) {
+            _cells->AddSlices(target, _format.scalarType, _format.components,
+                              _format.cellScale, _format.cellShift, z0, depth);
+            memcpy(slot.data, target, _sliceBytes * depth);
+        }
+
+        lock_guard<mutex> guard(_lock);
+        if (!ok) {
+            _readFailed = true;
+            return;
+        }
+        slot.z0 = z0;
+        slot.depth = depth;
+        slot.state = SLOT_READY;
+    }
+}
+
+int VolumeUploader::Update() {
+    if (!_thread.joinable() || _complete)
+        return 0;
+
+    //snapshot the slot states, only the render thread moves slots out of
+    //READY and PENDING so they can be worked on without holding the lock
+    vector<SlotState> states(_slots.size());
+    vector<bool> changed(_slots.size(), false);
+    {
+        lock_guard<mutex> guard(_lock);
+        for (size_t i = 0; i < _slots.size(); i++)
+            states[i] = _slots[i].state;
+        _failed = _readFailed;
+    }
+    if (_failed) {
+        cerr<<"Volume upload failed after "<<_uploadedSlices<<" of "<<_dims[2]<<" slices"<<endl;
+        Cancel();
+        return 0;
+    }
+
+    //recycle the buffers the GL finished reading from
+    bool freed = false;
+    for (size_t i = 0; i < _slots.size(); i++) {
+        Slot& slot = _slots[i];
+        if (states[i] != SLOT_PENDING)
+            continue;
+        GLenum status = glClientWaitSync(slot.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            continue;
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+        if (!_persistent) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+            MapSlot(slot);
+        }
+        states[i] = SLOT_FREE;
+        changed[i] = true;
+        freed = true;
+    }
+
+    //upload the filled slabs in order
+    int uploaded = 0;
+    glBindTexture(GL_TEXTURE_3D, _texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (;;) {
+        size_t i = _nextUpload % _slots.size();
+        Slot& slot = _slots[i];
+        if (states[i] != SLOT_READY)
+            break;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+        if (!_persistent)
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, slot.z0, _dims[0], _dims[1], slot.depth,
+                        _pixelFormat, _pixelType, 0);
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        states[i] = SLOT_PENDING;
+        changed[i] = true;
+        uploaded += slot.depth;
+        _nextUpload++;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    //make sure the fences get processed without waiting for the next frame
+    if (uploaded)
+        glFlush();
+
+    {
+        lock_guard<mutex> guard(_lock);
+        for (size_t i = 0; i < _slots.size(); i++)
+            if (changed[i])
+                _slots[i].state = states[i];
+    }
+    if (freed)
+        _slotFreed.notify_one();
+
+    _uploadedSlices += uploaded;
+    if (_uploadedSlices == _dims[2])
+        Finish();
+    return uploaded;
+}
+
+void VolumeUploader::Finish() {
+    _thread.join();
+    ReleaseBuffers();
+
+    //a generic compressed format may or may not have been compressed by the
+    //driver; compressed levels cannot be rendered to, so they get no mipmaps
+    glBindTexture(GL_TEXTURE_3D, _texture);
+    GLint compressed = GL_FALSE;
+    glGetTexLevelParameteriv(GL_TEXTURE_3D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+    _compressed = compressed == GL_TRUE;
+    if (_compressed) {
+        GLint bytes = 0;
+        glGetTexLevelParameteriv(GL_TEXTURE_3D, 0, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &bytes);
+        _textureBytes = size_t(bytes);
+    } else {
+        _textureBytes = _sliceBytes * _dims[2];
+    }
+
+    //all slices are in, the mip chain can be built now
+    if (!_compressed) {
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, _maxLevel);
+        glGenerateMipmap(GL_TEXTURE_3D);
+    }
+    _complete = true;
+}
+
+void VolumeUploader::Cancel() {
+    if (!_thread.joinable())
+        return;
+    {
+        lock_guard<mutex> guard(_lock);
+        _cancel = true;
+    }
+    _slotFreed.notify_all();
+    _thread.join();
+    ReleaseBuffers();
+}
+
+void VolumeUploader::ReleaseBuffers() {
+    for (size_t i = 0; i < _slots.size(); i++) {
+        Slot& slot = _slots[i];
+        if (slot.fence)
+            glDeleteSync(slot.fence);
+        //deleting a buffer unmaps it
+        glDeleteBuffers(1, &slot.buffer);
+    }
+    _slots.clear();
+}
+
+double VolumeUploader::GetElapsedTime() const {
+    return chrono::duration<double>(chrono::steady_clock::now() - _startTime).count();
+}
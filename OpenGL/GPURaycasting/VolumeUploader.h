@@ -0,0 +1,137 @@
+#pragma once
+#include <GL/glew.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class MacroCellGrid;
+
+//Streams a volume into a 3D texture without stalling the render
+//thread. A reader thread fills a ring of pixel buffer objects one slab of
+//slices at a time (persistently mapped when GL_ARB_buffer_storage is
+//available) while the render thread calls Update() once per frame to issue
+//glTexSubImage3D from every filled buffer. A fence per upload hands the
+//buffer back to the reader once the GL is done with it, so disk I/O and
+//transfers overlap and the first slabs are visible after a frame or two.
+//
+//The voxels go to the GL exactly as they were read: the texture takes the
+//scalar type and number of components of the file (see TextureFormat()),
+//the shader maps the values onto the transfer function. On request the
+//texture asks for a generic compressed format instead, which the driver
+//fills with a block-compressed one (RGTC for one and two components, at
+//about 8 bits of precision) where it supports one for 3D textures.
+//Compressed textures have no mipmaps.
+class VolumeUploader
+{
+public:
+    //fills 'depth' tightly packed slices starting at slice z0
+    typedef std::function<bool(int z0, int depth, unsigned char* slices)> SlabReader;
+
+    //the voxels as read: ScalarType (see BrickedVolume.h) and 1-4
+    //interleaved components; cellScale and cellShift map the raw scalar
+    //(the last component) onto the 0..255 domain of the macro cells.
+    //compressed asks for a compressed texture format.
+    struct Format
+    {
+        Format(void) : scalarType(0), components(1), cellScale(1.0f), cellShift(0.0f),
+                       compressed(false) {}
+
+        int scalarType;
+        int components;
+        float cellScale, cellShift;
+        bool compressed;
+    };
+
+    //texture formats that hold a format as is: R8..RGBA8, R16..RGBA16,
+    //R16_SNORM..RGBA16_SNORM and R32F..RGBA32F with the matching pixel
+    //transfer format and type
+    static void TextureFormat(int scalarType, int components, GLint& internalFormat,
+                              GLenum& format, GLenum& type);
+
+    //generic compressed format of 1-4 components, GL_COMPRESSED_RED..RGBA
+    static GLint CompressedTextureFormat(int components);
+
+    VolumeUploader(void);
+    ~VolumeUploader(void);
+
+    //allocates the texture storage and starts the reader thread. Until the
+    //volume is complete the texture is limited to its base level; the
+    //mipmaps are generated once the last slab landed. Every slab is also
+    //merged into the optional macro cell grid (Allocate()d by the caller),
+    //which is complete together with the texture.
+    bool Start(GLuint texture, int xdim, int ydim, int zdim, const Format& format,
+               const SlabReader& reader, MacroCellGrid* cells = 0, int slabDepth = 16,
+               int ringSize = 4);
+
+    //render thread, once per frame with the volume's texture unit active.
+    //Uploads the filled slabs and recycles the buffers the GL finished
+    //with. Returns the number of slices uploaded by this call.
+    int Update();
+
+    //stops the reader thread and releases the buffers
+    void Cancel();
+
+    bool IsActive() const { return _thread.joinable(); }
+    bool IsComplete() const { return _complete; }
+    bool HasFailed() const { return _failed; }
+    bool IsPersistent() const { return _persistent; }
+    int GetUploadedSlices() const { return _uploadedSlices; }
+    int GetTotalSlices() const { return _dims[2]; }
+
+    //known once complete: whether the driver compressed the texture, the
+    //bytes of its base level and whether the mip chain was built
+    bool IsCompressed() const { return _compressed; }
+    size_t GetTextureBytes() const { return _textureBytes; }
+    bool HasMipmaps() const { return _complete && !_compressed; }
+
+    //time since Start() in seconds
+    double GetElapsedTime() const;
+
+private:
+    enum SlotState {SLOT_FREE, SLOT_FILLING, SLOT_READY, SLOT_PENDING};
+
+    struct Slot
+    {
+        GLuint buffer;
+        unsigned char* data;    //mapping the reader writes to
+        GLsync fence;
+        SlotState state;
+        int z0, depth;
+    };
+
+    void ReaderLoop();
+    void MapSlot(Slot& slot);
+    void ReleaseBuffers();
+    void Finish();
+
+    GLuint _texture;
+    int _dims[3];
+    Format _format;
+    GLenum _pixelFormat, _pixelType;
+    int _slabDepth;
+    size_t _sliceBytes;
+    size_t _slabBytes;
+    GLint _maxLevel;
+    bool _persistent;
+    bool _compressed;
+    size_t _textureBytes;
+
+    SlabReader _reader;
+    MacroCellGrid* _cells;
+    std::vector<Slot> _slots;
+    int _nextUpload;            //slab index the render thread uploads next
+    int _uploadedSlices;
+    bool _complete;
+    bool _failed;
+    bool _readFailed;           //set by the reader thread
+    bool _cancel;
+    std::chrono::steady_clock::time_point _startTime;
+
+    std::thread _thread;
+    std::mutex _lock;
+    std::condition_variable _slotFreed;
+};
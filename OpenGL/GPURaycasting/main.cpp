@@ -2,14 +2,34 @@
 #include <GL/freeglut.h>
 #include <GL/gl.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 #include "GLSLShader.h"
+#include "BrickedVolume.h"
+#include "FrameProfiler.h"
+#include "GPUStageTimer.h"
+#include "GradientVolume.h"
+#include "MacroCellGrid.h"
+#include "PreIntegrationTable.h"
+#include "ProgressiveRefinement.h"
+#include "RenderScheduler.h"
+#include "RenderVariant.h"
+#include "ThreadPool.h"
+#include "VolumeSequence.h"
+#include "VolumeUploader.h"
 #include <fstream>
 
 #define GL_CHECK_ERRORS assert(glGetError()== GL_NO_ERROR);
@@ -22,11 +42,21 @@ using namespace std;
 //screen resolution
 const int WIDTH  = 1280;
 const int HEIGHT = 960;
+int winWidth = WIDTH, winHeight = HEIGHT;
 
 //camera transform variables
 int state = 0, oldX=0, oldY=0;
 float rX=4, rY=50, dist = -2;
 
+//input events reach the render loop through the scheduler, which paces
+//the frames; the mouse moves its own copy of the camera and posts it
+const double FRAME_RATE = 60.0;
+RenderScheduler scheduler;
+std::vector<RenderUpdate> frameUpdates;
+float inputCamera[3] = {rX, rY, dist};
+bool continuousRendering = false;
+bool ticking = false;
+
 //grid object
 #include "Grid.h"
 CGrid* grid;
@@ -39,64 +69,503 @@ GLuint cubeVBOID;
 GLuint cubeVAOID;
 GLuint cubeIndicesID;
 
-//ray casting shader
-GLSLShader shader;
+//ray casting shader programs, one per RenderVariant (see
+//Common/RenderVariant.h) linked on first use, and the slots of the
+//uniforms set every frame, which are the same in every program
+std::map<unsigned, GLSLShader*> raycasters;
+RenderVariant variant;
+int mvpUniform, camPosUniform, stepSizeUniform, skipEmptyUniform, saturationUniform;
+int usePreIntegrationUniform, sampleDistanceUniform, lodScaleUniform, maxLodUniform;
+int useGradientsUniform, useSceneDepthUniform, clipToTextureUniform, viewportUniform;
+int boxMinUniform, boxMaxUniform;
+
+//headlight shading parameters and the cropping planes (texture space) and
+//regions of the shaded and cropped variants; the default cuts away the
+//octant at the far corner of the volume
+const float AMBIENT = 0.3f, DIFFUSE = 0.7f, SPECULAR = 0.2f, SPECULAR_POWER = 10.0f;
+const float CROP_LOW = 0.0f, CROP_HIGH = 0.5f;
+const int CROP_REGIONS = 0x7ffffff & ~(1<<26);
 
 //background colour
 glm::vec4 bg=glm::vec4(0.5,0.5,1,1);
 
 
-//volume dataset filename
-const char* volume_file = "media/Engine256.raw";
+//volume dataset filename, either raw data or a bricked .bvol file (see
+//Apps/bvconvert), given on the command line. A raw file name with a printf
+//conversion such as "step%03d.raw" is a time series of steps 0, 1, ...
+std::string volume_file = "media/Engine256.raw";
+
+//volume dimensions, read from the header for .bvol files
+int XDIM = 256;
+int YDIM = 256;
+int ZDIM = 256;
 
-//volume dimensions
-const int XDIM = 256;
-const int YDIM = 256;
-const int ZDIM = 256;
+//voxel layout, read from the header for .bvol files: ScalarType (see
+//Common/BrickedVolume.h) and number of interleaved components, of which the
+//last is the scalar. The texture keeps the scalars as they are stored,
+//raycaster.frag maps scalarRange onto 0..1 (8-bit scalars always span
+//0..255).
+int scalarType = SCALAR_UINT8;
+int components = 1;
+double scalarRange[2] = {0.0, 255.0};
+bool scalarRangeGiven = false;
 
 //volume texture ID
 GLuint textureID;
 
-//function that load a volume from the given raw data file and
-//generates an OpenGL 3D texture from it
-bool LoadVolume() {
-    std::ifstream infile(volume_file, std::ios_base::binary);
+//streams the volume into the texture, see VolumeUploader.h
+VolumeUploader uploader;
+bool firstFrameReported = false;
+
+//time series playback (see Common/VolumeSequence.h): the step due is read
+//ahead of time and streamed into the back texture while the front one is
+//rendered, and the two swap with their macro cells once the upload is
+//complete. Gradients are taken by central differences.
+VolumeSequence sequence;
+VolumeUploader stepUploader;
+GLuint backTextureID = 0;
+int frontStep = -1, backStep = -1;
+double playbackSpeed = 10.0;
+double lastPlaybackReport = 0.0;
+
+//macro cell grid for empty space skipping and its occupancy texture ID
+MacroCellGrid macroCells;
+MacroCellGrid stepCells;
+const int MACRO_CELL_SIZE = 8;
+GLuint occupancyID;
+bool skipEmpty = true;
+
+//per macro cell value ranges (RG8, texture unit 7) against which maximum
+//and minimum projections skip when skipDominated is on, and the value
+//range of the whole volume where they stop. Skipping is off by default,
+//the cell tests only pay off where large regions are dominated.
+GLuint cellRangesID;
+bool skipDominated = false;
+unsigned char valueRange[2] = {0, 255};
+
+//precomputed gradients for shading (see Common/GradientVolume.h), built
+//once the volume is uploaded; until then shading takes central differences
+GLuint gradientsID = 0;
+bool useGradients = true;
+
+//pre-integrated transfer function table and its texture ID; the sample
+//distance is in voxels and can be raised when pre-integration is on
+PreIntegrationTable preIntegration;
+GLuint preIntegratedID;
+bool usePreIntegration = false;
+float sampleDistance = 1.0f;
+
+//level-of-detail sampling (see Common/VolumePyramid.h): rays sample the
+//coarsest mipmap level whose voxels project to at most lodTolerance pixels
+bool levelOfDetail = false;
+float lodTolerance = 1.0f;
+const int MAX_LOD = 4;
+
+//ray statistics (sampled/skipped steps, rays cast and rays ended by early
+//termination) read back through a shader storage buffer when the driver
+//supports it
+bool statsSupported = false;
+bool reportStats = false;
+GLuint statsBufferID;
+
+//progressive rendering (see Common/ProgressiveRefinement.h): passes are
+//rendered into passFBO and merged into the full size image of imageFBO,
+//refinement passes REFINE_BAND pixel rows at a time
+bool progressive = false;
+ProgressiveRefinement refinement;
+const int REFINE_BAND = 32;
+int nextBand = 0;
+GLuint passFBO, passTextureID, passDepthID;
+GLuint imageFBO, imageTextureID;
+int imageWidth = 0, imageHeight = 0;
+GLSLShader accumulateShader;
+GLuint quadVAOID;
+
+//intermixed geometry: the depth of the opaque geometry drawn before the
+//volume is copied into a texture, rays end where they meet it
+GLuint sceneDepthID = 0;
+int sceneDepthWidth = 0, sceneDepthHeight = 0;
+bool intermixGeometry = true;
+
+//ray exits: the back faces of the volume box are rasterized into a texture
+//of texture positions on unit 6 before the ray casting pass, which then
+//marches every ray from its front face to its exit. With tightHull the box
+//shrinks to the non-empty macro cells when samples are summed.
+GLSLShader exitShader;
+GLuint exitFBO = 0, exitTextureID = 0;
+int exitWidth = 0, exitHeight = 0;
+bool tightHull = true;
+
+//per-stage CPU and GPU frame times, printed as averages once a second
+FrameProfiler profiler;
+GPUStageTimer gpuTimer;
+double lastProfileReport = 0.0;
+int uploadStage, bindStage, drawStage, statsStage, swapStage;
+int raysCounter, samplesCounter, skippedCounter, terminatedCounter;
+int updatesCounter, latencyCounter;
+
+//classifies the macro cells against the opacity transfer function and
+//uploads the result as a 3D texture. raycaster.frag uses the normalized
+//sample itself as opacity, so the transfer function is the identity ramp.
+void UpdateOccupancy(bool report = true) {
+    float opacity[256];
+    for(int i=0;i<256;i++)
+        opacity[i] = i/255.0f;
+    int emptyCells = macroCells.Classify(opacity, 256);
+
+    const int* gridDims = macroCells.GetGridDimensions();
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_3D, occupancyID);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage3D(GL_TEXTURE_3D,0,GL_R8,gridDims[0],gridDims[1],gridDims[2],0,GL_RED,GL_UNSIGNED_BYTE,macroCells.GetOccupancy());
+    glActiveTexture(GL_TEXTURE7);
+    glBindTexture(GL_TEXTURE_3D, cellRangesID);
+    glTexImage3D(GL_TEXTURE_3D,0,GL_RG8,gridDims[0],gridDims[1],gridDims[2],0,GL_RG,GL_UNSIGNED_BYTE,macroCells.GetMinMax());
+    glActiveTexture(GL_TEXTURE0);
+    GL_CHECK_ERRORS
+    if(!macroCells.GetValueRange(valueRange)) {
+        valueRange[0] = 0;
+        valueRange[1] = 255;
+    }
 
-    if(infile.good()) {
-        //read the volume data file
-        GLubyte* pData = new GLubyte[XDIM*YDIM*ZDIM];
-        infile.read(reinterpret_cast<char*>(pData), XDIM*YDIM*ZDIM*sizeof(GLubyte));
-        infile.close();
+    if(report)
+        cout<<"Empty macro cells: "<<emptyCells<<"/"<<macroCells.GetNumberOfCells()<<endl;
+}
 
-        //generate OpenGL texture
-        glGenTextures(1, &textureID);
-        glBindTexture(GL_TEXTURE_3D, textureID);
+//rebuilds the pre-integrated table for the identity ramp of raycaster.frag
+//with the opacity corrected for the sample distance, and uploads the parts
+//that changed
+void UpdatePreIntegration() {
+    float rgba[4*256];
+    for(int i=0;i<256;i++) {
+        float s = i/255.0f;
+        rgba[4*i] = rgba[4*i+1] = rgba[4*i+2] = s;
+        rgba[4*i+3] = 1.0f - pow(1.0f - s, sampleDistance);
+    }
+    if(preIntegration.Update(rgba, 256) == 0)
+        return;
+
+    const int size = preIntegration.GetSize();
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, preIntegratedID);
+    glTexSubImage2D(GL_TEXTURE_2D,0,0,0,size,size,GL_RGBA,GL_FLOAT,preIntegration.GetTable());
+    glActiveTexture(GL_TEXTURE0);
+    GL_CHECK_ERRORS
+}
+
+//generates a volume texture object with its sampling state, the storage
+//is allocated by the caller
+GLuint CreateVolumeTexture() {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_3D, texture);
+
+    // set the texture parameters
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+    //set the mipmap levels (base and max)
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, MAX_LOD);
+    return texture;
+}
 
-        // set the texture parameters
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP);
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+//creates the occupancy and cell range textures and fills them from the
+//macro cell grid
+void CreateOccupancyTexture() {
+    GLuint textures[2];
+    glGenTextures(2, textures);
+    occupancyID = textures[0];
+    cellRangesID = textures[1];
+    for(int i=0;i<2;i++) {
+        glActiveTexture(i == 0 ? GL_TEXTURE1 : GL_TEXTURE7);
+        glBindTexture(GL_TEXTURE_3D, textures[i]);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    UpdateOccupancy();
+}
 
-        //set the mipmap levels (base and max)
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_BASE_LEVEL, 0);
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, 4);
+//reads the uploaded volume back, computes its gradients and uploads them as
+//an RGB8 texture (octahedral normal, magnitude) on texture unit 4. Normals
+//are fetched from the nearest voxel since octahedral codes do not
+//interpolate.
+void CreateGradientTexture() {
+    GLint internalFormat;
+    GLenum format, type;
+    VolumeUploader::TextureFormat(scalarType, components, internalFormat, format, type);
+    std::vector<GLubyte> voxels(size_t(XDIM)*YDIM*ZDIM*components*ScalarTypeSize(scalarType));
+    glBindTexture(GL_TEXTURE_3D, textureID);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(GL_TEXTURE_3D, 0, format, type, &voxels[0]);
+    GradientVolume gradients;
+    ThreadPool pool;
+    gradients.Build(&voxels[0], scalarType, components, XDIM, YDIM, ZDIM, &pool);
+
+    glGenTextures(1, &gradientsID);
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_3D, gradientsID);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage3D(GL_TEXTURE_3D,0,GL_RGB8,XDIM,YDIM,ZDIM,0,GL_RGB,GL_UNSIGNED_BYTE,gradients.GetData());
+    glActiveTexture(GL_TEXTURE0);
+    GL_CHECK_ERRORS
 
-        //allocate data with internal format and foramt as (GL_RED)
-        glTexImage3D(GL_TEXTURE_3D,0,GL_RED,XDIM,YDIM,ZDIM,0,GL_RED,GL_UNSIGNED_BYTE,pData);
-        GL_CHECK_ERRORS
+    cout<<"Gradients: "<<gradients.GetMemorySize()/(1024.0*1024.0)<<" MB built in "
+        <<gradients.GetBuildTime()*1000.0<<" ms"<<endl;
+}
 
-        //generate mipmaps
-        glGenerateMipmap(GL_TEXTURE_3D);
+//bricked volumes stay mapped while they stream in
+BrickedVolume brickedVolume;
 
-        //delete the volume data allocated on heap
-        delete [] pData;
+//of a compressed bricked volume the layer of bricks the last slab reached,
+//decoded, so slabs thinner than a brick decode each brick once
+vector<unsigned char> decodedLayer;
+int decodedLayerZ = -1;
 
-        return true;
-    } else {
+//opens a bricked volume and takes the volume dimensions from its header
+bool OpenBrickedVolume() {
+    if(!brickedVolume.Open(volume_file))
+        return false;
+
+    const BrickedVolumeInfo& info = brickedVolume.GetInfo();
+    if(info.components < 1 || info.components > 4) {
+        cerr<<"Only volumes of 1-4 components can be rendered"<<endl;
+        brickedVolume.Close();
+        return false;
+    }
+
+    //the whole volume has to fit into one 3D texture
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &maxSize);
+    if(info.dims[0] > maxSize || info.dims[1] > maxSize || info.dims[2] > maxSize) {
+        cerr<<"Volume exceeds the maximum 3D texture size of "<<maxSize<<endl;
+        brickedVolume.Close();
         return false;
     }
+    XDIM = info.dims[0];
+    YDIM = info.dims[1];
+    ZDIM = info.dims[2];
+    scalarType = info.scalarType;
+    components = info.components;
+    if(!scalarRangeGiven)
+        brickedVolume.GetScalarRange(scalarRange);
+    return true;
+}
+
+//gathers slices z0..z0+depth-1 from the mapped bricks (reader thread).
+//Bricks are (B+1)^3 voxels with x fastest; rows are copied straight out
+//of the mapping and brick layers the slab moved past are released.
+//Compressed bricks are decoded a layer at a time, which stays decoded for
+//the following slabs until they move on to the next layer.
+bool ReadBrickedSlab(int z0, int depth, unsigned char* slices) {
+    const int B = brickedVolume.GetInfo().brickSize;
+    const size_t voxelSize = ScalarTypeSize(scalarType) * components;
+    const int edge = brickedVolume.GetBrickEdge();
+    const int* bricks = brickedVolume.GetBrickGridDimensions();
+    const bool compressed = brickedVolume.IsCompressed();
+    const size_t brickBytes = compressed ? brickedVolume.GetDecodedBrickBytes() : 0;
+    if(compressed && decodedLayer.empty()) {
+        decodedLayer.resize(size_t(bricks[0])*bricks[1]*brickBytes);
+        decodedLayerZ = -1;
+    }
+    for(int bz=min(z0/B, bricks[2]-1);compressed && bz<=min((z0+depth-1)/B, bricks[2]-1);bz++) {
+        if(bz != decodedLayerZ) {
+            for(int by=0;by<bricks[1];by++)
+                for(int bx=0;bx<bricks[0];bx++)
+                    brickedVolume.DecodeBrick(brickedVolume.GetBrickIndex(bx, by, bz),
+                                              &decodedLayer[(size_t(by)*bricks[0] + bx)*brickBytes]);
+            decodedLayerZ = bz;
+        }
+
+        //voxels each brick provides: B along every axis, the rest of the
+        //volume in the last one
+        int zBegin = max(z0, bz*B);
+        int zEnd = (bz == bricks[2]-1) ? z0+depth : min(z0+depth, bz*B + B);
+        for(int by=0;by<bricks[1];by++) {
+            int yEnd = (by == bricks[1]-1) ? YDIM : by*B + B;
+            for(int bx=0;bx<bricks[0];bx++) {
+                int x0 = bx*B;
+                int width = (bx == bricks[0]-1) ? XDIM - x0 : B;
+                const unsigned char* decoded = &decodedLayer[(size_t(by)*bricks[0] + bx)*brickBytes];
+                for(int z=zBegin;z<zEnd;z++)
+                    for(int y=by*B;y<yEnd;y++)
+                        memcpy(slices + ((size_t(z-z0)*YDIM + y)*XDIM + x0)*voxelSize,
+                               decoded + (size_t(z - bz*B)*edge + (y - by*B))*edge*voxelSize,
+                               width*voxelSize);
+            }
+        }
+    }
+    for(int z=z0;!compressed && z<z0+depth;z++) {
+        int bz = min(z/B, bricks[2]-1);
+        for(int y=0;y<YDIM;y++) {
+            int by = min(y/B, bricks[1]-1);
+            unsigned char* row = slices + (size_t(z-z0)*YDIM + y)*XDIM*voxelSize;
+            for(int bx=0;bx<bricks[0];bx++) {
+                int x0 = bx*B;
+                int width = (bx == bricks[0]-1) ? XDIM - x0 : B;
+                const unsigned char* brick = brickedVolume.GetBrickData(brickedVolume.GetBrickIndex(bx, by, bz));
+                memcpy(row + x0*voxelSize, brick + (size_t(z - bz*B)*edge + (y - by*B))*edge*voxelSize,
+                       width*voxelSize);
+            }
+        }
+    }
+
+    //layers whose last slice was copied are not needed any more
+    for(int bz=0;bz<bricks[2];bz++) {
+        int last = min(bz*B + B, ZDIM-1);
+        if(last >= z0 && last < z0+depth)
+            for(int by=0;by<bricks[1];by++)
+                for(int bx=0;bx<bricks[0];bx++)
+                    brickedVolume.Release(brickedVolume.GetBrickIndex(bx, by, bz));
+    }
+    return true;
+}
+
+//the voxel format of the volume as uploaded, with the mapping of the macro
+//cells onto the scalar range of the ray caster
+VolumeUploader::Format VolumeFormat() {
+    VolumeUploader::Format format;
+    format.scalarType = scalarType;
+    format.components = components;
+    if(scalarType != SCALAR_UINT8) {
+        double scale = scalarRange[1] > scalarRange[0] ? 255.0/(scalarRange[1] - scalarRange[0]) : 1.0;
+        format.cellScale = float(scale);
+        format.cellShift = float(-scalarRange[0]*scale);
+    }
+    //compressed volumes stay compressed on the GPU where the driver can
+    format.compressed = brickedVolume.IsOpen() && brickedVolume.IsCompressed();
+    return format;
+}
+
+//file name of a step of a time series
+std::string StepFileName(int step) {
+    char name[1024];
+    snprintf(name, sizeof(name), volume_file.c_str(), step);
+    return name;
+}
+
+//opens a time series of raw files and starts reading its first steps;
+//the steps are counted up to the first missing file
+bool OpenSequence() {
+    int steps = 0;
+    while(std::ifstream(StepFileName(steps).c_str(), std::ios_base::binary).good())
+        steps++;
+    if(steps == 0)
+        return false;
+
+    const size_t volumeBytes = size_t(XDIM)*YDIM*ZDIM*components*ScalarTypeSize(scalarType);
+    VolumeSequence::StepReader reader = [volumeBytes](int step, vector<unsigned char>& voxels) {
+        std::ifstream infile(StepFileName(step).c_str(), std::ios_base::binary);
+        voxels.resize(volumeBytes);
+        infile.read(reinterpret_cast<char*>(&voxels[0]), std::streamsize(volumeBytes));
+        return infile.good();
+    };
+    if(!sequence.Open(steps, reader))
+        return false;
+    sequence.SetSpeed(playbackSpeed);
+    cout<<"Time series of "<<steps<<" steps, space pauses, v reverses, < and > change the speed"<<endl;
+    return true;
+}
+
+//function that starts streaming the volume from the given raw data file
+//or bricked volume into an OpenGL 3D texture. The volume shows up slab by
+//slab while OnRender() drives the uploader. Of a time series the first
+//step streams in this way.
+bool LoadVolume() {
+    VolumeUploader::SlabReader reader;
+    size_t dot = volume_file.rfind('.');
+    if(dot != std::string::npos && volume_file.substr(dot) == ".bvol") {
+        if(!OpenBrickedVolume())
+            return false;
+        reader = ReadBrickedSlab;
+    } else {
+        bool series = volume_file.find('%') != std::string::npos;
+        if(series && !OpenSequence())
+            return false;
+        const std::string file = series ? StepFileName(0) : volume_file;
+        frontStep = series ? 0 : -1;
+        std::shared_ptr<std::ifstream> infile(new std::ifstream(file.c_str(), std::ios_base::binary));
+        if(!infile->good())
+            return false;
+        const std::streamsize sliceSize = std::streamsize(XDIM)*YDIM*components*ScalarTypeSize(scalarType);
+        reader = [infile, sliceSize](int z0, int depth, unsigned char* slices) {
+            infile->seekg(z0*sliceSize);
+            infile->read(reinterpret_cast<char*>(slices), depth*sliceSize);
+            return infile->good();
+        };
+    }
+
+    //generate OpenGL texture, its storage is allocated by the uploader
+    textureID = CreateVolumeTexture();
+    if(sequence.IsOpen())
+        backTextureID = CreateVolumeTexture();
+    GL_CHECK_ERRORS
+
+    //the min/max macro cells are built from the slabs as they stream by,
+    //over the same scalar range as the ray caster
+    variant.scalarType = scalarType;
+    variant.components = components;
+    VolumeUploader::Format format = VolumeFormat();
+    macroCells.Allocate(XDIM, YDIM, ZDIM, MACRO_CELL_SIZE);
+    return uploader.Start(textureID, XDIM, YDIM, ZDIM, format, reader, &macroCells);
+}
+
+//time series playback, once per frame after the first step is uploaded:
+//streams the step due into the back texture unless one is on its way and
+//swaps the textures once it arrived. Returns whether the front changed.
+bool UpdatePlayback() {
+    double now = FrameProfiler::Now();
+    int step = sequence.Update(now);
+    bool swapped = false;
+    if(stepUploader.IsActive()) {
+        stepUploader.Update();
+        if(stepUploader.IsComplete()) {
+            std::swap(textureID, backTextureID);
+            std::swap(macroCells, stepCells);
+            UpdateOccupancy(false);
+            frontStep = backStep;
+            swapped = true;
+        }
+        //the uploader binds the back texture
+        glBindTexture(GL_TEXTURE_3D, textureID);
+    }
+    if(!stepUploader.IsActive() && step >= 0 && step != frontStep) {
+        //the voxels stay referenced by the reader until the upload is done
+        VolumeSequence::StepData voxels = sequence.GetStep(step);
+        const size_t sliceBytes = size_t(XDIM)*YDIM*components*ScalarTypeSize(scalarType);
+        VolumeUploader::SlabReader reader = [voxels, sliceBytes](int z0, int depth, unsigned char* slices) {
+            memcpy(slices, &(*voxels)[z0*sliceBytes], depth*sliceBytes);
+            return true;
+        };
+        stepCells.Allocate(XDIM, YDIM, ZDIM, MACRO_CELL_SIZE);
+        stepUploader.Start(backTextureID, XDIM, YDIM, ZDIM, VolumeFormat(), reader, &stepCells);
+        backStep = step;
+        glBindTexture(GL_TEXTURE_3D, textureID);
+    }
+    sequence.Presented(frontStep, now);
+
+    //sustained rate and drops of the last second
+    if(now - lastPlaybackReport >= 1.0 && sequence.GetSpeed() != 0.0) {
+        VolumeSequence::Statistics stats = sequence.GetStatistics();
+        cout<<"Step "<<frontStep<<"/"<<sequence.GetNumberOfSteps()<<": "<<stats.playbackRate<<" steps/s at "
+            <<sequence.GetSpeed()<<", dropped "<<stats.droppedFrames<<"/"<<stats.frames<<" frames, skipped "
+            <<stats.skippedSteps<<" steps, "<<stats.loadTime*1000.0<<" ms per load, "
+            <<stats.residentSteps<<" steps in memory"<<endl;
+        lastPlaybackReport = now;
+    }
+    return swapped;
 }
 
 //mouse down event handler
@@ -114,60 +583,401 @@ void OnMouseDown(int button, int s, int x, int y)
         state = 1;
 }
 
+//hands an input event to the render loop; unpaced, the next frame is due
+//right away
+void PostUpdate(const RenderUpdate& update) {
+    scheduler.Post(update);
+    if(scheduler.GetFrameRate() == 0.0)
+        glutPostRedisplay();
+}
+
 //mouse move event handler
 void OnMouseMove(int x, int y)
 {
     if (state == 0) {
-        dist += (y - oldY)/50.0f;
+        inputCamera[2] += (y - oldY)/50.0f;
     } else {
-        rX += (y - oldY)/5.0f;
-        rY += (x - oldX)/5.0f;
+        inputCamera[0] += (y - oldY)/5.0f;
+        inputCamera[1] += (x - oldX)/5.0f;
     }
     oldX = x;
     oldY = y;
 
-    glutPostRedisplay();
+    RenderUpdate update;
+    update.kind = RenderUpdate::CAMERA;
+    for(int i=0;i<3;i++)
+        update.values[i] = inputCamera[i];
+    PostUpdate(update);
 }
 
-//OpenGL initialization
-void OnInit() {
+//frame pacing: once the next frame slot has come and there is input to
+//show or rendering continues a frame is requested, then the tick waits
+//for the following slot. Stops while the frame rate is 0.
+void OnTick(int value) {
+    if(scheduler.GetFrameRate() == 0.0) {
+        ticking = false;
+        return;
+    }
+    double now = FrameProfiler::Now();
+    if(scheduler.IsFrameDue(now, continuousRendering))
+        glutPostRedisplay();
+    double wait = scheduler.GetNextFrameTime() - now;
+    if(wait <= 0.0)
+        wait = 1.0/scheduler.GetFrameRate();
+    glutTimerFunc(unsigned(max(1.0, floor(wait*1000.0))), OnTick, 0);
+}
 
-    GL_CHECK_ERRORS
+void StartTicking() {
+    if(!ticking && scheduler.GetFrameRate() > 0.0) {
+        ticking = true;
+        glutTimerFunc(1, OnTick, 0);
+    }
+}
 
-    //create a uniform grid of size 20x20 in XZ plane
-    grid = new CGrid(20,20);
+//(re)creates the render targets of progressive rendering for the window size
+void CreateProgressiveTargets(int w, int h) {
+    if(imageWidth > 0) {
+        glDeleteFramebuffers(1, &passFBO);
+        glDeleteFramebuffers(1, &imageFBO);
+        glDeleteTextures(1, &passTextureID);
+        glDeleteTextures(1, &imageTextureID);
+        glDeleteRenderbuffers(1, &passDepthID);
+    }
 
+    //pass colour and depth, the pass uses its lower left part
+    glActiveTexture(GL_TEXTURE3);
+    glGenTextures(1, &passTextureID);
+    glBindTexture(GL_TEXTURE_2D, passTextureID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA8,w,h,0,GL_RGBA,GL_UNSIGNED_BYTE,NULL);
+    glGenRenderbuffers(1, &passDepthID);
+    glBindRenderbuffer(GL_RENDERBUFFER, passDepthID);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+    glGenFramebuffers(1, &passFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, passFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, passTextureID, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, passDepthID);
+
+    //the image averages supersampling passes, so it keeps more precision
+    glGenTextures(1, &imageTextureID);
+    glBindTexture(GL_TEXTURE_2D, imageTextureID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA16F,w,h,0,GL_RGBA,GL_FLOAT,NULL);
+    glGenFramebuffers(1, &imageFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, imageFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, imageTextureID, 0);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glActiveTexture(GL_TEXTURE0);
     GL_CHECK_ERRORS
 
-    //Load the raycasting shader
+    imageWidth = w;
+    imageHeight = h;
+    refinement.Invalidate();
+    nextBand = 0;
+}
+
+//returns the ray casting program of a variant, compiling and linking it
+//on first use. The uniforms are added in the same order for every variant,
+//so their slots are too.
+GLSLShader& RaycasterProgram(const RenderVariant& v) {
+    GLSLShader*& program = raycasters[v.GetKey()];
+    if(program)
+        return *program;
+
+    program = new GLSLShader;
+    GLSLShader& shader = *program;
     shader.LoadFromFile(GL_VERTEX_SHADER, "shaders/raycaster.vert");
-    shader.LoadFromFile(GL_FRAGMENT_SHADER, "shaders/raycaster.frag");
+    shader.LoadFromFile(GL_FRAGMENT_SHADER, "shaders/raycaster.frag",
+                        v.GetShaderDefines());
 
     //compile and link the shader
     shader.CreateAndLinkProgram();
     shader.Use();
         //add attributes and uniforms
         shader.AddAttribute("vVertex");
-        shader.AddUniform("MVP");
+        mvpUniform = shader.AddUniform("MVP");
         shader.AddUniform("volume");
-        shader.AddUniform("camPos");
-        shader.AddUniform("step_size");
-
-        //pass constant uniforms at initialization
-        glUniform3f(shader("step_size"), 1.0f/XDIM, 1.0f/YDIM, 1.0f/ZDIM);
+        camPosUniform = shader.AddUniform("camPos");
+        stepSizeUniform = shader.AddUniform("step_size");
+        shader.AddUniform("occupancy");
+        shader.AddUniform("volumeDims");
+        shader.AddUniform("gridDims");
+        shader.AddUniform("cellSize");
+        skipEmptyUniform = shader.AddUniform("skipEmpty");
+        shader.AddUniform("preIntegrated");
+        usePreIntegrationUniform = shader.AddUniform("usePreIntegration");
+        sampleDistanceUniform = shader.AddUniform("sampleDistance");
+        lodScaleUniform = shader.AddUniform("lodScale");
+        maxLodUniform = shader.AddUniform("maxLod");
+        shader.AddUniform("gradients");
+        useGradientsUniform = shader.AddUniform("useGradients");
+        shader.AddUniform("sceneDepth");
+        useSceneDepthUniform = shader.AddUniform("useSceneDepth");
+        clipToTextureUniform = shader.AddUniform("clipToTexture");
+        viewportUniform = shader.AddUniform("viewport");
+        shader.AddUniform("rayExits");
+        boxMinUniform = shader.AddUniform("boxMin");
+        boxMaxUniform = shader.AddUniform("boxMax");
+        shader.AddUniform("cellRanges");
+        saturationUniform = shader.AddUniform("saturation");
+        if(v.statistics)
+            shader.SetStorageBlockBinding("RayStats", 0);
+
+        //pass constant uniforms, those a variant does not use are -1 and
+        //ignored by OpenGL
         glUniform1i(shader("volume"),0);
+        glUniform1i(shader("occupancy"),1);
+        glUniform1i(shader("preIntegrated"),2);
+        glUniform1i(shader("gradients"),4);
+        glUniform1i(shader("sceneDepth"),5);
+        glUniform1i(shader("rayExits"),6);
+        glUniform1i(shader("cellRanges"),7);
+        glUniform1f(shader("cellSize"), float(MACRO_CELL_SIZE));
+        glUniform3f(shader("volumeDims"), float(XDIM), float(YDIM), float(ZDIM));
+        const int* gridDims = macroCells.GetGridDimensions();
+        glUniform3i(shader("gridDims"), gridDims[0], gridDims[1], gridDims[2]);
+
+        //the texture normalizes unsigned scalars to 0..1 and signed ones to
+        //-1..1 (float ones stay raw), the uniforms map scalarRange onto 0..1
+        double unit = scalarType == SCALAR_UINT16 ? 65535.0 : (scalarType == SCALAR_INT16 ? 32767.0 : 1.0);
+        double extent = scalarRange[1] > scalarRange[0] ? scalarRange[1] - scalarRange[0] : 1.0;
+        glUniform1f(shader("scalarScale"), float(unit / extent));
+        glUniform1f(shader("scalarShift"), float(-scalarRange[0] / extent));
+        glUniform1f(shader("ambient"), AMBIENT);
+        glUniform1f(shader("diffuse"), DIFFUSE);
+        glUniform1f(shader("specular"), SPECULAR);
+        glUniform1f(shader("specularPower"), SPECULAR_POWER);
+        glUniform3f(shader("cropLow"), CROP_LOW, CROP_LOW, CROP_LOW);
+        glUniform3f(shader("cropHigh"), CROP_HIGH, CROP_HIGH, CROP_HIGH);
+        glUniform1i(shader("cropRegions"), CROP_REGIONS);
     shader.UnUse();
 
     GL_CHECK_ERRORS
+    cout<<"Linked ray caster variant "<<v.GetName()<<(shader.IsFromCache() ? " (cached)" : "")<<endl;
+    return shader;
+}
+
+//keyboard event handler: the key takes effect in the next frame
+void OnKey(unsigned char key, int x, int y)
+{
+    RenderUpdate update;
+    update.kind = RenderUpdate::STATE;
+    update.key = key;
+    PostUpdate(update);
+}
+
+//applies a key taken from the scheduler by the render loop
+void ApplyKey(unsigned char key)
+{
+    switch(key) {
+        case 'b':
+            variant.blendMode = (variant.blendMode + 1) % 5;
+            cout<<"Ray caster variant "<<variant.GetName()<<endl;
+            break;
+        case 'n':
+            variant.linear = !variant.linear;
+            cout<<"Ray caster variant "<<variant.GetName()<<endl;
+            break;
+        case 'l':
+            variant.shading = !variant.shading;
+            cout<<"Ray caster variant "<<variant.GetName()<<endl;
+            break;
+        case 'c':
+            variant.cropping = !variant.cropping;
+            cout<<"Ray caster variant "<<variant.GetName()<<endl;
+            break;
+        case 'g':
+            useGradients = !useGradients;
+            cout<<"Gradient cache "<<(useGradients ? "on" : "off")<<endl;
+            break;
+        case 'e':
+            skipEmpty = !skipEmpty;
+            cout<<"Empty space skipping "<<(skipEmpty ? "on" : "off")<<endl;
+            break;
+        case 'm':
+            skipDominated = !skipDominated;
+            cout<<"Dominated cell skipping "<<(skipDominated ? "on" : "off")<<endl;
+            break;
+        case 'p':
+            usePreIntegration = !usePreIntegration;
+            cout<<"Pre-integration "<<(usePreIntegration ? "on" : "off")<<endl;
+            break;
+        case '+':
+        case '-':
+            sampleDistance = key == '+' ? min(sampleDistance*2.0f, 8.0f) : max(sampleDistance*0.5f, 0.25f);
+            UpdatePreIntegration();
+            cout<<"Sample distance "<<sampleDistance<<" voxels"<<endl;
+            break;
+        case 'o':
+            levelOfDetail = !levelOfDetail;
+            cout<<"Level of detail "<<(levelOfDetail ? "on" : "off")<<endl;
+            break;
+        case '[':
+        case ']':
+            lodTolerance = key == ']' ? min(lodTolerance*2.0f, 16.0f) : max(lodTolerance*0.5f, 0.25f);
+            cout<<"Level of detail tolerance "<<lodTolerance<<" pixels"<<endl;
+            break;
+        case 's':
+            //the counters are only compiled into the programs while
+            //reported, they cost every ray four contended atomics
+            reportStats = statsSupported && !reportStats;
+            variant.statistics = reportStats;
+            if(!statsSupported)
+                cout<<"Ray statistics need GL_ARB_shader_storage_buffer_object and memory barriers"<<endl;
+            break;
+        case 'r':
+            progressive = !progressive;
+            cout<<"Progressive rendering "<<(progressive ? "on" : "off")<<endl;
+            break;
+        case 'h':
+            tightHull = !tightHull;
+            cout<<"Tight ray casting hull "<<(tightHull ? "on" : "off")<<endl;
+            break;
+        case 'd':
+            intermixGeometry = !intermixGeometry;
+            cout<<"Intermixed geometry "<<(intermixGeometry ? "on" : "off")<<endl;
+            break;
+        case ' ':
+            sequence.SetSpeed(sequence.GetSpeed() == 0.0 ? playbackSpeed : 0.0);
+            sequence.ResetStatistics();
+            cout<<"Playback "<<(sequence.GetSpeed() != 0.0 ? "on" : "paused")<<endl;
+            break;
+        case 'v':
+        case '<':
+        case '>':
+            if(key == 'v')
+                playbackSpeed = -playbackSpeed;
+            else if(key == '>' ? fabs(playbackSpeed) < 960.0 : fabs(playbackSpeed) > 0.25)
+                playbackSpeed *= key == '>' ? 2.0 : 0.5;
+            if(sequence.GetSpeed() != 0.0)
+                sequence.SetSpeed(playbackSpeed);
+            sequence.ResetStatistics();
+            cout<<"Playback speed "<<playbackSpeed<<" steps/s"<<endl;
+            break;
+        case 't':
+            profiler.SetEnabled(!profiler.IsEnabled());
+            profiler.Reset();
+            lastProfileReport = FrameProfiler::Now();
+            cout<<"Profiling "<<(profiler.IsEnabled() ? "on" : "off")
+                <<(gpuTimer.IsInitialized() ? "" : " (no GPU timer queries)")<<endl;
+            break;
+        case 'f':
+            scheduler.SetFrameRate(scheduler.GetFrameRate() == 0.0 ? FRAME_RATE : 0.0);
+            scheduler.ResetStatistics();
+            StartTicking();
+            if(scheduler.GetFrameRate() > 0.0)
+                cout<<"Frames paced to "<<scheduler.GetFrameRate()<<" fps"<<endl;
+            else
+                cout<<"Frames unpaced"<<endl;
+            break;
+    }
+}
+
+//applies an input update to the render state
+void ApplyUpdate(const RenderUpdate& update) {
+    if(update.kind == RenderUpdate::CAMERA) {
+        rX = update.values[0];
+        rY = update.values[1];
+        dist = update.values[2];
+    } else if(update.kind == RenderUpdate::STATE) {
+        ApplyKey((unsigned char)update.key);
+    }
+    refinement.Invalidate();
+}
 
-    //load volume data
+//OpenGL initialization
+void OnInit() {
+
+    GL_CHECK_ERRORS
+
+    //keep linked shader programs between runs
+    GLSLShader::SetCacheDirectory("shadercache");
+
+    //create a uniform grid of size 20x20 in XZ plane
+    grid = new CGrid(20,20);
+
+    GL_CHECK_ERRORS
+
+    //count ray steps when the driver can: the counters are written to a
+    //storage buffer and made visible to the read back by a memory barrier
+    statsSupported = GLEW_ARB_shader_storage_buffer_object && GLEW_ARB_program_interface_query &&
+                     (GLEW_ARB_shader_image_load_store || GLEW_VERSION_4_2);
+
+    //start loading volume data
     if(LoadVolume()) {
-        std::cout<<"Volume data loaded successfully."<<std::endl;
+        std::cout<<"Volume data streaming started."<<std::endl;
     } else {
         std::cout<<"Cannot load volume data."<<std::endl;
         exit(EXIT_FAILURE);
     }
 
+    //the volume and macro cell grid sizes are known once the volume is
+    //loaded, link the default ray caster up front
+    RaycasterProgram(variant);
+
+    GL_CHECK_ERRORS
+
+    //pre-integrated table, filtered linearly between table entries
+    glGenTextures(1, &preIntegratedID);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, preIntegratedID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA16F,256,256,0,GL_RGBA,GL_FLOAT,NULL);
+    glActiveTexture(GL_TEXTURE0);
+    UpdatePreIntegration();
+
+    //storage for the sampled/skipped step counters
+    if(statsSupported) {
+        glGenBuffers(1, &statsBufferID);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsBufferID);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, 4*sizeof(GLuint), NULL, GL_DYNAMIC_READ);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, statsBufferID);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    //render stages in frame order, the upload and draw are timed on the GPU too
+    uploadStage = profiler.AddStage("upload");
+    bindStage = profiler.AddStage("bind");
+    drawStage = profiler.AddStage("draw");
+    statsStage = profiler.AddStage("stats");
+    swapStage = profiler.AddStage("swap");
+    raysCounter = profiler.AddCounter("rays");
+    samplesCounter = profiler.AddCounter("samples");
+    skippedCounter = profiler.AddCounter("skipped");
+    terminatedCounter = profiler.AddCounter("terminated");
+    updatesCounter = profiler.AddCounter("updates");
+    latencyCounter = profiler.AddCounter("latency us");
+    gpuTimer.Init(&profiler);
+
+    //averages supersampling passes of progressive rendering, drawn as one
+    //full screen triangle without vertex attributes
+    accumulateShader.LoadFromFile(GL_VERTEX_SHADER, "shaders/quad.vert");
+    accumulateShader.LoadFromFile(GL_FRAGMENT_SHADER, "shaders/accumulate.frag");
+    accumulateShader.CreateAndLinkProgram();
+    accumulateShader.Use();
+        accumulateShader.AddUniform("image");
+        glUniform1i(accumulateShader("image"), 3);
+    accumulateShader.UnUse();
+    glGenVertexArrays(1, &quadVAOID);
+
+    //writes the texture position of the back faces of the volume box
+    exitShader.LoadFromFile(GL_VERTEX_SHADER, "shaders/raycaster.vert");
+    exitShader.LoadFromFile(GL_FRAGMENT_SHADER, "shaders/rayexit.frag");
+    exitShader.CreateAndLinkProgram();
+    exitShader.Use();
+        exitShader.AddAttribute("vVertex");
+        exitShader.AddUniform("MVP");
+        exitShader.AddUniform("boxMin");
+        exitShader.AddUniform("boxMax");
+    exitShader.UnUse();
+
     //set background colour
     glClearColor(bg.r, bg.g, bg.b, bg.a);
 
@@ -225,13 +1035,41 @@ void OnInit() {
 
 //release all allocated resources
 void OnShutdown() {
-    shader.DeleteShaderProgram();
+    uploader.Cancel();
+    stepUploader.Cancel();
+    sequence.Close();
+    gpuTimer.Destroy();
+    for(std::map<unsigned, GLSLShader*>::iterator it = raycasters.begin(); it != raycasters.end(); ++it) {
+        it->second->DeleteShaderProgram();
+        delete it->second;
+    }
+    raycasters.clear();
+    accumulateShader.DeleteShaderProgram();
+    glDeleteVertexArrays(1, &quadVAOID);
+    if(imageWidth > 0) {
+        glDeleteFramebuffers(1, &passFBO);
+        glDeleteFramebuffers(1, &imageFBO);
+        glDeleteTextures(1, &passTextureID);
+        glDeleteTextures(1, &imageTextureID);
+        glDeleteRenderbuffers(1, &passDepthID);
+    }
 
     glDeleteVertexArrays(1, &cubeVAOID);
     glDeleteBuffers(1, &cubeVBOID);
     glDeleteBuffers(1, &cubeIndicesID);
 
     glDeleteTextures(1, &textureID);
+    glDeleteTextures(1, &backTextureID);
+    glDeleteTextures(1, &occupancyID);
+    glDeleteTextures(1, &cellRangesID);
+    glDeleteTextures(1, &gradientsID);
+    glDeleteTextures(1, &preIntegratedID);
+    glDeleteTextures(1, &sceneDepthID);
+    exitShader.DeleteShaderProgram();
+    glDeleteFramebuffers(1, &exitFBO);
+    glDeleteTextures(1, &exitTextureID);
+    if(statsSupported)
+        glDeleteBuffers(1, &statsBufferID);
     delete grid;
     cout<<"Shutdown successfull"<<endl;
 }
@@ -241,66 +1079,415 @@ void OnShutdown() {
 void OnResize(int w, int h) {
     //reset the viewport
     glViewport (0, 0, (GLsizei) w, (GLsizei) h);
+    winWidth = w;
+    winHeight = h;
     //setup the projection matrix
     P = glm::perspective(60.0f,(float)w/h, 0.1f,1000.0f);
 }
 
-//display callback function
-void OnRender() {
+//copies the depth buffer within the viewport into the scene depth texture,
+//which grows to the largest viewport seen
+void CopySceneDepth(const GLint viewport[4]) {
+    glActiveTexture(GL_TEXTURE5);
+    if(sceneDepthID == 0) {
+        glGenTextures(1, &sceneDepthID);
+        glBindTexture(GL_TEXTURE_2D, sceneDepthID);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+    }
+    glBindTexture(GL_TEXTURE_2D, sceneDepthID);
+    if(viewport[2] > sceneDepthWidth || viewport[3] > sceneDepthHeight) {
+        sceneDepthWidth = max<int>(viewport[2], sceneDepthWidth);
+        sceneDepthHeight = max<int>(viewport[3], sceneDepthHeight);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, sceneDepthWidth, sceneDepthHeight, 0,
+                     GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+    }
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, viewport[0], viewport[1], viewport[2], viewport[3]);
+    glActiveTexture(GL_TEXTURE0);
     GL_CHECK_ERRORS
+}
 
-    //set the camera transform
-    glm::mat4 Tr	= glm::translate(glm::mat4(1.0f),glm::vec3(0.0f, 0.0f, dist));
-    glm::mat4 Rx	= glm::rotate(Tr,  rX, glm::vec3(1.0f, 0.0f, 0.0f));
-    glm::mat4 MV    = glm::rotate(Rx, rY, glm::vec3(0.0f, 1.0f, 0.0f));
-
-    //get the camera position
-    glm::vec3 camPos = glm::vec3(glm::inverse(MV)*glm::vec4(0,0,0,1));
+//rasterizes the back faces of the box (x0,x1,y0,y1,z0,z1 in texture
+//space) into the ray exit texture, which grows to the largest viewport
+//seen. Rays whose pixel the box does not cover keep alpha 0.
+void RenderRayExits(const glm::mat4& MVP, const GLint viewport[4], const float box[6]) {
+    glActiveTexture(GL_TEXTURE6);
+    if(exitTextureID == 0) {
+        glGenTextures(1, &exitTextureID);
+        glBindTexture(GL_TEXTURE_2D, exitTextureID);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glGenFramebuffers(1, &exitFBO);
+    }
+    glBindTexture(GL_TEXTURE_2D, exitTextureID);
+    if(viewport[2] > exitWidth || viewport[3] > exitHeight) {
+        exitWidth = max<int>(viewport[2], exitWidth);
+        exitHeight = max<int>(viewport[3], exitHeight);
+        //positions need more than half float precision to count samples
+        glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA32F,exitWidth,exitHeight,0,GL_RGBA,GL_FLOAT,NULL);
+    }
+    glActiveTexture(GL_TEXTURE0);
+
+    GLint target;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, exitFBO);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, exitTextureID, 0);
+    glViewport(0, 0, viewport[2], viewport[3]);
+    const GLfloat none[4] = {0, 0, 0, 0};
+    glClearBufferfv(GL_COLOR, 0, none);
+
+    //a convex box has one back face per pixel, so no depth test is needed
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_FRONT);
+    exitShader.Use();
+        glUniformMatrix4fv(exitShader("MVP"), 1, GL_FALSE, glm::value_ptr(MVP));
+        glUniform3f(exitShader("boxMin"), box[0], box[2], box[4]);
+        glUniform3f(exitShader("boxMax"), box[1], box[3], box[5]);
+        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_SHORT, 0);
+    exitShader.UnUse();
+    glCullFace(GL_BACK);
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_DEPTH_TEST);
 
-    //clear colour and depth buffer
-    glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    GL_CHECK_ERRORS
+}
 
+//renders the grid and the volume with the given projection and the sample
+//distance multiplied by distanceScale
+void DrawScene(const glm::mat4& proj, const glm::mat4& MV, float distanceScale) {
     //get the combined modelview projection matrix
-    glm::mat4 MVP	= P*MV;
+    glm::mat4 MVP	= proj*MV;
+
+    //get the camera position
+    glm::vec3 camPos = glm::vec3(glm::inverse(MV)*glm::vec4(0,0,0,1));
 
     //render grid
     grid->Render(glm::value_ptr(MVP));
 
-    //enable blending and bind the cube vertex array object
-    glEnable(GL_BLEND);
+    //copy the depth of the opaque geometry for the rays to end at; the copy
+    //is read while the cube's own depth goes to the framebuffer
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if(intermixGeometry)
+        CopySceneDepth(viewport);
+
+    //the box the rays are cast through: around the non-empty macro cells
+    //when empty space adds nothing to the image, nothing when all are empty
+    float box[6] = {0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 1.0f};
+    bool summed = variant.blendMode == BLEND_COMPOSITE || variant.blendMode == BLEND_ADDITIVE;
+    if(tightHull && summed && uploader.IsComplete() && !macroCells.GetOccupiedBounds(box))
+        return;
+
+    //rasterize the ray exits, then enable blending and cast the rays from
+    //the front faces of the cube
     glBindVertexArray(cubeVAOID);
-        //bind the raycasting shader
+    RenderRayExits(MVP, viewport, box);
+    glEnable(GL_BLEND);
+    glEnable(GL_CULL_FACE);
+        //bind the raycasting shader of the current variant
+        double stageStart = profiler.IsEnabled() ? FrameProfiler::Now() : 0.0;
+        GLSLShader& shader = RaycasterProgram(variant);
         shader.Use();
             //pass shader uniforms
-            glUniformMatrix4fv(shader("MVP"), 1, GL_FALSE, glm::value_ptr(MVP));
-
-              int i,j;
-              std::cerr << "matrix " << std::endl;
-              for (j=0; j<4; j++){
-                for (i=0; i<4; i++){
-                 std::cerr << MV[i][j] <<  " ";
-              }
-
-
-              std::cerr << std::endl;
-             }
-
-
-            glUniform3fv(shader("camPos"), 1, &(camPos.x));
+            glUniformMatrix4fv(shader(mvpUniform), 1, GL_FALSE, glm::value_ptr(MVP));
+            glUniform3fv(shader(camPosUniform), 1, &(camPos.x));
+            bool extremum = variant.blendMode == BLEND_MAXIMUM || variant.blendMode == BLEND_MINIMUM;
+            glUniform1i(shader(skipEmptyUniform), skipEmpty && uploader.IsComplete() &&
+                        (skipDominated || !extremum));
+
+            //the identity ramp saturates only at the ends of the scalar
+            //range, in which the volume's own extreme lies
+            bool ranged = uploader.IsComplete();
+            if(variant.blendMode == BLEND_MAXIMUM)
+                glUniform1f(shader(saturationUniform), ranged ? valueRange[1]/255.0f : 1.0f);
+            else if(variant.blendMode == BLEND_MINIMUM)
+                glUniform1f(shader(saturationUniform), ranged ? valueRange[0]/255.0f : 0.0f);
+            float distance = sampleDistance*distanceScale;
+            glUniform3f(shader(stepSizeUniform), distance/XDIM, distance/YDIM, distance/ZDIM);
+            glUniform1f(shader(sampleDistanceUniform), distance);
+            glUniform1i(shader(usePreIntegrationUniform), usePreIntegration);
+            glUniform1i(shader(useGradientsUniform), useGradients && gradientsID != 0);
+
+            //the cube's vertices are texture coordinates minus 0.5
+            glm::mat4 clipToTexture = glm::translate(glm::mat4(1.0f), glm::vec3(0.5f))*glm::inverse(MVP);
+            glUniform1i(shader(useSceneDepthUniform), intermixGeometry);
+            glUniformMatrix4fv(shader(clipToTextureUniform), 1, GL_FALSE, glm::value_ptr(clipToTexture));
+            glUniform4f(shader(viewportUniform), float(viewport[0]), float(viewport[1]), float(viewport[2]), float(viewport[3]));
+            glUniform3f(shader(boxMinUniform), box[0], box[2], box[4]);
+            glUniform3f(shader(boxMaxUniform), box[1], box[3], box[5]);
+
+            //voxels a pixel spans at unit distance from the camera; the
+            //mipmaps exist once the upload is complete, unless compressed
+            float pixelSize = 2.0f/(proj[1][1]*viewport[3]);
+            float lodScale = levelOfDetail ? pixelSize*min(XDIM, min(YDIM, ZDIM))*lodTolerance : 0.0f;
+            glUniform1f(shader(lodScaleUniform), lodScale);
+            glUniform1f(shader(maxLodUniform), uploader.HasMipmaps() ? float(MAX_LOD) : 0.0f);
+
+            //reset the step counters
+            GLuint stats[4] = {0, 0, 0, 0};
+            if(reportStats) {
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsBufferID);
+                glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(stats), stats);
+            }
+            if(profiler.IsEnabled()) {
+                double now = FrameProfiler::Now();
+                profiler.AddTime(bindStage, now - stageStart);
+                stageStart = now;
+            }
                 //render the cube
+                gpuTimer.Begin(drawStage);
                 glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_SHORT, 0);
+                gpuTimer.End(drawStage);
+            if(profiler.IsEnabled()) {
+                double now = FrameProfiler::Now();
+                profiler.AddTime(drawStage, now - stageStart);
+                stageStart = now;
+            }
+
+            //read back and report the step counters
+            if(reportStats) {
+                glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+                glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(stats), stats);
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+                profiler.AddCount(samplesCounter, stats[0]);
+                profiler.AddCount(skippedCounter, stats[1]);
+                profiler.AddCount(raysCounter, stats[2]);
+                profiler.AddCount(terminatedCounter, stats[3]);
+                if(!profiler.IsEnabled())
+                    cout<<"sampled steps "<<stats[0]<<" skipped steps "<<stats[1]
+                        <<" rays "<<stats[2]<<" terminated "<<stats[3]<<endl;
+            }
+            if(profiler.IsEnabled())
+                profiler.AddTime(statsStage, FrameProfiler::Now() - stageStart);
         //unbind the raycasting shader
         shader.UnUse();
-    //disable blending
+    //disable blending and culling
+    glDisable(GL_CULL_FACE);
     glDisable(GL_BLEND);
+}
+
+//progressive rendering: renders the current refinement pass, or the bands
+//of it that fit into the frame budget, into the pass target and merges
+//them into the full size image, which is then shown. Bands done earlier
+//are kept, supersampling passes are averaged in.
+void RenderProgressive(const glm::mat4& MV) {
+    if(imageWidth != winWidth || imageHeight != winHeight)
+        CreateProgressiveTargets(winWidth, winHeight);
+    refinement.SetImageSize(winWidth, winHeight);
+
+    if(!refinement.IsConverged()) {
+        const ProgressiveRefinement::Pass pass = refinement.GetPass();
+        const int ds = pass.downsample;
+        const int pw = (winWidth + ds - 1)/ds;
+        const int ph = (winHeight + ds - 1)/ds;
+
+        //pass pixel p covers the window pixels [p*ds, p*ds+ds), the jitter
+        //moves the rays within their pixel
+        glm::mat4 S(1.0f);
+        float ax = float(winWidth)/(pw*ds), ay = float(winHeight)/(ph*ds);
+        S[0][0] = ax; S[3][0] = ax - 1.0f + 2.0f*pass.jitter[0]/pw;
+        S[1][1] = ay; S[3][1] = ay - 1.0f + 2.0f*pass.jitter[1]/ph;
+
+        //interactive passes are rendered whole, refinement passes as many
+        //bands as the budget allows
+        const int bands = (ph + REFINE_BAND - 1)/REFINE_BAND;
+        int first = pass.interactive ? 0 : nextBand;
+        int count = bands - first;
+        if(!pass.interactive) {
+            long long budget = refinement.GetPixelBudget()/((long long)(pw)*REFINE_BAND);
+            count = int(min<long long>(count, max(budget, 1LL)));
+        }
+        const int y0 = first*REFINE_BAND;
+        const int y1 = min((first + count)*REFINE_BAND, ph);
+
+        double start = FrameProfiler::Now();
+        glBindFramebuffer(GL_FRAMEBUFFER, passFBO);
+        glViewport(0, 0, pw, ph);
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(0, y0, pw, y1 - y0);
+        glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+        DrawScene(S*P, MV, pass.sampleDistanceScale);
+
+        if(pass.supersample == 0) {
+            //replace the bands, repeating every pass pixel ds x ds times
+            glDisable(GL_SCISSOR_TEST);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, passFBO);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, imageFBO);
+            glBlitFramebuffer(0, y0, pw, y1, 0, y0*ds, pw*ds, y1*ds, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        } else {
+            //running average: image += (pass - image)/(n+1)
+            glBindFramebuffer(GL_FRAMEBUFFER, imageFBO);
+            glViewport(0, 0, winWidth, winHeight);
+            glDisable(GL_DEPTH_TEST);
+            glEnable(GL_BLEND);
+            glBlendColor(0, 0, 0, 1.0f/(pass.supersample + 1));
+            glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
+            glActiveTexture(GL_TEXTURE3);
+            glBindTexture(GL_TEXTURE_2D, passTextureID);
+            accumulateShader.Use();
+                glBindVertexArray(quadVAOID);
+                glDrawArrays(GL_TRIANGLES, 0, 3);
+            accumulateShader.UnUse();
+            glActiveTexture(GL_TEXTURE0);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            glDisable(GL_BLEND);
+            glEnable(GL_DEPTH_TEST);
+            glDisable(GL_SCISSOR_TEST);
+        }
+
+        //the budget is wall clock time, so wait for the GPU
+        glFinish();
+        nextBand = first + count;
+        bool complete = nextBand >= bands;
+        if(complete)
+            nextBand = 0;
+        refinement.FrameRendered(FrameProfiler::Now() - start, (long long)(pw)*(y1 - y0), complete);
+    }
+
+    //show the image
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, imageFBO);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, winWidth, winHeight, 0, 0, winWidth, winHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, winWidth, winHeight);
+}
+
+//display callback function
+void OnRender() {
+    GL_CHECK_ERRORS
+
+    profiler.BeginFrame();
+    gpuTimer.BeginFrame();
+    double frameStart = FrameProfiler::Now();
+
+    //the input posted since the last frame, coalesced to the latest camera
+    profiler.AddCount(updatesCounter, scheduler.TakeUpdates(frameUpdates));
+    for(size_t i=0;i<frameUpdates.size();i++)
+        ApplyUpdate(frameUpdates[i]);
+
+    //set the camera transform
+    glm::mat4 Tr	= glm::translate(glm::mat4(1.0f),glm::vec3(0.0f, 0.0f, dist));
+    glm::mat4 Rx	= glm::rotate(Tr,  rX, glm::vec3(1.0f, 0.0f, 0.0f));
+    glm::mat4 MV    = glm::rotate(Rx, rY, glm::vec3(0.0f, 1.0f, 0.0f));
+
+    //stream in the slabs read since the last frame
+    if(uploader.IsActive()) {
+        FrameProfiler::ScopedTimer timer(profiler, uploadStage);
+        gpuTimer.Begin(uploadStage);
+        uploader.Update();
+        refinement.Invalidate();
+        if(uploader.IsComplete()) {
+            brickedVolume.Close();
+            vector<unsigned char>().swap(decodedLayer);
+            CreateOccupancyTexture();
+            if(!sequence.IsOpen())
+                CreateGradientTexture();
+            cout<<"Volume uploaded after "<<uploader.GetElapsedTime()*1000.0<<" ms using "
+                <<(uploader.IsPersistent() ? "persistent mapped" : "mapped")<<" pixel buffers, "
+                <<uploader.GetTextureBytes()/(1024.0*1024.0)<<" MB "
+                <<(uploader.IsCompressed() ? "compressed" : "uncompressed")<<" texture"<<endl;
+        }
+        gpuTimer.End(uploadStage);
+    } else if(sequence.IsOpen()) {
+        FrameProfiler::ScopedTimer timer(profiler, uploadStage);
+        gpuTimer.Begin(uploadStage);
+        if(UpdatePlayback())
+            refinement.Invalidate();
+        gpuTimer.End(uploadStage);
+    }
+
+    //clear colour and depth buffer
+    if(progressive) {
+        RenderProgressive(MV);
+    } else {
+        glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+        DrawScene(P, MV, 1.0f);
+    }
 
     //swap front and back buffers to show the rendered result
-    glutSwapBuffers();
+    {
+        FrameProfiler::ScopedTimer timer(profiler, swapStage);
+        glutSwapBuffers();
+    }
+
+    //input-to-present latency of the updates this frame took
+    scheduler.Presented(frameStart, FrameProfiler::Now());
+    if(!frameUpdates.empty())
+        profiler.AddCount(latencyCounter, (unsigned long long)(scheduler.GetLastLatency()*1e6));
+    profiler.EndFrame();
+
+    //averages of the last second; keep rendering so the GPU times, which
+    //arrive a few frames late, keep coming
+    if(profiler.IsEnabled()) {
+        double now = FrameProfiler::Now();
+        if(now - lastProfileReport >= 1.0) {
+            cout<<profiler.GetFrameCount()<<" frames, average ";
+            profiler.Print(cout, profiler.GetAverage());
+            profiler.Reset();
+            RenderScheduler::Statistics input = scheduler.GetStatistics();
+            if(input.updates > 0)
+                cout<<"Input: "<<input.updates<<" updates in "<<input.frames<<" frames, "
+                    <<input.coalescedUpdates<<" coalesced, "<<input.droppedUpdates<<" dropped, latency "
+                    <<input.latency*1000.0<<" ms average, "<<input.maxLatency*1000.0<<" ms max"<<endl;
+            scheduler.ResetStatistics();
+            lastProfileReport = now;
+        }
+    }
+
+    //load-to-first-frame latency: the first frame showing volume data
+    if(!firstFrameReported && uploader.GetUploadedSlices() > 0) {
+        glFinish();
+        cout<<"First frame after "<<uploader.GetElapsedTime()*1000.0<<" ms with "
+            <<uploader.GetUploadedSlices()<<"/"<<uploader.GetTotalSlices()<<" slices"<<endl;
+        firstFrameReported = true;
+    }
+
+    //keep rendering while the volume streams in, a time series plays, the
+    //image refines or the profiler runs; paced frames are requested by the
+    //tick
+    bool playing = sequence.IsOpen() && (sequence.GetSpeed() != 0.0 || stepUploader.IsActive());
+    continuousRendering = uploader.IsActive() || playing || (progressive && !refinement.IsConverged()) ||
+                          profiler.IsEnabled();
+    if(continuousRendering && scheduler.GetFrameRate() == 0.0)
+        glutPostRedisplay();
 }
 
 int main(int argc, char** argv) {
     //freeglut initialization
     glutInit(&argc, argv);
+
+    //optional volume file: "file.raw xdim ydim zdim [type [components
+    //[min max]]]" with type uint8, uint16, int16 or float32, or "file.bvol
+    //[min max]". The range defaults to the full range of integer types, 0..1
+    //for float32 and the range stored in .bvol files.
+    if(argc > 1)
+        volume_file = argv[1];
+    int rangeArg = 2;
+    if(argc > 4) {
+        XDIM = atoi(argv[2]);
+        YDIM = atoi(argv[3]);
+        ZDIM = atoi(argv[4]);
+        rangeArg = 7;
+    }
+    if(argc > 5) {
+        const std::string type = argv[5];
+        scalarType = type == "uint16" ? SCALAR_UINT16 : type == "int16" ? SCALAR_INT16 :
+                     type == "float32" ? SCALAR_FLOAT32 : SCALAR_UINT8;
+        scalarRange[0] = scalarType == SCALAR_INT16 ? -32768.0 : 0.0;
+        scalarRange[1] = scalarType == SCALAR_UINT16 ? 65535.0 : scalarType == SCALAR_INT16 ? 32767.0 :
+                         scalarType == SCALAR_FLOAT32 ? 1.0 : 255.0;
+    }
+    if(argc > 6)
+        components = max(1, min(atoi(argv[6]), 4));
+    if(argc > rangeArg + 1) {
+        scalarRange[0] = atof(argv[rangeArg]);
+        scalarRange[1] = atof(argv[rangeArg + 1]);
+        scalarRangeGiven = true;
+    }
     glutInitDisplayMode(GLUT_DEPTH | GLUT_DOUBLE | GLUT_RGBA);
     glutInitContextVersion (3, 3);
     glutInitContextFlags (GLUT_CORE_PROFILE | GLUT_DEBUG);
@@ -339,6 +1526,9 @@ int main(int argc, char** argv) {
     glutReshapeFunc(OnResize);
     glutMouseFunc(OnMouseDown);
     glutMotionFunc(OnMouseMove);
+    glutKeyboardFunc(OnKey);
+    scheduler.SetFrameRate(FRAME_RATE);
+    StartTicking();
 
     //main loop call
     glutMainLoop();
@@ -0,0 +1,11 @@
+#version 330 core
+
+layout(location = 0) out vec4 vFragColor;	//fragment shader output
+
+uniform sampler2D image;	//pass image of the same size as the target
+
+//copies the pass pixel under the fragment, the blend state averages it in
+void main()
+{
+	vFragColor = texelFetch(image, ivec2(gl_FragCoord.xy), 0);
+}
@@ -1,4 +1,31 @@
 #version 330 core
+#ifdef REPORT_STATS
+#extension GL_ARB_shader_storage_buffer_object : require
+#endif
+
+//variant features, see Common/RenderVariant.h: BLEND_MODE is 0 composite,
+//1 maximum, 2 minimum, 3 additive and 4 average; SCALAR_TYPE the ScalarType of the
+//volume texture and COMPONENTS its number of components. NEAREST, SHADING
+//(composite only), CROPPING and REPORT_STATS are set when enabled.
+#ifndef BLEND_MODE
+#define BLEND_MODE 0
+#endif
+#ifndef SCALAR_TYPE
+#define SCALAR_TYPE 0
+#endif
+#ifndef COMPONENTS
+#define COMPONENTS 1
+#endif
+
+//empty cells contribute nothing only when samples are summed; maximum and
+//minimum projections skip the cells that cannot beat the extreme instead,
+//when the application turns skipEmpty on for them
+#if BLEND_MODE == 0 || BLEND_MODE == 3
+#define CAN_SKIP
+#elif BLEND_MODE == 1 || BLEND_MODE == 2
+#define CAN_SKIP
+#define EXTREMUM
+#endif
 
 layout(location = 0) out vec4 vFragColor;	//fragment shader output
 
@@ -10,10 +37,190 @@ uniform sampler3D	volume;		//volume dataset
 uniform vec3		camPos;		//camera position
 uniform vec3		step_size;	//ray step size 
 
+//ray exits rasterized from the back faces of the volume box beforehand
+uniform sampler2D	rayExits;	//texture position where the ray leaves, alpha 0 = none
+
+//empty space skipping (see Common/MacroCellGrid.h)
+uniform sampler3D	occupancy;	//per macro cell: 0 = fully transparent
+uniform vec3		volumeDims;	//volume size in voxels
+uniform ivec3		gridDims;	//macro cell grid size
+uniform float		cellSize;	//macro cell edge in voxels
+uniform bool		skipEmpty;	//jump over transparent macro cells
+
+#ifdef EXTREMUM
+//maximum and minimum projections: the normalized value range of every
+//macro cell, and the sample at which the extreme is final (the volume's
+//own extreme once the macro cells are complete)
+uniform sampler3D	cellRanges;	//per macro cell: min, max
+uniform float		saturation;
+#endif
+
+//pre-integrated classification (see Common/PreIntegrationTable.h)
+uniform sampler2D	preIntegrated;		//segment colour/opacity, x = front, y = back sample
+uniform bool		usePreIntegration;	//composite segments instead of samples
+uniform float		sampleDistance;		//step length in voxels, corrects the opacity
+
+//level of detail: rays sample the mipmap level whose voxels project to
+//about one pixel where they enter the volume (see Common/VolumePyramid.h)
+//and step proportionally further
+uniform float		lodScale;	//voxels per pixel at unit distance times the tolerance, 0 = off
+uniform float		maxLod;		//coarsest mipmap level
+
+#if SCALAR_TYPE != 0
+//maps the texture values of the volume's own scalar type and range onto
+//0..1, so the texture holds the scalars as they were read
+uniform float		scalarScale;
+uniform float		scalarShift;
+#endif
+
+#ifdef SHADING
+//Blinn-Phong with a headlight
+uniform float		ambient;
+uniform float		diffuse;
+uniform float		specular;
+uniform float		specularPower;
+
+//precomputed gradients (see Common/GradientVolume.h): octahedral encoded
+//normal and magnitude of the nearest voxel, one fetch per sample
+uniform sampler3D	gradients;
+uniform bool		useGradients;
+#endif
+
+//intermixed geometry: window depth of the opaque geometry drawn before the
+//volume, rays end at its surface
+uniform sampler2D	sceneDepth;		//depth of the viewport, lower left at 0,0
+uniform bool		useSceneDepth;	//end rays at the scene depth
+uniform mat4		clipToTexture;	//inverse MVP, to texture coordinates
+
+uniform vec4		viewport;		//x, y, width, height in pixels, of the textures too
+
+#ifdef CROPPING
+//cropping planes in texture space and the kept regions, region (i,j,k)
+//is kept when bit i+3j+9k is set
+uniform vec3		cropLow;
+uniform vec3		cropHigh;
+uniform int			cropRegions;
+#endif
+
+#ifdef REPORT_STATS
+//ray and step counters of all rays, read back by the application; the
+//binding point is set after linking, binding= would need GLSL 4.20
+layout(std430) buffer RayStats {
+	uint sampledSteps;
+	uint skippedSteps;
+	uint raysCast;
+	uint terminatedRays;
+};
+#endif
+
 //constants
-const int MAX_SAMPLES = 300;	//total samples for each ray march step
-const vec3 texMin = vec3(0);	//minimum texture access coordinate
-const vec3 texMax = vec3(1);	//maximum texture access coordinate
+const int MAX_CROP_SPANS = 4;	//separate spans of a ray in kept cropping regions
+const float TF_SIZE = 256.0;	//entries of the pre-integrated table per axis
+
+//mipmap level of the current ray
+float lod = 0.0;
+
+//normalized components at a texture position
+vec4 Fetch(vec3 pos)
+{
+#ifdef NEAREST
+	int level = int(lod + 0.5);
+	vec3 dims = vec3(textureSize(volume, level));
+	vec4 value = texelFetch(volume, ivec3(clamp(pos * dims, vec3(0), dims - 1.0)), level);
+#else
+	vec4 value = textureLod(volume, pos, lod);
+#endif
+#if SCALAR_TYPE != 0
+	value = clamp(value * scalarScale + scalarShift, 0.0, 1.0);
+#endif
+	return value;
+}
+
+//normalized scalar at a texture position: the last component, the others
+//only colour the samples
+float Sample(vec3 pos)
+{
+	return Fetch(pos)[COMPONENTS - 1];
+}
+
+#ifdef SHADING
+//cosine between the central difference gradient and the ray direction,
+//which is the light direction of the headlight; both sides are lit
+float HeadlightCosine(vec3 pos, vec3 dir)
+{
+	if (useGradients) {
+		vec3 g = textureLod(gradients, pos, 0.0).xyz;
+		if (g.z == 0.0)
+			return 0.0;
+		vec3 n = vec3(g.xy * 2.0 - 1.0, 0.0);
+		n.z = 1.0 - abs(n.x) - abs(n.y);
+		if (n.z < 0.0)
+			n.xy = (1.0 - abs(n.yx)) * mix(vec2(-1.0), vec2(1.0), greaterThanEqual(n.xy, vec2(0.0)));
+		return min(abs(dot(normalize(n), dir)), 1.0);
+	}
+	vec3 h = exp2(floor(lod)) / volumeDims;
+	vec3 gradient = vec3(Sample(pos + vec3(h.x, 0, 0)) - Sample(pos - vec3(h.x, 0, 0)),
+						 Sample(pos + vec3(0, h.y, 0)) - Sample(pos - vec3(0, h.y, 0)),
+						 Sample(pos + vec3(0, 0, h.z)) - Sample(pos - vec3(0, 0, h.z)));
+	float len = length(gradient);
+	return len > 1e-3 ? min(abs(dot(gradient, dir)) / len, 1.0) : 0.0;
+}
+#endif
+
+#ifdef CROPPING
+//the position lies in a region that is kept
+bool InCroppedRegion(vec3 pos)
+{
+	ivec3 region = ivec3(step(cropLow, pos) + vec3(greaterThan(pos, cropHigh)));
+	return ((cropRegions >> (region.x + 3 * region.y + 9 * region.z)) & 1) != 0;
+}
+
+//Intersects the ray origin + t*dir, sampled at t = 1..samples, with the
+//cropping regions once instead of testing every sample (see CropRaySpans
+//in Common/RenderVariant.h): the plane crossings split the ray into pieces
+//within one region each, visited in order by finding the next crossing.
+//Returns the first and last sample of the kept spans, adjacent pieces
+//merged.
+int CropSpans(vec3 origin, vec3 dir, int samples, out ivec2 spans[MAX_CROP_SPANS])
+{
+	int count = 0;
+	float keptUntil = -1.0;
+	float end = float(samples);
+	for (float t = 0.0; t < end; ) {
+		//the nearest plane crossing past t ends the piece
+		float next = end;
+		for (int i = 0; i < 6; i++) {
+			int axis = i / 2;
+			float plane = (i % 2 == 0) ? cropLow[axis] : cropHigh[axis];
+			float crossing = dir[axis] != 0.0 ? (plane - origin[axis]) / dir[axis] : -1.0;
+			if (crossing > t && crossing < next)
+				next = crossing;
+		}
+		if (InCroppedRegion(origin + dir * (0.5 * (t + next)))) {
+			//extend the previous span when the pieces touch
+			if (count > 0 && keptUntil == t) {
+				keptUntil = next;
+			} else if (count < MAX_CROP_SPANS) {
+				if (count > 0)
+					spans[count-1].y = int(floor(keptUntil));
+				spans[count].x = max(1, int(ceil(t)));
+				keptUntil = next;
+				count++;
+			}
+		}
+		t = next;
+	}
+	if (count > 0)
+		spans[count-1].y = int(floor(keptUntil));
+
+	//drop spans too short to hold a sample
+	int kept = 0;
+	for (int i = 0; i < count; i++)
+		if (spans[i].x <= spans[i].y)
+			spans[kept++] = spans[i];
+	return kept;
+}
+#endif
 
 void main()
 { 
@@ -29,35 +236,160 @@ void main()
 	//multiply the raymarching direction with the step size to get the
 	//sub-step size we need to take at each raymarching step
 	vec3 dirStep = geomDir * step_size; 
-	 
-	//flag to indicate if the raymarch loop should terminate
-	bool stop = false; 
 
-	//for all samples along the ray
-	for (int i = 0; i < MAX_SAMPLES; i++) {
+	//level of detail from the distance to the entry point, coarser levels
+	//take longer steps unless segments are pre-integrated for the step
+	float stepScale = 1.0;
+	if (lodScale > 0.0) {
+		lod = clamp(log2(lodScale * length((vUV - vec3(0.5)) - camPos)), 0.0, maxLod);
+		if (!usePreIntegration)
+			stepScale = exp2(floor(lod));
+	}
+	dirStep *= stepScale;
+	float opacityDistance = sampleDistance * stepScale;
+
+	//the ray marches every sample before the exit point rasterized for its
+	//pixel, so the loop needs neither a per-sample bounds test nor a cap
+	vec2 pixel = gl_FragCoord.xy - viewport.xy;
+	vec4 rayExit = texelFetch(rayExits, ivec2(pixel), 0);
+	int samples = rayExit.a > 0.0 ? int(ceil(dot(rayExit.xyz - vUV, dirStep) / dot(dirStep, dirStep))) - 1 : 0;
+
+	//opaque geometry ends the ray: the surface under the fragment is
+	//unprojected to texture space, the steps to it bound the samples
+	if (useSceneDepth) {
+		float depth = texelFetch(sceneDepth, ivec2(pixel), 0).r;
+		if (depth < 1.0) {
+			vec4 surface = clipToTexture * vec4(pixel / viewport.zw * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+			float t = dot(surface.xyz / surface.w - vUV, dirStep) / dot(dirStep, dirStep);
+			samples = min(samples, int(floor(t)));
+		}
+	}
+
+#ifdef CROPPING
+	//the ray ends with its last kept span
+	ivec2 spans[MAX_CROP_SPANS];
+	int spanCount = CropSpans(vUV, dirStep, samples, spans);
+	int span = 0;
+	samples = spanCount > 0 ? spans[spanCount-1].y : 0;
+#endif
+
+	//texel space increment per step, used to find macro cell exits
+	vec3 texelStep = dirStep * volumeDims;
+	vec3 safeStep = mix(texelStep, vec3(1e-20), equal(texelStep, vec3(0)));
+	uint sampled = 0u;
+	uint skipped = 0u;
+	bool terminated = false;
+
+	//scalar at the start of the current ray segment
+	float front = usePreIntegration ? Sample(dataPos) : 0.0;
+
+	//projections keep the extreme sample or the sum of the samples
+#if BLEND_MODE == 1
+	float extreme = -1.0;
+#elif BLEND_MODE == 2
+	float extreme = 2.0;
+#elif BLEND_MODE == 4
+	float extreme = 0.0;
+#endif
+
+	//for all samples along the ray, sample i+1 in iteration i
+	for (int i = 0; i < samples; i++) {
+#ifdef CROPPING
+		//past the current span continue with the next one, jumping over
+		//the samples of the cropped regions in between
+		while (span < spanCount && i + 1 > spans[span].y)
+			span++;
+		if (span == spanCount)
+			break;
+		if (i + 1 < spans[span].x) {
+			int gap = spans[span].x - 1 - i;
+			dataPos += dirStep * float(gap);
+			skipped += uint(gap);
+			i += gap;
+			if (usePreIntegration)
+				front = Sample(dataPos);
+		}
+#endif
+
 		// advance ray by dirstep
 		dataPos = dataPos + dirStep;
+
+		//Empty space skipping:
+		//find the macro cell of the current sample, if its value range is
+		//fully transparent (or, projecting, cannot beat the extreme) every
+		//further sample inside the cell is skipped by jumping to the last
+		//of them in one go
+#ifdef CAN_SKIP
+		if (skipEmpty) {
+			vec3 texel = dataPos * volumeDims - 0.5;
+			ivec3 cell = min(ivec3(clamp(texel, vec3(0), volumeDims - 1.0) / cellSize), gridDims - 1);
+#if BLEND_MODE == 1
+			bool skip = texelFetch(cellRanges, cell, 0).g <= extreme;
+#elif BLEND_MODE == 2
+			bool skip = texelFetch(cellRanges, cell, 0).r >= extreme;
+#else
+			bool skip = texelFetch(occupancy, cell, 0).r == 0.0;
+#endif
+			if (skip) {
+				vec3 boundary = (vec3(cell) + step(0.0, texelStep)) * cellSize;
+				vec3 steps = mix((boundary - texel) / safeStep, vec3(1e30), equal(texelStep, vec3(0)));
+				float run = max(ceil(min(steps.x, min(steps.y, steps.z))), 1.0);
+				dataPos += dirStep * (run - 1.0);
+				i += int(run) - 1;
+				skipped += uint(run);
+				if (usePreIntegration)
+					front = Sample(dataPos);
+				continue;
+			}
+		}
+#endif
+
+		sampled++;
 		
-		
-		//The two constants texMin and texMax have a value of vec3(-1,-1,-1)
-		//and vec3(1,1,1) respectively. To determine if the data value is 
-		//outside the volume data, we use the sign function. The sign function 
-		//return -1 if the value is less than 0, 0 if the value is equal to 0 
-		//and 1 if value is greater than 0. Hence, the sign function for the 
-		//calculation (sign(dataPos-texMin) and sign (texMax-dataPos)) will 
-		//give us vec3(1,1,1) at the possible minimum and maximum position. 
-		//When we do a dot product between two vec3(1,1,1) we get the answer 3. 
-		//So to be within the dataset limits, the dot product will return a 
-		//value less than 3. If it is greater than 3, we are already out of 
-		//the volume dataset
-		stop = dot(sign(dataPos-texMin),sign(texMax-dataPos)) < 3.0;
-
-		//if the stopping condition is true we brek out of the ray marching loop
-		if (stop) 
+		// data fetching from the red channel of volume texture; of
+		//multi-component volumes the last component is the scalar and the
+		//first one (grey) or three (RGB) the colour
+#if COMPONENTS == 1
+		float sample = Sample(dataPos);	
+		vec3 colour = vec3(sample);
+#else
+		vec4 voxel = Fetch(dataPos);
+		float sample = voxel[COMPONENTS - 1];
+#if COMPONENTS == 2
+		vec3 colour = vec3(voxel.r);
+#else
+		vec3 colour = voxel.rgb;
+#endif
+#endif
+
+#ifdef EXTREMUM
+		//projections stop once the extreme saturated
+#if BLEND_MODE == 1
+		extreme = max(extreme, sample);
+		if (extreme >= saturation) {
+#else
+		extreme = min(extreme, sample);
+		if (extreme <= saturation) {
+#endif
+			terminated = true;
 			break;
-		
-		// data fetching from the red channel of volume texture
-		float sample = texture(volume, dataPos).r;	
+		}
+		continue;
+#endif
+
+#if BLEND_MODE == 4
+		//average: the mean of the samples is classified once
+		extreme += sample;
+		continue;
+#endif
+
+#if BLEND_MODE == 3
+		//additive: order independent sum of the opacity weighted samples,
+		//a longer step stands for that many samples
+		float alpha = stepScale * (1.0 - pow(1.0 - sample, sampleDistance));
+		vFragColor += alpha * vec4(colour, 1.0);
+		continue;
+#endif
 		
 		//Opacity calculation using compositing:
 		//here we use front to back compositing scheme whereby the current sample
@@ -66,14 +398,57 @@ void main()
 		//Next, this alpha is multiplied with the current sample colour and accumulated
 		//to the composited colour. The alpha value from the previous steps is then 
 		//accumulated to the composited colour alpha.
-		float prev_alpha = sample - (sample * vFragColor.a);
-		vFragColor.rgb = prev_alpha * vec3(sample) + vFragColor.rgb; 
-		vFragColor.a += prev_alpha; 
+		//With pre-integration the segment from the previous sample is looked
+		//up instead; its colour is already premultiplied by its opacity.
+#ifdef SHADING
+		//The lit colour is the premultiplied colour scaled by the ambient and
+		//diffuse terms plus the opacity weighted specular highlight.
+		float cosine = HeadlightCosine(dataPos, geomDir);
+		float lighting = ambient + diffuse * cosine;
+		float highlight = specular * pow(cosine, specularPower);
+#endif
+		if (usePreIntegration) {
+			vec4 segment = texture(preIntegrated, (vec2(front, sample) * (TF_SIZE - 1.0) + 0.5) / TF_SIZE);
+			front = sample;
+#ifdef SHADING
+			segment.rgb = segment.rgb * lighting + highlight * segment.a;
+#endif
+			vFragColor += (1.0 - vFragColor.a) * segment;
+		} else {
+			float alpha = 1.0 - pow(1.0 - sample, opacityDistance);
+			float prev_alpha = alpha - (alpha * vFragColor.a);
+#ifdef SHADING
+			vFragColor.rgb = prev_alpha * (colour * lighting + highlight) + vFragColor.rgb;
+#else
+			vFragColor.rgb = prev_alpha * colour + vFragColor.rgb; 
+#endif
+			vFragColor.a += prev_alpha; 
+		}
 			
 		//early ray termination
 		//if the currently composited colour alpha is already fully saturated
 		//we terminated the loop
-		if( vFragColor.a>0.99)
+		if( vFragColor.a>0.99) {
+			terminated = true;
 			break;
+		}
 	} 
+
+#if BLEND_MODE == 4
+	extreme /= max(float(sampled), 1.0);
+#endif
+#if BLEND_MODE == 1 || BLEND_MODE == 2 || BLEND_MODE == 4
+	//the projected sample is classified like a single sample
+	vFragColor = sampled > 0u ? vec4(vec3(extreme * extreme), extreme) : vec4(0);
+#elif BLEND_MODE == 3
+	vFragColor = min(vFragColor, vec4(1.0));
+#endif
+
+#ifdef REPORT_STATS
+	atomicAdd(sampledSteps, sampled);
+	atomicAdd(skippedSteps, skipped);
+	atomicAdd(raysCast, 1u);
+	if (terminated)
+		atomicAdd(terminatedRays, 1u);
+#endif
 }
@@ -0,0 +1,12 @@
+#version 330 core
+
+layout(location = 0) out vec4 vFragColor;	//fragment shader output
+
+smooth in vec3 vUV;		//3D texture coordinates from the vertex shader
+
+//ray exit pass: the back faces of the volume box store where the ray of
+//their pixel leaves the volume, alpha marks covered pixels
+void main()
+{
+	vFragColor = vec4(vUV, 1.0);
+}
@@ -0,0 +1,174 @@
+#include "BrickedVolume.h"
+#include "CPURaycaster.h"
+#include "TestUtilities.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+//The SIMD kernels must render what the scalar (one ray per packet) kernel
+//renders, for every specialization the kernel table dispatches to. Lanes
+//compute the same float operations as the scalar path, up to fused
+//multiply-adds, so the images agree to rounding.
+
+static const int DIMS[3] = {37, 32, 29};
+static const int IMAGE_SIZE = 64;
+
+//a soft ball with a harder shell and some structure inside, on 0..1
+static float Field(int x, int y, int z)
+{
+    float fx = (x + 0.5f) / DIMS[0] - 0.5f, fy = (y + 0.5f) / DIMS[1] - 0.5f, fz = (z + 0.5f) / DIMS[2] - 0.5f;
+    float r = std::sqrt(fx*fx + fy*fy + fz*fz) * 2.0f;
+    float shell = std::exp(-60.0f * (r - 0.7f) * (r - 0.7f));
+    float core = r < 0.4f ? 0.5f + 0.5f * std::sin(20.0f * fx) * std::cos(15.0f * fy) : 0.0f;
+    return std::min(1.0f, shell + core * 0.8f);
+}
+
+//a ramp that keeps low scalars transparent, so empty space can be skipped
+static std::vector<float> TransferFunction()
+{
+    std::vector<float> rgba(4 * 256);
+    for (int i = 0; i < 256; i++) {
+        float t = i / 255.0f;
+        rgba[4*i] = t;
+        rgba[4*i+1] = 1.0f - t;
+        rgba[4*i+2] = 0.5f;
+        rgba[4*i+3] = i < 40 ? 0.0f : 0.15f * t;
+    }
+    return rgba;
+}
+
+struct Case
+{
+    const char* name;
+    int scalarType;
+    int components;
+    int blendMode;
+    bool linear;
+    bool shading;
+    bool gradientCache;
+    bool cropping;
+    bool preIntegration;
+    bool skipping;
+    bool depths;
+};
+
+static const Case CASES[] = {
+    //name                 type            comp blend             linear shade  cache  crop   preint skip   depths
+    {"composite",          SCALAR_UINT8,   1, BLEND_COMPOSITE, true,  false, false, false, false, false, false},
+    {"composite skipped",  SCALAR_UINT8,   1, BLEND_COMPOSITE, true,  false, false, false, false, true,  false},
+    {"composite nearest",  SCALAR_UINT8,   1, BLEND_COMPOSITE, false, false, false, false, false, true,  false},
+    {"composite shaded",   SCALAR_UINT8,   1, BLEND_COMPOSITE, true,  true,  false, false, false, true,  false},
+    {"composite gradients",SCALAR_UINT8,   1, BLEND_COMPOSITE, true,  true,  true,  false, false, true,  false},
+    {"composite cropped",  SCALAR_UINT8,   1, BLEND_COMPOSITE, true,  false, false, true,  false, true,  false},
+    {"pre-integrated",     SCALAR_UINT8,   1, BLEND_COMPOSITE, true,  false, false, false, true,  true,  false},
+    {"depths",             SCALAR_UINT8,   1, BLEND_COMPOSITE, true,  false, false, false, false, true,  true},
+    {"uint16",             SCALAR_UINT16,  1, BLEND_COMPOSITE, true,  false, false, false, false, true,  false},
+    {"int16 shaded",       SCALAR_INT16,   1, BLEND_COMPOSITE, true,  true,  false, false, false, false, false},
+    {"float32",            SCALAR_FLOAT32, 1, BLEND_COMPOSITE, false, false, false, true,  false, true,  false},
+    {"two components",     SCALAR_UINT8,   2, BLEND_COMPOSITE, true,  false, false, false, false, true,  false},
+    {"rgba",               SCALAR_UINT8,   4, BLEND_ADDITIVE,  true,  false, false, false, false, true,  true},
+    {"additive",           SCALAR_UINT8,   1, BLEND_ADDITIVE,  true,  false, false, true,  false, true,  false},
+    {"maximum",            SCALAR_UINT8,   1, BLEND_MAXIMUM,   true,  false, false, false, false, false, false},
+    {"maximum skipped",    SCALAR_UINT8,   1, BLEND_MAXIMUM,   true,  false, false, true,  false, true,  true},
+    {"minimum skipped",    SCALAR_UINT16,  1, BLEND_MINIMUM,   false, false, false, false, false, true,  false},
+    {"average",            SCALAR_UINT8,   1, BLEND_AVERAGE,   true,  false, false, true,  false, false, true},
+};
+
+//voxels of the field in the scalar type; of multi-component voxels the
+//last component is the field, the others are derived from it
+static std::vector<unsigned char> MakeVolume(int scalarType, int components)
+{
+    const size_t voxels = size_t(DIMS[0]) * DIMS[1] * DIMS[2];
+    std::vector<unsigned char> data(voxels * components * ScalarTypeSize(scalarType));
+    size_t i = 0;
+    for (int z = 0; z < DIMS[2]; z++)
+        for (int y = 0; y < DIMS[1]; y++)
+            for (int x = 0; x < DIMS[0]; x++, i++) {
+                float f = Field(x, y, z);
+                for (int c = 0; c < components; c++) {
+                    float v = c == components - 1 ? f : std::fmod(f * (c + 2) + 0.3f * c, 1.0f);
+                    size_t at = i * components + c;
+                    switch (scalarType) {
+                    case SCALAR_UINT16: reinterpret_cast<unsigned short*>(&data[0])[at] = (unsigned short)(v * 65535.0f); break;
+                    case SCALAR_INT16: reinterpret_cast<short*>(&data[0])[at] = (short)(v * 65535.0f - 32768.0f); break;
+                    case SCALAR_FLOAT32: reinterpret_cast<float*>(&data[0])[at] = v; break;
+                    default: data[at] = (unsigned char)(v * 255.0f); break;
+                    }
+                }
+            }
+    return data;
+}
+
+static void Configure(CPURaycaster& raycaster, const Case& c, const std::vector<unsigned char>& volume)
+{
+    raycaster.SetVolume(&volume[0], c.scalarType, c.components, DIMS[0], DIMS[1], DIMS[2]);
+    std::vector<float> tf = TransferFunction();
+    raycaster.SetTransferFunction(&tf[0], 256);
+    raycaster.SetBlendMode(c.blendMode);
+    raycaster.SetLinearInterpolation(c.linear);
+    raycaster.SetShading(c.shading);
+    raycaster.SetShadingParameters(0.2f, 0.7f, 0.3f, 12.0f);
+    raycaster.SetGradientCache(c.gradientCache);
+    raycaster.SetCropping(c.cropping);
+    const float planes[6] = {0.3f, 0.8f, 0.25f, 0.7f, 0.2f, 0.65f};
+    raycaster.SetCroppingPlanes(planes);
+    raycaster.SetCroppingRegions(0x0002000 | 0x0000010 | 0x0000400);
+    raycaster.SetPreIntegration(c.preIntegration);
+    raycaster.SetEmptySpaceSkipping(c.skipping);
+    raycaster.SetDominatedCellSkipping(c.skipping);
+    raycaster.SetRayDepthRecording(c.depths ? 0.5f : 0.0f);
+    raycaster.SetSampleDistance(c.preIntegration ? 2.0f : 0.7f);
+}
+
+int main(int, char*[])
+{
+    const Mat4 camera = TestCamera(Vec3(1.4f, 1.1f, 1.8f));
+    const int maxWidth = CPURaycaster::GetMaximumPacketWidth();
+    int failures = 0;
+
+    for (size_t i = 0; i < sizeof(CASES) / sizeof(CASES[0]); i++) {
+        const Case& c = CASES[i];
+        std::vector<unsigned char> volume = MakeVolume(c.scalarType, c.components);
+
+        CPURaycaster scalar;
+        scalar.SetThreadCount(2);
+        scalar.SetPacketWidth(1);
+        Configure(scalar, c, volume);
+        scalar.Render(camera, IMAGE_SIZE, IMAGE_SIZE);
+        const int pixels = IMAGE_SIZE * IMAGE_SIZE;
+        std::vector<float> reference(scalar.GetImage(), scalar.GetImage() + 4 * pixels);
+        if (scalar.GetStatistics().sampledSteps == 0) {
+            std::printf("%s: the scalar kernel took no samples\n", c.name);
+            failures++;
+            continue;
+        }
+
+        for (int width = 4; width <= maxWidth; width *= 2) {
+            CPURaycaster packets;
+            packets.SetThreadCount(3);
+            packets.SetPacketWidth(width);
+            Configure(packets, c, volume);
+            packets.Render(camera, IMAGE_SIZE, IMAGE_SIZE);
+
+            //nearest lookups may round the other way after a fused
+            //multiply-add, which moves a sample to the neighbouring entry
+            ImageDifference diff = CompareImages(reference.data(), packets.GetImage(), 4 * pixels, 1e-3f);
+            bool ok = diff.mismatches <= 4 * pixels / 200 && diff.maximum < 0.1f;
+            if (c.depths) {
+                ImageDifference depth = CompareImages(scalar.GetRayDepths(), packets.GetRayDepths(),
+                                                      2 * pixels, 1e-3f);
+                ok = ok && depth.mismatches <= 2 * pixels / 100;
+            }
+            std::printf("%-20s width %2d: max difference %g, %d values off\n", c.name, width,
+                        diff.maximum, diff.mismatches);
+            if (!ok)
+                failures++;
+        }
+    }
+
+    if (failures)
+        std::printf("%d kernel comparisons failed\n", failures);
+    return failures ? 1 : 0;
+}
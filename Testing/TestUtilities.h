@@ -0,0 +1,66 @@
+#pragma once
+#include <cmath>
+
+#include "VectorMath.h"
+
+//helpers shared by the tests
+
+//texture to clip space matrix of a camera at 'eye' (in units of the volume
+//edge, relative to the volume centre) looking at the volume centre with a
+//40 degree perspective
+inline Mat4 TestCamera(const Vec3& eye)
+{
+    Vec3 forward = Normalize(eye * -1.0f);
+    Vec3 up(0.0f, 1.0f, 0.0f);
+    Vec3 side = Normalize(Vec3(forward.y*up.z - forward.z*up.y, forward.z*up.x - forward.x*up.z,
+                               forward.x*up.y - forward.y*up.x));
+    up = Vec3(side.y*forward.z - side.z*forward.y, side.z*forward.x - side.x*forward.z,
+              side.x*forward.y - side.y*forward.x);
+
+    Mat4 view;
+    for (int col = 0; col < 3; col++) {
+        view(0, col) = side[col];
+        view(1, col) = up[col];
+        view(2, col) = -forward[col];
+    }
+    view(0, 3) = -Dot(side, eye);
+    view(1, 3) = -Dot(up, eye);
+    view(2, 3) = Dot(forward, eye);
+
+    const double nearPlane = 0.1, farPlane = 10.0;
+    const double f = 1.0 / std::tan(20.0 * 3.14159265358979 / 180.0);
+    Mat4 projection;
+    projection(0, 0) = f;
+    projection(1, 1) = f;
+    projection(2, 2) = (farPlane + nearPlane) / (nearPlane - farPlane);
+    projection(2, 3) = 2.0 * farPlane * nearPlane / (nearPlane - farPlane);
+    projection(3, 2) = -1.0;
+    projection(3, 3) = 0.0;
+
+    //texture space [0,1]^3 around the origin
+    Mat4 textureToWorld;
+    for (int axis = 0; axis < 3; axis++)
+        textureToWorld(axis, 3) = -0.5;
+    return projection * view * textureToWorld;
+}
+
+struct ImageDifference
+{
+    float maximum;      //largest absolute difference
+    int mismatches;     //values differing by more than the tolerance
+};
+
+inline ImageDifference CompareImages(const float* a, const float* b, int count, float tolerance)
+{
+    ImageDifference diff;
+    diff.maximum = 0.0f;
+    diff.mismatches = 0;
+    for (int i = 0; i < count; i++) {
+        float d = std::fabs(a[i] - b[i]);
+        if (d > diff.maximum)
+            diff.maximum = d;
+        if (d > tolerance)
+            diff.mismatches++;
+    }
+    return diff;
+}